@@ -4,7 +4,7 @@
 # > must include globals.mk first
 #
 
-.PHONY: distclean clean doc test cov help
+.PHONY: distclean clean headless doc test bench cov help
 
 distclean: clean
 	@rm -rf $(BIN_DIR) $(DOC_DIR)
@@ -13,9 +13,12 @@ distclean: clean
 
 clean:
 	@rm -f *~ \#*\# *.bmp
-	@rm -f $(TARGET_EXEC) $(TARGET_TEST)
+	@rm -f $(TARGET_EXEC) $(TARGET_TEST) $(TARGET_HEADLESS) $(BIN_DIR)main-test-headless
 	@rm -f $(BIN_DIR)*.gcda
 
+headless:
+	@$(MAKE) -C $(BASEDIR) HEADLESS=yes
+
 doc:
 	cd $(BASEDIR) && doxygen Doxyfile | grep warning | echo "Warnings:"
 	open $(DOC_DIR)index.html
@@ -23,6 +26,12 @@ doc:
 test:
 	@$(MAKE) -C $(TST_DIR) run-test
 
+bench:
+	@$(MAKE) -C $(TST_DIR) bench-startup
+	@$(MAKE) -C $(TST_DIR) bench-filter
+	@$(MAKE) -C $(TST_DIR) bench-batch
+	@$(MAKE) -C $(TST_DIR) bench-serve
+
 cov:
 	@rm -rf $(BIN_DIR)
 	@echo "compiling + run test"
@@ -33,9 +42,14 @@ cov:
 
 help:
 	@echo "make           : compile only sources ($(TARGET_EXEC))"
+	@echo "make headless  : compile sources without SDL, no --display ($(TARGET_HEADLESS))"
 	@echo "make clean     : clean compilation files"
 	@echo "make distclean : reset the folder as fresh new"
 	@echo "make doc       : generate Doxygen files (html)"
 	@echo "make test      : compile and run tests (maybe use LOG=NONE)"
+	@echo "make bench     : time the startup of --chunk on a tiny file, with and without SDL,"
+	@echo "                 then each filter strategy of the PNG writer (BENCH_PNG=<file>),"
+	@echo "                 then the suite saved to BMP by one process per file and by --batch,"
+	@echo "                 then decode requests to --serve with and without cache"
 	@echo "make cov       : recompile all sources and run tests silently, then print coverage"
 	@echo
@@ -15,6 +15,7 @@ DOC_DIR = $(BASEDIR)doc/
 # target
 TARGET_EXEC = $(BIN_DIR)png-plte
 TARGET_TEST = $(BIN_DIR)main-test
+TARGET_HEADLESS = $(BIN_DIR)png-plte-headless
 
 # makefile flood
 VERBOSE = nope
@@ -31,9 +32,23 @@ CFLAGS = -std=c99 -Wall -DLOG_LEVEL=$(LOG)
 
 # mandatory libraries
 ZLIB  = -I$(LIB_DIR) -L$(LIB_DIR) -lz
+MATH  = -lm
+THREAD = -lpthread
 # development libraries
 CUNIT = -lcunit
-SDL   = -lSDL2
+
+# SDL2 is opened at run time by --display (src/sdl.h): only its headers and dlopen are needed
+# HEADLESS=yes builds $(TARGET_HEADLESS) without SDL at all (no --display)
+HEADLESS = no
+SDL_SOURCES = viewer.c sdl.c
+ifeq ($(HEADLESS), yes)
+TARGET_EXEC = $(TARGET_HEADLESS)
+TARGET_TEST = $(BIN_DIR)main-test-headless
+CFLAGS += -DHEADLESS
+SDL   =
+else
+SDL   = -ldl
+endif
 
 # default target
 $(TARGET_EXEC): $(BASEDIR)header.mk $(SRC_DIR)*
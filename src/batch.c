@@ -0,0 +1,639 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "bmp.h"
+#include "chunk.h"
+#include "image.h"
+#include "log.h"
+#include "mfile.h"
+#include "prefetch.h"
+#include "scheduler.h"
+
+
+/** @brief Size read at once from the list */
+#define BATCH_READ_SIZE (4096U)
+/** @brief Size of the head of a file read to estimate its cost: signature and IHDR */
+#define BATCH_HEAD_SIZE (33U)
+/** @brief Bytes of a file which are not IDAT data, at least: signature, IHDR and IEND */
+#define BATCH_NOT_IDAT (57U)
+/** @brief Default number of files read ahead */
+#define BATCH_AHEAD (8U)
+
+/** @brief Cost of a byte of IDAT data (inflate), about in nanoseconds on one core */
+#define BATCH_COST_IDAT (20U)
+/** @brief Cost of a byte of filtered rows (unfilter and copy) */
+#define BATCH_COST_ROW (1U)
+/** @brief Cost of a pixel saved to BMP (render and write) */
+#define BATCH_COST_BMP (3U)
+
+
+/**
+ * @brief File to sort by cost
+ */
+struct batch_rank {
+  /** @brief Estimated cost */
+  uint64_t cost;
+  /** @brief Index of the file */
+  uint32_t index;
+};
+
+/**
+ * @brief State shared by the workers
+ */
+struct batch {
+  /** @brief Number of files */
+  uint32_t nb;
+  /** @brief Options */
+  struct batch_options options;
+  /** @brief Callback of each result or NULL */
+  batch_report report;
+  /** @brief Result of each file */
+  struct batch_result *result;
+  /** @brief Estimated cost of each file, 0 if its result is already known */
+  uint64_t *cost;
+  /** @brief Files to process, the most costly first */
+  uint32_t *order;
+  /** @brief Sum of the costs */
+  uint64_t total;
+  /** @brief Number of workers */
+  uint32_t nb_worker;
+  /** @brief Flag of each file: its result is known */
+  uint8_t *done;
+  /** @brief Next result to give (BATCH_ORDERED) */
+  uint32_t next_report;
+  /** @brief Files read ahead, by rank */
+  struct prefetch prefetch;
+  /** @brief Lock of done, next_report and of the callback */
+  pthread_mutex_t lock;
+};
+
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Append a name to a list
+ * @param[in,out] list
+ * @param[in,out] nb Number of names
+ * @param[in,out] allocated Number of names the list can hold
+ * @param[in] name
+ * @param[in] length Length of name
+ * @return The list (moved)
+ */
+static char **append_name(char **list, uint32_t *nb, uint32_t *allocated, const char *name, size_t length) {
+  if (*nb == *allocated) {
+    *allocated = (*allocated > 0) ? 2 * *allocated : 64;
+    list = realloc(list, *allocated * sizeof(char *));
+    if (list == NULL) {
+      LOG_FATAL("Can't realloc a list of %u names", *allocated);
+      exit(1);
+    }
+  }
+  char *copy = malloc(length + 1);
+  if (copy == NULL) {
+    LOG_FATAL("Can't malloc a name of %zu bytes", length);
+    exit(1);
+  }
+  memcpy(copy, name, length);
+  copy[length] = '\0';
+  list[(*nb)++] = copy;
+  return list;
+}
+
+/**
+ * @brief Compare two names for qsort
+ */
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @brief List the .png files of a directory
+ * @param[in] path
+ * @param[out] nb
+ * @return The names, sorted
+ */
+static char **list_directory(const char *path, uint32_t *nb) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    LOG_FATAL("Can't open the directory %s", path);
+    exit(1);
+  }
+  const size_t plength = strlen(path);
+  const uint8_t slash = (plength > 0) && (path[plength - 1] == '/');
+  char **list = NULL;
+  uint32_t allocated = 0;
+  char *name = NULL;
+  size_t name_size = 0;
+  *nb = 0;
+
+  const struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const size_t length = strlen(entry->d_name);
+    if ((length < 4) || (strcmp(entry->d_name + length - 4, ".png") != 0)) {
+      continue;
+    }
+    const size_t size = plength + 1 + length + 1;
+    if (size > name_size) {
+      name_size = 2 * size;
+      name = realloc(name, name_size);
+      if (name == NULL) {
+        LOG_FATAL("Can't realloc a name of %zu bytes", name_size);
+        exit(1);
+      }
+    }
+    memcpy(name, path, plength);
+    name[plength] = '/';
+    memcpy(name + plength + !slash, entry->d_name, length);
+    list = append_name(list, nb, &allocated, name, plength + !slash + length);
+  }
+  closedir(dir);
+  free(name);
+  if (*nb > 1) {
+    qsort(list, *nb, sizeof(char *), compare_names);
+  }
+  return list;
+}
+
+/**
+ * @brief List the matches of a glob pattern
+ * @param[in] pattern
+ * @param[out] nb
+ * @return The names, sorted
+ */
+static char **list_glob(const char *pattern, uint32_t *nb) {
+  glob_t g;
+  char **list = NULL;
+  uint32_t allocated = 0;
+  *nb = 0;
+  const int err = glob(pattern, 0, NULL, &g);
+  if (err == GLOB_NOMATCH) {
+    return NULL;
+  }
+  if (err != 0) {
+    LOG_FATAL("Can't glob %s (%d)", pattern, err);
+    exit(1);
+  }
+  for (size_t k = 0; k < g.gl_pathc; k++) {
+    list = append_name(list, nb, &allocated, g.gl_pathv[k], strlen(g.gl_pathv[k]));
+  }
+  globfree(&g);
+  return list;
+}
+
+/**
+ * @brief Name of the BMP file of a PNG file
+ * @param[in] filename
+ * @return The name (free it)
+ */
+static char *bmp_name(const char *filename) {
+  size_t length = strlen(filename);
+  char *name = malloc(length + 5);
+  if (name == NULL) {
+    LOG_FATAL("Can't malloc a name of %zu bytes", length + 5);
+    exit(1);
+  }
+  memcpy(name, filename, length);
+  if ((length >= 4) && (strcmp(filename + length - 4, ".png") == 0)) {
+    length -= 4;
+  }
+  strcpy(name + length, ".bmp");
+  return name;
+}
+
+/**
+ * @brief Decode a file, and write its BMP
+ * @param[in] batch
+ * @param[in] file The file, unmapped once decoded
+ * @param[in,out] result Its size
+ * @return What happened
+ */
+static enum batch_status decode_file(const struct batch *batch, const struct mfile *file,
+                                     struct batch_result *result) {
+  struct image image;
+  const enum decode_status status = get_image_checked(file, 1, &(batch->options.limits), &image);
+  unmap_file(file);
+  switch (status) {
+  case DECODE_OK:
+    break;
+  case DECODE_TOO_MANY_PIXELS:
+  case DECODE_OVER_BUDGET:
+    return BATCH_TOO_LARGE;
+  case DECODE_DEADLINE:
+  case DECODE_CANCELLED:
+    return BATCH_TIMEOUT;
+  default:
+    return BATCH_CORRUPT;
+  }
+
+  result->width  = image.width;
+  result->height = image.height;
+  uint8_t written = 1;
+  if (batch->options.action == BATCH_BMP) {
+    char *output = bmp_name(result->filename);
+    written = save_image_as_bmp(&image, output);
+    free(output);
+  }
+  free_image(&image);
+  return written ? BATCH_OK : BATCH_NOT_WRITTEN;
+}
+
+/**
+ * @brief Give the results known, the batch must be locked
+ * @param[in,out] batch
+ * @param[in] index Index of the file just done
+ */
+static void report_locked(struct batch *batch, uint32_t index) {
+  batch->done[index] = 1;
+  if (batch->options.order == BATCH_COMPLETED) {
+    if (batch->report != NULL) {
+      batch->report(batch->result + index);
+    }
+    return;
+  }
+  while ((batch->next_report < batch->nb) && batch->done[batch->next_report]) {
+    if (batch->report != NULL) {
+      batch->report(batch->result + batch->next_report);
+    }
+    batch->next_report++;
+  }
+}
+
+/**
+ * @brief Cost of decoding a file, from its IHDR and its size
+ * @details Only the head of the file is read: on cold storage, reading whole files here would load
+ * them twice. The IDAT data is taken as the whole file but the signature, IHDR and IEND, which
+ * overestimates the files with large ancillary chunks.
+ * @param[in] batch
+ * @param[in] head The first bytes of the file
+ * @param[in] result Size of the file; status set if the file can't be decoded, size of the image
+ * @return The cost, 0 if the file can't be decoded
+ */
+static uint64_t file_cost(const struct batch *batch, const struct mfile *head, struct batch_result *result) {
+  if ((head->size < BATCH_HEAD_SIZE) || !mfile_is_png(head)) {
+    result->status = BATCH_NOT_PNG;
+    return 0;
+  }
+  const struct chunk first = get_chunk_unchecked(head->size - 8, ((const uint8_t *) head->data) + 8);
+  if ((first.type != IHDR) || (first.length != 13)) {
+    result->status = BATCH_NOT_PNG;
+    return 0;
+  }
+  // samples per pixel from the color type
+  static const uint8_t samples[7] = {1, 0, 3, 1, 2, 0, 4};
+  const uint8_t *values = first.data;
+  if ((values[9] >= 7) || (samples[values[9]] == 0) || (values[10] != 0) || (values[11] != 0)) {
+    result->status = BATCH_CORRUPT; // IHDR_chunk and check_header_limits can't take these
+    return 0;
+  }
+  const struct IHDR header = IHDR_chunk(&first);
+  result->width  = header.width;
+  result->height = header.height;
+  if (header.interlace != 0) {
+    result->status = BATCH_INTERLACED;
+    return 0;
+  }
+  // too large: given back before being read
+  if (check_header_limits(&header, &(batch->options.limits)) != DECODE_OK) {
+    result->status = BATCH_TOO_LARGE;
+    return 0;
+  }
+
+  // inflate, then unfilter the rows
+  const uint8_t sample = samples[header.color_type];
+  const uint64_t row = ((uint64_t) header.width * sample * header.depth + 7) / 8 + 1;
+  const uint64_t idat = (result->size > BATCH_NOT_IDAT) ? result->size - BATCH_NOT_IDAT : 0;
+  uint64_t cost = BATCH_COST_IDAT * idat + BATCH_COST_ROW * row * header.height;
+  if (batch->options.action == BATCH_BMP) {
+    cost += BATCH_COST_BMP * (uint64_t) header.width * header.height;
+  }
+  return (cost > 0) ? cost : 1;
+}
+
+/**
+ * @brief Check a file and estimate its cost
+ * @details Files that can't be decoded get their result at once, and a cost of 0.
+ * @param[in,out] arg The struct batch
+ * @param[in] index Index of the file
+ */
+static void estimate_file(void *arg, uint32_t index) {
+  struct batch *batch = arg;
+  struct batch_result *result = batch->result + index;
+  const double start = now();
+  uint64_t cost = 0;
+
+  struct stat st;
+  const int fd = open(result->filename, O_RDONLY | O_NONBLOCK);
+  if ((fd < 0) || (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+    result->status = BATCH_NOT_FOUND;
+  }
+  else {
+    uint8_t data[BATCH_HEAD_SIZE];
+    const ssize_t n = pread(fd, data, BATCH_HEAD_SIZE, 0);
+    const struct mfile head = {
+      .pathname       = result->filename,
+      .data           = data,
+      .size           = (n > 0) ? (size_t) n : 0,
+      .allocated_size = 0,
+    };
+    result->size = st.st_size;
+    cost = file_cost(batch, &head, result);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  result->seconds = now() - start;
+  batch->cost[index] = cost;
+
+  if (cost == 0) {
+    pthread_mutex_lock(&(batch->lock));
+    report_locked(batch, index);
+    pthread_mutex_unlock(&(batch->lock));
+  }
+}
+
+/**
+ * @brief Decode a file, the most costly first
+ * @details A file worth more than the share of a worker (the cost of the batch over the workers)
+ * lets its kernels split the rows in pieces, for the workers left idle at the end of the batch.
+ * A smaller file keeps its rows in its worker: its pieces would only be stolen by workers
+ * that have files of their own.
+ * @param[in,out] arg The struct batch
+ * @param[in] rank Rank of the file in the order of the costs
+ */
+static void process_file(void *arg, uint32_t rank) {
+  struct batch *batch = arg;
+  const uint32_t index = batch->order[rank];
+  struct batch_result *result = batch->result + index;
+
+  const uint64_t shares = (batch->cost[index] * batch->nb_worker + batch->total - 1) / batch->total;
+  const uint32_t pieces = (shares <= 1) ? 1 : SCHED_PIECES * ((shares < batch->nb_worker) ? shares : batch->nb_worker);
+  const uint32_t previous = sched_limit_pieces(pieces);
+
+  const double start = now();
+  struct mfile file;
+  if (prefetch_get(&(batch->prefetch), rank, &file)) {
+    result->status = decode_file(batch, &file, result);
+  }
+  else {
+    result->status = BATCH_NOT_FOUND; // gone since the list was made
+  }
+  result->seconds += now() - start;
+  sched_limit_pieces(previous);
+
+  pthread_mutex_lock(&(batch->lock));
+  report_locked(batch, index);
+  pthread_mutex_unlock(&(batch->lock));
+}
+
+/**
+ * @brief Compare two files by decreasing cost for qsort (then in the order of the list)
+ */
+static int compare_cost(const void *a, const void *b) {
+  const struct batch_rank *i = a, *j = b;
+  if (i->cost != j->cost) {
+    return (i->cost > j->cost) ? -1 : 1;
+  }
+  return (i->index > j->index) - (i->index < j->index);
+}
+
+
+
+struct batch_options batch_default_options(void) {
+  const struct batch_options options = {
+    .action  = BATCH_DECODE,
+    .order   = BATCH_ORDERED,
+    .threads = 0,
+    .ahead   = BATCH_AHEAD,
+    .io      = PREFETCH_URING,
+    .limits  = {0, 0, 0, NULL},
+  };
+  return options;
+}
+
+
+uint8_t parse_batch(const char *arg, struct batch_options *options) {
+  *options = batch_default_options();
+  while (*arg != '\0') {
+    const char *comma = strchr(arg, ',');
+    const size_t length = (comma != NULL) ? (size_t) (comma - arg) : strlen(arg);
+    if ((length == 6) && (strncmp(arg, "decode", 6) == 0)) {
+      options->action = BATCH_DECODE;
+    }
+    else if ((length == 3) && (strncmp(arg, "bmp", 3) == 0)) {
+      options->action = BATCH_BMP;
+    }
+    else if ((length == 7) && (strncmp(arg, "ordered", 7) == 0)) {
+      options->order = BATCH_ORDERED;
+    }
+    else if ((length == 9) && (strncmp(arg, "completed", 9) == 0)) {
+      options->order = BATCH_COMPLETED;
+    }
+    else if ((length == 5) && (strncmp(arg, "uring", 5) == 0)) {
+      options->io = PREFETCH_URING;
+    }
+    else if ((length == 6) && (strncmp(arg, "advise", 6) == 0)) {
+      options->io = PREFETCH_ADVISE;
+    }
+    else if ((length > 5) && (length <= 7) && (strncmp(arg, "ahead", 5) == 0)
+             && (strspn(arg + 5, "0123456789") >= length - 5)) {
+      const uint32_t ahead = (length == 7) ? 10 * (arg[5] - '0') + (arg[6] - '0') : (uint32_t) (arg[5] - '0');
+      if (ahead > PREFETCH_MAX_DEPTH) {
+        return 0;
+      }
+      options->ahead = ahead;
+    }
+    else if ((length > 0) && (length <= 2) && (strspn(arg, "0123456789") >= length)) {
+      const uint32_t threads = (length == 2) ? 10 * (arg[0] - '0') + (arg[1] - '0') : (uint32_t) (arg[0] - '0');
+      if ((threads == 0) || (threads > BATCH_MAX_THREAD)) {
+        return 0;
+      }
+      options->threads = threads;
+    }
+    else if (parse_decode_limit(arg, length, &(options->limits))) {
+      // mpx<N>, mb<N> or ms<N>
+    }
+    else {
+      return 0;
+    }
+    arg += length + (comma != NULL);
+  }
+  return 1;
+}
+
+
+char **read_batch_list(FILE *in, uint32_t *nb) {
+  size_t size = 0, allocated = BATCH_READ_SIZE;
+  char *text = malloc(allocated);
+  if (text == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to read a list", allocated);
+    exit(1);
+  }
+  size_t n;
+  while ((n = fread(text + size, 1, allocated - size, in)) > 0) {
+    size += n;
+    if (size == allocated) {
+      allocated *= 2;
+      text = realloc(text, allocated);
+      if (text == NULL) {
+        LOG_FATAL("Can't realloc(%zu) to read a list", allocated);
+        exit(1);
+      }
+    }
+  }
+
+  const char separator = (memchr(text, '\0', size) != NULL) ? '\0' : '\n';
+  char **list = NULL;
+  uint32_t list_allocated = 0;
+  *nb = 0;
+  for (size_t start = 0; start < size;) {
+    const char *end = memchr(text + start, separator, size - start);
+    const size_t next = (end != NULL) ? (size_t) (end - text) : size;
+    size_t length = next - start;
+    if ((separator == '\n') && (length > 0) && (text[start + length - 1] == '\r')) {
+      length--;
+    }
+    if (length > 0) {
+      list = append_name(list, nb, &list_allocated, text + start, length);
+    }
+    start = next + 1;
+  }
+  free(text);
+  return list;
+}
+
+
+char **list_batch(const char *source, uint32_t *nb) {
+  if (strcmp(source, BATCH_STDIN) == 0) {
+    return read_batch_list(stdin, nb);
+  }
+  struct stat st;
+  if ((stat(source, &st) == 0) && S_ISDIR(st.st_mode)) {
+    return list_directory(source, nb);
+  }
+  return list_glob(source, nb);
+}
+
+
+void free_batch_list(char **list, uint32_t nb) {
+  for (uint32_t k = 0; k < nb; k++) {
+    free(list[k]);
+  }
+  free(list);
+}
+
+
+struct batch_stats run_batch(char *const *files, uint32_t nb, const struct batch_options *options,
+                             batch_report report) {
+  struct batch batch = {
+    .nb          = nb,
+    .options     = (options != NULL) ? *options : batch_default_options(),
+    .report      = report,
+    .result      = calloc((nb > 0) ? nb : 1, sizeof(struct batch_result)),
+    .cost        = calloc((nb > 0) ? nb : 1, sizeof(uint64_t)),
+    .order       = calloc((nb > 0) ? nb : 1, sizeof(uint32_t)),
+    .total       = 0,
+    .done        = calloc((nb > 0) ? nb : 1, 1),
+    .next_report = 0,
+  };
+  if ((batch.result == NULL) || (batch.cost == NULL) || (batch.order == NULL) || (batch.done == NULL)) {
+    LOG_FATAL("Can't calloc the results of %u files", nb);
+    exit(1);
+  }
+  pthread_mutex_init(&(batch.lock), NULL);
+  for (uint32_t k = 0; k < nb; k++) {
+    batch.result[k].filename = files[k];
+    batch.result[k].index    = k;
+  }
+
+  // one worker per core, not more than files
+  long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t nb_thread = (batch.options.threads > 0) ? batch.options.threads : (nb_cpu > 0) ? (uint32_t) nb_cpu : 1;
+  nb_thread = (nb_thread < BATCH_MAX_THREAD) ? nb_thread : BATCH_MAX_THREAD;
+  nb_thread = (nb_thread < nb) ? nb_thread : ((nb > 0) ? nb : 1);
+
+  const double start = now();
+  struct sched sched;
+  sched_open(&sched, nb_thread);
+  batch.nb_worker = sched.nb_worker;
+
+  // the costs, then the files that can be decoded, the most costly first (the last ones are short)
+  sched_run(&sched, nb, estimate_file, &batch);
+  struct batch_rank *rank = malloc(((nb > 0) ? nb : 1) * sizeof(struct batch_rank));
+  if (rank == NULL) {
+    LOG_FATAL("Can't malloc the costs of %u files", nb);
+    exit(1);
+  }
+  uint32_t nb_decoded = 0;
+  for (uint32_t k = 0; k < nb; k++) {
+    if (batch.cost[k] > 0) {
+      rank[nb_decoded].cost  = batch.cost[k];
+      rank[nb_decoded].index = k;
+      batch.total += batch.cost[k];
+      nb_decoded++;
+    }
+  }
+  qsort(rank, nb_decoded, sizeof(struct batch_rank), compare_cost);
+  for (uint32_t r = 0; r < nb_decoded; r++) {
+    batch.order[r] = rank[r].index;
+  }
+  free(rank);
+  // the files are read ahead in the order the workers take them
+  prefetch_open(&(batch.prefetch), files, batch.order, nb_decoded, batch.options.ahead,
+                (batch.options.ahead > 0) ? batch.options.io : PREFETCH_OFF);
+  sched_run(&sched, nb_decoded, process_file, &batch);
+  const struct prefetch_stats io = prefetch_close(&(batch.prefetch));
+
+  struct batch_stats stats = {
+    .nb_file   = nb,
+    .nb_failed = 0,
+    .bytes     = 0,
+    .pixels    = 0,
+    .seconds   = now() - start,
+    .busy      = 0,
+    .threads   = sched.nb_worker,
+    .stolen    = sched.stolen,
+    .io        = io.mode,
+    .io_files  = io.nb_file,
+    .io_bytes  = io.bytes,
+    .io_time   = io.io,
+    .io_wait   = io.wait,
+  };
+  sched_close(&sched);
+  for (uint32_t k = 0; k < nb; k++) {
+    const struct batch_result *result = batch.result + k;
+    stats.busy += result->seconds;
+    if (result->status != BATCH_OK) {
+      stats.nb_failed++;
+      continue;
+    }
+    stats.bytes  += result->size;
+    stats.pixels += (uint64_t) result->width * result->height;
+  }
+  LOG_INFO("Batch of %u files on %u workers: %.3f s", nb, stats.threads, stats.seconds);
+
+  pthread_mutex_destroy(&(batch.lock));
+  free(batch.result);
+  free(batch.cost);
+  free(batch.order);
+  free(batch.done);
+  return stats;
+}
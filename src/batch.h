@@ -0,0 +1,204 @@
+/**
+ * @file batch.h
+ * @brief Decode many files in one process, on a pool of workers
+ * @details The files come from a directory (its .png files), a glob pattern or a list on the standard
+ * input (one name per line, or NUL separated as find -print0 writes). The files are tasks of a
+ * scheduler (see scheduler.h): first each file is checked and its cost estimated from its IHDR and its
+ * IDAT chunks, then the files are decoded, the most costly first. The kernels of a file worth more
+ * than the share of a worker split its rows in pieces that the idle workers steal, so one large
+ * image does not finish alone at the end of the batch.
+The files are read ahead in that order (see prefetch.h), so the workers find them in memory.
+ * The result of each file is given to a callback, in the order of the list or as soon as known.
+ * Process startup, the CRC and expand tables and the caches of gamma and ICC transforms are paid once.
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "prefetch.h"
+
+
+/** @brief Max number of workers */
+#define BATCH_MAX_THREAD (64U)
+/** @brief Source of the list read on the standard input */
+#define BATCH_STDIN "-"
+
+
+/**
+ * @brief What is done with each file
+ */
+enum batch_action {
+  /** @brief Decode the image (get_image) */
+  BATCH_DECODE = 0,
+  /** @brief Save the image into a BMP file, next to the PNG file (.png replaced by .bmp) */
+  BATCH_BMP = 1,
+};
+
+/**
+ * @brief When the results are given
+ */
+enum batch_order {
+  /** @brief In the order of the list (a result waits for the ones before) */
+  BATCH_ORDERED = 0,
+  /** @brief As soon as each file is done */
+  BATCH_COMPLETED = 1,
+};
+
+/**
+ * @brief What happened to a file
+ */
+enum batch_status {
+  /** @brief Done */
+  BATCH_OK = 0,
+  /** @brief Not a regular file */
+  BATCH_NOT_FOUND = 1,
+  /** @brief No PNG signature */
+  BATCH_NOT_PNG = 2,
+  /** @brief Interlaced image, get_image does not decode it */
+  BATCH_INTERLACED = 3,
+  /** @brief Wrong chunks or compressed data */
+  BATCH_CORRUPT = 4,
+  /** @brief Over the pixels or the memory of the limits (known from the IHDR, never read ahead) */
+  BATCH_TOO_LARGE = 5,
+  /** @brief Not decoded within the timeout of the limits */
+  BATCH_TIMEOUT = 6,
+  /** @brief Decoded, but its BMP can't be written */
+  BATCH_NOT_WRITTEN = 7,
+};
+
+/**
+ * @brief Options of a batch
+ */
+struct batch_options {
+  /** @brief What is done with each file */
+  enum batch_action action;
+  /** @brief When the results are given */
+  enum batch_order order;
+  /** @brief Number of workers, 0 for one per core */
+  uint8_t threads;
+  /** @brief Number of files read ahead (up to PREFETCH_MAX_DEPTH), 0 to map each file in its worker */
+  uint8_t ahead;
+  /** @brief How the files are read ahead */
+  enum prefetch_mode io;
+  /** @brief Budget of each file (its cancel flag is not used) */
+  struct decode_limits limits;
+};
+
+/**
+ * @brief Result of one file
+ */
+struct batch_result {
+  /** @brief Name of the file */
+  const char *filename;
+  /** @brief Index of the file in the list */
+  uint32_t index;
+  /** @brief What happened */
+  enum batch_status status;
+  /** @brief Width of the image (not for BATCH_NOT_FOUND, BATCH_NOT_PNG and BATCH_CORRUPT) */
+  uint32_t width;
+  /** @brief Height of the image (same as width) */
+  uint32_t height;
+  /** @brief Size of the file (0 for BATCH_NOT_FOUND) */
+  uint64_t size;
+  /** @brief Time spent on the file in seconds */
+  double seconds;
+};
+
+/**
+ * @brief Summary of a batch
+ */
+struct batch_stats {
+  /** @brief Number of files */
+  uint32_t nb_file;
+  /** @brief Number of files not BATCH_OK */
+  uint32_t nb_failed;
+  /** @brief Size of the files done */
+  uint64_t bytes;
+  /** @brief Number of pixels decoded */
+  uint64_t pixels;
+  /** @brief Wall time of the batch in seconds */
+  double seconds;
+  /** @brief Time spent on the files by all the workers in seconds */
+  double busy;
+  /** @brief Number of workers */
+  uint8_t threads;
+  /** @brief Number of files and pieces of images run by a worker other than the one which pushed them */
+  uint64_t stolen;
+  /** @brief How the files were read ahead */
+  enum prefetch_mode io;
+  /** @brief Number of files read ahead */
+  uint32_t io_files;
+  /** @brief Number of bytes read ahead */
+  uint64_t io_bytes;
+  /** @brief Wall time with reads in flight in seconds */
+  double io_time;
+  /** @brief Wall time with workers waiting for their file in seconds */
+  double io_wait;
+};
+
+/**
+ * @brief Callback of each result, never called by two workers at once
+ */
+typedef void (*batch_report)(const struct batch_result *result);
+
+
+/**
+ * @brief Default options: BATCH_DECODE, BATCH_ORDERED, one worker per core, 8 files read ahead with io_uring
+ * @return The options
+ */
+struct batch_options batch_default_options(void);
+
+/**
+ * @brief Read the options from the argument of --batch
+ * @details Comma separated words: decode or bmp, ordered or completed, a number of workers,
+ * ahead and a number of files read ahead (ahead0 for none), uring or advise (the fallback of
+ * prefetch.h), and the limits of each file (see parse_decode_limit), such as "bmp,4,completed,ahead16,ms50".
+ * Words not given keep their default.
+ * @param[in] arg The argument
+ * @param[out] options
+ * @return 1 if every word is known, 0 otherwise
+ */
+uint8_t parse_batch(const char *arg, struct batch_options *options);
+
+/**
+ * @brief Read a list of file names, one per line or NUL separated (if there is any NUL)
+ * @details Empty names are skipped, as well as the carriage return ending a line
+ * @param[in] in Stream of the list, read to the end
+ * @param[out] nb Number of names
+ * @return The names (free them with free_batch_list)
+ */
+char **read_batch_list(FILE *in, uint32_t *nb);
+
+/**
+ * @brief List the files of a source
+ * @param[in] source A directory (its .png files, sorted), BATCH_STDIN (see read_batch_list)
+ * or a glob pattern (its matches, sorted)
+ * @param[out] nb Number of files
+ * @return The names (free them with free_batch_list)
+ */
+char **list_batch(const char *source, uint32_t *nb);
+
+/**
+ * @brief Free a list of names
+ * @param[in] list
+ * @param[in] nb Number of names
+ */
+void free_batch_list(char **list, uint32_t nb);
+
+/**
+ * @brief Process every file of a list
+ * @param[in] files Names of the files
+ * @param[in] nb Number of files
+ * @param[in] options Options or NULL for batch_default_options
+ * @param[in] report Callback of each result, NULL for none
+ * @return The summary
+ */
+struct batch_stats run_batch(char *const *files, uint32_t nb, const struct batch_options *options,
+                             batch_report report);
+
+
+#endif // __BATCH_H__
@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#include "bmp.h"
+#include "log.h"
+#include "render.h"
+#include "scheduler.h"
+
+
+/** @brief Size of the file header */
+#define FILE_HEADER (14U)
+/** @brief Size of BITMAPINFOHEADER */
+#define INFO_HEADER (40U)
+/** @brief Size of BITMAPV4HEADER */
+#define V4_HEADER (108U)
+
+/** @brief No compression */
+#define BI_RGB (0U)
+/** @brief Channel masks given */
+#define BI_BITFIELDS (3U)
+/** @brief 'Win ' color space */
+#define LCS_WINDOWS_COLOR_SPACE (0x57696e20U)
+
+/** @brief Min number of pixels of a piece of a batch rendered by a worker */
+#define BMP_PIECE_PIXELS (1U << 16)
+/** @brief Max number of pieces of a batch */
+#define BMP_MAX_PIECES (64U)
+
+
+/**
+ * @brief Rows of a batch rendered in pieces
+ */
+struct bmp_render {
+  /** @brief The image */
+  const struct image *image;
+  /** @brief First row of the batch in the image */
+  uint32_t row0;
+  /** @brief Number of rows of the batch */
+  uint32_t nrows;
+  /** @brief Rows of a piece (the last one may have less) */
+  uint32_t piece_rows;
+  /** @brief Alpha of the rows rendered */
+  enum alpha_mode mode;
+  /** @brief Rendered rows (BGRA8) */
+  uint8_t *bgra;
+  /** @brief Distance in bytes between two rows of bgra */
+  size_t stride;
+};
+
+
+
+/**
+ * @brief Render a piece of a batch
+ * @param[in,out] arg A struct bmp_render
+ * @param[in] index Index of the piece
+ */
+static void render_piece(void *arg, uint32_t index) {
+  const struct bmp_render *render = arg;
+  const uint32_t first = index * render->piece_rows;
+  const uint32_t n = (render->nrows - first < render->piece_rows) ? render->nrows - first : render->piece_rows;
+  render_rows(render->image, render->row0 + first, n, FORMAT_BGRA8, render->mode,
+              render->bgra + first * render->stride, render->stride);
+}
+
+static void put16(uint8_t *ptr, uint16_t v) {
+  ptr[0] = v;
+  ptr[1] = v >> 8;
+}
+
+static void put32(uint8_t *ptr, uint32_t v) {
+  ptr[0] = v;
+  ptr[1] = v >> 8;
+  ptr[2] = v >> 16;
+  ptr[3] = v >> 24;
+}
+
+/**
+ * @brief Write the whole buffer at an offset of the file, unless a write already failed
+ */
+static void write_at(struct bmp_writer *writer, const uint8_t *buffer, size_t size, off_t offset) {
+  while ((size > 0) && !writer->failed) {
+    const ssize_t n = pwrite(writer->fd, buffer, size, offset);
+    if (n < 0) {
+      LOG_ERROR("Can't write %s (%s)", writer->filename, strerror(errno));
+      writer->failed = 1;
+      return;
+    }
+    buffer += n;
+    size   -= n;
+    offset += n;
+  }
+}
+
+/**
+ * @brief Pack a BGRA8 row to BGR, padding included
+ * @param[in] src BGRA8 pixels
+ * @param[in] width Number of pixels
+ * @param[out] dst Area of pitch bytes
+ * @param[in] pitch Length of the row with its padding
+ */
+static void pack_bgr(const uint8_t *src, uint32_t width, uint8_t *dst, uint32_t pitch) {
+  uint32_t j = 0;
+
+#ifdef __SSSE3__
+  // 4 pixels at once, 16 bytes stored for 12: stop 2 pixels before the end
+  const __m128i drop = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for (; j + 6 <= width; j += 4) {
+    const __m128i px = _mm_loadu_si128((const __m128i *) (src + 4 * j));
+    _mm_storeu_si128((__m128i *) (dst + 3 * j), _mm_shuffle_epi8(px, drop));
+  }
+#endif
+
+  for (; j < width; j++) {
+    dst[3 * j]     = src[4 * j];
+    dst[3 * j + 1] = src[4 * j + 1];
+    dst[3 * j + 2] = src[4 * j + 2];
+  }
+  memset(dst + 3 * width, 0, pitch - 3 * width);
+}
+
+/**
+ * @brief Write the rows of the batch at their place
+ */
+static void flush_batch(struct bmp_writer *writer) {
+  if (writer->batched == 0) {
+    return;
+  }
+  // the last row of the batch is the first one in the file
+  const uint32_t last = writer->row - 1;
+  const off_t offset = writer->offset + (off_t) (writer->height - 1 - last) * writer->pitch;
+  const uint8_t *start = writer->batch + (size_t) (writer->batch_rows - writer->batched) * writer->pitch;
+  write_at(writer, start, (size_t) writer->batched * writer->pitch, offset);
+  writer->batched = 0;
+}
+
+
+
+uint8_t bmp_open(struct bmp_writer *writer, const char *filename, uint32_t width, uint32_t height, uint8_t alpha) {
+  writer->filename = filename;
+  writer->width    = width;
+  writer->height   = height;
+  writer->alpha    = alpha;
+  writer->offset   = FILE_HEADER + (alpha ? V4_HEADER : INFO_HEADER);
+  writer->pitch    = alpha ? width * 4 : (width * 3 + 3) & ~3U;
+  writer->row      = 0;
+  writer->batched  = 0;
+  writer->failed   = 0;
+  writer->batch_rows = ((writer->pitch > 0) && (writer->pitch < BMP_BATCH_SIZE)) ? BMP_BATCH_SIZE / writer->pitch : 1;
+  if (writer->batch_rows > height) {
+    writer->batch_rows = (height > 0) ? height : 1;
+  }
+
+  writer->batch = malloc((size_t) writer->batch_rows * writer->pitch);
+  writer->bgra  = malloc((size_t) writer->batch_rows * width * 4);
+  if ((writer->batch == NULL) || (writer->bgra == NULL)) {
+    LOG_FATAL("Can't malloc(%zu) to write a BMP", (size_t) writer->batch_rows * (writer->pitch + width * 4));
+    exit(1);
+  }
+  LOG_ALLOC("Malloc BMP batch %p (%d rows)", writer->batch, writer->batch_rows);
+
+  writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (writer->fd < 0) {
+    LOG_ERROR("Can't open %s (%s)", filename, strerror(errno));
+    free(writer->batch);
+    free(writer->bgra);
+    return 0;
+  }
+
+  // headers, as SDL_SaveBMP writes them
+  uint8_t header[FILE_HEADER + V4_HEADER];
+  memset(header, 0, sizeof(header));
+  const uint32_t image_size = height * writer->pitch;
+  header[0] = 'B';
+  header[1] = 'M';
+  put32(header + 2, writer->offset + image_size);  // bfSize
+  put32(header + 10, writer->offset);              // bfOffBits
+  put32(header + 14, writer->offset - FILE_HEADER); // biSize
+  put32(header + 18, width);
+  put32(header + 22, height);                      // positive: bottom-up
+  put16(header + 26, 1);                           // biPlanes
+  put16(header + 28, alpha ? 32 : 24);             // biBitCount
+  put32(header + 30, alpha ? BI_BITFIELDS : BI_RGB);
+  put32(header + 34, image_size);                  // biSizeImage
+  if (alpha) {
+    put32(header + 54, 0x00ff0000);                // red mask
+    put32(header + 58, 0x0000ff00);                // green mask
+    put32(header + 62, 0x000000ff);                // blue mask
+    put32(header + 66, 0xff000000);                // alpha mask
+    put32(header + 70, LCS_WINDOWS_COLOR_SPACE);   // endpoints and gamma stay 0
+  }
+  write_at(writer, header, writer->offset, 0);
+  return 1;
+}
+
+
+void bmp_write_rows(struct bmp_writer *writer, const uint8_t *bgra, uint32_t nrows, size_t stride) {
+  if (writer->row + nrows > writer->height) {
+    LOG_FATAL("Too many rows for %s (%d + %d > %d)", writer->filename, writer->row, nrows, writer->height);
+    exit(1);
+  }
+
+  for (uint32_t i = 0; i < nrows; i++, bgra += stride) {
+    // batch filled from its end: file order
+    uint8_t *dst = writer->batch + (size_t) (writer->batch_rows - 1 - writer->batched) * writer->pitch;
+    if (writer->alpha) {
+      memcpy(dst, bgra, writer->pitch);
+    } else {
+      pack_bgr(bgra, writer->width, dst, writer->pitch);
+    }
+    writer->row++;
+    writer->batched++;
+    if (writer->batched == writer->batch_rows) {
+      flush_batch(writer);
+    }
+  }
+}
+
+
+void bmp_write_image(struct bmp_writer *writer, const struct image *image, uint32_t row0, uint32_t nrows) {
+  struct bmp_render render = {
+    .image  = image,
+    .mode   = writer->alpha ? ALPHA_STRAIGHT : ALPHA_BACKGROUND,
+    .bgra   = writer->bgra,
+    .stride = (size_t) writer->width * 4,
+  };
+
+  while (nrows > 0) {
+    const uint32_t n = (nrows < writer->batch_rows) ? nrows : writer->batch_rows;
+    // pieces of the batch stolen by the idle workers
+    const uint32_t nb_piece = sched_pieces((uint64_t) n * writer->width, BMP_PIECE_PIXELS, BMP_MAX_PIECES);
+    render.row0       = row0;
+    render.nrows      = n;
+    render.piece_rows = (n + nb_piece - 1) / nb_piece;
+    sched_run(NULL, (n + render.piece_rows - 1) / render.piece_rows, render_piece, &render);
+    bmp_write_rows(writer, writer->bgra, n, render.stride);
+    row0  += n;
+    nrows -= n;
+  }
+}
+
+
+uint8_t bmp_close(struct bmp_writer *writer) {
+  flush_batch(writer);
+  if (writer->row != writer->height) {
+    LOG_FATAL("Only %d rows of %d written to %s", writer->row, writer->height, writer->filename);
+    exit(1);
+  }
+  if (close(writer->fd) != 0) {
+    LOG_ERROR("Can't close %s (%s)", writer->filename, strerror(errno));
+    writer->failed = 1;
+  }
+  LOG_ALLOC("Free BMP batch %p", writer->batch);
+  free(writer->batch);
+  free(writer->bgra);
+  LOG_INFO("Write %s", writer->filename);
+  return !writer->failed;
+}
+
+
+/**
+ * @brief Save the whole image
+ * @return 1 if written
+ */
+static uint8_t save_image(const struct image *image, const char *filename, uint8_t alpha) {
+  struct bmp_writer writer;
+  if (!bmp_open(&writer, filename, image->width, image->height, alpha)) {
+    return 0;
+  }
+  bmp_write_image(&writer, image, 0, image->height);
+  return bmp_close(&writer);
+}
+
+uint8_t save_image_as_bmp(const struct image *image, const char *filename) {
+  return save_image(image, filename, 0);
+}
+
+uint8_t save_image_as_bmp32(const struct image *image, const char *filename) {
+  return save_image(image, filename, 1);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file bmp.h
+ * @brief Write BMP files without SDL
+ * @details 24-bit files are byte for byte what SDL_SaveBMP writes from a 32-bit surface
+ * (BITMAPINFOHEADER, BGR rows padded to 4 bytes). 32-bit files keep the alpha channel
+ * with a BITMAPV4HEADER, as SDL_SaveBMP does for surfaces with alpha.
+ * BMP rows go bottom-up, but the size of the file is known from the start: rows given top-down
+ * are gathered in reverse order in a batch buffer, then written at their place with a single pwrite.
+ * The rows of a batch are rendered in pieces by the workers of the scheduler.
+ * Memory is one batch (about BMP_BATCH_SIZE), whatever the size of the image.
+ */
+
+#ifndef __BMP_H__
+#define __BMP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+
+/** @brief Size of the rows written at once */
+#define BMP_BATCH_SIZE (1U << 20)
+
+
+/**
+ * @brief BMP file being written
+ */
+struct bmp_writer {
+  /** @brief File descriptor */
+  int fd;
+  /** @brief Name of the file */
+  const char *filename;
+  /** @brief Width of the image */
+  uint32_t width;
+  /** @brief Height of the image */
+  uint32_t height;
+  /** @brief Flag: 32-bit BGRA (24-bit BGR otherwise) */
+  uint8_t alpha;
+  /** @brief Offset of the pixels in the file (size of the headers) */
+  uint32_t offset;
+  /** @brief Length of a row in the file (padded to 4 bytes) */
+  uint32_t pitch;
+  /** @brief Number of rows given so far (from the top) */
+  uint32_t row;
+  /** @brief Max number of rows in a batch */
+  uint32_t batch_rows;
+  /** @brief Number of rows in the batch */
+  uint32_t batched;
+  /** @brief Rows of the batch in file order, aligned on the end of the buffer */
+  uint8_t *batch;
+  /** @brief Rows rendered by bmp_write_image (BGRA8) */
+  uint8_t *bgra;
+  /** @brief Flag: a write failed, nothing more is written */
+  uint8_t failed;
+};
+
+
+/**
+ * @brief Create the file and write the headers
+ * @param[out] writer
+ * @param[in] filename
+ * @param[in] width
+ * @param[in] height
+ * @param[in] alpha Flag: 32-bit BMP with alpha, 24-bit otherwise
+ * @return 1 if the file is created, 0 otherwise (nothing to close)
+ */
+uint8_t bmp_open(struct bmp_writer *writer, const char *filename, uint32_t width, uint32_t height, uint8_t alpha);
+
+/**
+ * @brief Write the next rows
+ * @param[in,out] writer
+ * @param[in] bgra Rows in the BGRA8 format (alpha ignored by 24-bit files)
+ * @param[in] nrows Number of rows
+ * @param[in] stride Distance in bytes between two rows of bgra
+ */
+void bmp_write_rows(struct bmp_writer *writer, const uint8_t *bgra, uint32_t nrows, size_t stride);
+
+/**
+ * @brief Render rows of an image (see render_rows) and write them as the next rows
+ * @details 24-bit files get the rows composited onto the background, 32-bit files the straight alpha
+ * @param[in,out] writer
+ * @param[in] image An image as wide as the file (a whole image, or the band of a stream)
+ * @param[in] row0 First row of the image to write
+ * @param[in] nrows Number of rows
+ */
+void bmp_write_image(struct bmp_writer *writer, const struct image *image, uint32_t row0, uint32_t nrows);
+
+/**
+ * @brief Write the last batch and close the file
+ * @param[in,out] writer Every row must have been written
+ * @return 1 if the whole file is written, 0 if a write failed (the file is incomplete)
+ */
+uint8_t bmp_close(struct bmp_writer *writer);
+
+/**
+ * @brief Save the image in a 24-bit BMP file
+ * @details Transparent pixels are composited onto the background
+ * @param[in] image
+ * @param[in] filename Name of the file to write
+ * @return 1 if written, 0 if the file can't be created or written
+ */
+uint8_t save_image_as_bmp(const struct image *image, const char *filename);
+
+/**
+ * @brief Save the image in a 32-bit BMP file with alpha
+ * @param[in] image
+ * @param[in] filename Name of the file to write
+ * @return 1 if written, 0 if the file can't be created or written
+ */
+uint8_t save_image_as_bmp32(const struct image *image, const char *filename);
+
+
+
+#endif // __BMP_H__
@@ -45,7 +45,7 @@ uint32_t enum_to_type_value(enum chunk_type type) {
 
 
 
-const struct chunk get_chunk(size_t size, const void *data) {
+const struct chunk get_chunk_unchecked(size_t size, const void *data) {
   if (size < 12) {
     LOG_FATAL("Remaind file too short to get a chunk: size %zu", size);
     exit(1);
@@ -61,24 +61,28 @@ const struct chunk get_chunk(size_t size, const void *data) {
     exit(1);
   }
   
-  uint32_t expected_crc = ntohl(UINT32_FROM_PTR(ptr + 8 + data_length));
-  uint32_t computed_crc = crc((unsigned char *) ptr + 4, 4 + data_length);
-  if (expected_crc != computed_crc) {
-    LOG_WARN("Chunk CRC 0x%x != computed 0x%x", expected_crc, computed_crc);
-  }
-
   uint32_t chunk_type = UINT32_FROM_PTR(ptr + 4);
   
   const struct chunk res = {
     .length = data_length,
     .type   = chunk_type_value_to_enum(chunk_type),
     .data   = ptr + 8,
-    .crc    = expected_crc,
+    .crc    = ntohl(UINT32_FROM_PTR(ptr + 8 + data_length)),
   };
   LOG_INFO("%.4s, data %-6d crc 0x%x", (char *) &(chunk_type), res.length, res.crc);
   return res;
 }
 
+const struct chunk get_chunk(size_t size, const void *data) {
+  const struct chunk res = get_chunk_unchecked(size, data);
+
+  uint32_t computed_crc = crc((unsigned char *) data + 4, 4 + res.length);
+  if (res.crc != computed_crc) {
+    LOG_WARN("Chunk CRC 0x%x != computed 0x%x", res.crc, computed_crc);
+  }
+  return res;
+}
+
 
 
 
@@ -143,6 +147,39 @@ uint32_t GAMA_chunk(const struct chunk *chunk) {
 
 
 
+enum rendering_intent SRGB_chunk(const struct chunk *chunk) {
+  assert(chunk->type == SRGB);
+  assert(chunk->length == 1);
+
+  uint8_t intent = UINT8_FROM_PTR(chunk->data);
+  if (intent > INTENT_ABSOLUTE) {
+    LOG_WARN("Unknown rendering intent %d", intent);
+  }
+  return intent;
+}
+
+
+
+const struct CHRM CHRM_chunk(const struct chunk *chunk) {
+  assert(chunk->type == CHRM);
+  assert(chunk->length == 32);
+
+  const uint8_t *ptr = chunk->data;
+  const struct CHRM res = {
+    .white_x = ntohl(UINT32_FROM_PTR(ptr)),
+    .white_y = ntohl(UINT32_FROM_PTR(ptr + 4)),
+    .red_x   = ntohl(UINT32_FROM_PTR(ptr + 8)),
+    .red_y   = ntohl(UINT32_FROM_PTR(ptr + 12)),
+    .green_x = ntohl(UINT32_FROM_PTR(ptr + 16)),
+    .green_y = ntohl(UINT32_FROM_PTR(ptr + 20)),
+    .blue_x  = ntohl(UINT32_FROM_PTR(ptr + 24)),
+    .blue_y  = ntohl(UINT32_FROM_PTR(ptr + 28)),
+  };
+  return res;
+}
+
+
+
 const struct BKGD BKGD_chunk(const struct chunk *chunk, const struct IHDR *header) {
   assert(chunk->type == BKGD);
   
@@ -80,13 +80,13 @@ uint32_t enum_to_type_value(enum chunk_type type);
  */
 struct chunk {
   /** @brief Length of the field .data (the size of a chunk is .length + 12) */
-  const uint32_t length;
+  uint32_t length;
   /** @brief Type of the chunk */
   enum chunk_type type;
   /** @brief Pointer to the mapped data */
   const void *data;
   /** @brief CRC of the field type and data */
-  const uint32_t crc;
+  uint32_t crc;
 };
 
 /**
@@ -97,6 +97,14 @@ struct chunk {
  */
 const struct chunk get_chunk(size_t size, const void *data);
 
+/**
+ * @brief Same as get_chunk, but the CRC is not checked: the data of the chunk is never read
+ * @param[in] size Max size of the data starting at data
+ * @param[in] data Content from a PNG file
+ * @result A generic chunk (.crc is the one of the file)
+ */
+const struct chunk get_chunk_unchecked(size_t size, const void *data);
+
 
 
 // chunk header
@@ -182,6 +190,66 @@ uint32_t GAMA_chunk(const struct chunk *chunk);
 
 
 
+// chunk standard RGB
+
+/**
+ * @brief Rendering intent of the sRGB chunk
+ * @details [Source](http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html#C.sRGB)
+ */
+enum rendering_intent {
+  /** @brief Perceptual */
+  INTENT_PERCEPTUAL = 0,
+  /** @brief Relative colorimetric */
+  INTENT_RELATIVE = 1,
+  /** @brief Saturation */
+  INTENT_SATURATION = 2,
+  /** @brief Absolute colorimetric */
+  INTENT_ABSOLUTE = 3,
+};
+
+/**
+ * @brief Get the rendering intent (the samples are in the sRGB color space)
+ * @param[in] chunk
+ * @return SRGB chunk
+ */
+enum rendering_intent SRGB_chunk(const struct chunk *chunk);
+
+
+
+// chunk primary chromaticities
+
+/**
+ * @brief Chromaticities of the white point and the primaries, times 100000
+ * @details [Source](http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html#C.cHRM)
+ */
+struct CHRM {
+  /** @brief White point x */
+  uint32_t white_x;
+  /** @brief White point y */
+  uint32_t white_y;
+  /** @brief Red x */
+  uint32_t red_x;
+  /** @brief Red y */
+  uint32_t red_y;
+  /** @brief Green x */
+  uint32_t green_x;
+  /** @brief Green y */
+  uint32_t green_y;
+  /** @brief Blue x */
+  uint32_t blue_x;
+  /** @brief Blue y */
+  uint32_t blue_y;
+};
+
+/**
+ * @brief Get the chromaticities chunk
+ * @param[in] chunk
+ * @return CHRM chunk
+ */
+const struct CHRM CHRM_chunk(const struct chunk *chunk);
+
+
+
 // chunk background
 
 /**
@@ -43,8 +43,13 @@ enum command_option arg_parse(int argc, char *const *argv, const char **opt_para
       return CMD_VERSION;
 
     case 'p':
+      LOG_TRACE("Option --plte <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
       option = CMD_PLTE;
       opt_index = index;
+      *opt_param = optarg;
       break;
 
     case 'a':
@@ -62,6 +67,11 @@ enum command_option arg_parse(int argc, char *const *argv, const char **opt_para
       opt_index = index;
       break;
 
+    case 's':
+      option = CMD_STATS;
+      opt_index = index;
+      break;
+
     case 'b':
       LOG_TRACE("Option --bmp <%s>", optarg);
       if (strlen(optarg) == 0) {
@@ -72,6 +82,126 @@ enum command_option arg_parse(int argc, char *const *argv, const char **opt_para
       *opt_param = optarg;
       break;
 
+    case 'B':
+      LOG_TRACE("Option --bmp32 <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_BMP32;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'P':
+      LOG_TRACE("Option --ppm <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_PPM;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'M':
+      LOG_TRACE("Option --pam <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_PAM;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'r':
+      LOG_TRACE("Option --raw <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_RAW;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'R':
+      LOG_TRACE("Option --raw16 <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_RAW16;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'n':
+      LOG_TRACE("Option --png <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_PNG;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'o':
+      LOG_TRACE("Option --optimize <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_OPTIMIZE;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'C':
+      LOG_TRACE("Option --clean <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_CLEAN;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 't':
+      LOG_TRACE("Option --transcode <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_TRANSCODE;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'j':
+      LOG_TRACE("Option --batch <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_BATCH;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'S':
+      LOG_TRACE("Option --serve <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_SERVE;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
+    case 'i':
+      LOG_TRACE("Option --index <%s>", optarg);
+      if (strlen(optarg) == 0) {
+        return CMD_ERROR;
+      }
+      option = CMD_INDEX;
+      opt_index = index;
+      *opt_param = optarg;
+      break;
+
     default:
       LOG_ERROR("Wrong option -%c", c);
       return CMD_ERROR;
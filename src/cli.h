@@ -29,10 +29,36 @@ enum command_option {
   CMD_DISPLAY = 5,
   /** @brief Save the image to BMP */
   CMD_BMP = 6,
-  /** @brief Get the palette */
+  /** @brief Reduce the image to a palette of 256 colors */
   CMD_PLTE = 7,
   /** @brief Get all passes of an interlace image */
   CMD_PASS = 8,
+  /** @brief Write the IDAT index in a sidecar file */
+  CMD_INDEX = 9,
+  /** @brief Print color statistics */
+  CMD_STATS = 10,
+  /** @brief Save the image to a 32-bit BMP with alpha */
+  CMD_BMP32 = 11,
+  /** @brief Save the image to PPM */
+  CMD_PPM = 12,
+  /** @brief Save the image to PAM with alpha */
+  CMD_PAM = 13,
+  /** @brief Save the image as raw RGBA8 */
+  CMD_RAW = 14,
+  /** @brief Save the image as raw RGBA16 (native byte order) */
+  CMD_RAW16 = 15,
+  /** @brief Save the image to PNG */
+  CMD_PNG = 16,
+  /** @brief Save the image to the smallest PNG found */
+  CMD_OPTIMIZE = 17,
+  /** @brief Copy the file without metadata, IDAT merged */
+  CMD_CLEAN = 18,
+  /** @brief Convert to another PNG (color type, depth, crop) a few rows at a time */
+  CMD_TRANSCODE = 19,
+  /** @brief Decode many files on a pool of workers */
+  CMD_BATCH = 20,
+  /** @brief Serve decode requests on a Unix domain socket */
+  CMD_SERVE = 21,
 };
 
 /**
@@ -45,8 +71,21 @@ static const struct option long_option[] = {
   {"chunk",   no_argument,       NULL, 'c'},
   {"display", no_argument,       NULL, 'd'},
   {"bmp",     required_argument, NULL, 'b'},
-  {"plte",    no_argument,       NULL, 'p'},
+  {"bmp32",   required_argument, NULL, 'B'},
+  {"ppm",     required_argument, NULL, 'P'},
+  {"pam",     required_argument, NULL, 'M'},
+  {"raw",     required_argument, NULL, 'r'},
+  {"raw16",   required_argument, NULL, 'R'},
+  {"png",     required_argument, NULL, 'n'},
+  {"plte",    required_argument, NULL, 'p'},
+  {"optimize", required_argument, NULL, 'o'},
+  {"clean",   required_argument, NULL, 'C'},
+  {"transcode", required_argument, NULL, 't'},
+  {"batch",   required_argument, NULL, 'j'},
+  {"serve",   required_argument, NULL, 'S'},
   {"passes",  no_argument,       NULL, 'a'},
+  {"index",   required_argument, NULL, 'i'},
+  {"stats",   no_argument,       NULL, 's'},
   {NULL,      0,                 NULL,  0 },
 };
 
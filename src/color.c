@@ -22,6 +22,16 @@ static void *pixel_pointer(const struct image *image, uint32_t i, uint32_t j) {
   return image->data + (i * lsize) + (psize * j);
 }
 
+/**
+ * @brief Read a 16-bit sample in the byte order of the image
+ * @param[in] image
+ * @param[in] ptr Pointer to the sample
+ * @return The sample value
+ */
+static uint16_t get_sample16(const struct image *image, const uint16_t *ptr) {
+  return image->native ? *ptr : ntohs(*ptr);
+}
+
 /**
  * @brief Compute the pointer to the byte holding the pixel (i, j)
  * @details A sample is less than a byte, so the pixel is in the bit, left_shift bits from the left 
@@ -75,8 +85,8 @@ void get_color(const struct image *image, uint32_t i, uint32_t j, struct color *
     color->red   = pixel[0];
     color->green = pixel[1];
     color->blue  = pixel[2];
-    color->alpha = max;
-    color->max   = max;
+    color->alpha = 0xff; // palette colors are on 1 byte, whatever the index depth
+    color->max   = 0xff;
     return;
   }
 
@@ -103,7 +113,7 @@ void get_color(const struct image *image, uint32_t i, uint32_t j, struct color *
       color->max   = 0xff;
     } else { // depth 16
       uint16_t *ptr = pixel_pointer(image, i, j);
-      uint16_t gray = ntohs(ptr[0]);
+      uint16_t gray = get_sample16(image, ptr);
       color->red   = gray;
       color->green = gray;
       color->blue  = gray;
@@ -121,11 +131,11 @@ void get_color(const struct image *image, uint32_t i, uint32_t j, struct color *
       color->max   = 0xff;
     } else { // depth 16
       uint16_t *ptr = pixel_pointer(image, i, j);
-      uint16_t gray = ntohs(ptr[0]);
+      uint16_t gray = get_sample16(image, ptr);
       color->red   = gray;
       color->green = gray;
       color->blue  = gray;
-      color->alpha = ntohs(ptr[1]);
+      color->alpha = get_sample16(image, ptr + 1);
       color->max   = 0xffff;
     }
     break;
@@ -139,9 +149,9 @@ void get_color(const struct image *image, uint32_t i, uint32_t j, struct color *
       color->max   = 0xff;
     } else { // depth 16
       uint16_t *ptr = pixel_pointer(image, i, j);
-      color->red   = ntohs(ptr[0]);
-      color->green = ntohs(ptr[1]);
-      color->blue  = ntohs(ptr[2]);
+      color->red   = get_sample16(image, ptr);
+      color->green = get_sample16(image, ptr + 1);
+      color->blue  = get_sample16(image, ptr + 2);
       color->alpha = 0xffff;
       color->max   = 0xffff;
     }
@@ -156,10 +166,10 @@ void get_color(const struct image *image, uint32_t i, uint32_t j, struct color *
       color->max   = 0xff;
     } else { // depth 16
       uint16_t *ptr = pixel_pointer(image, i, j);
-      color->red   = ntohs(ptr[0]);
-      color->green = ntohs(ptr[1]);
-      color->blue  = ntohs(ptr[2]);
-      color->alpha = ntohs(ptr[3]);
+      color->red   = get_sample16(image, ptr);
+      color->green = get_sample16(image, ptr + 1);
+      color->blue  = get_sample16(image, ptr + 2);
+      color->alpha = get_sample16(image, ptr + 3);
       color->max   = 0xffff;
     }
     break;
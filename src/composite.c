@@ -0,0 +1,185 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "composite.h"
+#include "log.h"
+
+
+/**
+ * @brief round(x / 255) for x <= 255 * 255
+ */
+static inline uint32_t div255(uint32_t x) {
+  x += 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * @brief round(x / 65535) for x <= 65535 * 65535
+ */
+static inline uint32_t div65535(uint32_t x) {
+  x += 32768;
+  return (x + (x >> 16)) >> 16;
+}
+
+
+
+void get_background(const struct image *image, const uint16_t fallback[3], uint16_t background[3]) {
+  const uint16_t *bg = image->has_background ? image->background : fallback;
+  for (uint8_t k = 0; k < 3; k++) {
+    background[k] = bg[k];
+  }
+}
+
+
+
+/**
+ * @brief Composite 4-byte pixels (RGBA8 or BGRA8, alpha last)
+ * @param[in,out] row
+ * @param[in] width Number of pixels
+ * @param[in] mode ALPHA_PREMULTIPLIED or ALPHA_BACKGROUND
+ * @param[in] bg 8-bit background in the order of the pixels
+ */
+static void composite_row8(uint8_t *row, uint32_t width, enum alpha_mode mode, const uint8_t bg[3]) {
+  const uint32_t opaque = (mode == ALPHA_BACKGROUND);
+  uint32_t j = 0;
+
+#ifdef __SSE2__
+  // 4 pixels at once, 2 per 16-bit lanes register
+  const __m128i zero  = _mm_setzero_si128();
+  const __m128i full  = _mm_set1_epi16(255);
+  const __m128i round = _mm_set1_epi16(128);
+  const __m128i bgv   = opaque ? _mm_set_epi16(0, bg[2], bg[1], bg[0], 0, bg[2], bg[1], bg[0]) : zero;
+  const __m128i amask = _mm_set1_epi32(0xff000000);
+
+  for (; j + 4 <= width; j += 4) {
+    const __m128i px = _mm_loadu_si128((const __m128i *) (row + 4 * j));
+    __m128i half[2] = {_mm_unpacklo_epi8(px, zero), _mm_unpackhi_epi8(px, zero)};
+
+    for (uint8_t h = 0; h < 2; h++) {
+      const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(half[h], 0xff), 0xff);
+      __m128i x = _mm_add_epi16(_mm_mullo_epi16(half[h], a), _mm_mullo_epi16(bgv, _mm_sub_epi16(full, a)));
+      x = _mm_add_epi16(x, round); // <= 65025 + 128: no carry out of the lane
+      half[h] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+    __m128i out = _mm_packus_epi16(half[0], half[1]);
+    // alpha: kept (premultiplied) or opaque
+    out = _mm_or_si128(_mm_andnot_si128(amask, out), opaque ? amask : _mm_and_si128(amask, px));
+    _mm_storeu_si128((__m128i *) (row + 4 * j), out);
+  }
+#endif
+
+  for (uint8_t *pixel = row + 4 * j; j < width; j++, pixel += 4) {
+    const uint32_t a = pixel[3];
+    for (uint8_t k = 0; k < 3; k++) {
+      pixel[k] = div255(pixel[k] * a + (opaque ? bg[k] * (255 - a) : 0));
+    }
+    pixel[3] = opaque ? 255 : a;
+  }
+}
+
+/**
+ * @brief Composite RGBA16 pixels (native byte order)
+ * @param[in,out] row
+ * @param[in] width Number of pixels
+ * @param[in] mode ALPHA_PREMULTIPLIED or ALPHA_BACKGROUND
+ * @param[in] bg 16-bit background
+ */
+static void composite_row16(uint16_t *row, uint32_t width, enum alpha_mode mode, const uint16_t bg[3]) {
+  const uint32_t opaque = (mode == ALPHA_BACKGROUND);
+  uint32_t j = 0;
+
+#ifdef __SSE2__
+  // 2 pixels at once, products on 32 bits from the low and high halves
+  const __m128i zero  = _mm_setzero_si128();
+  const __m128i ones  = _mm_set1_epi16(-1);
+  const __m128i round = _mm_set1_epi32(32768);
+  const __m128i bgv   = opaque ? _mm_set_epi16(0, bg[2], bg[1], bg[0], 0, bg[2], bg[1], bg[0]) : zero;
+  const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  const __m128i sign  = _mm_set1_epi16(-32768);
+
+  for (; j + 2 <= width; j += 2) {
+    const __m128i px  = _mm_loadu_si128((const __m128i *) (row + 4 * j));
+    const __m128i a   = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+    const __m128i inv = _mm_xor_si128(a, ones); // 65535 - a
+
+    const __m128i clo = _mm_mullo_epi16(px, a), chi = _mm_mulhi_epu16(px, a);
+    const __m128i blo = _mm_mullo_epi16(bgv, inv), bhi = _mm_mulhi_epu16(bgv, inv);
+    __m128i x[2] = {
+      _mm_add_epi32(_mm_unpacklo_epi16(clo, chi), _mm_unpacklo_epi16(blo, bhi)),
+      _mm_add_epi32(_mm_unpackhi_epi16(clo, chi), _mm_unpackhi_epi16(blo, bhi)),
+    };
+    for (uint8_t h = 0; h < 2; h++) {
+      x[h] = _mm_add_epi32(x[h], round); // <= 65535^2 + 32768: still 32 bits
+      x[h] = _mm_srli_epi32(_mm_add_epi32(x[h], _mm_srli_epi32(x[h], 16)), 16);
+      x[h] = _mm_sub_epi32(x[h], _mm_set1_epi32(32768)); // signed pack
+    }
+    __m128i out = _mm_xor_si128(_mm_packs_epi32(x[0], x[1]), sign);
+    out = _mm_or_si128(_mm_andnot_si128(amask, out), opaque ? amask : _mm_and_si128(amask, px));
+    _mm_storeu_si128((__m128i *) (row + 4 * j), out);
+  }
+#endif
+
+  for (uint16_t *pixel = row + 4 * j; j < width; j++, pixel += 4) {
+    const uint32_t a = pixel[3];
+    for (uint8_t k = 0; k < 3; k++) {
+      pixel[k] = div65535(pixel[k] * a + (opaque ? bg[k] * (65535 - a) : 0));
+    }
+    pixel[3] = opaque ? 65535 : a;
+  }
+}
+
+/**
+ * @brief Composite float pixels
+ */
+static void composite_rowf(float *row, uint32_t width, enum alpha_mode mode, const uint16_t bg[3]) {
+  const uint32_t opaque = (mode == ALPHA_BACKGROUND);
+  const float bgf[3] = {bg[0] / 65535.0f, bg[1] / 65535.0f, bg[2] / 65535.0f};
+
+  for (uint32_t j = 0; j < width; j++, row += 4) {
+    const float a = row[3];
+    for (uint8_t k = 0; k < 3; k++) {
+      row[k] = row[k] * a + (opaque ? bgf[k] * (1.0f - a) : 0.0f);
+    }
+    row[3] = opaque ? 1.0f : a;
+  }
+}
+
+
+
+void composite_rows(enum alpha_mode mode, const uint16_t background[3], enum pixel_format format,
+                    void *rows, uint32_t width, uint32_t nrows, size_t stride) {
+  if (mode == ALPHA_STRAIGHT) {
+    return;
+  }
+  const uint16_t black[3] = {0, 0, 0};
+  if (background == NULL) {
+    background = black;
+  }
+  // 8-bit background, in the order of the pixels
+  const uint8_t bg8[3] = {
+    div65535(background[(format == FORMAT_BGRA8) ? 2 : 0] * 255),
+    div65535(background[1] * 255),
+    div65535(background[(format == FORMAT_BGRA8) ? 0 : 2] * 255),
+  };
+
+  for (uint32_t i = 0; i < nrows; i++) {
+    uint8_t *row = ((uint8_t *) rows) + i * stride;
+
+    switch (format) {
+    case FORMAT_RGBA8:
+    case FORMAT_BGRA8:
+      composite_row8(row, width, mode, bg8);
+      break;
+    case FORMAT_RGBA16:
+      composite_row16((uint16_t *) row, width, mode, background);
+      break;
+    case FORMAT_FLOAT32:
+      composite_rowf((float *) row, width, mode, background);
+      break;
+    case FORMAT_RGB8:
+    case FORMAT_GRAY8:
+      return; // no alpha
+    }
+  }
+}
@@ -0,0 +1,57 @@
+/**
+ * @file composite.h
+ * @brief Alpha compositing onto the background (bKGD) and premultiplied alpha
+ * @details Rows already converted (see convert_rows) are updated in place with integer
+ * arithmetic: c * a + bg * (max - a) divided by max with exact rounding, without any division.
+ * The background is in the color space of the samples (as bKGD), so compositing comes
+ * before the color correction (gamma_rows, icc_rows).
+ * Formats without alpha (RGB8, GRAY8) have dropped it already: nothing to do.
+ */
+
+#ifndef __COMPOSITE_H__
+#define __COMPOSITE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+#include "image.h"
+
+
+/**
+ * @brief What to do with the alpha channel
+ */
+enum alpha_mode {
+  /** @brief Untouched (what convert_rows gives) */
+  ALPHA_STRAIGHT = 0,
+  /** @brief Colors multiplied by alpha, alpha kept */
+  ALPHA_PREMULTIPLIED = 1,
+  /** @brief Composited onto the background, alpha set to opaque */
+  ALPHA_BACKGROUND = 2,
+};
+
+
+/**
+ * @brief Background color of an image
+ * @param[in] image
+ * @param[in] fallback 16-bit red, green, blue used if the file has no bKGD chunk
+ * @param[out] background 16-bit red, green, blue
+ */
+void get_background(const struct image *image, const uint16_t fallback[3], uint16_t background[3]);
+
+/**
+ * @brief Composite rows in place
+ * @param[in] mode
+ * @param[in] background 16-bit red, green, blue (only for ALPHA_BACKGROUND, may be NULL otherwise)
+ * @param[in] format Pixel format of the rows
+ * @param[in,out] rows Rows written by convert_rows
+ * @param[in] width Number of pixels per row
+ * @param[in] nrows Number of rows
+ * @param[in] stride Distance in bytes between two rows
+ */
+void composite_rows(enum alpha_mode mode, const uint16_t background[3], enum pixel_format format,
+                    void *rows, uint32_t width, uint32_t nrows, size_t stride);
+
+
+
+#endif // __COMPOSITE_H__
@@ -0,0 +1,677 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+/** @brief SIMD kernels on 16-bit lanes assume a little endian host (always true with SSE2) */
+#if defined(__SSE2__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define SIMD16 (1)
+#endif
+
+#include "convert.h"
+#include "expand.h"
+#include "log.h"
+
+
+/** @brief Weight of red in the luma (on 256) */
+#define LUMA_RED   (77U)
+/** @brief Weight of green in the luma (on 256) */
+#define LUMA_GREEN (150U)
+/** @brief Weight of blue in the luma (on 256) */
+#define LUMA_BLUE  (29U)
+
+/** @brief Largest pixel (FORMAT_FLOAT32) */
+#define MAX_FORMAT_SIZE (16U)
+
+
+/**
+ * @brief Convert a row of 8-bit samples
+ */
+typedef void (*row_kernel)(const uint8_t *src, uint32_t width, uint8_t *dst);
+
+/**
+ * @brief Convert a row of 16-bit samples (big endian or native) to FORMAT_RGBA16
+ */
+typedef void (*row_kernel16)(const uint8_t *src, uint32_t width, uint8_t native, uint16_t *dst);
+
+
+/**
+ * @brief Ordered dithering matrix (Bayer 4x4), thresholds 0 to 15
+ */
+static const uint8_t bayer[4][4] =
+  {{ 0,  8,  2, 10},
+   {12,  4, 14,  6},
+   { 3, 11,  1,  9},
+   {15,  7, 13,  5}};
+
+
+/**
+ * @brief Table of the 256 byte values as float in [0, 1]
+ */
+static float unit_table[256];
+
+/**
+ * @brief Once flag of unit_table (rows are converted on many threads)
+ */
+static pthread_once_t unit_table_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * @brief Make unit_table
+ */
+static void make_unit_table(void) {
+  for (uint16_t v = 0; v < 256; v++) {
+    unit_table[v] = v / 255.0f;
+  }
+  LOG_DEBUG("Float table computed");
+}
+
+
+/**
+ * @brief Luma of a color, all on 8 bits
+ */
+static inline uint8_t luma(uint8_t red, uint8_t green, uint8_t blue) {
+  return (LUMA_RED * red + LUMA_GREEN * green + LUMA_BLUE * blue + 128) >> 8;
+}
+
+/**
+ * @brief Read a 16-bit sample
+ * @param[in] src The sample
+ * @param[in] native Flag: native byte order (big endian otherwise)
+ */
+static inline uint16_t sample16(const uint8_t *src, uint8_t native) {
+  if (native) {
+    uint16_t v;
+    memcpy(&v, src, 2);
+    return v;
+  }
+  return (src[0] << 8) | src[1];
+}
+
+/**
+ * @brief Reduce one 16-bit sample to 8 bits
+ * @details v - (v + 128) / 256 maps [0, 65535] on [0, 65280] (v * 256 / 257 rounded),
+ * then adding 128 and dividing by 256 is exactly round(v / 257). A threshold t in [8, 248] dithers.
+ * No intermediate value overflows 16 bits, so SIMD lanes do the same.
+ * @param[in] v The sample
+ * @param[in] t Threshold, 128 to round
+ */
+static inline uint8_t reduce_sample(uint16_t v, uint16_t t) {
+  return (uint16_t) (v - (v >> 8) - ((v >> 7) & 1) + t) >> 8;
+}
+
+
+
+/*
+ * One byte per sample to the 8-bit formats
+ */
+
+static void ga8_to_rgba8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 2, dst += 4) {
+    dst[0] = src[0];
+    dst[1] = src[0];
+    dst[2] = src[0];
+    dst[3] = src[1];
+  }
+}
+
+static void ga8_to_rgb8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 2, dst += 3) {
+    dst[0] = src[0];
+    dst[1] = src[0];
+    dst[2] = src[0];
+  }
+}
+
+static void ga8_to_gray8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++) {
+    dst[k] = src[2 * k];
+  }
+}
+
+
+/**
+ * @brief RGB to RGBA or BGRA (swap red and blue if swap)
+ */
+static inline void rgb8_to_4(const uint8_t *src, uint32_t width, uint8_t *dst, uint8_t swap) {
+  uint32_t k = 0;
+#ifdef __SSSE3__
+  // 4 pixels per shuffle, the 16 bytes loaded must stay in the row
+  const __m128i shuffle = swap ?
+    _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+    _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+  for (; 3 * k + 16 <= 3 * width; k += 4) {
+    __m128i rgb = _mm_loadu_si128((const __m128i *) (src + 3 * k));
+    __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+    _mm_storeu_si128((__m128i *) (dst + 4 * k), rgba);
+  }
+#elif defined(__SSE2__)
+  // the pixel p of the 16 bytes loaded moves p bytes up to its 32-bit lane
+  const __m128i lane0 = _mm_setr_epi32(0x00ffffff, 0, 0, 0);
+  const __m128i lane1 = _mm_setr_epi32(0, 0x00ffffff, 0, 0);
+  const __m128i lane2 = _mm_setr_epi32(0, 0, 0x00ffffff, 0);
+  const __m128i lane3 = _mm_setr_epi32(0, 0, 0, 0x00ffffff);
+  const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+  const __m128i ga    = _mm_set1_epi32((int) 0xff00ff00);
+  const __m128i lo    = _mm_set1_epi32(0x000000ff);
+  const __m128i hi    = _mm_set1_epi32(0x00ff0000);
+  for (; 3 * k + 16 <= 3 * width; k += 4) {
+    __m128i rgb  = _mm_loadu_si128((const __m128i *) (src + 3 * k));
+    __m128i rgba = _mm_or_si128(_mm_or_si128(_mm_and_si128(rgb, lane0),
+                                             _mm_and_si128(_mm_slli_si128(rgb, 1), lane1)),
+                                _mm_or_si128(_mm_and_si128(_mm_slli_si128(rgb, 2), lane2),
+                                             _mm_and_si128(_mm_slli_si128(rgb, 3), lane3)));
+    rgba = _mm_or_si128(rgba, alpha);
+    if (swap) {
+      rgba = _mm_or_si128(_mm_and_si128(rgba, ga),
+                          _mm_or_si128(_mm_and_si128(_mm_srli_epi32(rgba, 16), lo),
+                                       _mm_and_si128(_mm_slli_epi32(rgba, 16), hi)));
+    }
+    _mm_storeu_si128((__m128i *) (dst + 4 * k), rgba);
+  }
+#endif
+  const uint8_t r = swap ? 2 : 0;
+  for (; k < width; k++) {
+    dst[4 * k + r]     = src[3 * k];
+    dst[4 * k + 1]     = src[3 * k + 1];
+    dst[4 * k + 2 - r] = src[3 * k + 2];
+    dst[4 * k + 3]     = 0xff;
+  }
+}
+
+static void rgb8_to_rgba8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  rgb8_to_4(src, width, dst, 0);
+}
+
+static void rgb8_to_bgra8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  rgb8_to_4(src, width, dst, 1);
+}
+
+static void rgb8_to_rgb8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  memcpy(dst, src, 3 * width);
+}
+
+static void rgb8_to_gray8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 3) {
+    dst[k] = luma(src[0], src[1], src[2]);
+  }
+}
+
+static void rgba8_to_rgba8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  memcpy(dst, src, 4 * width);
+}
+
+static void rgba8_to_bgra8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  uint32_t k = 0;
+#ifdef __SSE2__
+  // swap the bytes 0 and 2 of each 32-bit lane
+  const __m128i ga = _mm_set1_epi32((int) 0xff00ff00);
+  const __m128i lo = _mm_set1_epi32(0x000000ff);
+  const __m128i hi = _mm_set1_epi32(0x00ff0000);
+  for (; k + 4 <= width; k += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + 4 * k));
+    __m128i y = _mm_or_si128(_mm_and_si128(x, ga),
+                             _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 16), lo),
+                                          _mm_and_si128(_mm_slli_epi32(x, 16), hi)));
+    _mm_storeu_si128((__m128i *) (dst + 4 * k), y);
+  }
+#endif
+  for (; k < width; k++) {
+    dst[4 * k]     = src[4 * k + 2];
+    dst[4 * k + 1] = src[4 * k + 1];
+    dst[4 * k + 2] = src[4 * k];
+    dst[4 * k + 3] = src[4 * k + 3];
+  }
+}
+
+static void rgba8_to_rgb8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 4, dst += 3) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+  }
+}
+
+static void rgba8_to_gray8(const uint8_t *src, uint32_t width, uint8_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 4) {
+    dst[k] = luma(src[0], src[1], src[2]);
+  }
+}
+
+/**
+ * @brief Kernels for 2, 3 and 4 samples of 8 bits to each 8-bit format
+ * @details kernels8[sample - 2][format], GA to BGRA is the same as to RGBA
+ */
+static const row_kernel kernels8[3][FORMAT_GRAY8 + 1] = {
+  {ga8_to_rgba8,   ga8_to_rgba8,   ga8_to_rgb8,   NULL, ga8_to_gray8},
+  {rgb8_to_rgba8,  rgb8_to_bgra8,  rgb8_to_rgb8,  NULL, rgb8_to_gray8},
+  {rgba8_to_rgba8, rgba8_to_bgra8, rgba8_to_rgb8, NULL, rgba8_to_gray8},
+};
+
+
+
+/*
+ * 16-bit samples
+ */
+
+static void g16_to_rgba16(const uint8_t *src, uint32_t width, uint8_t native, uint16_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 2, dst += 4) {
+    uint16_t gray = sample16(src, native);
+    dst[0] = gray;
+    dst[1] = gray;
+    dst[2] = gray;
+    dst[3] = 0xffff;
+  }
+}
+
+static void ga16_to_rgba16(const uint8_t *src, uint32_t width, uint8_t native, uint16_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 4, dst += 4) {
+    uint16_t gray = sample16(src, native);
+    dst[0] = gray;
+    dst[1] = gray;
+    dst[2] = gray;
+    dst[3] = sample16(src + 2, native);
+  }
+}
+
+static void rgb16_to_rgba16(const uint8_t *src, uint32_t width, uint8_t native, uint16_t *dst) {
+  for (uint32_t k = 0; k < width; k++, src += 6, dst += 4) {
+    dst[0] = sample16(src, native);
+    dst[1] = sample16(src + 2, native);
+    dst[2] = sample16(src + 4, native);
+    dst[3] = 0xffff;
+  }
+}
+
+static void rgba16_to_rgba16(const uint8_t *src, uint32_t width, uint8_t native, uint16_t *dst) {
+  memcpy(dst, src, 8 * width);
+  if (!native) {
+    samples_to_native((uint8_t *) dst, 4 * width);
+  }
+}
+
+/**
+ * @brief Kernels for 1 to 4 samples of 16 bits, kernels16[sample - 1]
+ */
+static const row_kernel16 kernels16[4] = {
+  g16_to_rgba16, ga16_to_rgba16, rgb16_to_rgba16, rgba16_to_rgba16,
+};
+
+
+
+/*
+ * Wide formats
+ */
+
+static void rgba8_to_rgba16(const uint8_t *src, uint32_t width, uint16_t *dst) {
+  uint32_t k = 0;
+  const uint32_t count = 4 * width;
+#ifdef SIMD16
+  // v * 257 is the byte v twice
+  for (; k + 16 <= count; k += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + k));
+    _mm_storeu_si128((__m128i *) (dst + k),     _mm_unpacklo_epi8(x, x));
+    _mm_storeu_si128((__m128i *) (dst + k + 8), _mm_unpackhi_epi8(x, x));
+  }
+#endif
+  for (; k < count; k++) {
+    dst[k] = src[k] * 257;
+  }
+}
+
+static void rgba8_to_float(const uint8_t *src, uint32_t width, float *dst) {
+  for (uint32_t k = 0; k < 4 * width; k++) {
+    dst[k] = unit_table[src[k]];
+  }
+}
+
+static void rgba16_to_float(const uint16_t *src, uint32_t width, float *dst) {
+  const float scale = 1.0f / 65535.0f;
+  for (uint32_t k = 0; k < 4 * width; k++) {
+    dst[k] = src[k] * scale;
+  }
+}
+
+
+
+/*
+ * Palette and grayscale lookup
+ */
+
+/**
+ * @brief Write one 8-bit color in the format
+ */
+static void put_pixel(enum pixel_format format, uint8_t red, uint8_t green, uint8_t blue, uint8_t *dst) {
+  const uint8_t rgba[4] = {red, green, blue, 0xff};
+
+  switch (format) {
+  case FORMAT_RGBA8:
+    memcpy(dst, rgba, 4);
+    break;
+  case FORMAT_BGRA8:
+    rgba8_to_bgra8(rgba, 1, dst);
+    break;
+  case FORMAT_RGB8:
+    memcpy(dst, rgba, 3);
+    break;
+  case FORMAT_RGBA16: {
+    uint16_t wide[4];
+    rgba8_to_rgba16(rgba, 1, wide);
+    memcpy(dst, wide, sizeof(wide));
+    break;
+  }
+  case FORMAT_GRAY8:
+    dst[0] = luma(red, green, blue);
+    break;
+  case FORMAT_FLOAT32: {
+    float unit[4];
+    rgba8_to_float(rgba, 1, unit);
+    memcpy(dst, unit, sizeof(unit));
+    break;
+  }
+  }
+}
+
+/**
+ * @brief Fill the table of the 256 entries in the format
+ * @details From the palette or the gray ramp of the depth (entry k is the sample k)
+ */
+static void make_lookup_table(const uint8_t *palette, uint8_t depth, enum pixel_format format, uint8_t *table) {
+  const uint8_t size = format_size(format);
+  const uint16_t max = (1 << depth) - 1;
+
+  for (uint16_t k = 0; k < 256; k++) {
+    if (palette != NULL) {
+      put_pixel(format, palette[3 * k], palette[3 * k + 1], palette[3 * k + 2], table + k * size);
+    } else {
+      uint8_t gray = (k <= max) ? (k * 255 / max) : 0;
+      put_pixel(format, gray, gray, gray, table + k * size);
+    }
+  }
+}
+
+/**
+ * @brief Replace each index by its entry in the table
+ */
+static void lookup_row(const uint8_t *src, uint32_t width, const uint8_t *table, uint8_t size, uint8_t *dst) {
+  switch (size) {
+  case 1:
+    for (uint32_t k = 0; k < width; k++) {
+      dst[k] = table[src[k]];
+    }
+    break;
+  case 3:
+    for (uint32_t k = 0; k < width; k++, dst += 3) {
+      memcpy(dst, table + 3 * src[k], 3);
+    }
+    break;
+  case 4:
+    for (uint32_t k = 0; k < width; k++, dst += 4) {
+      memcpy(dst, table + 4 * src[k], 4);
+    }
+    break;
+  case 8:
+    for (uint32_t k = 0; k < width; k++, dst += 8) {
+      memcpy(dst, table + 8 * src[k], 8);
+    }
+    break;
+  case 16:
+    for (uint32_t k = 0; k < width; k++, dst += 16) {
+      memcpy(dst, table + 16 * src[k], 16);
+    }
+    break;
+  }
+}
+
+
+
+/**
+ * @brief Everything chosen once for all the rows
+ */
+struct converter {
+  /** @brief Number of pixel per row */
+  uint32_t width;
+  /** @brief Samples per pixel of the image */
+  uint8_t sample;
+  /** @brief Depth of the image */
+  uint8_t depth;
+  /** @brief Flag: 16-bit samples of the image in the native byte order */
+  uint8_t native;
+  /** @brief Reduction of 16-bit samples to the 8-bit formats */
+  enum reduce_mode mode;
+  /** @brief Target format */
+  enum pixel_format format;
+  /** @brief Flag: the target has 8-bit samples (RGBA8, BGRA8, RGB8, GRAY8) */
+  uint8_t narrow;
+  /** @brief Flag: one sample per pixel translated through table */
+  uint8_t lookup;
+  /** @brief Kernel from 8-bit samples (to format if narrow, to RGBA8 otherwise) */
+  row_kernel kernel;
+  /** @brief Palette or gray ramp in the target format */
+  uint8_t table[256 * MAX_FORMAT_SIZE];
+  /** @brief Row with one byte per sample (expanded or reduced), 4 * width bytes */
+  uint8_t *bytes;
+  /** @brief Row in RGBA8, 4 * width bytes */
+  uint8_t *rgba;
+  /** @brief Row in RGBA16, 4 * width samples */
+  uint16_t *wide;
+};
+
+
+/**
+ * @brief Convert one row of the image
+ * @param[in] conv
+ * @param[in] src The row in the image
+ * @param[in] y Index of the row in the image
+ * @param[out] dst The row in the target format
+ */
+static void convert_row(const struct converter *conv, const uint8_t *src, uint32_t y, uint8_t *dst) {
+  const uint8_t *row = src;
+
+  // 16-bit samples to a wide format, straight to RGBA16
+  if ((conv->depth == 16) && !conv->narrow) {
+    uint16_t *wide = (conv->format == FORMAT_RGBA16) ? (uint16_t *) dst : conv->wide;
+    kernels16[conv->sample - 1](src, conv->width, conv->native, wide);
+    if (conv->format == FORMAT_FLOAT32) {
+      rgba16_to_float(wide, conv->width, (float *) dst);
+    }
+    return;
+  }
+
+  // one byte per sample
+  if (conv->depth < 8) {
+    expand_row(src, conv->width, conv->depth, EXPAND_INDEX, conv->bytes);
+    row = conv->bytes;
+  } else if (conv->depth == 16) {
+    reduce_16_to_8(src, conv->width * conv->sample, conv->sample, conv->native, conv->mode, y, conv->bytes);
+    row = conv->bytes;
+  }
+
+  if (conv->lookup) {
+    lookup_row(row, conv->width, conv->table, format_size(conv->format), dst);
+  } else if (conv->narrow) {
+    conv->kernel(row, conv->width, dst);
+  } else { // 8-bit samples to a wide format, through RGBA8
+    conv->kernel(row, conv->width, conv->rgba);
+    if (conv->format == FORMAT_RGBA16) {
+      rgba8_to_rgba16(conv->rgba, conv->width, (uint16_t *) dst);
+    } else {
+      rgba8_to_float(conv->rgba, conv->width, (float *) dst);
+    }
+  }
+}
+
+
+
+uint8_t format_size(enum pixel_format format) {
+  switch (format) {
+  case FORMAT_RGBA8:
+  case FORMAT_BGRA8:
+    return 4;
+  case FORMAT_RGB8:
+    return 3;
+  case FORMAT_RGBA16:
+    return 8;
+  case FORMAT_GRAY8:
+    return 1;
+  case FORMAT_FLOAT32:
+    return 16;
+  }
+  LOG_FATAL("Unknown pixel format %d", format);
+  exit(1);
+}
+
+
+/**
+ * @brief Convert consecutive rows of the image
+ * @param[in] image
+ * @param[in] row0 First row to convert
+ * @param[in] nrows Number of rows
+ * @param[in] format Pixel format of dst
+ * @param[in] mode Reduction of 16-bit samples to the 8-bit formats
+ * @param[out] dst Rows in the target format
+ * @param[in] stride Distance in bytes between two rows of dst
+ */
+static void convert_band(const struct image *image, uint32_t row0, uint32_t nrows,
+                         enum pixel_format format, enum reduce_mode mode, void *dst, size_t stride) {
+  assert(row0 + nrows <= image->height);
+  assert(stride >= (size_t) image->width * format_size(format));
+
+  if ((nrows == 0) || (image->width == 0)) {
+    return;
+  }
+  pthread_once(&unit_table_once, make_unit_table);
+
+  // the table is the largest part, keep it off the stack
+  struct converter *conv = malloc(sizeof(struct converter) + 16 * (size_t) image->width);
+  if (conv == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to convert rows", sizeof(struct converter) + 16 * (size_t) image->width);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc converter %p", conv);
+
+  conv->width  = image->width;
+  conv->sample = image->sample;
+  conv->depth  = image->depth;
+  conv->native = image->native;
+  conv->mode   = mode;
+  conv->format = format;
+  conv->narrow = (format != FORMAT_RGBA16) && (format != FORMAT_FLOAT32);
+  conv->lookup = (image->sample == 1) && ((image->depth <= 8) || conv->narrow);
+  conv->kernel = NULL;
+  conv->bytes  = (uint8_t *) (conv + 1);
+  conv->rgba   = conv->bytes + 4 * (size_t) image->width;
+  conv->wide   = (uint16_t *) (conv->rgba + 4 * (size_t) image->width);
+
+  if (conv->lookup) {
+    // 16-bit gray is reduced to 8 bits before the lookup
+    make_lookup_table(image->palette, (image->depth == 16) ? 8 : image->depth, format, conv->table);
+  } else if (image->sample > 1) {
+    conv->kernel = kernels8[image->sample - 2][conv->narrow ? format : FORMAT_RGBA8];
+  }
+
+  const uint32_t lsize = line_size(image);
+  const uint8_t *src   = ((const uint8_t *) image->data) + (size_t) row0 * lsize;
+  uint8_t *out         = dst;
+
+  // gray 8 to gray 8 is a plain copy
+  const uint8_t copy = (image->sample == 1) && (image->depth == 8) && (image->palette == NULL) &&
+                       (format == FORMAT_GRAY8);
+
+  for (uint32_t i = 0; i < nrows; i++, src += lsize, out += stride) {
+    if (copy) {
+      memcpy(out, src, image->width);
+    } else {
+      convert_row(conv, src, row0 + i, out);
+    }
+  }
+
+  LOG_ALLOC("Free converter %p", conv);
+  free(conv);
+}
+
+
+void convert_rows(const struct image *image, uint32_t row0, uint32_t nrows,
+                  enum pixel_format format, void *dst, size_t stride) {
+  convert_band(image, row0, nrows, format, REDUCE_ROUND, dst, stride);
+}
+
+
+void convert_rows_dithered(const struct image *image, uint32_t row0, uint32_t nrows,
+                           enum pixel_format format, void *dst, size_t stride) {
+  convert_band(image, row0, nrows, format, REDUCE_DITHER, dst, stride);
+}
+
+
+
+void samples_to_native(uint8_t *samples, uint32_t count) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  (void) samples;
+  (void) count;
+#else
+  uint32_t k = 0;
+#ifdef SIMD16
+  for (; k + 8 <= count; k += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (samples + 2 * k));
+    x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+    _mm_storeu_si128((__m128i *) (samples + 2 * k), x);
+  }
+#endif
+  for (; k < count; k++) {
+    uint16_t v = (samples[2 * k] << 8) | samples[2 * k + 1];
+    memcpy(samples + 2 * k, &v, 2);
+  }
+#endif
+}
+
+
+void reduce_16_to_8(const uint8_t *src, uint32_t count, uint8_t sample, uint8_t native,
+                    enum reduce_mode mode, uint32_t y, uint8_t *dst) {
+  assert((1 <= sample) && (sample <= 4));
+
+  // thresholds of 16 pixels: a whole number of SIMD vectors and of dithering patterns
+  const uint32_t period = 16 * sample;
+  uint16_t threshold[16 * 4];
+  for (uint32_t k = 0; k < period; k++) {
+    threshold[k] = (mode == REDUCE_DITHER) ? bayer[y & 3][(k / sample) & 3] * 16 + 8 : 128;
+  }
+
+  uint32_t k = 0;
+#ifdef SIMD16
+  const __m128i one = _mm_set1_epi16(1);
+  uint32_t t = 0;
+  for (; k + 16 <= count; k += 16) {
+    __m128i v[2];
+    v[0] = _mm_loadu_si128((const __m128i *) (src + 2 * k));
+    v[1] = _mm_loadu_si128((const __m128i *) (src + 2 * k + 16));
+
+    for (uint8_t h = 0; h < 2; h++) {
+      if (!native) {
+        v[h] = _mm_or_si128(_mm_slli_epi16(v[h], 8), _mm_srli_epi16(v[h], 8));
+      }
+      // same as reduce_sample
+      __m128i round = _mm_add_epi16(_mm_srli_epi16(v[h], 8), _mm_and_si128(_mm_srli_epi16(v[h], 7), one));
+      __m128i x = _mm_add_epi16(_mm_sub_epi16(v[h], round),
+                                _mm_loadu_si128((const __m128i *) (threshold + t + 8 * h)));
+      v[h] = _mm_srli_epi16(x, 8);
+    }
+    _mm_storeu_si128((__m128i *) (dst + k), _mm_packus_epi16(v[0], v[1]));
+
+    t += 16;
+    if (t == period) {
+      t = 0;
+    }
+  }
+#endif
+  for (; k < count; k++) {
+    dst[k] = reduce_sample(sample16(src + 2 * k, native), threshold[k % period]);
+  }
+}
@@ -0,0 +1,98 @@
+/**
+ * @file convert.h
+ * @brief Convert rows of an image to a fixed pixel format
+ * @details The kernel is chosen once per call from the sample count, the depth and the target format,
+ * so the pixel loops hold no switch and no assert (unlike get_color).
+ * Palette and grayscale (depth <= 8) go through a 256 entries table already in the target format,
+ * 16-bit samples are reduced to 8 bits with reduce_16_to_8 for the 8-bit formats.
+ * Alpha is kept as it (straight alpha), images without alpha channel are opaque.
+ */
+
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+
+/**
+ * @brief Output pixel formats
+ */
+enum pixel_format {
+  /** @brief 4 bytes: red, green, blue, alpha */
+  FORMAT_RGBA8 = 0,
+  /** @brief 4 bytes: blue, green, red, alpha (SDL ARGB8888 on little endian) */
+  FORMAT_BGRA8 = 1,
+  /** @brief 3 bytes: red, green, blue (alpha dropped) */
+  FORMAT_RGB8 = 2,
+  /** @brief 4 uint16_t in the native byte order: red, green, blue, alpha */
+  FORMAT_RGBA16 = 3,
+  /** @brief 1 byte: luma 0.299 R + 0.587 G + 0.114 B (alpha dropped) */
+  FORMAT_GRAY8 = 4,
+  /** @brief 4 float in [0, 1]: red, green, blue, alpha */
+  FORMAT_FLOAT32 = 5,
+};
+
+/**
+ * @brief How 16-bit samples are reduced to 8 bits
+ */
+enum reduce_mode {
+  /** @brief Nearest value, round(v / 257) */
+  REDUCE_ROUND = 0,
+  /** @brief Ordered dithering with a 4x4 Bayer matrix (no banding on smooth gradients) */
+  REDUCE_DITHER = 1,
+};
+
+
+/**
+ * @brief Size of a pixel
+ * @param[in] format
+ * @return Number of bytes of one pixel in this format
+ */
+uint8_t format_size(enum pixel_format format);
+
+/**
+ * @brief Convert consecutive rows of the image
+ * @param[in] image Any image returned by get_image (or a crop, a downscale, an Adam7 pass)
+ * @param[in] row0 First row to convert
+ * @param[in] nrows Number of rows (row0 + nrows <= image height)
+ * @param[in] format Pixel format of dst
+ * @param[out] dst Area of nrows * stride bytes, the row row0 + k starts at dst + k * stride
+ * @param[in] stride Distance in bytes between two rows of dst (>= width * format_size(format))
+ */
+void convert_rows(const struct image *image, uint32_t row0, uint32_t nrows,
+                  enum pixel_format format, void *dst, size_t stride);
+
+/**
+ * @brief Same as convert_rows, but 16-bit samples are dithered to the 8-bit formats
+ * @details The dithering pattern is anchored on the first column and on the row index in the image
+ */
+void convert_rows_dithered(const struct image *image, uint32_t row0, uint32_t nrows,
+                           enum pixel_format format, void *dst, size_t stride);
+
+/**
+ * @brief Put big endian 16-bit samples in the native byte order, in place
+ * @details Nothing to do on big endian hosts
+ * @param[in,out] samples Area of 2 * count bytes
+ * @param[in] count Number of samples
+ */
+void samples_to_native(uint8_t *samples, uint32_t count);
+
+/**
+ * @brief Reduce 16-bit samples to 8 bits
+ * @param[in] src Area of 2 * count bytes
+ * @param[in] count Number of samples
+ * @param[in] sample Samples per pixel (the dithering threshold is the same for the samples of a pixel)
+ * @param[in] native Flag: src is in the native byte order (big endian otherwise)
+ * @param[in] mode Rounding or dithering
+ * @param[in] y Row of the samples in the image (only for dithering)
+ * @param[out] dst Area of count bytes
+ */
+void reduce_16_to_8(const uint8_t *src, uint32_t count, uint8_t sample, uint8_t native,
+                    enum reduce_mode mode, uint32_t y, uint8_t *dst);
+
+
+
+#endif // __CONVERT_H__
@@ -1,5 +1,7 @@
 
 
+#include <pthread.h>
+
 #include "crc.h"
 
 
@@ -9,9 +11,9 @@
 static unsigned long crc_table[256];
 
 /**
- * @brief Flag: has the table been computed? Initially false
+ * @brief Once flag of crc_table
  */
-static int crc_table_computed = 0;
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
 
 
 /**
@@ -30,7 +32,6 @@ static void make_crc_table(void) {
     }
     crc_table[n] = c;
   }
-  crc_table_computed = 1;
 }
 
 /**
@@ -42,8 +43,7 @@ static void make_crc_table(void) {
 static unsigned long update_crc(unsigned long crc, const unsigned char *buf, int len) {
   unsigned long c = crc;
   int n;
-  if (!crc_table_computed)
-    make_crc_table();
+  pthread_once(&crc_table_once, make_crc_table);
   for (n = 0; n < len; n++) {
     c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
   }
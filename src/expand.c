@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "expand.h"
+#include "log.h"
+
+
+/** @brief Number of supported sub-byte depth (1, 2 and 4) */
+#define NB_DEPTH (3)
+
+/**
+ * @brief Table of expanded bytes for each mode, depth and packed byte
+ * @details expand_table[mode][d][byte] holds the 8 / depth samples of byte (d = 0, 1, 2 for depth 1, 2, 4)
+ */
+static uint8_t expand_table[2][NB_DEPTH][256][8];
+
+/**
+ * @brief Once flag of expand_table
+ */
+static pthread_once_t expand_table_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * @brief Index of the depth in expand_table
+ */
+static uint8_t depth_index(uint8_t depth) {
+  switch (depth) {
+  case 1:
+    return 0;
+  case 2:
+    return 1;
+  case 4:
+    return 2;
+  }
+  assert(0);
+  return 0;
+}
+
+/**
+ * @brief Make the tables for every mode and depth
+ */
+static void make_expand_table(void) {
+  const uint8_t depths[NB_DEPTH] = {1, 2, 4};
+
+  for (uint8_t d = 0; d < NB_DEPTH; d++) {
+    const uint8_t depth = depths[d];
+    const uint8_t mask  = (1 << depth) - 1;
+    const uint8_t scale = 255 / mask; // exact: 255, 85, 17
+
+    for (uint16_t byte = 0; byte < 256; byte++) {
+      for (uint8_t k = 0; k < (8 / depth); k++) {
+        uint8_t sample = (byte >> (8 - depth * (k + 1))) & mask;
+        expand_table[EXPAND_INDEX][d][byte][k] = sample;
+        expand_table[EXPAND_GRAY][d][byte][k]  = sample * scale;
+      }
+    }
+  }
+  LOG_DEBUG("Expand tables computed");
+}
+
+
+
+void expand_row(const uint8_t *src, uint32_t count, uint8_t depth, enum expand_mode mode, uint8_t *dst) {
+  pthread_once(&expand_table_once, make_expand_table);
+
+  const uint8_t (*table)[8] = expand_table[mode][depth_index(depth)];
+  const uint8_t per_byte = 8 / depth;
+  const uint32_t full = count / per_byte; // bytes expanded as a whole
+
+  switch (depth) {
+  case 1:
+    for (uint32_t k = 0; k < full; k++, dst += 8) {
+      memcpy(dst, table[src[k]], 8);
+    }
+    break;
+  case 2:
+    for (uint32_t k = 0; k < full; k++, dst += 4) {
+      memcpy(dst, table[src[k]], 4);
+    }
+    break;
+  case 4:
+    for (uint32_t k = 0; k < full; k++, dst += 2) {
+      memcpy(dst, table[src[k]], 2);
+    }
+    break;
+  }
+
+  // last byte partially used
+  uint8_t remain = count % per_byte;
+  if (remain > 0) {
+    memcpy(dst, table[src[full]], remain);
+  }
+}
+
+
+void expand_image_row(const struct image *image, uint32_t i, uint8_t *dst) {
+  assert(image->sample == 1);
+  assert(i < image->height);
+
+  const uint8_t *src = ((const uint8_t *) image->data) + i * line_size(image);
+
+  if (image->depth == 8) {
+    memcpy(dst, src, image->width);
+    return;
+  }
+  enum expand_mode mode = (image->palette != NULL) ? EXPAND_INDEX : EXPAND_GRAY;
+  expand_row(src, image->width, image->depth, mode, dst);
+}
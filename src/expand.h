@@ -0,0 +1,48 @@
+/**
+ * @file expand.h
+ * @brief Expand packed samples (depth 1, 2, 4) to one byte per sample
+ * @details Sub-byte scanlines are expanded a whole byte at a time through lookup tables
+ * (one packed byte gives 8, 4 or 2 output bytes) instead of extracting each sample with shifts.
+ */
+
+#ifndef __EXPAND_H__
+#define __EXPAND_H__
+
+#include <stdint.h>
+
+#include "image.h"
+
+
+/**
+ * @brief How to expand a sample to a byte
+ */
+enum expand_mode {
+  /** @brief Keep the sample value (palette index) */
+  EXPAND_INDEX = 0,
+  /** @brief Scale the sample to [0, 255] (grayscale), 1 -> 255, 2 -> 85, 4 -> 17 */
+  EXPAND_GRAY = 1,
+};
+
+/**
+ * @brief Expand a packed scanline to one byte per sample
+ * @param[in] src Packed samples (most significant bits first)
+ * @param[in] count Number of samples to expand
+ * @param[in] depth Bits per sample (1, 2 or 4)
+ * @param[in] mode Keep the raw value or scale it to 8 bits
+ * @param[out] dst Area of at least count bytes
+ */
+void expand_row(const uint8_t *src, uint32_t count, uint8_t depth, enum expand_mode mode, uint8_t *dst);
+
+/**
+ * @brief Expand the line i of a grayscale or palette image to one byte per pixel
+ * @details Grayscale is scaled to [0, 255], palette index are kept as it.
+ * Depth 8 lines are copied as it.
+ * @param[in] image Image with depth 1, 2, 4 or 8 and one sample per pixel
+ * @param[in] i Line to expand
+ * @param[out] dst Area of at least image->width bytes
+ */
+void expand_image_row(const struct image *image, uint32_t i, uint8_t *dst);
+
+
+
+#endif // __EXPAND_H__
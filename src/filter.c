@@ -1,4 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "filter.h"
 #include "log.h"
@@ -99,6 +105,30 @@ static void paeth_unfilter(uint32_t size, uint8_t *raw, const uint8_t *prior, ui
 
 
 
+void unfilter_line(uint8_t type, uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp) {
+
+  switch (type) {
+  case 0:
+    break;
+  case 1:
+    sub_unfilter(size, raw, bpp);
+    break;
+  case 2:
+    up_unfilter(size, raw, prior, bpp);
+    break;
+  case 3:
+    average_unfilter(size, raw, prior, bpp);
+    break;
+  case 4:
+    paeth_unfilter(size, raw, prior, bpp);
+    break;
+  default:
+    LOG_FATAL("Unknown filter-byte %d", type);
+    exit(1);
+  }
+}
+
+
 void unfilter(uint8_t *data, uint32_t length, uint32_t height, uint8_t bpp) {
   LOG_INFO("Begin %d line", height);
   
@@ -109,27 +139,272 @@ void unfilter(uint8_t *data, uint32_t length, uint32_t height, uint8_t bpp) {
   for (uint32_t i = 0; i < height; i++) {
   
     LOG_TRACE("line %-3d   filter %d", i, raw[-1]);
-    switch (raw[-1]) {
-    case 0:
-      break;
-    case 1:
-      sub_unfilter(size, raw, bpp);
-      break;
-    case 2:
-      up_unfilter(size, raw, prior, bpp);
-      break;
-    case 3:
-      average_unfilter(size, raw, prior, bpp);
-      break;
-    case 4:
-      paeth_unfilter(size, raw, prior, bpp);
-      break;
-    default:
-      LOG_FATAL("Unknown filter-byte %d", raw[-1]);
-      exit(1);
-    }
+    unfilter_line(raw[-1], raw, prior, size, bpp);
     prior = raw;
     raw  += length;
   }
   LOG_INFO("Done");
 }
+
+
+
+/*
+ * Forward filters
+ */
+
+/**
+ * @brief Filter bytes [from, to) of a row with every type asked, and sum them
+ * @details Bytes before bpp have no left neighbour, prior NULL is a row of 0 (as unfilter_line).
+ * The cost of a type is the sum of its filtered bytes as absolute signed values.
+ * @param[in] raw
+ * @param[in] prior Previous row or NULL
+ * @param[in] from First byte
+ * @param[in] to Last byte + 1
+ * @param[in] bpp
+ * @param[out] out Filtered row of each type, NULL for the types not asked
+ * @param[in,out] cost Sum of each type asked, or NULL
+ */
+static void filter_scalar(const uint8_t *raw, const uint8_t *prior, uint32_t from, uint32_t to, uint8_t bpp,
+                          uint8_t *const out[NB_FILTER], uint64_t *cost) {
+  for (uint32_t i = from; i < to; i++) {
+    const uint8_t a = (i >= bpp) ? raw[i - bpp] : 0;
+    const uint8_t b = (prior != NULL) ? prior[i] : 0;
+    const uint8_t c = ((prior != NULL) && (i >= bpp)) ? prior[i - bpp] : 0;
+    const uint8_t v[NB_FILTER] = {raw[i], raw[i] - a, raw[i] - b, raw[i] - (a + b) / 2, raw[i] - paeth_predictor(a, b, c)};
+
+    for (uint8_t t = 0; t < NB_FILTER; t++) {
+      if (out[t] != NULL) {
+        out[t][i] = v[t];
+        if (cost != NULL) {
+          cost[t] += ABS((int8_t) v[t], 0);
+        }
+      }
+    }
+  }
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Sum of 16 bytes as absolute signed values
+ */
+static inline __m128i sum_abs(__m128i acc, __m128i v) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i abs = _mm_min_epu8(v, _mm_sub_epi8(zero, v)); // |-128| is 128 either way
+  return _mm_add_epi64(acc, _mm_sad_epu8(abs, zero));
+}
+
+/**
+ * @brief Paeth predictor of 8 pixels bytes on 16-bit lanes
+ */
+static inline __m128i paeth_epi16(__m128i a, __m128i b, __m128i c) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i sa = _mm_sub_epi16(b, c); // p - a
+  const __m128i sb = _mm_sub_epi16(a, c); // p - b
+  const __m128i pa = _mm_max_epi16(sa, _mm_sub_epi16(zero, sa));
+  const __m128i pb = _mm_max_epi16(sb, _mm_sub_epi16(zero, sb));
+  const __m128i sc = _mm_add_epi16(sa, sb); // p - c
+  const __m128i pc = _mm_max_epi16(sc, _mm_sub_epi16(zero, sc));
+
+  // a if pa <= pb and pa <= pc, else b if pb <= pc, else c
+  const __m128i use_a = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)),
+                                         _mm_set1_epi16(-1));
+  const __m128i use_b = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+  const __m128i bc = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+  return _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, bc));
+}
+#endif
+
+/**
+ * @brief Filter a row with every type asked (see filter_scalar), 16 bytes at a time with SSE2
+ */
+static void filter_types(const uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp,
+                         uint8_t *const out[NB_FILTER], uint64_t *cost) {
+  const uint32_t first = (bpp < size) ? bpp : size;
+  filter_scalar(raw, prior, 0, first, bpp, out, cost);
+  uint32_t i = first;
+
+#ifdef __SSE2__
+  // left neighbours are raw bytes, not filtered ones: no dependency from one byte to the next
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one  = _mm_set1_epi8(1);
+  __m128i acc[NB_FILTER];
+  for (uint8_t t = 0; t < NB_FILTER; t++) {
+    acc[t] = zero;
+  }
+  for (; i + 16 <= size; i += 16) {
+    const __m128i x = _mm_loadu_si128((const __m128i *) (raw + i));
+    const __m128i a = _mm_loadu_si128((const __m128i *) (raw + i - bpp));
+    const __m128i b = (prior != NULL) ? _mm_loadu_si128((const __m128i *) (prior + i)) : zero;
+    const __m128i c = (prior != NULL) ? _mm_loadu_si128((const __m128i *) (prior + i - bpp)) : zero;
+
+    __m128i v[NB_FILTER];
+    v[0] = x;
+    v[1] = _mm_sub_epi8(x, a);
+    v[2] = _mm_sub_epi8(x, b);
+    // floor((a + b) / 2): pavgb rounds up
+    v[3] = _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)));
+    if (out[4] != NULL) {
+      const __m128i lo = paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+      const __m128i hi = paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+      v[4] = _mm_sub_epi8(x, _mm_packus_epi16(lo, hi));
+    }
+
+    for (uint8_t t = 0; t < NB_FILTER; t++) {
+      if (out[t] != NULL) {
+        _mm_storeu_si128((__m128i *) (out[t] + i), v[t]);
+        if (cost != NULL) {
+          acc[t] = sum_abs(acc[t], v[t]);
+        }
+      }
+    }
+  }
+  if (cost != NULL) {
+    for (uint8_t t = 0; t < NB_FILTER; t++) {
+      cost[t] += (uint64_t) _mm_cvtsi128_si32(acc[t]) + (uint64_t) _mm_cvtsi128_si32(_mm_srli_si128(acc[t], 8));
+    }
+  }
+#endif
+
+  filter_scalar(raw, prior, i, size, bpp, out, cost);
+}
+
+
+
+void filter_line(uint8_t type, const uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp, uint8_t *out) {
+  if (type >= NB_FILTER) {
+    LOG_FATAL("Unknown filter-byte %d", type);
+    exit(1);
+  }
+  uint8_t *row[NB_FILTER] = {NULL, NULL, NULL, NULL, NULL};
+  row[type] = out;
+  filter_types(raw, prior, size, bpp, row, NULL);
+}
+
+
+void filter_all(const uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp,
+                uint8_t *candidate, uint64_t cost[NB_FILTER]) {
+  uint8_t *row[NB_FILTER];
+  for (uint8_t t = 0; t < NB_FILTER; t++) {
+    row[t] = candidate + (size_t) t * size;
+    cost[t] = 0;
+  }
+  filter_types(raw, prior, size, bpp, row, cost);
+}
+
+
+
+void row_filter_init(struct row_filter *filter, enum filter_strategy strategy, uint8_t type, int level,
+                     uint32_t size, uint8_t bpp) {
+  filter->strategy = strategy;
+  filter->type  = type;
+  filter->size  = size;
+  filter->bpp   = bpp;
+  filter->has_last = 0;
+  filter->z     = NULL;
+  filter->trial = NULL;
+  filter->trial_size = 0;
+  if (type >= NB_FILTER) {
+    LOG_FATAL("Unknown filter-byte %d", type);
+    exit(1);
+  }
+
+  filter->candidate = malloc((size_t) (NB_FILTER + 1) * size); // and the last row chosen
+  if (filter->candidate == NULL) {
+    LOG_FATAL("Can't malloc(%zu) for the filters", (size_t) (NB_FILTER + 1) * size);
+    exit(1);
+  }
+  filter->last = filter->candidate + (size_t) NB_FILTER * size;
+
+  if (strategy == FILTER_BRUTE) {
+    filter->z = calloc(1, sizeof(z_stream));
+    if ((filter->z == NULL) || (deflateInit2(filter->z, level, Z_DEFLATED, -MAX_WBITS, 8, Z_FILTERED) != Z_OK)) {
+      LOG_FATAL("Can't init deflate for filter trials (level %d)", level);
+      exit(1);
+    }
+    filter->trial_size = deflateBound(filter->z, (uLong) size + 1);
+    filter->trial = malloc(filter->trial_size);
+    if (filter->trial == NULL) {
+      LOG_FATAL("Can't malloc(%zu) for filter trials", filter->trial_size);
+      exit(1);
+    }
+  }
+}
+
+
+/**
+ * @brief Size of a filtered row (and its type-byte) deflated right after the last row chosen
+ */
+static size_t trial_size(struct row_filter *filter, const uint8_t *type_byte, const uint8_t *row) {
+  z_stream *z = filter->z;
+  deflateReset(z);
+  if (filter->has_last) {
+    // the window holds the end of the row: the bytes nearest to the next one
+    const size_t window = (filter->size < 32768) ? filter->size : 32768;
+    deflateSetDictionary(z, filter->last + filter->size - window, window);
+  }
+  z->next_in   = (uint8_t *) type_byte;
+  z->avail_in  = 1;
+  z->next_out  = filter->trial;
+  z->avail_out = filter->trial_size;
+  deflate(z, Z_NO_FLUSH);
+  z->next_in  = (uint8_t *) row;
+  z->avail_in = filter->size;
+  deflate(z, Z_FINISH);
+  return z->total_out;
+}
+
+
+uint8_t row_filter_apply(struct row_filter *filter, const uint8_t *raw, const uint8_t *prior, uint8_t nb_type,
+                         uint8_t *out) {
+  const uint32_t size = filter->size;
+  uint8_t best = 0;
+  if (prior == NULL) {
+    filter->has_last = 0; // a new strip
+  }
+
+  switch (filter->strategy) {
+  case FILTER_FIXED:
+    // types out of reach fall back on the closest one that does not look above
+    best = (filter->type < nb_type) ? filter->type : ((filter->type == 2) || (nb_type < 2)) ? 0 : 1;
+    filter_line(best, raw, prior, size, filter->bpp, out);
+    break;
+
+  case FILTER_HEURISTIC:
+  case FILTER_BRUTE: {
+    if (nb_type == 1) {
+      memcpy(out, raw, size);
+      break;
+    }
+    uint64_t cost[NB_FILTER];
+    filter_all(raw, prior, size, filter->bpp, filter->candidate, cost);
+    for (uint8_t t = 0; t < nb_type; t++) {
+      if (filter->strategy == FILTER_BRUTE) {
+        cost[t] = trial_size(filter, &t, filter->candidate + (size_t) t * size);
+      }
+      best = (cost[t] < cost[best]) ? t : best;
+    }
+    memcpy(out, filter->candidate + (size_t) best * size, size);
+    break;
+  }
+
+  default:
+    LOG_FATAL("Unknown filter strategy %d", filter->strategy);
+    exit(1);
+  }
+
+  if (filter->strategy == FILTER_BRUTE) {
+    memcpy(filter->last, out, size);
+    filter->has_last = 1;
+  }
+  return best;
+}
+
+
+void row_filter_free(struct row_filter *filter) {
+  if (filter->z != NULL) {
+    deflateEnd(filter->z);
+    free(filter->z);
+  }
+  free(filter->trial);
+  free(filter->candidate);
+}
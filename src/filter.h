@@ -10,6 +10,10 @@
 #include <stdint.h>
 
 
+/** @brief Number of filter types (None, Sub, Up, Average, Paeth) */
+#define NB_FILTER (5U)
+
+
 /**
  * @brief Unfilter the consecutive scanline of same length
  * @param[in,out] data Pointer to the first scanline
@@ -20,5 +24,116 @@
  */
 void unfilter(uint8_t *data, uint32_t length, uint32_t height, uint8_t bpp);
 
+/**
+ * @brief Unfilter one scanline
+ * @param[in] type The filter type-byte of the scanline
+ * @param[in,out] raw The scanline (without the filter type-byte)
+ * @param[in] prior The previous unfiltered scanline or NULL for the first one
+ * @param[in] size Length of the scanline (without the filter type-byte)
+ * @param[in] bpp Byte per pixel (round up to one)
+ */
+void unfilter_line(uint8_t type, uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp);
+
+
+/**
+ * @brief Filter one scanline
+ * @param[in] type The filter type (0 to NB_FILTER - 1)
+ * @param[in] raw The scanline
+ * @param[in] prior The previous scanline or NULL for the first one (as unfilter_line)
+ * @param[in] size Length of the scanline
+ * @param[in] bpp Byte per pixel (round up to one)
+ * @param[out] out The filtered scanline (size bytes, without the filter type-byte)
+ */
+void filter_line(uint8_t type, const uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp, uint8_t *out);
+
+/**
+ * @brief Filter one scanline with the five types at once, and score them
+ * @details One pass over the scanline, 16 bytes of each type at a time with SSE2. The score of a type
+ * is the sum of its filtered bytes as absolute signed values (the heuristic of the PNG specification:
+ * the smallest sum usually deflates best).
+ * @param[in] raw The scanline
+ * @param[in] prior The previous scanline or NULL for the first one
+ * @param[in] size Length of the scanline
+ * @param[in] bpp Byte per pixel (round up to one)
+ * @param[out] candidate The NB_FILTER filtered scanlines, one after the other (NB_FILTER * size bytes)
+ * @param[out] cost Score of each type
+ */
+void filter_all(const uint8_t *raw, const uint8_t *prior, uint32_t size, uint8_t bpp,
+                uint8_t *candidate, uint64_t cost[NB_FILTER]);
+
+
+
+/**
+ * @brief How the filter type of each scanline is chosen
+ */
+enum filter_strategy {
+  /** @brief The same type for every scanline */
+  FILTER_FIXED = 0,
+  /** @brief Smallest sum of absolute differences (see filter_all) */
+  FILTER_HEURISTIC = 1,
+  /** @brief Each type deflated after the scanline before, the smallest wins (slow) */
+  FILTER_BRUTE = 2,
+};
+
+/** @brief zlib stream of the brute force trials */
+struct z_stream_s;
+
+/**
+ * @brief Filter of consecutive scanlines (one per thread)
+ */
+struct row_filter {
+  /** @brief Strategy */
+  enum filter_strategy strategy;
+  /** @brief Type of FILTER_FIXED */
+  uint8_t type;
+  /** @brief Length of a scanline */
+  uint32_t size;
+  /** @brief Byte per pixel (round up to one) */
+  uint8_t bpp;
+  /** @brief The NB_FILTER candidates of a scanline */
+  uint8_t *candidate;
+  /** @brief Last filtered scanline (FILTER_BRUTE) */
+  uint8_t *last;
+  /** @brief Flag: last is the scanline above */
+  uint8_t has_last;
+  /** @brief Deflate stream of the trials (FILTER_BRUTE) */
+  struct z_stream_s *z;
+  /** @brief Output of the trials */
+  uint8_t *trial;
+  /** @brief Size of trial */
+  size_t trial_size;
+};
+
+/**
+ * @brief Prepare the filter of scanlines
+ * @param[out] filter
+ * @param[in] strategy
+ * @param[in] type Type of FILTER_FIXED
+ * @param[in] level zlib level of the FILTER_BRUTE trials
+ * @param[in] size Length of a scanline
+ * @param[in] bpp Byte per pixel (round up to one)
+ */
+void row_filter_init(struct row_filter *filter, enum filter_strategy strategy, uint8_t type, int level,
+                     uint32_t size, uint8_t bpp);
+
+/**
+ * @brief Filter the next scanline
+ * @param[in,out] filter
+ * @param[in] raw The scanline
+ * @param[in] prior The previous scanline, NULL for the first one (or a scanline that must not look above)
+ * @param[in] nb_type Types allowed, from 0 (2 for None and Sub, NB_FILTER for all).
+ * FILTER_FIXED falls back on None instead of Up, on Sub instead of Average or Paeth.
+ * @param[out] out The filtered scanline (without the filter type-byte)
+ * @return The filter type
+ */
+uint8_t row_filter_apply(struct row_filter *filter, const uint8_t *raw, const uint8_t *prior, uint8_t nb_type,
+                         uint8_t *out);
+
+/**
+ * @brief Free the filter
+ * @param[in,out] filter
+ */
+void row_filter_free(struct row_filter *filter);
+
 
 #endif // __FILTER_H__
@@ -0,0 +1,229 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gamma.h"
+#include "log.h"
+
+
+/** @brief Number of cached (gamma, transfer) pairs */
+#define GAMMA_CACHE_SIZE (8U)
+
+/**
+ * @brief Cache of tables
+ */
+static struct gamma_table *gamma_cache[GAMMA_CACHE_SIZE];
+
+/**
+ * @brief Number of tables in the cache
+ */
+static uint8_t gamma_cached = 0;
+
+/**
+ * @brief Next entry to replace when the cache is full
+ */
+static uint8_t gamma_next = 0;
+
+/**
+ * @brief Lock of the cache and of the tables built lazily
+ */
+static pthread_mutex_t gamma_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/**
+ * @brief sRGB curve to linear light
+ */
+static double srgb_to_linear(double v) {
+  return (v <= 0.04045) ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+/**
+ * @brief Linear light to the sRGB curve
+ */
+static double linear_to_srgb(double v) {
+  return (v <= 0.0031308) ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+}
+
+
+/**
+ * @brief Build the 16-bit table if missing
+ */
+static const uint16_t *table16_of(struct gamma_table *table) {
+  if (table->table16 == NULL) {
+    table->table16 = malloc(65536 * sizeof(uint16_t));
+    if (table->table16 == NULL) {
+      LOG_FATAL("Can't malloc 16-bit gamma table");
+      exit(1);
+    }
+    LOG_ALLOC("Malloc 16-bit gamma table %p", table->table16);
+    for (uint32_t k = 0; k < 65536; k++) {
+      table->table16[k] = lround(65535.0 * gamma_value(table->gamma, table->transfer, k / 65535.0));
+    }
+  }
+  return table->table16;
+}
+
+/**
+ * @brief Build the float table if missing
+ */
+static const float *tablef_of(struct gamma_table *table) {
+  if (table->tablef == NULL) {
+    table->tablef = malloc(65536 * sizeof(float));
+    if (table->tablef == NULL) {
+      LOG_FATAL("Can't malloc float gamma table");
+      exit(1);
+    }
+    LOG_ALLOC("Malloc float gamma table %p", table->tablef);
+    for (uint32_t k = 0; k < 65536; k++) {
+      table->tablef[k] = gamma_value(table->gamma, table->transfer, k / 65535.0);
+    }
+  }
+  return table->tablef;
+}
+
+/**
+ * @brief Drop a reference, the cache must be locked
+ */
+static void release_locked(struct gamma_table *table) {
+  if (--table->refs == 0) {
+    LOG_ALLOC("Free gamma tables %p %p %p", table, table->table16, table->tablef);
+    free(table->table16);
+    free(table->tablef);
+    free(table);
+  }
+}
+
+/**
+ * @brief Find or build the tables of a pair and take a reference, the cache must be locked
+ */
+static struct gamma_table *find_table(uint32_t gamma, enum transfer transfer) {
+  for (uint8_t k = 0; k < gamma_cached; k++) {
+    if ((gamma_cache[k]->gamma == gamma) && (gamma_cache[k]->transfer == transfer)) {
+      gamma_cache[k]->refs++;
+      return gamma_cache[k];
+    }
+  }
+
+  struct gamma_table *table = malloc(sizeof(struct gamma_table));
+  if (table == NULL) {
+    LOG_FATAL("Can't malloc gamma tables");
+    exit(1);
+  }
+  table->gamma    = gamma;
+  table->transfer = transfer;
+  table->table16  = NULL;
+  table->tablef   = NULL;
+  table->refs     = 2; // the cache and the caller
+  for (uint16_t k = 0; k < 256; k++) {
+    table->table8[k] = lround(255.0 * gamma_value(gamma, transfer, k / 255.0));
+  }
+  LOG_DEBUG("Gamma table %d/100000 transfer %d computed", gamma, transfer);
+
+  if (gamma_cached < GAMMA_CACHE_SIZE) {
+    gamma_cache[gamma_cached++] = table;
+  } else {
+    // out of the cache, freed by its last user
+    release_locked(gamma_cache[gamma_next]);
+    gamma_cache[gamma_next] = table;
+    gamma_next = (gamma_next + 1) % GAMMA_CACHE_SIZE;
+  }
+  return table;
+}
+
+
+
+double gamma_value(uint32_t gamma, enum transfer transfer, double value) {
+  const double linear = (gamma == 0) ? srgb_to_linear(value) : pow(value, 100000.0 / gamma);
+  return (transfer == TRANSFER_DISPLAY) ? linear_to_srgb(linear) : linear;
+}
+
+
+uint8_t gamma_identity(uint32_t gamma, enum transfer transfer) {
+  return (gamma == 0) && (transfer == TRANSFER_DISPLAY);
+}
+
+
+const struct gamma_table *get_gamma_table(uint32_t gamma, enum transfer transfer) {
+  pthread_mutex_lock(&gamma_lock);
+  const struct gamma_table *table = find_table(gamma, transfer);
+  pthread_mutex_unlock(&gamma_lock);
+  return table;
+}
+
+
+void release_gamma_table(const struct gamma_table *table) {
+  pthread_mutex_lock(&gamma_lock);
+  release_locked((struct gamma_table *) table);
+  pthread_mutex_unlock(&gamma_lock);
+}
+
+
+void gamma_rows(const struct image *image, enum transfer transfer, enum pixel_format format,
+                void *rows, uint32_t nrows, size_t stride) {
+  if (gamma_identity(image->gamma, transfer)) {
+    return;
+  }
+  // other threads may push the tables out of the cache meanwhile: they are held until the end
+  const uint16_t *t16 = NULL;
+  const float *tf = NULL;
+  pthread_mutex_lock(&gamma_lock);
+  struct gamma_table *table = find_table(image->gamma, transfer);
+  const uint8_t *t8 = table->table8;
+  if (format == FORMAT_RGBA16) {
+    t16 = table16_of(table);
+  }
+  else if (format == FORMAT_FLOAT32) {
+    tf = tablef_of(table);
+  }
+  pthread_mutex_unlock(&gamma_lock);
+  const uint32_t width = image->width;
+
+  for (uint32_t i = 0; i < nrows; i++) {
+    uint8_t *row = ((uint8_t *) rows) + i * stride;
+
+    switch (format) {
+    case FORMAT_RGBA8:
+    case FORMAT_BGRA8:
+      for (uint32_t j = 0; j < width; j++, row += 4) {
+        row[0] = t8[row[0]];
+        row[1] = t8[row[1]];
+        row[2] = t8[row[2]];
+      }
+      break;
+    case FORMAT_RGB8:
+      for (uint32_t j = 0; j < 3 * width; j++) {
+        row[j] = t8[row[j]];
+      }
+      break;
+    case FORMAT_GRAY8:
+      for (uint32_t j = 0; j < width; j++) {
+        row[j] = t8[row[j]];
+      }
+      break;
+    case FORMAT_RGBA16: {
+      uint16_t *px = (uint16_t *) row;
+      for (uint32_t j = 0; j < width; j++, px += 4) {
+        px[0] = t16[px[0]];
+        px[1] = t16[px[1]];
+        px[2] = t16[px[2]];
+      }
+      break;
+    }
+    case FORMAT_FLOAT32: {
+      // float samples come from 8 or 16-bit ones: k / 65535 is exact enough to find the entry
+      float *px = (float *) row;
+      for (uint32_t j = 0; j < width; j++, px += 4) {
+        for (uint8_t c = 0; c < 3; c++) {
+          float v = px[c];
+          uint32_t k = (v <= 0.0f) ? 0 : (v >= 1.0f) ? 65535 : (uint32_t) (v * 65535.0f + 0.5f);
+          px[c] = tf[k];
+        }
+      }
+      break;
+    }
+    }
+  }
+  release_gamma_table(table);
+}
@@ -0,0 +1,98 @@
+/**
+ * @file gamma.h
+ * @brief Color management: gAMA and sRGB transfer curves
+ * @details Samples are decoded to linear light with the gamma of the file (or the sRGB curve), then
+ * encoded for an sRGB display or kept linear. Rows already converted (see convert_rows) go through
+ * lookup tables: 256 entries for the 8-bit formats, 65536 for RGBA16 and float. Tables are built once
+ * per distinct gamma and cached. sRGB images to an sRGB display need no table at all. Tables are
+ * counted: one pushed out of the cache is freed when the last thread using it is done.
+ * Primaries (cHRM) are not converted, they are assumed close enough to the sRGB ones.
+ */
+
+#ifndef __GAMMA_H__
+#define __GAMMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+#include "image.h"
+
+
+/**
+ * @brief Output transfer function
+ */
+enum transfer {
+  /** @brief Display referred, encoded with the sRGB curve */
+  TRANSFER_DISPLAY = 0,
+  /** @brief Linear light */
+  TRANSFER_LINEAR = 1,
+};
+
+/**
+ * @brief Lookup tables of one (gamma, transfer) pair
+ */
+struct gamma_table {
+  /** @brief Encoding gamma of the input times 100000, 0 for sRGB */
+  uint32_t gamma;
+  /** @brief Output transfer function */
+  enum transfer transfer;
+  /** @brief 8-bit to 8-bit */
+  uint8_t table8[256];
+  /** @brief 16-bit to 16-bit (NULL until needed) */
+  uint16_t *table16;
+  /** @brief 16-bit to float (NULL until needed) */
+  float *tablef;
+  /** @brief References: the cache and each user (under the lock of the cache) */
+  uint32_t refs;
+};
+
+
+/**
+ * @brief Apply the transfer curves to one value
+ * @param[in] gamma Encoding gamma of the input times 100000, 0 for sRGB
+ * @param[in] transfer Output transfer
+ * @param[in] value Input in [0, 1]
+ * @return Output in [0, 1]
+ */
+double gamma_value(uint32_t gamma, enum transfer transfer, double value);
+
+/**
+ * @brief Check if a correction does nothing
+ * @param[in] gamma Encoding gamma of the input times 100000, 0 for sRGB
+ * @param[in] transfer Output transfer
+ * @return 1 if output = input (sRGB to display), 0 otherwise
+ */
+uint8_t gamma_identity(uint32_t gamma, enum transfer transfer);
+
+/**
+ * @brief Get the cached tables of a (gamma, transfer) pair, build the 8-bit one if missing
+ * @details The oldest tables leave the cache when it is full. The cache is locked: any thread can call it.
+ * @param[in] gamma Encoding gamma of the input times 100000, 0 for sRGB
+ * @param[in] transfer Output transfer
+ * @return A reference on the tables (see release_gamma_table)
+ */
+const struct gamma_table *get_gamma_table(uint32_t gamma, enum transfer transfer);
+
+/**
+ * @brief Drop a reference on tables, they are freed once out of the cache and unused
+ * @param[in] table Tables from get_gamma_table
+ */
+void release_gamma_table(const struct gamma_table *table);
+
+/**
+ * @brief Correct rows converted from the image, in place
+ * @details Color channels only, alpha is linear already. Nothing is done for sRGB images to display.
+ * @param[in] image The image the rows come from (for its gamma and width)
+ * @param[in] transfer Output transfer
+ * @param[in] format Pixel format of the rows
+ * @param[in,out] rows Rows written by convert_rows
+ * @param[in] nrows Number of rows
+ * @param[in] stride Distance in bytes between two rows
+ */
+void gamma_rows(const struct image *image, enum transfer transfer, enum pixel_format format,
+                void *rows, uint32_t nrows, size_t stride);
+
+
+
+#endif // __GAMMA_H__
@@ -0,0 +1,748 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "icc.h"
+#include "log.h"
+#include "scheduler.h"
+
+
+/** @brief Distance between two nodes for 8-bit samples (255 / 17) */
+#define STEP8 (15U)
+/** @brief Distance between two nodes for 16-bit samples (65535 / 17) */
+#define STEP16 (3855U)
+
+/** @brief Number of cached transforms */
+#define ICC_CACHE_SIZE (32U)
+/** @brief Largest profile inflated */
+#define ICC_MAX_SIZE (16U << 20)
+
+/** @brief Max number of pieces of one band */
+#define ICC_MAX_PIECES (64U)
+/** @brief Min number of pixels of a piece */
+#define ICC_PIECE_PIXELS (1U << 16)
+
+/** @brief Build a signature from 4 chars */
+#define SIGNATURE(a, b, c, d) (((uint32_t) (a) << 24) | ((uint32_t) (b) << 16) | ((uint32_t) (c) << 8) | (d))
+
+
+/**
+ * @brief sRGB primaries adapted to D50 (the PCS white), columns are red, green and blue XYZ
+ */
+static const double srgb_d50[3][3] =
+  {{0.4360747, 0.3850649, 0.1430804},
+   {0.2225045, 0.7168786, 0.0606169},
+   {0.0139322, 0.0971045, 0.7141733}};
+
+
+/**
+ * @brief Cached transforms
+ */
+static struct icc_transform *icc_cache[ICC_CACHE_SIZE];
+
+/**
+ * @brief Number of cached transforms
+ */
+static uint32_t icc_cached = 0;
+
+/**
+ * @brief Next cached transform to replace when the cache is full
+ */
+static uint32_t icc_next = 0;
+
+/**
+ * @brief Lock of the cache
+ */
+static pthread_mutex_t icc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Node below each 8-bit value (0 to 16, 255 is the end of the last cell)
+ */
+static uint8_t node8[256];
+
+/**
+ * @brief Position of each 8-bit value in its cell (0 to STEP8)
+ */
+static uint8_t frac8[256];
+
+/**
+ * @brief Once flag of node8 and frac8
+ */
+static pthread_once_t node8_once = PTHREAD_ONCE_INIT;
+
+
+
+/*
+ * Profile parsing
+ */
+
+/**
+ * @brief Tone reproduction curve of a channel
+ */
+struct curve {
+  /** @brief curv or para */
+  uint32_t type;
+  /** @brief Number of entries of a curv table (0: identity, 1: gamma) */
+  uint32_t count;
+  /** @brief Entries of a curv table (big endian) */
+  const uint8_t *table;
+  /** @brief para function type (0 to 4) */
+  uint16_t function;
+  /** @brief para parameters g a b c d e f (or the gamma of a curv) */
+  double param[7];
+};
+
+
+static uint32_t read32(const uint8_t *ptr) {
+  return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+static uint16_t read16(const uint8_t *ptr) {
+  return (ptr[0] << 8) | ptr[1];
+}
+
+static double read_s15f16(const uint8_t *ptr) {
+  return ((int32_t) read32(ptr)) / 65536.0;
+}
+
+
+/**
+ * @brief Find a tag in the profile
+ * @param[in] profile
+ * @param[in] size
+ * @param[in] signature Tag signature
+ * @param[out] length Length of the tag data
+ * @return Pointer to the tag data or NULL if missing
+ */
+static const uint8_t *find_tag(const uint8_t *profile, uint32_t size, uint32_t signature, uint32_t *length) {
+  const uint32_t count = read32(profile + 128);
+  if (count > (size - 132) / 12) {
+    return NULL;
+  }
+  for (uint32_t k = 0; k < count; k++) {
+    const uint8_t *entry = profile + 132 + 12 * k;
+    const uint32_t offset = read32(entry + 4);
+    *length = read32(entry + 8);
+    if ((read32(entry) == signature) && (offset <= size) && (*length <= size - offset)) {
+      return profile + offset;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Read a XYZ tag
+ * @return 1 if found
+ */
+static int read_xyz(const uint8_t *profile, uint32_t size, uint32_t signature, double xyz[3]) {
+  uint32_t length;
+  const uint8_t *tag = find_tag(profile, size, signature, &length);
+  if ((tag == NULL) || (length < 20) || (read32(tag) != SIGNATURE('X', 'Y', 'Z', ' '))) {
+    return 0;
+  }
+  for (uint8_t k = 0; k < 3; k++) {
+    xyz[k] = read_s15f16(tag + 8 + 4 * k);
+  }
+  return 1;
+}
+
+/**
+ * @brief Read a TRC tag (curv or para)
+ * @return 1 if found and supported
+ */
+static int read_curve(const uint8_t *profile, uint32_t size, uint32_t signature, struct curve *curve) {
+  static const uint8_t nb_param[5] = {1, 3, 4, 5, 7};
+  uint32_t length;
+  const uint8_t *tag = find_tag(profile, size, signature, &length);
+  if ((tag == NULL) || (length < 12)) {
+    return 0;
+  }
+  curve->type = read32(tag);
+
+  if (curve->type == SIGNATURE('c', 'u', 'r', 'v')) {
+    curve->count = read32(tag + 8);
+    if (curve->count > (length - 12) / 2) {
+      return 0;
+    }
+    curve->table = tag + 12;
+    curve->param[0] = (curve->count == 1) ? read16(tag + 12) / 256.0 : 1.0; // u8Fixed8
+    return 1;
+  }
+  if (curve->type == SIGNATURE('p', 'a', 'r', 'a')) {
+    curve->function = read16(tag + 8);
+    if ((curve->function > 4) || (length < 12U + 4 * nb_param[curve->function])) {
+      return 0;
+    }
+    for (uint8_t k = 0; k < nb_param[curve->function]; k++) {
+      curve->param[k] = read_s15f16(tag + 12 + 4 * k);
+    }
+    return 1;
+  }
+  LOG_WARN("Unsupported curve type %.4s", (const char *) tag);
+  return 0;
+}
+
+/**
+ * @brief Evaluate a curve (device value to linear light)
+ */
+static double eval_curve(const struct curve *curve, double x) {
+  const double *p = curve->param;
+  double y;
+
+  if (curve->type == SIGNATURE('c', 'u', 'r', 'v')) {
+    if (curve->count <= 1) {
+      y = pow(x, p[0]);
+    } else {
+      double pos = x * (curve->count - 1);
+      uint32_t k = (uint32_t) pos;
+      if (k >= curve->count - 1) {
+        k = curve->count - 2;
+      }
+      double t = pos - k;
+      y = ((1 - t) * read16(curve->table + 2 * k) + t * read16(curve->table + 2 * k + 2)) / 65535.0;
+    }
+  } else {
+    switch (curve->function) {
+    case 0:
+      y = pow(x, p[0]);
+      break;
+    case 1:
+      y = (x >= -p[2] / p[1]) ? pow(p[1] * x + p[2], p[0]) : 0;
+      break;
+    case 2:
+      y = (x >= -p[2] / p[1]) ? pow(p[1] * x + p[2], p[0]) + p[3] : p[3];
+      break;
+    case 3:
+      y = (x >= p[4]) ? pow(p[1] * x + p[2], p[0]) : p[3] * x;
+      break;
+    default:
+      y = (x >= p[4]) ? pow(p[1] * x + p[2], p[0]) + p[5] : p[3] * x + p[6];
+    }
+  }
+  return (y < 0) ? 0 : (y > 1) ? 1 : y;
+}
+
+/**
+ * @brief Linear light to the sRGB curve, clipped to [0, 1]
+ */
+static double encode_srgb(double v) {
+  if (v <= 0) {
+    return 0;
+  }
+  if (v >= 1) {
+    return 1;
+  }
+  return (v <= 0.0031308) ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+}
+
+/**
+ * @brief Invert a 3x3 matrix
+ * @return 0 if not invertible
+ */
+static int invert3(const double m[3][3], double r[3][3]) {
+  const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                   - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                   + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  if (fabs(det) < 1e-12) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < 3; i++) {
+    for (uint8_t j = 0; j < 3; j++) {
+      // cofactor of m[j][i]
+      const uint8_t a = (j + 1) % 3, b = (j + 2) % 3, c = (i + 1) % 3, d = (i + 2) % 3;
+      r[i][j] = (m[a][c] * m[b][d] - m[a][d] * m[b][c]) / det;
+    }
+  }
+  return 1;
+}
+
+
+int icc_build(const uint8_t *profile, uint32_t size, struct icc_transform *transform) {
+  if ((size < 132) || (read32(profile + 36) != SIGNATURE('a', 'c', 's', 'p'))) {
+    LOG_WARN("Not an ICC profile");
+    return 0;
+  }
+  const uint32_t space = read32(profile + 16);
+  struct curve trc[3];
+  double to_srgb[3][3];
+
+  if (space == SIGNATURE('G', 'R', 'A', 'Y')) {
+    if (!read_curve(profile, size, SIGNATURE('k', 'T', 'R', 'C'), trc)) {
+      LOG_WARN("GRAY profile without kTRC");
+      return 0;
+    }
+    trc[1] = trc[0];
+    trc[2] = trc[0];
+    memset(to_srgb, 0, sizeof(to_srgb));
+    for (uint8_t k = 0; k < 3; k++) {
+      to_srgb[k][k] = 1;
+    }
+    transform->gray = 1;
+  }
+  else if (space == SIGNATURE('R', 'G', 'B', ' ')) {
+    const uint32_t xyz_tag[3] = {SIGNATURE('r', 'X', 'Y', 'Z'), SIGNATURE('g', 'X', 'Y', 'Z'), SIGNATURE('b', 'X', 'Y', 'Z')};
+    const uint32_t trc_tag[3] = {SIGNATURE('r', 'T', 'R', 'C'), SIGNATURE('g', 'T', 'R', 'C'), SIGNATURE('b', 'T', 'R', 'C')};
+    double to_xyz[3][3];
+    double from_xyz[3][3];
+
+    for (uint8_t c = 0; c < 3; c++) {
+      double xyz[3];
+      if (!read_xyz(profile, size, xyz_tag[c], xyz) || !read_curve(profile, size, trc_tag[c], trc + c)) {
+        LOG_WARN("RGB profile without matrix/TRC (A2B LUTs are not supported)");
+        return 0;
+      }
+      for (uint8_t k = 0; k < 3; k++) {
+        to_xyz[k][c] = xyz[k];
+      }
+    }
+    invert3(srgb_d50, from_xyz);
+    for (uint8_t i = 0; i < 3; i++) {
+      for (uint8_t j = 0; j < 3; j++) {
+        to_srgb[i][j] = from_xyz[i][0] * to_xyz[0][j] + from_xyz[i][1] * to_xyz[1][j] + from_xyz[i][2] * to_xyz[2][j];
+      }
+    }
+    transform->gray = 0;
+  }
+  else {
+    LOG_WARN("Unsupported profile color space %.4s", (const char *) (profile + 16));
+    return 0;
+  }
+
+  // each channel curve once per node value
+  double linear[3][ICC_GRID];
+  for (uint8_t c = 0; c < 3; c++) {
+    for (uint32_t n = 0; n < ICC_GRID; n++) {
+      linear[c][n] = eval_curve(trc + c, n / (double) (ICC_GRID - 1));
+    }
+  }
+
+  for (uint32_t r = 0; r < ICC_GRID; r++) {
+    for (uint32_t g = 0; g < ICC_GRID; g++) {
+      for (uint32_t b = 0; b < ICC_GRID; b++) {
+        const double in[3] = {linear[0][r], linear[1][g], linear[2][b]};
+        int16_t *node = transform->grid[r][g][b];
+        for (uint8_t c = 0; c < 3; c++) {
+          double out = to_srgb[c][0] * in[0] + to_srgb[c][1] * in[1] + to_srgb[c][2] * in[2];
+          node[c] = lround(ICC_SCALE * encode_srgb(out));
+        }
+        node[3] = 0;
+      }
+    }
+  }
+  LOG_DEBUG("ICC transform built (%s)", transform->gray ? "gray" : "rgb");
+  return 1;
+}
+
+
+
+/*
+ * Cache
+ */
+
+/**
+ * @brief FNV-1a hash (never 0)
+ */
+static uint64_t hash_bytes(const uint8_t *data, uint32_t length) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (uint32_t k = 0; k < length; k++) {
+    h = (h ^ data[k]) * 0x100000001b3ULL;
+  }
+  return (h == 0) ? 1 : h;
+}
+
+/**
+ * @brief Drop a reference, the cache must be locked
+ */
+static void release_locked(struct icc_transform *transform) {
+  if (--transform->refs == 0) {
+    LOG_ALLOC("Free ICC transform %p", transform);
+    free(transform->zdata);
+    free(transform);
+  }
+}
+
+/**
+ * @brief Find the transform of a compressed profile, the cache must be locked
+ */
+static struct icc_transform *find_locked(uint64_t hash, const uint8_t *zdata, uint32_t zsize) {
+  for (uint32_t k = 0; k < icc_cached; k++) {
+    const struct icc_transform *t = icc_cache[k];
+    if ((t->hash == hash) && (t->zsize == zsize) && (memcmp(t->zdata, zdata, zsize) == 0)) {
+      return icc_cache[k];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Inflate a profile
+ * @param[in] zdata zlib stream
+ * @param[in] zsize Size of the stream
+ * @param[out] size Size of the profile
+ * @return The profile to free or NULL
+ */
+static uint8_t *inflate_profile(const uint8_t *zdata, uint32_t zsize, uint32_t *size) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  zs.next_in  = (z_const Bytef *) zdata;
+  zs.avail_in = zsize;
+  if (inflateInit(&zs) != Z_OK) {
+    return NULL;
+  }
+
+  uint32_t capacity = 4 * zsize + 1024;
+  uint8_t *profile = NULL;
+  int err = Z_OK;
+
+  while (err != Z_STREAM_END) {
+    uint8_t *bigger = realloc(profile, capacity);
+    if (bigger == NULL) {
+      break;
+    }
+    profile = bigger;
+    zs.next_out  = profile + zs.total_out;
+    zs.avail_out = capacity - zs.total_out;
+
+    err = inflate(&zs, Z_NO_FLUSH);
+    if (((err != Z_OK) && (err != Z_STREAM_END) && (err != Z_BUF_ERROR))
+        || ((err != Z_STREAM_END) && (zs.avail_out > 0)) // truncated
+        || (capacity >= ICC_MAX_SIZE)) {
+      break;
+    }
+    capacity *= 2;
+  }
+  inflateEnd(&zs);
+
+  if (err != Z_STREAM_END) {
+    LOG_WARN("Can't inflate the ICC profile (%d)", err);
+    free(profile);
+    return NULL;
+  }
+  *size = zs.total_out;
+  return profile;
+}
+
+
+const struct icc_transform *icc_prepare(const uint8_t *data, uint32_t length) {
+  // profile name, null separator, compression method (0) then zlib stream
+  const uint8_t *end = memchr(data, 0, (length < 80) ? length : 80);
+  if ((end == NULL) || (end + 2 > data + length) || (end[1] != 0)) {
+    LOG_WARN("Broken iCCP chunk");
+    return NULL;
+  }
+  const uint8_t *zdata = end + 2;
+  const uint32_t zsize = length - (zdata - data);
+  const uint64_t hash  = hash_bytes(zdata, zsize);
+
+  pthread_mutex_lock(&icc_lock);
+  struct icc_transform *cached = find_locked(hash, zdata, zsize);
+  if (cached != NULL) {
+    cached->refs++;
+  }
+  pthread_mutex_unlock(&icc_lock);
+  if (cached != NULL) {
+    LOG_DEBUG("ICC profile %s cached", (const char *) data);
+    return cached;
+  }
+
+  // lazy: the profile is only inflated once
+  uint32_t size;
+  uint8_t *profile = inflate_profile(zdata, zsize, &size);
+  if (profile == NULL) {
+    return NULL;
+  }
+  struct icc_transform *transform = malloc(sizeof(struct icc_transform));
+  uint8_t *copy = malloc(zsize);
+  if ((transform == NULL) || (copy == NULL)) {
+    LOG_FATAL("Can't malloc(%zu) for the ICC transform", sizeof(struct icc_transform) + zsize);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc ICC transform %p", transform);
+  const int ok = icc_build(profile, size, transform);
+  free(profile);
+  if (!ok) {
+    free(copy);
+    free(transform);
+    return NULL;
+  }
+  memcpy(copy, zdata, zsize);
+  transform->hash  = hash;
+  transform->zsize = zsize;
+  transform->zdata = copy;
+  transform->refs = 2; // the cache and the caller
+
+  pthread_mutex_lock(&icc_lock);
+  struct icc_transform *built = find_locked(hash, zdata, zsize);
+  if (built != NULL) { // built by another thread meanwhile
+    built->refs++;
+    free(transform->zdata);
+    free(transform);
+    transform = built;
+  } else if (icc_cached < ICC_CACHE_SIZE) {
+    icc_cache[icc_cached++] = transform;
+  } else {
+    // out of the cache, freed by the last image using it
+    release_locked(icc_cache[icc_next]);
+    icc_cache[icc_next] = transform;
+    icc_next = (icc_next + 1) % ICC_CACHE_SIZE;
+  }
+  pthread_mutex_unlock(&icc_lock);
+  LOG_INFO("ICC profile %s ready", (const char *) data);
+  return transform;
+}
+
+
+const struct icc_transform *icc_retain(const struct icc_transform *transform) {
+  if (transform != NULL) {
+    pthread_mutex_lock(&icc_lock);
+    ((struct icc_transform *) transform)->refs++;
+    pthread_mutex_unlock(&icc_lock);
+  }
+  return transform;
+}
+
+
+void icc_release(const struct icc_transform *transform) {
+  if (transform != NULL) {
+    pthread_mutex_lock(&icc_lock);
+    release_locked((struct icc_transform *) transform);
+    pthread_mutex_unlock(&icc_lock);
+  }
+}
+
+
+
+/*
+ * Interpolation
+ */
+
+static void make_node8(void) {
+  for (uint32_t v = 0; v < 256; v++) {
+    node8[v] = (v / STEP8 < ICC_GRID - 2) ? v / STEP8 : ICC_GRID - 2;
+    frac8[v] = v - node8[v] * STEP8;
+  }
+}
+
+/**
+ * @brief Tetrahedral interpolation in a cell of the grid
+ * @param[in] transform
+ * @param[in] node Node at the origin of the cell (red, green, blue)
+ * @param[in] frac Position in the cell on each axis (0 to step)
+ * @param[in] step Size of the cell
+ * @param[out] sum Interpolated red, green, blue times step (ICC_SCALE is 1.0)
+ */
+static inline void interpolate(const struct icc_transform *transform, const uint32_t node[3],
+                               const int32_t frac[3], int32_t step, int32_t sum[4]) {
+  const int32_t dr = ICC_GRID * ICC_GRID * 4, dg = ICC_GRID * 4, db = 4;
+  const int32_t fr = frac[0], fg = frac[1], fb = frac[2];
+  const int16_t *c0 = transform->grid[node[0]][node[1]][node[2]];
+  const int16_t *c1 = c0 + dr + dg + db;
+
+  // the cell is cut in 6 tetrahedra along its diagonal: the two middle vertices and the weights
+  int32_t da, dbb, w0, wa, wb, w1;
+  if (fr >= fg) {
+    if (fg >= fb) {        // r >= g >= b
+      da = dr; dbb = dr + dg; w0 = step - fr; wa = fr - fg; wb = fg - fb; w1 = fb;
+    } else if (fr >= fb) { // r >= b > g
+      da = dr; dbb = dr + db; w0 = step - fr; wa = fr - fb; wb = fb - fg; w1 = fg;
+    } else {               // b > r >= g
+      da = db; dbb = dr + db; w0 = step - fb; wa = fb - fr; wb = fr - fg; w1 = fg;
+    }
+  } else {
+    if (fr >= fb) {        // g > r >= b
+      da = dg; dbb = dr + dg; w0 = step - fg; wa = fg - fr; wb = fr - fb; w1 = fb;
+    } else if (fg >= fb) { // g >= b > r
+      da = dg; dbb = dg + db; w0 = step - fg; wa = fg - fb; wb = fb - fr; w1 = fr;
+    } else {               // b > g > r
+      da = db; dbb = dg + db; w0 = step - fb; wa = fb - fg; wb = fg - fr; w1 = fr;
+    }
+  }
+  const int16_t *ca = c0 + da;
+  const int16_t *cb = c0 + dbb;
+
+#ifdef __SSE2__
+  // nodes and weights fit in 16 bits: one madd per pair of vertices
+  __m128i p = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) c0), _mm_loadl_epi64((const __m128i *) ca));
+  __m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) cb), _mm_loadl_epi64((const __m128i *) c1));
+  __m128i s = _mm_add_epi32(_mm_madd_epi16(p, _mm_set1_epi32((w0 & 0xffff) | (wa << 16))),
+                            _mm_madd_epi16(q, _mm_set1_epi32((wb & 0xffff) | (w1 << 16))));
+  _mm_storeu_si128((__m128i *) sum, s);
+#else
+  for (uint8_t c = 0; c < 3; c++) {
+    sum[c] = c0[c] * w0 + ca[c] * wa + cb[c] * wb + c1[c] * w1;
+  }
+#endif
+}
+
+
+/**
+ * @brief Transform 8-bit pixels
+ * @param[in] transform
+ * @param[in,out] row Pixels
+ * @param[in] width Number of pixels
+ * @param[in] size Size of a pixel
+ * @param[in] red Offset of red in a pixel (blue is 2 - red)
+ */
+static void apply_row8(const struct icc_transform *transform, uint8_t *row, uint32_t width, uint8_t size, uint8_t red) {
+  const int32_t div = STEP8 * 128; // step and the 8-bit shift
+  for (uint32_t j = 0; j < width; j++, row += size) {
+    const uint8_t in[3] = {row[red], row[1], row[2 - red]};
+    const uint32_t node[3] = {node8[in[0]], node8[in[1]], node8[in[2]]};
+    const int32_t frac[3]  = {frac8[in[0]], frac8[in[1]], frac8[in[2]]};
+    int32_t sum[4];
+    interpolate(transform, node, frac, STEP8, sum);
+    row[red]     = (sum[0] + div / 2) / div;
+    row[1]       = (sum[1] + div / 2) / div;
+    row[2 - red] = (sum[2] + div / 2) / div;
+  }
+}
+
+/**
+ * @brief Transform RGBA16 pixels (native byte order)
+ */
+static void apply_row16(const struct icc_transform *transform, uint16_t *row, uint32_t width) {
+  const uint64_t div = (uint64_t) STEP16 * ICC_SCALE;
+  for (uint32_t j = 0; j < width; j++, row += 4) {
+    uint32_t node[3];
+    int32_t frac[3];
+    for (uint8_t c = 0; c < 3; c++) {
+      node[c] = (row[c] / STEP16 < ICC_GRID - 2) ? row[c] / STEP16 : ICC_GRID - 2;
+      frac[c] = row[c] - node[c] * STEP16;
+    }
+    int32_t sum[4];
+    interpolate(transform, node, frac, STEP16, sum);
+    for (uint8_t c = 0; c < 3; c++) {
+      row[c] = ((uint64_t) sum[c] * 65535 + div / 2) / div;
+    }
+  }
+}
+
+/**
+ * @brief Transform float pixels through 16 bits
+ */
+static void apply_rowf(const struct icc_transform *transform, float *row, uint32_t width) {
+  for (uint32_t j = 0; j < width; j++, row += 4) {
+    uint16_t px[4];
+    for (uint8_t c = 0; c < 3; c++) {
+      float v = row[c];
+      px[c] = (v <= 0.0f) ? 0 : (v >= 1.0f) ? 65535 : (uint16_t) (v * 65535.0f + 0.5f);
+    }
+    apply_row16(transform, px, 1);
+    for (uint8_t c = 0; c < 3; c++) {
+      row[c] = px[c] / 65535.0f;
+    }
+  }
+}
+
+/**
+ * @brief Transform gray pixels along the diagonal of the grid
+ */
+static void apply_row_gray(const struct icc_transform *transform, uint8_t *row, uint32_t width) {
+  uint8_t table[256];
+  for (uint32_t v = 0; v < 256; v++) {
+    uint8_t px[3] = {v, v, v};
+    apply_row8(transform, px, 1, 3, 0);
+    table[v] = px[1];
+  }
+  for (uint32_t j = 0; j < width; j++) {
+    row[j] = table[row[j]];
+  }
+}
+
+
+/**
+ * @brief Rows split in pieces
+ */
+struct icc_job {
+  /** @brief The transform */
+  const struct icc_transform *transform;
+  /** @brief Pixel format of the rows */
+  enum pixel_format format;
+  /** @brief First row */
+  uint8_t *rows;
+  /** @brief Number of pixels per row */
+  uint32_t width;
+  /** @brief Number of rows */
+  uint32_t nrows;
+  /** @brief Distance in bytes between two rows */
+  size_t stride;
+  /** @brief Rows of a piece (the last one may have less) */
+  uint32_t piece_rows;
+};
+
+/**
+ * @brief Transform a piece of the rows
+ * @param[in] arg A struct icc_job
+ * @param[in] index Index of the piece
+ */
+static void apply_piece(void *arg, uint32_t index) {
+  const struct icc_job *job = arg;
+  const uint32_t row0 = index * job->piece_rows;
+  const uint32_t end = (job->nrows - row0 < job->piece_rows) ? job->nrows : row0 + job->piece_rows;
+
+  for (uint32_t i = row0; i < end; i++) {
+    uint8_t *row = job->rows + i * job->stride;
+
+    switch (job->format) {
+    case FORMAT_RGBA8:
+      apply_row8(job->transform, row, job->width, 4, 0);
+      break;
+    case FORMAT_BGRA8:
+      apply_row8(job->transform, row, job->width, 4, 2);
+      break;
+    case FORMAT_RGB8:
+      apply_row8(job->transform, row, job->width, 3, 0);
+      break;
+    case FORMAT_RGBA16:
+      apply_row16(job->transform, (uint16_t *) row, job->width);
+      break;
+    case FORMAT_GRAY8:
+      apply_row_gray(job->transform, row, job->width);
+      break;
+    case FORMAT_FLOAT32:
+      apply_rowf(job->transform, (float *) row, job->width);
+      break;
+    }
+  }
+}
+
+
+
+void icc_apply(const struct icc_transform *transform, enum pixel_format format,
+               void *rows, uint32_t width, uint32_t nrows, size_t stride) {
+  pthread_once(&node8_once, make_node8);
+
+  // pieces of at least ICC_PIECE_PIXELS pixels, stolen by the idle workers
+  const uint32_t nb_piece = sched_pieces((uint64_t) width * nrows, ICC_PIECE_PIXELS, ICC_MAX_PIECES);
+  const uint32_t piece_rows = (nrows + nb_piece - 1) / nb_piece;
+  struct icc_job job = {
+    .transform  = transform,
+    .format     = format,
+    .rows       = rows,
+    .width      = width,
+    .nrows      = nrows,
+    .stride     = stride,
+    .piece_rows = (piece_rows > 0) ? piece_rows : 1,
+  };
+  sched_run(NULL, (nrows + job.piece_rows - 1) / job.piece_rows, apply_piece, &job);
+}
+
+
+int icc_rows(const struct image *image, enum pixel_format format, void *rows, uint32_t nrows, size_t stride) {
+  if (image->profile == NULL) {
+    return 0;
+  }
+  // the image holds a reference: the transform stays valid even out of the cache
+  icc_apply(image->profile, format, rows, image->width, nrows, stride);
+  return 1;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file icc.h
+ * @brief Embedded ICC profiles (iCCP) to sRGB through cached 3D lookup tables
+ * @details The iCCP chunk is only inflated when its transform is not cached yet. Matrix/TRC profiles
+ * (RGB: rXYZ gXYZ bXYZ + rTRC gTRC bTRC, GRAY: kTRC) are evaluated once on a 18x18x18 grid holding
+ * the sRGB output of each node, out-of-gamut colors are clipped. Pixels are then interpolated
+ * between 4 nodes of the grid (tetrahedral interpolation). Nodes are 15 apart on 8-bit samples,
+ * so 0 and 255 fall on nodes and black and white stay exact.
+ * Transforms are cached by a hash of the compressed profile: images sharing a profile share the table.
+ * Each image holds a reference on its transform: a transform pushed out of the cache stays valid
+ * until the last image using it is freed (threads of --batch and --serve share the cache).
+ * Profiles using A2B LUTs only are not supported (the image is left as it).
+ */
+
+#ifndef __ICC_H__
+#define __ICC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+#include "image.h"
+
+
+/** @brief Number of nodes on each axis of the grid */
+#define ICC_GRID (18U)
+
+/** @brief Value of 1.0 in the grid (255 * 128, so 8-bit output is a shift) */
+#define ICC_SCALE (32640)
+
+
+/**
+ * @brief Transform of a profile to sRGB
+ */
+struct icc_transform {
+  /** @brief Hash of the compressed profile (never 0) */
+  uint64_t hash;
+  /** @brief Size of the compressed profile */
+  uint32_t zsize;
+  /** @brief Copy of the compressed profile, compared on lookup (the hash only filters) */
+  uint8_t *zdata;
+  /** @brief References: the cache and each image using it (under the lock of the cache) */
+  uint32_t refs;
+  /** @brief Flag: GRAY profile (each channel goes through the same curve) */
+  uint8_t gray;
+  /** @brief sRGB output of each node [red][green][blue], 4th sample unused (aligned nodes) */
+  int16_t grid[ICC_GRID][ICC_GRID][ICC_GRID][4];
+};
+
+
+/**
+ * @brief Build the transform of a profile
+ * @param[in] profile The ICC profile (inflated)
+ * @param[in] size Size of the profile
+ * @param[out] transform The transform (hash, zsize, zdata and refs not set)
+ * @return 1 if the profile is supported, 0 otherwise
+ */
+int icc_build(const uint8_t *profile, uint32_t size, struct icc_transform *transform);
+
+/**
+ * @brief Get the transform of an iCCP chunk, through the cache
+ * @details Only the hash is computed when the transform is cached already,
+ * otherwise the profile is inflated and its transform built.
+ * @param[in] data Data of the iCCP chunk (name, compression method, zlib stream)
+ * @param[in] length Length of the chunk data
+ * @return A reference on the transform (see icc_release), NULL if the profile is broken or not supported
+ */
+const struct icc_transform *icc_prepare(const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Take one more reference on a transform
+ * @param[in] transform A transform or NULL
+ * @return transform
+ */
+const struct icc_transform *icc_retain(const struct icc_transform *transform);
+
+/**
+ * @brief Drop a reference, the transform is freed once out of the cache and unused
+ * @param[in] transform A transform from icc_prepare or icc_retain, or NULL
+ */
+void icc_release(const struct icc_transform *transform);
+
+/**
+ * @brief Apply a transform to rows in place
+ * @details Large bands are split in pieces run by the workers of the scheduler. Alpha is untouched.
+ * GRAY8 rows go through the gray diagonal of the grid.
+ * @param[in] transform
+ * @param[in] format Pixel format of the rows
+ * @param[in,out] rows Rows written by convert_rows
+ * @param[in] width Number of pixels per row
+ * @param[in] nrows Number of rows
+ * @param[in] stride Distance in bytes between two rows
+ */
+void icc_apply(const struct icc_transform *transform, enum pixel_format format,
+               void *rows, uint32_t width, uint32_t nrows, size_t stride);
+
+/**
+ * @brief Transform rows converted from an image with an ICC profile to sRGB
+ * @param[in] image The image the rows come from
+ * @param[in] format Pixel format of the rows
+ * @param[in,out] rows Rows written by convert_rows
+ * @param[in] nrows Number of rows
+ * @param[in] stride Distance in bytes between two rows
+ * @return 1 if the rows were transformed, 0 if the image has no usable profile
+ */
+int icc_rows(const struct image *image, enum pixel_format format, void *rows, uint32_t nrows, size_t stride);
+
+
+
+#endif // __ICC_H__
@@ -1,201 +1,527 @@
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <zlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "chunk.h"
+#include "convert.h"
+#include "expand.h"
 #include "filter.h"
+#include "icc.h"
 #include "image.h"
+#include "index.h"
 #include "log.h"
+#include "stream.h"
+
 
 
 
+/**
+ * @brief Origin and step of each Adam7 pass: {x start, y start, x step, y step}
+ */
+static const uint8_t adam7_grid[ADAM7_NB_PASS][4] =
+  {{0, 0, 8, 8},
+   {4, 0, 8, 8},
+   {0, 4, 4, 8},
+   {2, 0, 4, 4},
+   {0, 2, 2, 4},
+   {1, 0, 2, 2},
+   {0, 1, 1, 2}};
+
+
 
-/** @brief Size of the square pattern */
-#define ADAM7_SIZE (8)
 
 /**
- * @brief Adam7 layout [pattern](http://www.libpng.org/pub/png/spec/1.2/PNG-DataRep.html#DR.Interlaced-data-order)
+ * @brief Copy the palette into a full size palette
+ * @details Missing colors are black, so any index of any depth is safe to look up
+ * @param[in] plte The PLTE chunk
+ * @param[out] palette Area of PALETTE_SIZE bytes
  */
-static const uint8_t adam7_pattern[ADAM7_SIZE * ADAM7_SIZE] =
-  {0, 5, 3, 5, 1, 5, 3, 5,
-   6, 6, 6, 6, 6, 6, 6, 6,
-   4, 5, 4, 5, 4, 5, 4, 5,
-   6, 6, 6, 6, 6, 6, 6, 6,
-   2, 5, 3, 5, 2, 5, 3, 5,
-   6, 6, 6, 6, 6, 6, 6, 6,
-   4, 5, 4, 5, 4, 5, 4, 5,
-   6, 6, 6, 6, 6, 6, 6, 6};
+static void copy_palette(const struct PLTE *plte, uint8_t *palette) {
+  uint16_t nb_color = (plte->nb_color > 256) ? 256 : plte->nb_color;
+  memcpy(palette, plte->color, nb_color * 3);
+  memset(palette + nb_color * 3, 0, PALETTE_SIZE - nb_color * 3);
+}
 
 
 
 
 /**
- * @brief Number of sample of a pixel
- * @param[in] type Color type
- * @return Count of sample
+ * @brief Encoding gamma of the image
+ * @details sRGB overrides gAMA, without any of them the samples are assumed sRGB
+ * @param[in] stream Stream opened on the file
+ * @return The gAMA value or 0 for sRGB
+ */
+static uint32_t image_gamma(const struct scanline_stream *stream) {
+  return stream->srgb ? 0 : stream->gamma;
+}
+
+/**
+ * @brief ICC profile of the image
+ * @details sRGB overrides iCCP (both should not be present), the profile is only inflated once
+ * @param[in] stream Stream opened on the file
+ * @return A reference on the transform or NULL
+ */
+static const struct icc_transform *image_profile(const struct scanline_stream *stream) {
+  if (stream->srgb || (stream->iccp == NULL)) {
+    return NULL;
+  }
+  return icc_prepare(stream->iccp, stream->iccp_length);
+}
+
+/**
+ * @brief Background color of the image (bKGD) as 16-bit red, green, blue
+ * @param[in] stream Stream opened on the file
+ * @param[out] image Image whose background is set
  */
-static uint8_t count_sample(enum color_type type) {
-  switch (type) {
-  case PLTE_INDEX:
+static void image_background(const struct scanline_stream *stream, struct image *image) {
+  const struct BKGD *bg = &(stream->bkgd);
+  image->has_background = stream->has_bkgd;
+  if (!stream->has_bkgd) {
+    memset(image->background, 0, sizeof(image->background));
+    return;
+  }
+
+  switch (bg->color_type) {
+  case PLTE_INDEX: {
+    const uint8_t index = bg->color.index;
+    for (uint8_t k = 0; k < 3; k++) {
+      image->background[k] = (index < stream->plte.nb_color) ? stream->plte.color[3 * index + k] * 257 : 0;
+    }
+    break;
+  }
   case GRAYSCALE:
-    return 1;
-  case GRAYSCALE_ALPHA:
-    return 2;
-  case RGB_TRIPLE:
-    return 3;
-  case RGB_TRIPLE_ALPHA:
-    return 4;
+  case GRAYSCALE_ALPHA: {
+    const uint32_t max = (1U << stream->header.depth) - 1;
+    const uint16_t gray = ((uint32_t) (bg->color.gray & max) * 65535) / max;
+    for (uint8_t k = 0; k < 3; k++) {
+      image->background[k] = gray;
+    }
+    break;
+  }
+  default: {
+    const uint32_t f = (stream->header.depth == 8) ? 257 : 1;
+    image->background[0] = bg->color.rgb.red * f;
+    image->background[1] = bg->color.rgb.green * f;
+    image->background[2] = bg->color.rgb.blue * f;
+  }
   }
 }
 
+
 /**
- * @brief Compute the length of a scanline (in byte)
- * @param[in] depth Count of bit per sample
- * @param[in] sample Count of sample per pixel
- * @param[in] width Count of pixel
- * @return Number of byte for a scanline in the image
+ * @brief Image of width x height pixels without data nor palette
+ * @param[in] stream Stream giving the image format
+ * @param[in] width
+ * @param[in] height
+ * @param[in] depth Depth of the image (may differ from the file)
+ * @return The image (.palette and .data are NULL)
  */
-static uint32_t byte_per_line(uint8_t depth, uint8_t sample, uint32_t width) {
-  uint32_t bit_per_line = depth * sample * width;
-  return (bit_per_line + 7) / 8; // round up to one if % 8 != 0
+static struct image image_info(const struct scanline_stream *stream, uint32_t width, uint32_t height, uint8_t depth) {
+  struct image r = {
+    .width   = width,
+    .height  = height,
+    .depth   = depth,
+    .sample  = stream->sample,
+    .native  = 0,
+    .gamma   = image_gamma(stream),
+    .profile = image_profile(stream),
+    .palette = NULL,
+    .data    = NULL,
+  };
+  image_background(stream, &r);
+  return r;
 }
 
 
+/**
+ * @brief Allocate an image of width x height pixels (and its palette), NULL data if malloc fails
+ * @param[in] stream Stream giving the image format
+ * @param[in] width
+ * @param[in] height
+ * @param[in] depth Depth of the image (may differ from the file)
+ * @return The image (data not initialized)
+ */
+static struct image try_alloc_image(const struct scanline_stream *stream, uint32_t width, uint32_t height,
+                                    uint8_t depth) {
+  const uint32_t lsize = byte_per_line(depth, stream->sample, width);
+  const size_t data_size = (size_t) height * lsize;
+  const int indexed = (stream->header.color_type == PLTE_INDEX);
+  const size_t palette_size = indexed ? PALETTE_SIZE : 0; // palette right after the data
+
+  struct image r = image_info(stream, width, height, depth);
+  void *data = malloc(data_size + palette_size);
+  if (data == NULL) {
+    LOG_ERROR("Can't malloc(%zu) to unpack image", data_size + palette_size);
+    icc_release(r.profile);
+    r.profile = NULL;
+    r.data    = NULL;
+    return r;
+  }
+  LOG_ALLOC("Malloc(%zu) at %p", data_size + palette_size, data);
+  r.data = data;
+
+  // palette
+  if (indexed) {
+    r.palette = ((uint8_t *) data) + data_size;
+    copy_palette(&(stream->plte), r.palette);
+  }
+  return r;
+}
 
 
 /**
- * @brief Consume all IDAT chunk to inflate all image data (using zlib only in this function)
- * @details IDAT chunk must be [consecutive](http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html#C.Summary-of-standard-chunks)
- * @param[in] fsize Remaining size of the file starting at fptr
- * @param[in] fptr Allocated file content (pointer to the first IDAT chunk)
- * @param[in] isize Size allocated from iptr
- * @param[out] iptr Pointer to the area to fill with unpack data
+ * @brief Allocate an image of width x height pixels (and its palette)
+ * @param[in] stream Stream giving the image format
+ * @param[in] width
+ * @param[in] height
+ * @param[in] depth Depth of the image (may differ from the file)
+ * @return The image (data not initialized)
  */
-static void unpack_IDAT(uint32_t fsize, const uint8_t *fptr, uint32_t isize, void *iptr) {
-  // the first IDAT chunk of the file
-  struct chunk current = get_chunk(fsize, fptr);
-  assert(current.type == IDAT);
-
-  // init z_stream value
-  z_stream stream;
-  stream.zalloc = Z_NULL;
-  stream.zfree  = Z_NULL;
-  stream.opaque = (voidpf) 0;
-  stream.next_in   = (z_const Bytef *) current.data; // drop the const but it's ok (z_const)
-  stream.avail_in  = current.length;
-  stream.next_out  = iptr;
-  stream.avail_out = isize;
-  LOG_INFO("Inflate IDAT ...");
-
-  // inflate init
-  int err = inflateInit(&stream);
-  if (err != Z_OK) {
-    LOG_FATAL("InflateInit failed, returned %d", err);
+static struct image alloc_image(const struct scanline_stream *stream, uint32_t width, uint32_t height, uint8_t depth) {
+  const struct image r = try_alloc_image(stream, width, height, depth);
+  if (r.data == NULL) {
+    LOG_FATAL("No memory for an image [%d,%d]", width, height);
     exit(1);
   }
+  return r;
+}
 
-  // loop through each IDAT
-  while (current.type == IDAT) {
 
-    while (stream.avail_in > 0) {
-      err = inflate(&stream, Z_NO_FLUSH); // consume data in the chunk
+/**
+ * @brief Deadline and cancel flag of a decode (see get_image_checked)
+ */
+struct decode_check {
+  /** @brief Flag: the deadline is set */
+  uint8_t has_deadline;
+  /** @brief Monotonic time of the deadline */
+  struct timespec deadline;
+  /** @brief Cancel flag or NULL */
+  const uint8_t *cancel;
+  /** @brief DECODE_OK until the decode must stop */
+  enum decode_status status;
+};
 
-      if (err == Z_STREAM_END) {
-        break; // zlib know it is the last IDAT
-      }
-      else if (err != Z_OK) {
-        LOG_FATAL("Inflate failed, returned %d", err);
-        exit(1);
+/**
+ * @brief Check the cancel flag and the deadline of a decode
+ * @param[in,out] arg The struct decode_check, its status is set once the decode must stop
+ * @return 1 if the decode must stop, 0 otherwise
+ */
+static int decode_stopped(void *arg) {
+  struct decode_check *check = arg;
+  if ((check->cancel != NULL) && __atomic_load_n(check->cancel, __ATOMIC_RELAXED)) {
+    check->status = DECODE_CANCELLED;
+    return 1;
+  }
+  if (check->has_deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec > check->deadline.tv_sec)
+        || ((now.tv_sec == check->deadline.tv_sec) && (now.tv_nsec >= check->deadline.tv_nsec))) {
+      check->status = DECODE_DEADLINE;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Inflate and unfilter each scanline right in the image (NO interlace image)
+ * @details Each scanline is unfiltered using the previous one already in place, so nothing is remapped
+ * With a check, the file must pass scanline_check: a wrong scanline or a stop of the check frees the
+ * image and gives NULL data (the reason is in check->status, DECODE_CORRUPT for a wrong scanline).
+ * @param[in,out] stream Opened stream on the file
+ * @param[in] native Flag: put 16-bit samples in the native byte order
+ * @param[in,out] check Deadline and cancel flag, NULL to end the process on a wrong scanline
+ * @return The final image
+ */
+static struct image image_from_stream(struct scanline_stream *stream, uint8_t native, struct decode_check *check) {
+  assert(stream->header.interlace == 0); // no interlace
+
+  struct image r = (check == NULL)
+                   ? alloc_image(stream, stream->header.width, stream->header.height, stream->header.depth)
+                   : try_alloc_image(stream, stream->header.width, stream->header.height, stream->header.depth);
+  if (r.data == NULL) {
+    check->status = DECODE_OVER_BUDGET;
+    return r;
+  }
+  r.native = native && (r.depth == 16);
+  const uint32_t count = stream->lsize / 2; // samples per line if 16-bit
+
+  uint8_t *prior = NULL;
+  uint8_t *line  = r.data;
+
+  for (uint32_t i = 0; i < r.height; i++) {
+    if (check == NULL) {
+      scanline_read(stream, line, prior);
+    }
+    else if (decode_stopped(check) || !scanline_try_read(stream, line, prior)) {
+      if (check->status == DECODE_OK) {
+        check->status = DECODE_CORRUPT;
       }
+      free_image(&r);
+      r.data    = NULL;
+      r.palette = NULL;
+      r.profile = NULL;
+      return r;
+    }
+    // the prior line is no longer needed in the file byte order
+    if (r.native && (prior != NULL)) {
+      samples_to_native(prior, count);
     }
-    // get the next IDAT to consume
-    fsize -= (current.length + 12);
-    fptr  += (current.length + 12);
-    current = get_chunk(fsize, fptr);
+    prior = line;
+    line += stream->lsize;
+  }
+  if (r.native && (prior != NULL)) {
+    samples_to_native(prior, count);
+  }
+  return r;
+}
 
-    if ((err == Z_STREAM_END) && (current.type == IDAT)) {
-      LOG_WARN("Weird, zlib said it inflates the whole image but there is still IDAT left");
-      break;
+
+/**
+ * @brief Copy bit_count bits starting at bit_offset in src to the beginning of dst
+ * @param[in] src Unfiltered scanline
+ * @param[in] bit_offset First bit to copy (from the most significant bit of src[0])
+ * @param[in] bit_count Number of bits to copy
+ * @param[out] dst Area of (bit_count + 7) / 8 bytes (unused low bits of the last byte are 0)
+ */
+static void copy_bits(const uint8_t *src, uint32_t bit_offset, uint32_t bit_count, uint8_t *dst) {
+  const uint8_t *from = src + (bit_offset / 8);
+  const uint8_t shift = bit_offset % 8;
+  const uint32_t size = (bit_count + 7) / 8;
+
+  if (shift == 0) {
+    memcpy(dst, from, size);
+  }
+  else {
+    // a byte of dst overlap two bytes of src (the last one may be out of the copied bits)
+    const uint32_t last = (bit_offset + bit_count - 1) / 8 - (bit_offset / 8);
+    for (uint32_t k = 0; k < size; k++) {
+      uint8_t next = (k + 1 <= last) ? from[k + 1] : 0;
+      dst[k] = (from[k] << shift) | (next >> (8 - shift));
     }
-    stream.next_in  = (z_const Bytef *) current.data;
-    stream.avail_in = current.length;
   }
-  if (stream.avail_out != 0) {
-    LOG_FATAL("Inflating IDAT didn't take as much space as expected, remaind %d byte", stream.avail_out);
-    exit(1);
+  if (bit_count % 8 != 0) {
+    dst[size - 1] &= (uint8_t) (0xff << (8 - bit_count % 8));
   }
+}
 
-  // end inflate
-  err = inflateEnd(&stream);
-  if (err != Z_OK) {
-    LOG_FATAL("InflateEnd failed, returned %d", err);
-    exit(1);
+
+/**
+ * @brief Copy the pixel at index from in src to index to in dst
+ * @param[in] src Scanline
+ * @param[in] from Index of the pixel in src
+ * @param[out] dst Scanline
+ * @param[in] to Index of the pixel in dst
+ * @param[in] bits Bits per pixel (1, 2, 4 or a multiple of 8)
+ */
+static void copy_pixel(const uint8_t *src, uint32_t from, uint8_t *dst, uint32_t to, uint8_t bits) {
+  if (bits >= 8) {
+    memcpy(dst + to * (bits / 8), src + from * (bits / 8), bits / 8);
+    return;
   }
-  LOG_INFO("Inflate IDAT done");
+  const uint8_t mask = (1 << bits) - 1;
+  const uint8_t src_shift = 8 - bits - (from * bits) % 8;
+  const uint8_t dst_shift = 8 - bits - (to * bits) % 8;
+  uint8_t value = (src[(from * bits) / 8] >> src_shift) & mask;
+  uint8_t *byte = dst + (to * bits) / 8;
+  *byte = (*byte & ~(mask << dst_shift)) | (value << dst_shift);
 }
 
 
 /**
- * @brief Unpack IDAT chunk, unfilter image (NO interlace image)
- * @details The no interlace version is quite easy to understand, however with adam7...
- * @param[in] header Header chunk of the file
- * @param[in] fsize Size after fptr
- * @param[in] fptr Pointer to file content (first IDAT chunk)
- * @return The final image
+ * @brief Depth of a downscaled image
+ * @details Sub-byte grayscale is averaged on 8 bits, palette index are kept as it
  */
-static struct image image_from_IDAT(const struct IHDR *hdr, uint32_t fsize, const uint8_t *fptr) {
-  assert(hdr->interlace == 0); // no interlace
+static uint8_t scaled_depth(const struct scanline_stream *stream) {
+  if ((stream->header.color_type == GRAYSCALE) && (stream->header.depth < 8)) {
+    return 8;
+  }
+  return stream->header.depth;
+}
 
-  // needed constants, compute unpack size
-  const uint8_t sample = count_sample(hdr->color_type); // number of sample in a pixel
-  const uint32_t lsize = byte_per_line(hdr->depth, sample, hdr->width); // length of a line
-  const uint32_t unpack_size = hdr->height * (1 + lsize); // adding the filter type-byte per scanline
 
-  // malloc
-  void *data = malloc(unpack_size);
-  if (data == NULL) {
-    LOG_FATAL("Can't malloc(%d) to unpack image", unpack_size);
+/**
+ * @brief Downscale a NO interlace image with a box filter, line by line as they are unfiltered
+ * @details Palette images keep the top left pixel of each box (index can't be averaged)
+ * @param[in,out] stream Opened stream on the file
+ * @param[in] scale The image is divided by 2^scale
+ * @return The downscaled image
+ */
+static struct image image_scaled_box(struct scanline_stream *stream, uint8_t scale) {
+  const struct IHDR *hdr = &(stream->header);
+  const uint32_t f = 1U << scale; // size of a box
+  const uint8_t sample = stream->sample;
+  const uint8_t depth = scaled_depth(stream);
+
+  struct image r = alloc_image(stream, (hdr->width + f - 1) >> scale, (hdr->height + f - 1) >> scale, depth);
+  const uint32_t out_lsize = line_size(&r);
+
+  // two scanlines, an expanded scanline (sub-byte gray) and a line of sums
+  const size_t buffer_size = 2 * stream->lsize + hdr->width + (size_t) r.width * sample * sizeof(uint32_t);
+  uint8_t *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to downscale", buffer_size);
     exit(1);
   }
-  LOG_ALLOC("Malloc(%d) at %p", unpack_size, data);
+  LOG_ALLOC("Malloc(%zu) downscale buffer %p", buffer_size, buffer);
+
+  uint8_t *line  = buffer;
+  uint8_t *prior = buffer + stream->lsize;
+  uint8_t *expanded = buffer + 2 * stream->lsize;
+  uint32_t *sum = (uint32_t *) (expanded + hdr->width);
+  memset(sum, 0, r.width * sample * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < hdr->height; i++) {
+    scanline_read(stream, line, prior);
+    uint8_t *out = ((uint8_t *) r.data) + (i >> scale) * out_lsize;
+
+    if (r.palette != NULL) {
+      if ((i % f) == 0) {
+        for (uint32_t j = 0; j < r.width; j++) {
+          copy_pixel(line, j << scale, out, j, depth);
+        }
+      }
+    }
+    else {
+      // add the line to the sums
+      const uint8_t *src = line;
+      if (hdr->depth < 8) {
+        expand_row(line, hdr->width, hdr->depth, EXPAND_GRAY, expanded);
+        src = expanded;
+      }
+      if (depth == 16) {
+        for (uint32_t j = 0; j < hdr->width; j++) {
+          for (uint8_t c = 0; c < sample; c++) {
+            const uint8_t *v = src + 2 * (j * sample + c);
+            sum[(j >> scale) * sample + c] += (v[0] << 8) | v[1];
+          }
+        }
+      }
+      else {
+        for (uint32_t j = 0; j < hdr->width; j++) {
+          for (uint8_t c = 0; c < sample; c++) {
+            sum[(j >> scale) * sample + c] += src[j * sample + c];
+          }
+        }
+      }
 
-  // unpack
-  unpack_IDAT(fsize, fptr, unpack_size, data);
+      // last line of a box: write the averages
+      if (((i + 1) % f == 0) || (i + 1 == hdr->height)) {
+        const uint32_t box_height = (i % f) + 1;
+
+        for (uint32_t j = 0; j < r.width; j++) {
+          const uint32_t box_width = ((j + 1) << scale <= hdr->width) ? f : hdr->width - (j << scale);
+          const uint32_t n = box_width * box_height;
+
+          for (uint8_t c = 0; c < sample; c++) {
+            uint32_t *s = sum + j * sample + c;
+            uint32_t average = (*s + n / 2) / n;
+            if (depth == 16) {
+              out[2 * (j * sample + c)]     = average >> 8;
+              out[2 * (j * sample + c) + 1] = average & 0xff;
+            } else {
+              out[j * sample + c] = average;
+            }
+            *s = 0;
+          }
+        }
+      }
+    }
+    // swap
+    uint8_t *tmp = prior;
+    prior = line;
+    line = tmp;
+  }
+
+  LOG_ALLOC("Free downscale buffer %p", buffer);
+  free(buffer);
+  return r;
+}
 
-  // unfilter
-  uint8_t bpp = (hdr->depth * sample + 7) / 8;
-  unfilter(data, 1 + lsize, hdr->height, bpp);
 
-  // remap pixels
-  for (uint8_t i = 0; i < hdr->height; i++) {
-    uint8_t *src = data + (i * (1 + lsize)) + 1;
-    uint8_t *dst = data + (i * lsize);
-    memcpy(dst, src, lsize);
+/**
+ * @brief Downscale an Adam7 image using only the first passes
+ * @details Passes 1, 1-3 and 1-5 hold exactly the pixels of the 1/8, 1/4 and 1/2 grid,
+ * so next passes are never inflated
+ * @param[in,out] stream Opened stream on the file
+ * @param[in] scale The image is divided by 2^scale
+ * @return The downscaled image
+ */
+static struct image image_scaled_adam7(struct scanline_stream *stream, uint8_t scale) {
+  const struct IHDR *hdr = &(stream->header);
+  const uint32_t f = 1U << scale;
+  const uint8_t nb_pass = ADAM7_NB_PASS - 2 * scale;
+  const uint8_t depth = scaled_depth(stream);
+  const uint8_t in_bits  = hdr->depth * stream->sample;
+  const uint8_t out_bits = depth * stream->sample;
+
+  struct image r = alloc_image(stream, (hdr->width + f - 1) >> scale, (hdr->height + f - 1) >> scale, depth);
+  const uint32_t out_lsize = line_size(&r);
+
+  // two scanlines (of the widest pass) and an expanded scanline (sub-byte gray)
+  const size_t buffer_size = 2 * stream->lsize + hdr->width;
+  uint8_t *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to downscale", buffer_size);
+    exit(1);
   }
+  LOG_ALLOC("Malloc(%zu) downscale buffer %p", buffer_size, buffer);
+  uint8_t *expanded = buffer + 2 * stream->lsize;
+
+  for (uint8_t p = 0; p < nb_pass; p++) {
+    const uint8_t *grid = adam7_grid[p];
+    const uint32_t pass_width  = (hdr->width  > grid[0]) ? (hdr->width  - grid[0] + grid[2] - 1) / grid[2] : 0;
+    const uint32_t pass_height = (hdr->height > grid[1]) ? (hdr->height - grid[1] + grid[3] - 1) / grid[3] : 0;
+    if ((pass_width == 0) || (pass_height == 0)) {
+      LOG_INFO("Pass %d empty", p + 1);
+      continue;
+    }
+    const uint32_t pass_lsize = byte_per_line(hdr->depth, stream->sample, pass_width);
 
-  // data
-  struct image r = {
-    .width   = hdr->width,
-    .height  = hdr->height,
-    .depth   = hdr->depth,
-    .sample  = sample,
-    .palette = NULL,
-    .data    = data,
-  };
+    uint8_t *line  = buffer;
+    uint8_t *prior = NULL;
+
+    for (uint32_t i = 0; i < pass_height; i++) {
+      scanline_read_line(stream, line, prior, pass_lsize);
+
+      const uint8_t *src = line;
+      if (out_bits != in_bits) { // sub-byte gray
+        expand_row(line, pass_width, hdr->depth, EXPAND_GRAY, expanded);
+        src = expanded;
+      }
+      uint8_t *out = ((uint8_t *) r.data) + ((grid[1] + i * grid[3]) >> scale) * out_lsize;
+      for (uint32_t j = 0; j < pass_width; j++) {
+        copy_pixel(src, j, out, (grid[0] + j * grid[2]) >> scale, out_bits);
+      }
+      // swap
+      prior = line;
+      line = (line == buffer) ? buffer + stream->lsize : buffer;
+    }
+    LOG_INFO("Pass %d done", p + 1);
+  }
+
+  LOG_ALLOC("Free downscale buffer %p", buffer);
+  free(buffer);
   return r;
 }
 
 
 /**
  * @brief Unpack IDAT chunk, unfilter each passes from an interlace (ADAM7) image
- * @param[in] header Header chunk of the file
- * @param[in] fsize Size after fptr
- * @param[in] fptr Pointer to file content (first IDAT chunk)
+ * @param[in,out] stream Opened stream on the file
  * @param[out] pass Pointer to 7 images
  */
-static void passes_from_IDAT_adam7(const struct IHDR *hdr, uint32_t fsize, const uint8_t *fptr, struct image pass[ADAM7_NB_PASS]) {
+static void passes_from_stream_adam7(struct scanline_stream *stream, struct image pass[ADAM7_NB_PASS]) {
+  const struct IHDR *hdr = &(stream->header);
   assert(hdr->interlace == 1); // adam7
+  const struct icc_transform *profile = image_profile(stream); // one reference for the 7 passes
 
   // needed constants, compute sizes
   pass[0].width  = (hdr->width + 7) / 8; // divide by 8 (round up to one)
@@ -218,7 +544,7 @@ static void passes_from_IDAT_adam7(const struct IHDR *hdr, uint32_t fsize, const
             pass[1].width, pass[1].height, pass[2].width, pass[2].height, pass[3].width, pass[3].height,
             pass[4].width, pass[4].height, pass[5].width, pass[5].height, pass[6].width, pass[6].height);
 
-  const uint8_t sample = count_sample(hdr->color_type);
+  const uint8_t sample = stream->sample;
   uint32_t unpack_size = 0;
   uint32_t lsize[ADAM7_NB_PASS]; // lenght (in byte) of the line
 
@@ -238,20 +564,32 @@ static void passes_from_IDAT_adam7(const struct IHDR *hdr, uint32_t fsize, const
     // use this first loop to init passes
     pass[p].depth   = hdr->depth;
     pass[p].sample  = sample;
+    pass[p].native  = 0;
+    pass[p].gamma   = image_gamma(stream);
+    pass[p].profile = profile;
+    image_background(stream, pass + p);
 
   }
 
-  // malloc
-  void *unpack = malloc(unpack_size);
+  // malloc (palette shared by all passes, right after the data)
+  const int indexed = (hdr->color_type == PLTE_INDEX);
+  const uint32_t palette_size = indexed ? PALETTE_SIZE : 0;
+  void *unpack = malloc(unpack_size + palette_size);
   if (unpack == NULL) {
-    LOG_FATAL("Can't malloc(%d) to unpack image", unpack_size);
+    LOG_FATAL("Can't malloc(%d) to unpack image", unpack_size + palette_size);
     exit(1);
   }
-  LOG_ALLOC("Malloc(%d) packed interlace img %p", unpack_size, unpack);
-  unpack_IDAT(fsize, fptr, unpack_size, unpack); // unpack
+  LOG_ALLOC("Malloc(%d) packed interlace img %p", unpack_size + palette_size, unpack);
+  idat_read(&(stream->idat), unpack, unpack_size); // unpack
+
+  uint8_t *palette = NULL;
+  if (indexed) {
+    palette = ((uint8_t *) unpack) + unpack_size;
+    copy_palette(&(stream->plte), palette);
+  }
 
   // unfilter, remap, data
-  uint8_t bpp = (hdr->depth * sample + 7) / 8;
+  uint8_t bpp = stream->bpp;
   uint8_t *ptr = unpack; // current ptr to pass
 
   for (uint8_t p = 0; p < ADAM7_NB_PASS; p++) {
@@ -272,7 +610,7 @@ static void passes_from_IDAT_adam7(const struct IHDR *hdr, uint32_t fsize, const
         memcpy(dst, src, lsize[p]);
       }
       // data
-      pass[p].palette = NULL;
+      pass[p].palette = palette;
       pass[p].data    = ptr;
       // set ptr to next pass
       ptr += pass[p].height * (1 + lsize[p]);
@@ -290,78 +628,316 @@ uint32_t line_size(const struct image *image) {
 }
 
 
+/**
+ * @brief Decode the whole image (NO interlace image)
+ * @param[in] file
+ * @param[in] native Flag: put 16-bit samples in the native byte order
+ */
+static struct image decode_image(const struct mfile *file, uint8_t native) {
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+
+  // limitation
+  if (stream.header.interlace == 1) {
+    LOG_FATAL("Interlace ADAM7 not handle YET");
+    exit(1);
+  }
+
+  const struct image r = image_from_stream(&stream, native, NULL);
+  scanline_close(&stream);
+  return r;
+}
+
+
+enum decode_status check_header_limits(const struct IHDR *header, const struct decode_limits *limits) {
+  const uint64_t pixels = (uint64_t) header->width * header->height;
+  if ((limits->max_pixels > 0) && (pixels > limits->max_pixels)) {
+    return DECODE_TOO_MANY_PIXELS;
+  }
+  // byte_per_line counts the bits of a scanline on 32 bits
+  const uint64_t bits = (uint64_t) header->width * header->depth * count_sample(header->color_type);
+  if (bits > UINT32_MAX) {
+    return DECODE_OVER_BUDGET;
+  }
+  const uint64_t lsize = (bits + 7) / 8;
+  const uint64_t memory = lsize * header->height + ((header->color_type == PLTE_INDEX) ? PALETTE_SIZE : 0)
+                          + DECODE_INFLATE_MEMORY;
+  if (((limits->max_memory > 0) && (memory > limits->max_memory)) || (memory > SIZE_MAX)) {
+    return DECODE_OVER_BUDGET;
+  }
+  return DECODE_OK;
+}
+
+
+enum decode_status get_image_checked(const struct mfile *file, uint8_t native, const struct decode_limits *limits,
+                                     struct image *image) {
+  static const struct decode_limits none = {0, 0, 0, NULL};
+  if (limits == NULL) {
+    limits = &none;
+  }
+  struct decode_check check = {
+    .has_deadline = (limits->timeout_ms > 0),
+    .cancel       = limits->cancel,
+    .status       = DECODE_OK,
+  };
+  if (check.has_deadline) {
+    clock_gettime(CLOCK_MONOTONIC, &(check.deadline));
+    const uint64_t ns = check.deadline.tv_nsec + (uint64_t) (limits->timeout_ms % 1000) * 1000000;
+    check.deadline.tv_sec += limits->timeout_ms / 1000 + ns / 1000000000;
+    check.deadline.tv_nsec = ns % 1000000000;
+  }
+
+  // everything scanline_open could end the process on, then the budget, before the CRC of the chunks
+  if (!scanline_check(file)) {
+    return DECODE_CORRUPT;
+  }
+  const struct chunk first = get_chunk_unchecked(file->size - 8, ((const uint8_t *) file->data) + 8);
+  const struct IHDR header = IHDR_chunk(&first);
+  if (header.interlace == 1) {
+    return DECODE_INTERLACED;
+  }
+  enum decode_status status = check_header_limits(&header, limits);
+  if (status != DECODE_OK) {
+    return status;
+  }
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+  if (!decode_stopped(&check)) {
+    stream.idat.check     = decode_stopped;
+    stream.idat.check_arg = &check;
+    *image = image_from_stream(&stream, native, &check);
+  }
+  scanline_close(&stream);
+  return check.status;
+}
+
+
+uint8_t parse_decode_limit(const char *word, size_t length, struct decode_limits *limits) {
+  static const char *const names[3] = {"mpx", "mb", "ms"};
+  for (uint8_t k = 0; k < 3; k++) {
+    const size_t n = strlen(names[k]);
+    if ((length <= n) || (length > n + 9) || (strncmp(word, names[k], n) != 0)) {
+      continue;
+    }
+    uint32_t value = 0;
+    for (size_t i = n; i < length; i++) {
+      if ((word[i] < '0') || (word[i] > '9')) {
+        return 0;
+      }
+      value = value * 10 + (word[i] - '0');
+    }
+    switch (k) {
+    case 0:
+      limits->max_pixels = (uint64_t) value * 1000000;
+      break;
+    case 1:
+      limits->max_memory = (uint64_t) value << 20;
+      break;
+    default:
+      limits->timeout_ms = value;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+
+const char *decode_reason(enum decode_status status) {
+  static const char *const reasons[] = {"ok", "corrupt file", "interlaced", "too many pixels",
+                                        "over the memory budget", "deadline passed", "cancelled"};
+  return (status <= DECODE_CANCELLED) ? reasons[status] : "unknown";
+}
+
+
 const struct image get_image(const struct mfile *file) {
-  assert(mfile_is_png(file) == 1);
+  return decode_image(file, 0);
+}
+
 
-  // skip the 8 byte signature
-  uint32_t fsize = file->size - 8;
-  uint8_t *fptr  = ((uint8_t *) file->data) + 8;
+const struct image get_image_native(const struct mfile *file) {
+  return decode_image(file, 1);
+}
 
-  // get the header chunk
-  struct chunk current = get_chunk(fsize, fptr);
-  const struct IHDR header = IHDR_chunk(&current);
 
+const struct image get_image_crop(const struct mfile *file, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+  return get_image_crop_indexed(file, NULL, x, y, width, height);
+}
+
+
+const struct image get_image_crop_indexed(const struct mfile *file, const struct idat_index *index,
+                                          uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+  const struct IHDR *hdr = &(stream.header);
 
   // limitation
-  if (header.color_type == PLTE_INDEX) {
-    LOG_FATAL("Color type (PLTE) not handle YET");
+  if (hdr->interlace == 1) {
+    LOG_FATAL("Interlace ADAM7 not handle YET");
     exit(1);
   }
-  if (header.interlace == 1) {
-    LOG_FATAL("Interlace ADAM7 not handle YET");
+  if ((width == 0) || (height == 0) || (x > hdr->width - width) || (y > hdr->height - height)
+      || (width > hdr->width) || (height > hdr->height)) {
+    LOG_FATAL("Crop [%d,%d] at (%d,%d) out of the image [%d,%d]", width, height, x, y, hdr->width, hdr->height);
+    exit(1);
+  }
+
+  struct image r = alloc_image(&stream, width, height, hdr->depth);
+  const uint32_t bit_per_pixel = hdr->depth * stream.sample;
+  const uint32_t crop_lsize = line_size(&r);
+
+  // rolling two scanlines buffer
+  uint8_t *rows = malloc(2 * stream.lsize);
+  if (rows == NULL) {
+    LOG_FATAL("Can't malloc(%d) for two scanlines", 2 * stream.lsize);
     exit(1);
   }
+  LOG_ALLOC("Malloc(%d) scanlines at %p", 2 * stream.lsize, rows);
 
-  // find the first IDAT chunk
-  while (current.type != IDAT) {
-    fsize -= (current.length + 12); // chunk size
-    fptr  += (current.length + 12);
-    current = get_chunk(fsize, fptr);
+  uint8_t *prior = rows + stream.lsize;
+  uint8_t *line  = rows;
+
+  // lines above the crop (from the nearest checkpoint if any)
+  index_seek(&stream, file, index, y, prior);
+
+  for (uint32_t i = y; i < y + height; i++) {
+    scanline_read(&stream, line, prior);
+
+    // copy only the needed columns
+    uint8_t *dst = ((uint8_t *) r.data) + (i - y) * crop_lsize;
+    copy_bits(line, x * bit_per_pixel, width * bit_per_pixel, dst);
+
+    // swap
+    uint8_t *tmp = prior;
+    prior = line;
+    line = tmp;
   }
-  return image_from_IDAT(&header, fsize, fptr);
+  scanline_close(&stream); // the rest is never inflated
+
+  LOG_ALLOC("Free scanlines %p", rows);
+  free(rows);
+  return r;
+}
+
+
+const struct image get_image_scaled(const struct mfile *file, uint8_t scale) {
+  assert((1 <= scale) && (scale <= 3));
+
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+
+  const struct image r = (stream.header.interlace == 1) ?
+    image_scaled_adam7(&stream, scale) : image_scaled_box(&stream, scale);
+
+  scanline_close(&stream); // Adam7: last passes are never inflated
+  return r;
 }
 
 
 void free_image(const struct image *image) {
   LOG_ALLOC("Free image %p", image->data);
   free(image->data);
+  icc_release(image->profile);
 }
 
 
 
-void get_adam7_passes(const struct mfile *file, struct image pass[ADAM7_NB_PASS]) {
-  assert(mfile_is_png(file) == 1);
-
-  // skip the 8 byte signature
-  uint32_t fsize = file->size - 8;
-  uint8_t *fptr  = ((uint8_t *) file->data) + 8;
+void image_stream_open(struct image_stream *is, const struct mfile *file, uint32_t band_rows, uint8_t native) {
+  assert(band_rows > 0);
+  scanline_open(&(is->stream), file);
+  const struct IHDR *hdr = &(is->stream.header);
 
-  // get the header chunk
-  struct chunk current = get_chunk(fsize, fptr);
-  const struct IHDR header = IHDR_chunk(&current);
-
-  if (header.interlace != 1) {
-    LOG_FATAL("Ask to get passes from a non interlaced (ADAM7) image %s", file->pathname);
+  // limitation
+  if (hdr->interlace == 1) {
+    LOG_FATAL("Interlace ADAM7 not handle YET");
     exit(1);
   }
 
-  // limitation
-  if (header.color_type == PLTE_INDEX) {
-    LOG_FATAL("Color type (PLTE) not handle YET");
+  is->band_rows = (band_rows < hdr->height) ? band_rows : hdr->height;
+  is->row0 = 0;
+  is->next = 0;
+  is->band = image_info(&(is->stream), hdr->width, 0, hdr->depth);
+  is->band.native = native && (hdr->depth == 16);
+
+  // two bands, the prior scanline and the palette in one mapping
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t lsize = is->stream.lsize;
+  is->buffer_size = (((size_t) is->band_rows * lsize + page - 1) / page) * page;
+  const size_t size = 2 * is->buffer_size + lsize + PALETTE_SIZE;
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    LOG_FATAL("Can't mmap(%zu) to decode %s by bands", size, file->pathname);
     exit(1);
   }
+  LOG_ALLOC("Mmap(%zu) image stream %p", size, map);
+  is->buffer[0] = map;
+  is->buffer[1] = map + is->buffer_size;
+  is->prior     = map + 2 * is->buffer_size;
+
+  if (hdr->color_type == PLTE_INDEX) {
+    is->band.palette = is->prior + lsize;
+    copy_palette(&(is->stream.plte), is->band.palette);
+  }
+}
+
 
-  // find the first IDAT chunk
-  while (current.type != IDAT) {
-    fsize -= (current.length + 12); // chunk size
-    fptr  += (current.length + 12);
-    current = get_chunk(fsize, fptr);
+uint32_t image_stream_read(struct image_stream *is) {
+  const uint32_t height = is->stream.header.height;
+  const uint32_t lsize  = is->stream.lsize;
+  is->row0 += is->band.height;
+  if (is->row0 >= height) {
+    is->band.height = 0;
+    return 0;
+  }
+  const uint32_t nrows = (height - is->row0 < is->band_rows) ? height - is->row0 : is->band_rows;
+  uint8_t *data = is->buffer[is->next];
+  is->next ^= 1;
+
+  // same as image_from_stream, the last row is kept in the file byte order for the next band
+  const uint8_t *prior = (is->row0 == 0) ? NULL : is->prior;
+  uint8_t *line = data;
+  for (uint32_t i = 0; i < nrows; i++) {
+    scanline_read(&(is->stream), line, prior);
+    if (is->band.native && (i > 0)) {
+      samples_to_native(line - lsize, lsize / 2);
+    }
+    prior = line;
+    line += lsize;
+  }
+  memcpy(is->prior, prior, lsize);
+  if (is->band.native) {
+    samples_to_native(line - lsize, lsize / 2);
+  }
+
+  is->band.height = nrows;
+  is->band.data   = data;
+  return nrows;
+}
+
+
+void image_stream_close(struct image_stream *is) {
+  scanline_close(&(is->stream));
+  icc_release(is->band.profile);
+  const size_t size = 2 * is->buffer_size + is->stream.lsize + PALETTE_SIZE;
+  LOG_ALLOC("Munmap image stream %p", is->buffer[0]);
+  munmap(is->buffer[0], size);
+}
+
+
+void get_adam7_passes(const struct mfile *file, struct image pass[ADAM7_NB_PASS]) {
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+
+  if (stream.header.interlace != 1) {
+    LOG_FATAL("Ask to get passes from a non interlaced (ADAM7) image %s", file->pathname);
+    exit(1);
   }
-  passes_from_IDAT_adam7(&header, fsize, fptr, pass);
+  passes_from_stream_adam7(&stream, pass);
+  scanline_close(&stream);
 }
 
 
 void free_passes(struct image pass[ADAM7_NB_PASS]) {
+  icc_release(pass[0].profile); // shared by the passes
   for (uint8_t p = 0; p < ADAM7_NB_PASS; p++) {
     // free the first non-NULL pass[p].data
     if (pass[p].data != NULL) {
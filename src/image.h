@@ -8,11 +8,20 @@
 #ifndef __IMAGE_H__
 #define __IMAGE_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "index.h"
 #include "mfile.h"
+#include "stream.h"
 
 
+/** @brief Transform of an ICC profile (see icc.h) */
+struct icc_transform;
+
+/** @brief Size of a full palette (256 RGB colors) */
+#define PALETTE_SIZE (256 * 3)
+
 /**
  * @brief Image struct
  */
@@ -25,7 +34,17 @@ struct image {
   uint8_t depth;
   /** @brief Number of sample of pixel */
   uint8_t sample;
-  /** @brief PLTE pointer or NULL (no control on the palette size) */
+  /** @brief Flag: 16-bit samples are in the native byte order (big endian as in the file otherwise) */
+  uint8_t native;
+  /** @brief Encoding gamma of the samples times 100000 (gAMA), 0 for the sRGB curve (sRGB chunk or no gAMA) */
+  uint32_t gamma;
+  /** @brief Transform of the ICC profile, a reference dropped by free_image (NULL if none or unsupported) */
+  const struct icc_transform *profile;
+  /** @brief Flag: the file has a background color (bKGD) */
+  uint8_t has_background;
+  /** @brief Background color as 16-bit red, green, blue (valid only if has_background) */
+  uint16_t background[3];
+  /** @brief Palette of 256 RGB colors (missing colors are black) or NULL */
   uint8_t *palette;
   /** @brief Image data (pixels or index) */
   void *data;
@@ -48,13 +67,189 @@ uint32_t line_size(const struct image *image);
 const struct image get_image(const struct mfile *file);
 
 /**
- * @brief Free the image
+ * @brief Same as get_image, but 16-bit samples are put in the native byte order during the decode
+ * @details Each scanline is swapped right after the next one is unfiltered (filters work on
+ * the file byte order), while it is still in cache. Later reads of the samples need no ntohs.
+ * @param[in] file A PNG file which may be free right after
+ * @return The image with .native set for 16-bit images
+ */
+const struct image get_image_native(const struct mfile *file);
+
+
+
+/**
+ * @brief Why get_image_checked gave no image
+ */
+enum decode_status {
+  /** @brief Decoded */
+  DECODE_OK = 0,
+  /** @brief Wrong chunks or compressed data (see scanline_check) */
+  DECODE_CORRUPT = 1,
+  /** @brief Interlaced image, not decoded */
+  DECODE_INTERLACED = 2,
+  /** @brief More pixels than limits->max_pixels */
+  DECODE_TOO_MANY_PIXELS = 3,
+  /** @brief Image bigger than limits->max_memory, or no memory for it */
+  DECODE_OVER_BUDGET = 4,
+  /** @brief Not done before limits->timeout_ms */
+  DECODE_DEADLINE = 5,
+  /** @brief The cancel flag was set */
+  DECODE_CANCELLED = 6,
+};
+
+/** @brief Memory counted for the inflate state by the budget of decode_limits */
+#define DECODE_INFLATE_MEMORY (1U << 16)
+
+/**
+ * @brief Budget of a decode, 0 (or NULL) for no limit
+ */
+struct decode_limits {
+  /** @brief Max width x height */
+  uint64_t max_pixels;
+  /** @brief Max bytes allocated: pixels, palette and DECODE_INFLATE_MEMORY */
+  uint64_t max_memory;
+  /** @brief Time allowed from the call, in milliseconds */
+  uint32_t timeout_ms;
+  /** @brief Flag set by another thread to stop the decode */
+  const uint8_t *cancel;
+};
+
+/**
+ * @brief Check an image header against a budget
+ * @param[in] header
+ * @param[in] limits
+ * @return DECODE_OK, DECODE_TOO_MANY_PIXELS or DECODE_OVER_BUDGET
+ */
+enum decode_status check_header_limits(const struct IHDR *header, const struct decode_limits *limits);
+
+/**
+ * @brief Same as get_image (or get_image_native), but fails instead of ending the process
+ * @details The chunks are checked (scanline_check) and the header against the limits before anything
+ * is allocated. The deadline and the cancel flag are checked before each scanline and each IDAT chunk,
+ * so a decode stops within a scanline or a chunk of inflate. On failure nothing is left allocated.
+ * @param[in] file A file which may be free right after
+ * @param[in] native Flag: put 16-bit samples in the native byte order
+ * @param[in] limits Budget or NULL for none
+ * @param[out] image The image if DECODE_OK (free it with free_image)
+ * @return DECODE_OK or why there is no image
+ */
+enum decode_status get_image_checked(const struct mfile *file, uint8_t native, const struct decode_limits *limits,
+                                     struct image *image);
+
+/**
+ * @brief Read a word of limit: mpx<N> (megapixels), mb<N> (MB) or ms<N> (timeout), 0 for none
+ * @param[in] word Start of the word
+ * @param[in] length Length of the word
+ * @param[in,out] limits The limit of the word is set
+ * @return 1 if the word is a limit, 0 otherwise
+ */
+uint8_t parse_decode_limit(const char *word, size_t length, struct decode_limits *limits);
+
+/**
+ * @brief Reason of a status, for messages
+ * @param[in] status
+ * @return A constant string
+ */
+const char *decode_reason(enum decode_status status);
+
+/**
+ * @brief Get only a crop of the image (NO interlace image)
+ * @details Inflating stops right after the last line of the crop, lines above are unfiltered
+ * in a two lines buffer and only the crop is allocated
+ * @param[in] file A PNG file which may be free right after
+ * @param[in] x First column of the crop
+ * @param[in] y First line of the crop
+ * @param[in] width Number of column (x + width <= image width)
+ * @param[in] height Number of line (y + height <= image height)
+ * @return The cropped image (free it with free_image)
+ */
+const struct image get_image_crop(const struct mfile *file, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+/**
+ * @brief Get only a crop of the image, inflating from the nearest checkpoint above the crop
+ * @details Same as get_image_crop but lines above the last checkpoint before y are never inflated,
+ * so the time does not depend on the position of the crop
+ * @param[in] file A PNG file which may be free right after
+ * @param[in] index Index of the file (see build_index) or NULL
+ * @param[in] x First column of the crop
+ * @param[in] y First line of the crop
+ * @param[in] width Number of column (x + width <= image width)
+ * @param[in] height Number of line (y + height <= image height)
+ * @return The cropped image (free it with free_image)
+ */
+const struct image get_image_crop_indexed(const struct mfile *file, const struct idat_index *index,
+                                          uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+/**
+ * @brief Get the image downscaled by 2, 4 or 8 (thumbnail)
+ * @details Without interlace, each box of pixels is averaged as soon as its lines are unfiltered,
+ * so the full image is never allocated (palette index are not averaged: top left pixel of the box).
+ * With Adam7, only the first passes are inflated (1 for 1/8, 1-3 for 1/4, 1-5 for 1/2).
+ * Sub-byte grayscale images come out on 8 bits.
+ * @param[in] file A PNG file which may be free right after
+ * @param[in] scale The image is divided by 2^scale (1, 2 or 3)
+ * @return The image of size ceil(width / 2^scale) x ceil(height / 2^scale) (free it with free_image)
+ */
+const struct image get_image_scaled(const struct mfile *file, uint8_t scale);
+
+/**
+ * @brief Free the image (and its reference on the ICC transform)
  * @param[in] image The image to free
  */
 void free_image(const struct image *image);
 
 
 
+/**
+ * @brief Image decoded a band of rows at a time (NO interlace image)
+ * @details Two band buffers are used in turn, so a band stays untouched while the next one is decoded.
+ * Buffers are mapped pages (not malloc'd): a band given to a pipe with vmsplice can't be reused by
+ * the allocator, even after image_stream_close.
+ */
+struct image_stream {
+  /** @brief Scanline reader of the file */
+  struct scanline_stream stream;
+  /** @brief The current band: rows of the image from row0, .height is the number of rows */
+  struct image band;
+  /** @brief First row of the band in the image */
+  uint32_t row0;
+  /** @brief Max number of rows in a band */
+  uint32_t band_rows;
+  /** @brief Size of each band buffer (whole pages) */
+  size_t buffer_size;
+  /** @brief The two band buffers */
+  uint8_t *buffer[2];
+  /** @brief Buffer of the next band (0 or 1) */
+  uint8_t next;
+  /** @brief Last row of the previous band in the file byte order (needed to unfilter) */
+  uint8_t *prior;
+};
+
+/**
+ * @brief Get ready to decode the image band by band
+ * @param[out] is
+ * @param[in] file A PNG file without interlace (must stay mapped until image_stream_close)
+ * @param[in] band_rows Max number of rows of a band (> 0)
+ * @param[in] native Flag: put 16-bit samples in the native byte order
+ */
+void image_stream_open(struct image_stream *is, const struct mfile *file, uint32_t band_rows, uint8_t native);
+
+/**
+ * @brief Decode the next band
+ * @details The band of the previous call stays valid, the one before is overwritten
+ * @param[in,out] is
+ * @return Number of rows in is->band (0 once every row is decoded)
+ */
+uint32_t image_stream_read(struct image_stream *is);
+
+/**
+ * @brief Stop decoding and free the buffers
+ * @param[in,out] is
+ */
+void image_stream_close(struct image_stream *is);
+
+
+
 /** @brief Number of passes in the Adam7 interlace */
 #define ADAM7_NB_PASS (7U)
 
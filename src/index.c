@@ -0,0 +1,384 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "index.h"
+#include "log.h"
+
+
+/** @brief Magic bytes at the beginning of a sidecar file */
+static const char index_magic[8] = {'P', 'L', 'T', 'E', 'I', 'D', 'X', '1'};
+
+
+/**
+ * @brief Record a checkpoint at the current deflate block boundary
+ * @param[in,out] index Index to append the checkpoint to
+ * @param[in] stream Stream right after a block
+ * @param[in] file The indexed file
+ * @param[in] row Scanline being inflated
+ * @param[in] partial First bytes of the scanline row (with the filter type-byte)
+ * @param[in] offset Number of bytes in partial
+ * @param[in] prior Unfiltered scanline row - 1
+ * @param[in] window Circular window of the last inflated bytes
+ * @param[in] wpos Next position to write in window
+ * @param[in] total Number of bytes inflated from the beginning
+ * @return 1 if the checkpoint is recorded, 0 if this boundary can't be a checkpoint
+ */
+static int add_point(struct idat_index *index, const struct scanline_stream *stream, const struct mfile *file,
+                     uint32_t row, const uint8_t *partial, uint32_t offset, const uint8_t *prior,
+                     const uint8_t *window, uint32_t wpos, uint64_t total) {
+
+  const z_stream *zs = &(stream->idat.zstream);
+  const uint8_t *chunk_data = stream->idat.fptr + 8; // skip length and type
+  const uint32_t in = zs->next_in - chunk_data;
+  const uint8_t bits = zs->data_type & 7;
+
+  if ((bits > 0) && (in == 0)) {
+    return 0; // the previous byte is in the previous chunk, wait for the next boundary
+  }
+
+  const uint32_t wsize = (total < INDEX_WINDOW_SIZE) ? total : INDEX_WINDOW_SIZE;
+  uint8_t *data = malloc(wsize + index->lsize + offset);
+  if (data == NULL) {
+    LOG_FATAL("Can't malloc(%d) for a checkpoint", wsize + index->lsize + offset);
+    exit(1);
+  }
+
+  // unwrap the window
+  if (total < INDEX_WINDOW_SIZE) {
+    memcpy(data, window, wsize);
+  } else {
+    memcpy(data, window + wpos, INDEX_WINDOW_SIZE - wpos);
+    memcpy(data + INDEX_WINDOW_SIZE - wpos, window, wpos);
+  }
+  memcpy(data + wsize, prior, index->lsize);
+  memcpy(data + wsize + index->lsize, partial, offset);
+
+  if ((index->nb_point & (index->nb_point - 1)) == 0) { // power of 2 (or 0), double the array
+    uint32_t capacity = (index->nb_point == 0) ? 8 : 2 * index->nb_point;
+    struct index_point *point = realloc(index->point, capacity * sizeof(struct index_point));
+    if (point == NULL) {
+      LOG_FATAL("Can't realloc %d checkpoints", capacity);
+      exit(1);
+    }
+    index->point = point;
+  }
+
+  struct index_point *p = index->point + index->nb_point;
+  p->row     = row;
+  p->offset  = offset;
+  p->chunk   = stream->idat.fptr - (const uint8_t *) file->data;
+  p->in      = in;
+  p->bits    = bits;
+  p->byte    = (bits > 0) ? zs->next_in[-1] : 0;
+  p->wsize   = wsize;
+  p->window  = data;
+  p->prior   = data + wsize;
+  p->partial = data + wsize + index->lsize;
+  index->nb_point++;
+
+  LOG_DEBUG("Checkpoint %d: row %d + %d byte, chunk %llu + %d, %d bits",
+            index->nb_point, row, offset, (unsigned long long) p->chunk, in, bits);
+  return 1;
+}
+
+
+
+void build_index(const struct mfile *file, uint32_t span, struct idat_index *index) {
+  assert(span > 0);
+
+  struct scanline_stream stream;
+  scanline_open(&stream, file);
+
+  if (stream.header.interlace != 0) {
+    LOG_FATAL("Can't index an interlaced image %s", file->pathname);
+    exit(1);
+  }
+
+  index->header   = stream.header;
+  index->span     = span;
+  index->lsize    = stream.lsize;
+  index->nb_point = 0;
+  index->point    = NULL;
+
+  // window, current and previous scanlines (with the filter type-byte)
+  const uint32_t length = 1 + stream.lsize;
+  uint8_t *buffer = malloc(INDEX_WINDOW_SIZE + 2 * length);
+  if (buffer == NULL) {
+    LOG_FATAL("Can't malloc(%d) to index", INDEX_WINDOW_SIZE + 2 * length);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc(%d) index buffer %p", INDEX_WINDOW_SIZE + 2 * length, buffer);
+
+  uint8_t *window = buffer;
+  uint8_t *raw    = buffer + INDEX_WINDOW_SIZE;
+  uint8_t *prior  = raw + length;
+
+  uint64_t total  = 0; // inflated bytes
+  uint32_t wpos   = 0; // position in the window
+  uint32_t filled = 0; // bytes of the current scanline
+  uint32_t row    = 0; // current scanline
+  uint32_t next   = span; // next scanline to checkpoint
+
+  while (row < stream.header.height) {
+
+    uint32_t n = idat_read_block(&(stream.idat), window + wpos, INDEX_WINDOW_SIZE - wpos);
+    if ((n == 0) && stream.idat.end) {
+      LOG_FATAL("Inflating IDAT stops at scanline %d/%d", row, stream.header.height);
+      exit(1);
+    }
+
+    // cut the inflated bytes in scanlines
+    const uint8_t *src = window + wpos;
+    uint32_t left = n;
+
+    while ((left > 0) && (row < stream.header.height)) {
+      uint32_t k = (left < length - filled) ? left : length - filled;
+      memcpy(raw + filled, src, k);
+      filled += k;
+      src    += k;
+      left   -= k;
+
+      if (filled == length) {
+        unfilter_line(raw[0], raw + 1, (row == 0) ? NULL : prior + 1, stream.lsize, stream.bpp);
+        uint8_t *tmp = prior;
+        prior = raw;
+        raw = tmp;
+        filled = 0;
+        row++;
+      }
+    }
+    total += n;
+    wpos  += n;
+    if (wpos == INDEX_WINDOW_SIZE) {
+      wpos = 0;
+    }
+
+    // end of a deflate block (not the last one)
+    int data_type = stream.idat.zstream.data_type;
+    if ((data_type & 128) && !(data_type & 64) && (row >= next) && (row < stream.header.height)) {
+      if (add_point(index, &stream, file, row, raw, filled, prior + 1, window, wpos, total)) {
+        next = row + span;
+      }
+    }
+  }
+  scanline_close(&stream);
+
+  LOG_ALLOC("Free index buffer %p", buffer);
+  free(buffer);
+  LOG_INFO("%d checkpoints for %d scanlines", index->nb_point, index->header.height);
+}
+
+
+void free_index(struct idat_index *index) {
+  for (uint32_t p = 0; p < index->nb_point; p++) {
+    free(index->point[p].window); // window, prior and partial in one area
+  }
+  free(index->point);
+  index->point = NULL;
+  index->nb_point = 0;
+}
+
+
+
+
+/**
+ * @brief Write a 32 bits value (network order)
+ */
+static void write_u32(FILE *f, uint32_t value) {
+  uint32_t v = htonl(value);
+  fwrite(&v, sizeof(v), 1, f);
+}
+
+/**
+ * @brief Read a 32 bits value (network order)
+ */
+static uint32_t read_u32(FILE *f, const char *pathname) {
+  uint32_t v;
+  if (fread(&v, sizeof(v), 1, f) != 1) {
+    LOG_FATAL("Truncated index file %s", pathname);
+    exit(1);
+  }
+  return ntohl(v);
+}
+
+/**
+ * @brief Read exactly size bytes
+ */
+static void read_bytes(FILE *f, void *dst, uint32_t size, const char *pathname) {
+  if ((size > 0) && (fread(dst, size, 1, f) != 1)) {
+    LOG_FATAL("Truncated index file %s", pathname);
+    exit(1);
+  }
+}
+
+
+void save_index(const struct idat_index *index, const char *pathname) {
+  FILE *f = fopen(pathname, "wb");
+  if (f == NULL) {
+    LOG_FATAL("Can't open %s to write the index", pathname);
+    exit(1);
+  }
+
+  fwrite(index_magic, sizeof(index_magic), 1, f);
+  write_u32(f, index->header.width);
+  write_u32(f, index->header.height);
+  write_u32(f, index->header.depth);
+  write_u32(f, index->header.color_type);
+  write_u32(f, index->span);
+  write_u32(f, index->lsize);
+  write_u32(f, index->nb_point);
+
+  for (uint32_t p = 0; p < index->nb_point; p++) {
+    const struct index_point *point = index->point + p;
+    write_u32(f, point->row);
+    write_u32(f, point->offset);
+    write_u32(f, point->chunk >> 32);
+    write_u32(f, point->chunk & 0xffffffff);
+    write_u32(f, point->in);
+    write_u32(f, (point->bits << 8) | point->byte);
+    write_u32(f, point->wsize);
+    fwrite(point->window, 1, point->wsize + index->lsize + point->offset, f);
+  }
+
+  if (ferror(f) || (fclose(f) != 0)) {
+    LOG_FATAL("Can't write the index in %s", pathname);
+    exit(1);
+  }
+  LOG_INFO("Write %d checkpoints in %s", index->nb_point, pathname);
+}
+
+
+void load_index(const char *pathname, struct idat_index *index) {
+  FILE *f = fopen(pathname, "rb");
+  if (f == NULL) {
+    LOG_FATAL("Can't open the index %s", pathname);
+    exit(1);
+  }
+
+  char magic[sizeof(index_magic)];
+  read_bytes(f, magic, sizeof(magic), pathname);
+  if (memcmp(magic, index_magic, sizeof(magic)) != 0) {
+    LOG_FATAL("%s is not an index file", pathname);
+    exit(1);
+  }
+
+  index->header.width       = read_u32(f, pathname);
+  index->header.height      = read_u32(f, pathname);
+  index->header.depth       = read_u32(f, pathname);
+  index->header.color_type  = read_u32(f, pathname);
+  index->header.compression = 0;
+  index->header.filter      = 0;
+  index->header.interlace   = 0;
+  index->span     = read_u32(f, pathname);
+  index->lsize    = read_u32(f, pathname);
+  index->nb_point = read_u32(f, pathname);
+  index->point    = malloc(index->nb_point * sizeof(struct index_point));
+  if ((index->point == NULL) && (index->nb_point > 0)) {
+    LOG_FATAL("Can't malloc %d checkpoints", index->nb_point);
+    exit(1);
+  }
+
+  for (uint32_t p = 0; p < index->nb_point; p++) {
+    struct index_point *point = index->point + p;
+    point->row    = read_u32(f, pathname);
+    point->offset = read_u32(f, pathname);
+    point->chunk  = ((uint64_t) read_u32(f, pathname)) << 32;
+    point->chunk |= read_u32(f, pathname);
+    point->in     = read_u32(f, pathname);
+    uint32_t bits = read_u32(f, pathname);
+    point->bits   = bits >> 8;
+    point->byte   = bits & 0xff;
+    point->wsize  = read_u32(f, pathname);
+
+    if ((point->wsize > INDEX_WINDOW_SIZE) || (point->offset > index->lsize + 1)) {
+      LOG_FATAL("Corrupted checkpoint %d in %s", p, pathname);
+      exit(1);
+    }
+    uint32_t size = point->wsize + index->lsize + point->offset;
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+      LOG_FATAL("Can't malloc(%d) for a checkpoint", size);
+      exit(1);
+    }
+    read_bytes(f, data, size, pathname);
+    point->window  = data;
+    point->prior   = data + point->wsize;
+    point->partial = data + point->wsize + index->lsize;
+  }
+  fclose(f);
+  LOG_INFO("Read %d checkpoints from %s", index->nb_point, pathname);
+}
+
+
+
+
+void index_seek(struct scanline_stream *stream, const struct mfile *file, const struct idat_index *index,
+                uint32_t row, uint8_t *prior) {
+  assert(stream->row == 0);
+  assert(row <= stream->header.height);
+
+  // last checkpoint strictly before row (its scanline is finished here)
+  const struct index_point *point = NULL;
+
+  if (index != NULL) {
+    const struct IHDR *hdr = &(stream->header);
+    if ((index->header.width != hdr->width) || (index->header.height != hdr->height)
+        || (index->header.depth != hdr->depth) || (index->header.color_type != hdr->color_type)
+        || (index->lsize != stream->lsize)) {
+      LOG_FATAL("The index doesn't match %s", file->pathname);
+      exit(1);
+    }
+    uint32_t low = 0;
+    uint32_t high = index->nb_point;
+    while (low < high) { // first checkpoint >= row
+      uint32_t middle = (low + high) / 2;
+      if (index->point[middle].row < row) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    if (low > 0) {
+      point = index->point + low - 1;
+    }
+  }
+
+  const uint32_t length = 1 + stream->lsize;
+  uint8_t *buffer = malloc(length);
+  if (buffer == NULL) {
+    LOG_FATAL("Can't malloc(%d) to seek", length);
+    exit(1);
+  }
+
+  if (point != NULL) {
+    idat_resume(&(stream->idat), file->size - point->chunk, ((const uint8_t *) file->data) + point->chunk,
+                point->in, point->bits, point->byte, point->window, point->wsize);
+
+    // finish the scanline of the checkpoint
+    memcpy(buffer, point->partial, point->offset);
+    idat_read(&(stream->idat), buffer + point->offset, length - point->offset);
+    memcpy(prior, point->prior, stream->lsize);
+    unfilter_line(buffer[0], buffer + 1, (point->row == 0) ? NULL : prior, stream->lsize, stream->bpp);
+    memcpy(prior, buffer + 1, stream->lsize);
+    stream->row = point->row + 1;
+    LOG_INFO("Seek from checkpoint at scanline %d to %d", point->row, row);
+  }
+
+  // scanlines up to row - 1, the last one ends in prior
+  uint8_t *last = prior;
+  uint8_t *line = buffer;
+  while (stream->row < row) {
+    scanline_read(stream, line, last);
+    uint8_t *tmp = last;
+    last = line;
+    line = tmp;
+  }
+  if (last != prior) {
+    memcpy(prior, last, stream->lsize);
+  }
+  free(buffer);
+}
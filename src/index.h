@@ -0,0 +1,112 @@
+/**
+ * @file index.h
+ * @brief Random access into the IDAT stream (NO interlace image)
+ * @details One pass over the image records checkpoints at deflate block boundaries every span scanlines,
+ * like [zran](https://github.com/madler/zlib/blob/master/examples/zran.c).
+ * A checkpoint holds the position in the compressed stream, the last 32 KiB inflated (the deflate window),
+ * the previous unfiltered scanline and the start of the current one, which is all it takes
+ * to inflate and unfilter from there. The index can be saved in a sidecar file.
+ */
+
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stdint.h>
+
+#include "mfile.h"
+#include "stream.h"
+
+
+/** @brief Size of the deflate window */
+#define INDEX_WINDOW_SIZE (32768U)
+
+/** @brief Default number of scanlines between two checkpoints */
+#define DEFAULT_INDEX_SPAN (64U)
+
+
+/**
+ * @brief Checkpoint in the IDAT stream
+ */
+struct index_point {
+  /** @brief Scanline being inflated at the checkpoint */
+  uint32_t row;
+  /** @brief Number of bytes of the scanline (with the filter type-byte) already inflated */
+  uint32_t offset;
+  /** @brief Offset in the file of the IDAT chunk holding the next compressed byte */
+  uint64_t chunk;
+  /** @brief Offset of the next compressed byte in the chunk data */
+  uint32_t in;
+  /** @brief Number of unused bits in the previous compressed byte */
+  uint8_t bits;
+  /** @brief The previous compressed byte */
+  uint8_t byte;
+  /** @brief Size of the window (less than INDEX_WINDOW_SIZE at the beginning of the stream) */
+  uint32_t wsize;
+  /** @brief Last bytes inflated before the checkpoint */
+  uint8_t *window;
+  /** @brief Unfiltered scanline row - 1 (meaningless if row is 0) */
+  uint8_t *prior;
+  /** @brief The offset first bytes of the scanline row */
+  uint8_t *partial;
+};
+
+/**
+ * @brief Index of the IDAT stream of a file
+ */
+struct idat_index {
+  /** @brief Header of the indexed file (to check the index matches the file) */
+  struct IHDR header;
+  /** @brief Number of scanlines between two checkpoints */
+  uint32_t span;
+  /** @brief Length of a scanline (without the filter type-byte) */
+  uint32_t lsize;
+  /** @brief Number of checkpoints */
+  uint32_t nb_point;
+  /** @brief Checkpoints sorted by row */
+  struct index_point *point;
+};
+
+
+/**
+ * @brief Inflate and unfilter the whole file once to build its index
+ * @param[in] file A PNG file without interlace
+ * @param[in] span Number of scanlines between two checkpoints (> 0)
+ * @param[out] index The index (free it with free_index)
+ */
+void build_index(const struct mfile *file, uint32_t span, struct idat_index *index);
+
+/**
+ * @brief Free the checkpoints of an index
+ * @param[in] index
+ */
+void free_index(struct idat_index *index);
+
+/**
+ * @brief Write the index in a sidecar file
+ * @param[in] index
+ * @param[in] pathname File to write
+ */
+void save_index(const struct idat_index *index, const char *pathname);
+
+/**
+ * @brief Read the index from a sidecar file
+ * @param[in] pathname File written by save_index
+ * @param[out] index The index (free it with free_index)
+ */
+void load_index(const char *pathname, struct idat_index *index);
+
+/**
+ * @brief Move a stream to a scanline from the nearest checkpoint before it
+ * @details Scanlines between the checkpoint and row are inflated and unfiltered, earlier ones are never read
+ * @param[in,out] stream Stream just opened with scanline_open on file
+ * @param[in] file The indexed file
+ * @param[in] index Index of file (NULL to read from the beginning)
+ * @param[in] row The next scanline to read
+ * @param[out] prior Area of stream->lsize bytes, filled with the unfiltered scanline row - 1 (if row > 0)
+ */
+void index_seek(struct scanline_stream *stream, const struct mfile *file, const struct idat_index *index,
+                uint32_t row, uint8_t *prior);
+
+
+
+#endif // __INDEX_H__
@@ -5,17 +5,30 @@
  */
 
 #include <assert.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
+#include "bmp.h"
 #include "cli.h"
 #include "chunk.h"
 #include "image.h"
+#include "index.h"
 #include "log.h"
 #include "mfile.h"
+#include "optimize.h"
+#include "png.h"
+#include "pnm.h"
 #include "print.h"
+#include "quantize.h"
+#include "rewrite.h"
+#include "serve.h"
+#include "transcode.h"
+#ifndef HEADLESS
 #include "viewer.h"
+#endif
 
 
 /** @brief max size of buffer */
@@ -62,9 +75,35 @@ int main(int argc, char *argv[]) {
     printf("wrong command line\n");
     return 1;
 
-  case CMD_PLTE:
-    printf("Not handled yet\n");
+  case CMD_BATCH: {
+    // the file is the source of the list
+    struct batch_options options;
+    if (!parse_batch(opt_param, &options)) {
+      printf("wrong batch options %s\n", opt_param);
+      return 1;
+    }
+    uint32_t nb;
+    char **files = list_batch(file_name, &nb);
+    const struct batch_stats stats = run_batch(files, nb, &options, print_batch_result);
+    print_batch_stats(&stats);
+    free_batch_list(files, nb);
+    return ((nb == 0) || (stats.nb_failed > 0));
+  }
+
+  case CMD_SERVE: {
+    // the file is the path of the socket
+    struct serve_options options;
+    if (!parse_serve(opt_param, &options)) {
+      printf("wrong serve options %s\n", opt_param);
+      return 1;
+    }
+    struct serve_stats stats;
+    if (!run_serve(file_name, &options, &stats)) {
+      return 1;
+    }
+    print_serve_stats(&stats);
     return 0;
+  }
 
   default:; // go further
   }
@@ -82,7 +121,10 @@ int main(int argc, char *argv[]) {
     return 1;
   }
   // file is PNG file
-  
+
+  // 1 if the output can't be written: a closed pipe too, rather than a silent SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  int status = 0;
   switch (option) {
 
   case CMD_CHUNK:
@@ -90,19 +132,109 @@ int main(int argc, char *argv[]) {
     break;
 
   case CMD_DISPLAY: {
-    const struct image image = get_image(&file);
+#ifdef HEADLESS
+    LOG_FATAL("No --display in a headless build");
+    unmap_file(&file);
+    return 1;
+#else
+    const struct image image = get_image_native(&file);
     view_image(&image);
     free_image(&image);
     break;
+#endif
   }
     
   case CMD_BMP: {
-    const struct image image = get_image(&file);
-    save_image_as_bmp(&image, opt_param);
+    const struct image image = get_image_native(&file);
+    status = !save_image_as_bmp(&image, opt_param);
+    free_image(&image);
+    break;
+  }
+
+  case CMD_BMP32: {
+    const struct image image = get_image_native(&file);
+    status = !save_image_as_bmp32(&image, opt_param);
     free_image(&image);
     break;
   }
 
+  case CMD_PPM:
+    status = !save_file_as_pnm(&file, opt_param, PNM_PPM, 0, NULL);
+    break;
+
+  case CMD_PAM:
+    status = !save_file_as_pnm(&file, opt_param, PNM_PAM, 0, NULL);
+    break;
+
+  case CMD_RAW:
+    status = !save_file_as_pnm(&file, opt_param, PNM_RAW, 8, NULL);
+    break;
+
+  case CMD_RAW16:
+    status = !save_file_as_pnm(&file, opt_param, PNM_RAW, 16, NULL);
+    break;
+
+  case CMD_PNG: {
+    // same color type and depth: the transparency and the color space of the source are kept
+    const struct image image = get_image_native(&file);
+    struct png_options options = png_default_options();
+    uint8_t *chunks = png_source_chunks(&file, &options, NULL);
+    status = (write_png(&image, opt_param, &options) == 0);
+    free(chunks);
+    free_image(&image);
+    break;
+  }
+
+  case CMD_OPTIMIZE: {
+    const struct image image = get_image_native(&file);
+    struct optimize_report report;
+    status = (optimize_png(&image, &file, opt_param, 0, &report) == 0);
+    if (!status) {
+      print_optimize_report(&report);
+    }
+    free_optimize_report(&report);
+    free_image(&image);
+    break;
+  }
+
+  case CMD_CLEAN:
+    rewrite_png(&file, opt_param, REWRITE_CLEAN);
+    break;
+
+  case CMD_TRANSCODE: {
+    struct transcode_options options;
+    const char *output = parse_transcode(opt_param, &options);
+    transcode_png(&file, output, &options);
+    break;
+  }
+
+  case CMD_PLTE: {
+    const struct image image = get_image_native(&file);
+    uint16_t nb_color;
+    const struct image quantized = quantize_image(&image, QUANTIZE_MAX_COLOR, DITHER_FLOYD_STEINBERG, &nb_color);
+    LOG_INFO("%d colors in the palette", nb_color);
+    status = (write_png(&quantized, opt_param, NULL) == 0);
+    free_image(&quantized);
+    free_image(&image);
+    break;
+  }
+
+  case CMD_STATS: {
+    const struct image image = get_image_native(&file);
+    const struct color_stats stats = get_color_stats(&image);
+    print_color_stats(&stats);
+    free_image(&image);
+    break;
+  }
+
+  case CMD_INDEX: {
+    struct idat_index index;
+    build_index(&file, DEFAULT_INDEX_SPAN, &index);
+    save_index(&index, opt_param);
+    free_index(&index);
+    break;
+  }
+
   case CMD_PASS: {
 
     // TODO check size!!!
@@ -116,7 +248,7 @@ int main(int argc, char *argv[]) {
     
     for (uint8_t p = 0; p < ADAM7_NB_PASS; p++) {
       *nb = '0' + p + 1; // char 'p + 1'
-      save_image_as_bmp(pass + p, tmp_buffer);
+      status |= !save_image_as_bmp(pass + p, tmp_buffer);
     }
     free_passes(pass);
   }
@@ -127,5 +259,5 @@ int main(int argc, char *argv[]) {
   
   unmap_file(&file);
   LOG_INFO("\t Job done");
-  return 0;
+  return status;
 }
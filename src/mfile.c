@@ -1,7 +1,9 @@
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -11,20 +13,20 @@
 
 
 
-const struct mfile map_file(const char *pathname) {
+uint8_t try_map_file(const char *pathname, struct mfile *file) {
   LOG_INFO("Opening file %s", pathname);
 
   int fd = open(pathname, O_RDONLY);
   if (fd < 0) {
-    LOG_FATAL("Can't open the file: %s", pathname);
-    exit(1);
+    LOG_ERROR("Can't open the file: %s (%s)", pathname, strerror(errno));
+    return 0;
   }
 
   struct stat st;
   if (fstat(fd, &st) != 0) {
-    LOG_FATAL("Can't get stats about the file: %s", pathname);
+    LOG_ERROR("Can't get stats about the file: %s", pathname);
     close(fd);
-    exit(1);
+    return 0;
   }
 
   size_t file_size = (size_t) st.st_size;
@@ -34,9 +36,9 @@ const struct mfile map_file(const char *pathname) {
 
   void * file_ptr = mmap(NULL, mult_size, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
   if (file_ptr == MAP_FAILED) {
-    LOG_FATAL("Can't map the file [%s:%zd] in memory (asked size %zd)", pathname, file_size, mult_size);
+    LOG_ERROR("Can't map the file [%s:%zd] in memory (asked size %zd)", pathname, file_size, mult_size);
     close(fd);
-    exit(1);
+    return 0;
   }
   LOG_ALLOC("Mmap %s (size %zu) in %p", pathname, file_size, file_ptr);
   
@@ -50,7 +52,19 @@ const struct mfile map_file(const char *pathname) {
     .size           = file_size,
     .allocated_size = mult_size,
   };
-  return res;
+  *file = res;
+  return 1;
+}
+
+
+
+const struct mfile map_file(const char *pathname) {
+  struct mfile file;
+  if (!try_map_file(pathname, &file)) {
+    LOG_FATAL("Can't read %s", pathname);
+    exit(1);
+  }
+  return file;
 }
 
 
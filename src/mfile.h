@@ -28,12 +28,20 @@ struct mfile {
 
 
 /**
- * @brief Map a file to the memory
+ * @brief Map a file to the memory, exit if it can't be
  * @param[in] pathname Path to the file to open
  * @return the allocated file
  */
 const struct mfile map_file(const char *pathname);
 
+/**
+ * @brief Map a file to the memory, as map_file, and tell if it can't be
+ * @param[in] pathname Path to the file to open
+ * @param[out] file The allocated file
+ * @return 1 if mapped, 0 if the file can't be opened or mapped (nothing to unmap)
+ */
+uint8_t try_map_file(const char *pathname, struct mfile *file);
+
 /**
  * @brief Unmap a mfile from allocated memory
  * @param[in] file The allocated file to free
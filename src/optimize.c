@@ -0,0 +1,562 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "chunk.h"
+#include "convert.h"
+#include "icc.h"
+#include "log.h"
+#include "optimize.h"
+#include "scheduler.h"
+#include "stats.h"
+
+
+/** @brief Number of rows converted at once */
+#define OPTIMIZE_ROWS (16U)
+/** @brief Slots of the hash table of the palette (power of 2, more than twice 256) */
+#define PALETTE_SLOT (1024U)
+/** @brief Max number of trials at once */
+#define OPTIMIZE_MAX_THREAD (32U)
+
+
+/**
+ * @brief Open addressing hash table of RGB8 colors, to their number of pixels then their index
+ */
+struct palette_table {
+  /** @brief Colors (0xRRGGBB) */
+  uint32_t key[PALETTE_SLOT];
+  /** @brief Number of pixels of the color, then its index in the palette */
+  uint64_t value[PALETTE_SLOT];
+  /** @brief Flag: the slot holds a color */
+  uint8_t used[PALETTE_SLOT];
+  /** @brief Number of colors */
+  uint32_t count;
+};
+
+/**
+ * @brief Trials shared by the threads
+ */
+struct optimize_job {
+  /** @brief The report being filled */
+  struct optimize_report *report;
+  /** @brief Next trial to run */
+  uint32_t next;
+  /** @brief Size of the smallest file so far, 0 if none */
+  uint64_t best;
+  /** @brief Lock of next, best and the trials */
+  pthread_mutex_t lock;
+};
+
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Smallest gray depth holding a 16-bit sample exactly
+ * @param[in] v The sample
+ * @return 1, 2, 4, 8 or 16
+ */
+static uint8_t gray_depth(uint16_t v) {
+  // a sample of depth d is scaled by 65535 / (2^d - 1)
+  return (v % 65535 == 0) ? 1 : (v % 21845 == 0) ? 2 : (v % 4369 == 0) ? 4 : (v % 257 == 0) ? 8 : 16;
+}
+
+/**
+ * @brief Slot of a color in the table (free slot if missing)
+ */
+static uint32_t palette_slot(const struct palette_table *table, uint32_t key) {
+  uint32_t slot = (key * 0x9e3779b1U) >> 22; // 10 bits
+  while (table->used[slot] && (table->key[slot] != key)) {
+    slot = (slot + 1) & (PALETTE_SLOT - 1);
+  }
+  return slot;
+}
+
+/**
+ * @brief Add pixels of a color to the table
+ * @return 0 if the table already has 256 other colors
+ */
+static uint8_t palette_add(struct palette_table *table, uint32_t key, uint64_t count) {
+  const uint32_t slot = palette_slot(table, key);
+  if (!table->used[slot]) {
+    if (table->count == 256) {
+      return 0;
+    }
+    table->used[slot]  = 1;
+    table->key[slot]   = key;
+    table->value[slot] = 0;
+    table->count++;
+  }
+  table->value[slot] += count;
+  return 1;
+}
+
+/**
+ * @brief RGB8 color of a RGBA16 pixel
+ */
+static inline uint32_t rgb_key(const uint16_t *px) {
+  return ((uint32_t) (px[0] >> 8) << 16) | ((px[1] >> 8) << 8) | (px[2] >> 8);
+}
+
+/**
+ * @brief Put a sample in a row
+ * @param[in,out] row Row of zeros before the first call
+ * @param[in] k Index of the sample in the row
+ * @param[in] depth
+ * @param[in] v Value of the sample on depth bits
+ */
+static inline void put_sample(uint8_t *row, uint32_t k, uint8_t depth, uint16_t v) {
+  switch (depth) {
+  case 16:
+    ((uint16_t *) row)[k] = v;
+    break;
+  case 8:
+    row[k] = v;
+    break;
+  default: {
+    const uint32_t bit = k * depth;
+    row[bit / 8] |= v << (8 - depth - bit % 8);
+  }
+  }
+}
+
+
+/**
+ * @brief Order of the palette: most used colors first
+ */
+static int palette_order(const void *a, const void *b) {
+  const uint64_t *x = a;
+  const uint64_t *y = b;
+  // (count, key) pairs, the key breaks ties
+  if (x[0] != y[0]) {
+    return (x[0] > y[0]) ? -1 : 1;
+  }
+  return (x[1] < y[1]) ? -1 : (x[1] > y[1]);
+}
+
+/**
+ * @brief Fill the table with the colors of the image, then give each one its index
+ * @param[in] image An opaque image of at most 256 colors, all on 8 bits
+ * @param[out] table
+ * @param[out] palette PALETTE_SIZE bytes
+ * @param[in] rows Room for OPTIMIZE_ROWS rows of RGBA16
+ * @return Number of colors, 0 if the background does not fit
+ */
+static uint32_t build_palette(const struct image *image, struct palette_table *table, uint8_t *palette,
+                              uint16_t *rows) {
+  const uint32_t w = image->width;
+  memset(table, 0, sizeof(struct palette_table));
+  for (uint32_t r0 = 0; r0 < image->height; r0 += OPTIMIZE_ROWS) {
+    const uint32_t n = (image->height - r0 < OPTIMIZE_ROWS) ? image->height - r0 : OPTIMIZE_ROWS;
+    convert_rows(image, r0, n, FORMAT_RGBA16, rows, (size_t) w * 8);
+    uint32_t last = rgb_key(rows);
+    uint64_t run = 0;
+    for (const uint16_t *px = rows; px < rows + (size_t) n * w * 4; px += 4) {
+      const uint32_t key = rgb_key(px);
+      if (key != last) {
+        palette_add(table, last, run);
+        last = key;
+        run  = 0;
+      }
+      run++;
+    }
+    palette_add(table, last, run);
+  }
+  if (image->has_background) {
+    const uint16_t *bg = image->background;
+    if (!palette_add(table, rgb_key(bg), 0)) {
+      return 0;
+    }
+  }
+
+  uint64_t order[256][2];
+  uint32_t nb_color = 0;
+  for (uint32_t s = 0; s < PALETTE_SLOT; s++) {
+    if (table->used[s]) {
+      order[nb_color][0] = table->value[s];
+      order[nb_color][1] = table->key[s];
+      nb_color++;
+    }
+  }
+  qsort(order, nb_color, sizeof(order[0]), palette_order);
+
+  memset(palette, 0, PALETTE_SIZE);
+  for (uint32_t c = 0; c < nb_color; c++) {
+    const uint32_t key = order[c][1];
+    palette[3 * c]     = key >> 16;
+    palette[3 * c + 1] = key >> 8;
+    palette[3 * c + 2] = key;
+    table->value[palette_slot(table, key)] = c;
+  }
+  return nb_color;
+}
+
+
+
+struct image reduce_image(const struct image *image, uint8_t palette) {
+  const uint32_t w = image->width;
+  const struct color_stats stats = get_color_stats(image);
+  uint16_t *rows = malloc((size_t) w * 8 * OPTIMIZE_ROWS);
+  if (rows == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to reduce the image", (size_t) w * 8 * OPTIMIZE_ROWS);
+    exit(1);
+  }
+
+  // smallest depths holding every sample
+  uint8_t gray = 1;  // depth of the gray samples (red)
+  uint8_t color = 8; // depth of red, green, blue
+  uint8_t alpha = 8; // depth of alpha
+  for (uint32_t r0 = 0; r0 < image->height; r0 += OPTIMIZE_ROWS) {
+    const uint32_t n = (image->height - r0 < OPTIMIZE_ROWS) ? image->height - r0 : OPTIMIZE_ROWS;
+    convert_rows(image, r0, n, FORMAT_RGBA16, rows, (size_t) w * 8);
+    for (const uint16_t *px = rows; px < rows + (size_t) n * w * 4; px += 4) {
+      const uint8_t g = gray_depth(px[0]);
+      gray  = (g > gray) ? g : gray;
+      color = ((px[0] % 257) || (px[1] % 257) || (px[2] % 257)) ? 16 : color;
+      alpha = (px[3] % 257) ? 16 : alpha;
+    }
+  }
+
+  // the background must fit as well
+  uint8_t is_gray = stats.gray;
+  const uint8_t source_gray = (image->palette == NULL) && (image->sample <= 2);
+  if (image->profile != NULL) {
+    // the profile only holds in its own color space
+    is_gray = source_gray;
+  }
+  if (image->has_background) {
+    const uint16_t *bg = image->background;
+    is_gray &= (bg[0] == bg[1]) && (bg[1] == bg[2]);
+    const uint8_t g = gray_depth(bg[0]);
+    gray  = (g > gray) ? g : gray;
+    color = ((bg[0] % 257) || (bg[1] % 257) || (bg[2] % 257)) ? 16 : color;
+  }
+
+  struct image r = {
+    .width   = w,
+    .height  = image->height,
+    .native  = 1,
+    .gamma   = image->gamma,
+    .profile = NULL,
+    .has_background = image->has_background,
+    .palette = NULL,
+    .data    = NULL,
+  };
+  memcpy(r.background, image->background, sizeof(r.background));
+
+  struct palette_table *table = NULL;
+  uint8_t *colors = NULL;
+  if (palette) {
+    // no tRNS: only opaque colors
+    table = malloc(sizeof(struct palette_table));
+    colors = malloc(PALETTE_SIZE);
+    if ((table == NULL) || (colors == NULL)) {
+      LOG_FATAL("Can't malloc a palette");
+      exit(1);
+    }
+    const uint32_t nb_color = (stats.opaque && (stats.nb_color <= 256) && (color == 8)
+                               && ((image->profile == NULL) || !source_gray))
+      ? build_palette(image, table, colors, rows) : 0;
+    if (nb_color == 0) {
+      free(table);
+      free(colors);
+      free(rows);
+      return r;
+    }
+    r.sample = 1;
+    r.depth  = (nb_color <= 2) ? 1 : (nb_color <= 4) ? 2 : (nb_color <= 16) ? 4 : 8;
+  }
+  else if (is_gray) {
+    r.sample = stats.opaque ? 1 : 2;
+    // gray with alpha is 8 or 16 bits
+    r.depth  = stats.opaque ? gray : ((gray <= 8) && (alpha == 8)) ? 8 : 16;
+  }
+  else {
+    r.sample = stats.opaque ? 3 : 4;
+    r.depth  = ((color == 8) && (stats.opaque || (alpha == 8))) ? 8 : 16;
+  }
+
+  const uint32_t lsize = line_size(&r);
+  const size_t data_size = (size_t) lsize * r.height;
+  r.profile = icc_retain(image->profile);
+  r.data = calloc(data_size + (palette ? PALETTE_SIZE : 0), 1); // palette right after the data
+  if (r.data == NULL) {
+    LOG_FATAL("Can't calloc(%zu) for the reduced image", data_size + (palette ? PALETTE_SIZE : 0));
+    exit(1);
+  }
+  if (palette) {
+    r.palette = ((uint8_t *) r.data) + data_size;
+    memcpy(r.palette, colors, PALETTE_SIZE);
+  }
+
+  // scale of a sample on r.depth bits
+  const uint32_t scale = 65535 / ((1U << r.depth) - 1);
+  for (uint32_t r0 = 0; r0 < r.height; r0 += OPTIMIZE_ROWS) {
+    const uint32_t n = (r.height - r0 < OPTIMIZE_ROWS) ? r.height - r0 : OPTIMIZE_ROWS;
+    convert_rows(image, r0, n, FORMAT_RGBA16, rows, (size_t) w * 8);
+    for (uint32_t i = 0; i < n; i++) {
+      uint8_t *row = ((uint8_t *) r.data) + (size_t) (r0 + i) * lsize;
+      const uint16_t *px = rows + (size_t) i * w * 4;
+      uint32_t k = 0;
+      for (uint32_t j = 0; j < w; j++, px += 4) {
+        if (palette) {
+          put_sample(row, k++, r.depth, table->value[palette_slot(table, rgb_key(px))]);
+          continue;
+        }
+        put_sample(row, k++, r.depth, px[0] / scale);
+        if (!is_gray) {
+          put_sample(row, k++, r.depth, px[1] / scale);
+          put_sample(row, k++, r.depth, px[2] / scale);
+        }
+        if (!stats.opaque) {
+          put_sample(row, k++, r.depth, px[3] / scale);
+        }
+      }
+    }
+  }
+  free(table);
+  free(colors);
+  free(rows);
+  LOG_INFO("Reduced to %d samples of %d bits%s", r.sample, r.depth, palette ? " (palette)" : "");
+  return r;
+}
+
+
+
+/**
+ * @brief Run trials until there is none left (the usual winners start first)
+ * @param[in,out] arg A struct optimize_job
+ * @param[in] lane Index of the lane (unused)
+ */
+static void run_trials(void *arg, uint32_t lane) {
+  (void) lane;
+  struct optimize_job *job = arg;
+  struct optimize_report *report = job->report;
+
+  for (;;) {
+    pthread_mutex_lock(&(job->lock));
+    const uint32_t t = job->next++;
+    const uint64_t best = job->best;
+    pthread_mutex_unlock(&(job->lock));
+    if (t >= report->nb_trial) {
+      break;
+    }
+
+    // each trial is the only one to touch its entry
+    struct optimize_trial *trial = report->trial + t;
+    trial->options.limit = best;
+    const double start = now();
+    trial->size = png_size(report->image + trial->image, &(trial->options));
+    trial->seconds = now() - start;
+
+    pthread_mutex_lock(&(job->lock));
+    if ((trial->size > 0) && ((job->best == 0) || (trial->size < job->best))) {
+      job->best = trial->size;
+    }
+    pthread_mutex_unlock(&(job->lock));
+  }
+}
+
+/**
+ * @brief Every trial of an image
+ * @param[in,out] report
+ * @param[in] index Index of the image
+ * @param[in] level zlib level
+ * @param[in] chunks Chunks copied from the source, or NULL
+ * @param[in] chunks_size Size of the chunks
+ */
+static void add_trials(struct optimize_report *report, uint8_t index, int level, const uint8_t *chunks,
+                       uint32_t chunks_size) {
+  // the usual winners first, so the best size stops the others early
+  static const struct {
+    enum filter_strategy filter;
+    uint8_t type;
+  } filters[] = {
+    {FILTER_HEURISTIC, 0}, {FILTER_FIXED, 4}, {FILTER_FIXED, 0}, {FILTER_FIXED, 1},
+    {FILTER_FIXED, 2}, {FILTER_FIXED, 3}, {FILTER_BRUTE, 0},
+  };
+  static const int strategies[] = {Z_FILTERED, Z_DEFAULT_STRATEGY, Z_RLE};
+  const struct image *image = report->image + index;
+
+  // one strip (or a dictionary if too large), the smallest window holding the rows
+  const uint64_t length = (uint64_t) (line_size(image) + 1) * image->height;
+  struct png_options options = png_default_options();
+  options.level   = level;
+  options.threads = 1;
+  options.chunks  = chunks;
+  options.chunks_size = chunks_size;
+  if (length <= (1U << 30)) {
+    options.strip_rows = image->height;
+  }
+  else {
+    options.dictionary = 1;
+  }
+  options.window_bits = 9;
+  while ((options.window_bits < MAX_WBITS) && ((1ULL << options.window_bits) < length)) {
+    options.window_bits++;
+  }
+
+  for (uint8_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+    for (uint8_t s = 0; s < sizeof(strategies) / sizeof(strategies[0]); s++) {
+      struct optimize_trial *trial = report->trial + report->nb_trial++;
+      trial->image = index;
+      trial->options = options;
+      trial->options.filter      = filters[f].filter;
+      trial->options.filter_type = filters[f].type;
+      trial->options.strategy    = strategies[s];
+      trial->size    = 0;
+      trial->seconds = 0;
+    }
+  }
+}
+
+
+
+/**
+ * @brief Write the source as it is
+ * @param[in] file Source
+ * @param[in] filename Name of the file to write (nothing is written if it is the source)
+ * @return Size of the file, 0 if it can't be written
+ */
+static uint64_t copy_source(const struct mfile *file, const char *filename) {
+  struct stat src, dst;
+  if ((stat(file->pathname, &src) == 0) && (stat(filename, &dst) == 0)
+      && (src.st_dev == dst.st_dev) && (src.st_ino == dst.st_ino)) {
+    return file->size;
+  }
+  const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Can't open %s (%s)", filename, strerror(errno));
+    return 0;
+  }
+  for (size_t done = 0; done < file->size;) {
+    const ssize_t n = write(fd, ((const uint8_t *) file->data) + done, file->size - done);
+    if (n < 0) {
+      LOG_ERROR("Can't write %s (%s)", filename, strerror(errno));
+      close(fd);
+      return 0;
+    }
+    done += n;
+  }
+  if (close(fd) != 0) {
+    LOG_ERROR("Can't close %s (%s)", filename, strerror(errno));
+    return 0;
+  }
+  LOG_INFO("Write %s as it is: %lu bytes", filename, (unsigned long) file->size);
+  return file->size;
+}
+
+
+uint64_t optimize_png(const struct image *image, const struct mfile *source, const char *filename, uint8_t threads,
+                      struct optimize_report *report) {
+  const double start = now();
+  memset(report, 0, sizeof(struct optimize_report));
+  report->input_size = (source != NULL) ? source->size : 0;
+
+  struct png_options copied = png_default_options();
+  uint32_t iccp = 0;
+  uint8_t *chunks = (source != NULL) ? png_source_chunks(source, &copied, &iccp) : NULL;
+  const uint32_t chunks_size = copied.chunks_size;
+  if (copied.transparency != NULL) {
+    // the reduced images have other colors, indexes or depths
+    LOG_INFO("%s has tRNS: written as it is", source->pathname);
+    free(chunks);
+    report->copied = 1;
+    report->seconds = now() - start;
+    return copy_source(source, filename);
+  }
+
+  // the reduced image, then its palette if any
+  report->image[report->nb_image++] = reduce_image(image, 0);
+  const struct image indexed = reduce_image(image, 1);
+  if (indexed.data != NULL) {
+    report->image[report->nb_image++] = indexed;
+  }
+
+  // level 9 first, then 6 which is sometimes smaller
+  static const int levels[] = {9, 6};
+  const uint8_t source_gray = (image->palette == NULL) && (image->sample <= 2);
+  for (uint8_t l = 0; l < 2; l++) {
+    for (uint8_t i = 0; i < report->nb_image; i++) {
+      // iCCP only while gray stays gray and color stays color (an unknown profile does not keep it)
+      const struct image *reduced = report->image + i;
+      const uint8_t gray = (reduced->palette == NULL) && (reduced->sample <= 2);
+      const uint32_t size = chunks_size - ((gray == source_gray) ? 0 : iccp);
+      if ((l == 0) && (size < chunks_size)) {
+        LOG_WARN("iCCP of %s dropped from a reduced image", source->pathname);
+      }
+      add_trials(report, i, levels[l], chunks, size);
+    }
+  }
+
+  // never larger than the source
+  struct optimize_job job = {
+    .report = report,
+    .next   = 0,
+    .best   = report->input_size,
+  };
+  uint32_t nb_lane = sched_current()->nb_worker;
+  nb_lane = ((threads > 0) && (threads < nb_lane)) ? threads : nb_lane;
+  nb_lane = (nb_lane > OPTIMIZE_MAX_THREAD) ? OPTIMIZE_MAX_THREAD : nb_lane;
+  nb_lane = (nb_lane > report->nb_trial) ? report->nb_trial : nb_lane;
+  LOG_INFO("%d trials on %d lanes", report->nb_trial, nb_lane);
+
+  pthread_mutex_init(&(job.lock), NULL);
+  sched_run(NULL, nb_lane, run_trials, &job);
+  pthread_mutex_destroy(&(job.lock));
+
+  // the first smallest one: the same file whatever the threads
+  report->best = 0;
+  for (uint32_t t = 0; t < report->nb_trial; t++) {
+    const uint64_t size = report->trial[t].size;
+    if ((size > 0) && ((report->trial[report->best].size == 0) || (size < report->trial[report->best].size))) {
+      report->best = t;
+    }
+  }
+
+  struct optimize_trial *best = report->trial + report->best;
+  uint64_t size;
+  if ((best->size == 0) && (source != NULL)) {
+    LOG_INFO("No trial smaller than %s: written as it is", source->pathname);
+    report->copied = 1;
+    size = copy_source(source, filename);
+  }
+  else {
+    best->options.limit = 0;
+    size = write_png(report->image + best->image, filename, &(best->options));
+    if ((size != 0) && (size != best->size)) {
+      LOG_FATAL("%s is %lu bytes instead of %lu", filename, (unsigned long) size, (unsigned long) best->size);
+      exit(1);
+    }
+  }
+  free(chunks);
+  for (uint32_t t = 0; t < report->nb_trial; t++) {
+    report->trial[t].options.chunks = NULL; // freed
+  }
+  report->seconds = now() - start;
+  return size;
+}
+
+
+void free_optimize_report(struct optimize_report *report) {
+  for (uint8_t i = 0; i < report->nb_image; i++) {
+    free_image(report->image + i);
+  }
+  report->nb_image = 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file optimize.h
+ * @brief Smallest lossless PNG of an image
+ * @details The image is first reduced to the smallest color type and depth holding exactly the same
+ * pixels (alpha dropped when opaque, gray when red = green = blue, 8 bits when 16-bit samples are
+ * multiples of 257, sub-byte gray, then a palette when there are at most 256 opaque colors).
+ * Each reduced image is then deflated with many filters, zlib levels and strategies: the trials run
+ * in parallel, one strip each (see png.h), and a trial stops as soon as it is larger than the best
+ * file so far. The best trial is written.
+ *
+ * sRGB, cHRM and iCCP are copied from the source as they are (gAMA and bKGD are written from the image).
+ * The output is never larger than the source: the source is written as it is when no trial is smaller,
+ * or when it has tRNS (the reduced images do not apply it).
+ */
+
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include <stdint.h>
+
+#include "image.h"
+#include "mfile.h"
+#include "png.h"
+
+
+/** @brief Max number of reduced images */
+#define OPTIMIZE_MAX_IMAGE (2U)
+/** @brief Max number of trials */
+#define OPTIMIZE_MAX_TRIAL (128U)
+
+
+/**
+ * @brief One way to write the file
+ */
+struct optimize_trial {
+  /** @brief Index of the reduced image */
+  uint8_t image;
+  /** @brief Options of the encoder */
+  struct png_options options;
+  /** @brief Size of the file, 0 if stopped because larger than the best one */
+  uint64_t size;
+  /** @brief Time spent on the trial in seconds */
+  double seconds;
+};
+
+/**
+ * @brief What the optimizer tried
+ */
+struct optimize_report {
+  /** @brief Size of the input file */
+  uint64_t input_size;
+  /** @brief Reduced images, see reduce_image */
+  struct image image[OPTIMIZE_MAX_IMAGE];
+  /** @brief Number of reduced images */
+  uint8_t nb_image;
+  /** @brief Trials, in the order they were started */
+  struct optimize_trial trial[OPTIMIZE_MAX_TRIAL];
+  /** @brief Number of trials */
+  uint32_t nb_trial;
+  /** @brief Index of the trial written, unless copied */
+  uint32_t best;
+  /** @brief Flag: the source is written as it is (it has tRNS, or no trial is smaller) */
+  uint8_t copied;
+  /** @brief Wall time of the whole optimization in seconds */
+  double seconds;
+};
+
+
+/**
+ * @brief Same pixels with the smallest color type and depth
+ * @details Metadata (gAMA, bKGD) are kept: a reduction the background does not fit in is not done.
+ * A palette is only possible for opaque images (there is no tRNS), its colors are sorted by use.
+ * With an ICC profile, gray stays gray and color stays color (a palette is color): the profile still holds.
+ * @param[in] image Any image returned by get_image
+ * @param[in] palette Flag: reduce to a palette
+ * @return The image (16-bit samples in the native byte order), .data is NULL if palette is set
+ * but not possible. Free it with free_image.
+ */
+struct image reduce_image(const struct image *image, uint8_t palette);
+
+/**
+ * @brief Write the smallest PNG file found for the image
+ * @param[in] image Any image returned by get_image
+ * @param[in] source File of the image, or NULL (no chunk copied, no limit on the size)
+ * @param[in] filename Name of the file to write
+ * @param[in] threads Max number of trials at once (at most the workers of the scheduler), 0 for no other limit
+ * @param[out] report What was tried (free it with free_optimize_report)
+ * @return Size of the file, 0 if it can't be written
+ */
+uint64_t optimize_png(const struct image *image, const struct mfile *source, const char *filename, uint8_t threads,
+                      struct optimize_report *report);
+
+/**
+ * @brief Free the reduced images of a report
+ * @param[in,out] report
+ */
+void free_optimize_report(struct optimize_report *report);
+
+
+#endif // __OPTIMIZE_H__
@@ -0,0 +1,752 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "chunk.h"
+#include "convert.h"
+#include "filter.h"
+#include "log.h"
+#include "png.h"
+#include "scheduler.h"
+
+
+/** @brief Max number of lanes deflating strips (deflate is bound by the CPU, not the memory) */
+#define PNG_MAX_THREAD (32U)
+/** @brief Min number of pixels per lane */
+#define PNG_THREAD_PIXELS (1U << 16)
+/** @brief Size of a deflate window, the dictionary of a strip */
+#define PNG_WINDOW (32768U)
+/** @brief Max number of filtered bytes of a strip */
+#define PNG_MAX_STRIP (1U << 30)
+/** @brief Size of the zlib header, before the deflated data of the first strip */
+#define ZLIB_HEADER (2U)
+/** @brief Size of the adler32, after the deflated data of the last strip */
+#define ZLIB_TRAILER (4U)
+/** @brief Number of filtered bytes deflated between two checks of the size limit */
+#define PNG_LIMIT_SLICE (1U << 16)
+
+
+/**
+ * @brief Strip of rows, deflated by one thread
+ */
+struct png_strip {
+  /** @brief First row */
+  uint32_t row0;
+  /** @brief Number of rows */
+  uint32_t nrows;
+  /** @brief Data of its IDAT chunk, with room for the zlib header and trailer */
+  uint8_t *buffer;
+  /** @brief Length of the IDAT data in buffer */
+  uint32_t size;
+  /** @brief CRC of the IDAT chunk so far (type and data) */
+  uint32_t crc;
+  /** @brief Adler32 of the filtered rows */
+  uint32_t adler;
+  /** @brief Number of filtered bytes */
+  size_t length;
+};
+
+/**
+ * @brief What a thread needs to deflate strips
+ */
+struct png_worker {
+  /** @brief Deflate stream */
+  z_stream z;
+  /** @brief Filter of the rows */
+  struct row_filter filter;
+  /** @brief Filtered rows of a strip, after the rows of its dictionary */
+  uint8_t *filtered;
+  /** @brief Room for two rows in the byte order of the file */
+  uint8_t *tmp;
+};
+
+/**
+ * @brief Encoder shared by the threads
+ */
+struct png_encoder {
+  /** @brief The image */
+  const struct image *image;
+  /** @brief The options */
+  const struct png_options *options;
+  /** @brief Length of a row of the image */
+  uint32_t lsize;
+  /** @brief Byte per pixel (round up to one) */
+  uint8_t bpp;
+  /** @brief Number of filter types allowed (1: None only) */
+  uint8_t nb_type;
+  /** @brief zlib header */
+  uint8_t header[ZLIB_HEADER];
+  /** @brief Rows of a strip */
+  uint32_t strip_rows;
+  /** @brief Strips */
+  struct png_strip *strip;
+  /** @brief Number of strips */
+  uint32_t nb_strip;
+  /** @brief Size of the file without the IDAT data */
+  uint64_t overhead;
+  /** @brief IDAT data of the strips deflated so far */
+  uint64_t done;
+  /** @brief Flag: the file would be larger than the limit of the options, stop */
+  uint8_t cancelled;
+  /** @brief Next strip to deflate */
+  uint32_t next;
+  /** @brief Lock of next, done and cancelled */
+  pthread_mutex_t lock;
+};
+
+
+
+static void put32(uint8_t *ptr, uint32_t v) {
+  ptr[0] = v >> 24;
+  ptr[1] = v >> 16;
+  ptr[2] = v >> 8;
+  ptr[3] = v;
+}
+
+/**
+ * @brief CRC of a chunk
+ * @param[in] type Chunk type (4 characters)
+ * @param[in] data
+ * @param[in] length Length of data
+ */
+static uint32_t chunk_crc(const char *type, const uint8_t *data, uint32_t length) {
+  const uint32_t crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *) type, 4);
+  return (length > 0) ? crc32(crc, data, length) : crc; // crc32() of Z_NULL is the initial value
+}
+
+/**
+ * @brief A row of the image in the byte order of the file
+ * @param[in] encoder
+ * @param[in] row
+ * @param[out] tmp Room for a row, used only if samples must be swapped
+ * @return The row
+ */
+static const uint8_t *get_row(const struct png_encoder *encoder, uint32_t row, uint8_t *tmp) {
+  const struct image *image = encoder->image;
+  const uint8_t *data = ((const uint8_t *) image->data) + (size_t) row * encoder->lsize;
+  if ((image->depth != 16) || !image->native) {
+    return data;
+  }
+  memcpy(tmp, data, encoder->lsize);
+  samples_to_native(tmp, encoder->lsize / 2); // native to big endian: the same swap
+  return tmp;
+}
+
+/**
+ * @brief Filter consecutive rows, each one after its filter type-byte
+ * @details The filter of a row depends only on the rows of its strip from the first one,
+ * so the rows of a strip get the same filters whoever filters them
+ * @param[in] encoder
+ * @param[in,out] worker Thread filtering the rows
+ * @param[in] row0 First row
+ * @param[in] nrows Number of rows
+ * @param[in] start First row of the strip of the rows (row0 if the filter keeps no state, see FILTER_BRUTE)
+ * @param[out] out nrows * (lsize + 1) bytes
+ */
+static void filter_rows(const struct png_encoder *encoder, struct png_worker *worker, uint32_t row0, uint32_t nrows,
+                        uint32_t start, uint8_t *out) {
+  const uint32_t lsize = encoder->lsize;
+  uint8_t *tmp = worker->tmp;
+  const uint8_t *prior = (row0 > start) ? get_row(encoder, row0 - 1, tmp + ((row0 - 1) & 1) * lsize) : NULL;
+
+  for (uint32_t r = row0; r < row0 + nrows; r++, out += lsize + 1) {
+    const uint8_t *raw = get_row(encoder, r, tmp + (r & 1) * lsize);
+    // the first row of a strip never refers to the row above
+    const uint8_t nb_type = ((r == start) && (encoder->nb_type > 2)) ? 2 : encoder->nb_type;
+    out[0] = row_filter_apply(&(worker->filter), raw, (r == start) ? NULL : prior, nb_type, out + 1);
+    prior = raw;
+  }
+}
+
+/**
+ * @brief Filter and deflate a strip
+ * @param[in,out] encoder
+ * @param[in] s Index of the strip
+ * @param[in,out] worker Thread deflating the strip
+ */
+static void deflate_strip(struct png_encoder *encoder, uint32_t s, struct png_worker *worker) {
+  struct png_strip *strip = encoder->strip + s;
+  z_stream *z = &(worker->z);
+  uint8_t *filtered = worker->filtered;
+  const uint32_t length = encoder->lsize + 1;
+  const uint8_t last = (s + 1 == encoder->nb_strip);
+
+  // rows at the end of the strip before, filtered from its first row if the filter has a state
+  size_t dict = 0;
+  if (encoder->options->dictionary && (s > 0)) {
+    const struct png_strip *before = strip - 1;
+    uint32_t nrows = (PNG_WINDOW + length - 1) / length;
+    nrows = (nrows < before->nrows) ? nrows : before->nrows;
+    if (encoder->options->filter == FILTER_BRUTE) {
+      nrows = before->nrows;
+    }
+    filter_rows(encoder, worker, strip->row0 - nrows, nrows, before->row0, filtered);
+    dict = (size_t) nrows * length;
+  }
+  strip->length = (size_t) strip->nrows * length;
+  filter_rows(encoder, worker, strip->row0, strip->nrows, strip->row0, filtered + dict);
+  strip->adler = adler32(adler32(0L, Z_NULL, 0), filtered + dict, strip->length);
+
+  if (deflateReset(z) != Z_OK) {
+    LOG_FATAL("Can't reset deflate: %s", z->msg);
+    exit(1);
+  }
+  if (dict > 0) {
+    const size_t window = (dict < PNG_WINDOW) ? dict : PNG_WINDOW;
+    deflateSetDictionary(z, filtered + dict - window, window);
+  }
+
+  // the bound is for Z_FINISH, a full flush adds an empty stored block
+  const size_t bound = deflateBound(z, strip->length) + 16;
+  strip->buffer = malloc(ZLIB_HEADER + bound + ZLIB_TRAILER);
+  if (strip->buffer == NULL) {
+    LOG_FATAL("Can't malloc(%zu) for the strip %d", ZLIB_HEADER + bound + ZLIB_TRAILER, s);
+    exit(1);
+  }
+
+  uint8_t *data = strip->buffer + ZLIB_HEADER;
+  z->next_in   = filtered + dict;
+  z->avail_in  = 0;
+  z->next_out  = data;
+  z->avail_out = bound;
+
+  // with a limit, by slices to stop as soon as the file is too large (same output as in one call)
+  const uint64_t limit = encoder->options->limit;
+  const size_t slice = (limit > 0) ? PNG_LIMIT_SLICE : strip->length;
+  for (size_t left = strip->length; left > slice; left -= slice) {
+    z->avail_in = slice;
+    if ((deflate(z, Z_NO_FLUSH) != Z_OK) || (z->avail_in != 0)) {
+      LOG_FATAL("Can't deflate the strip %d", s);
+      exit(1);
+    }
+    pthread_mutex_lock(&(encoder->lock));
+    encoder->cancelled |= (encoder->overhead + encoder->done + (bound - z->avail_out) > limit);
+    const uint8_t cancelled = encoder->cancelled;
+    pthread_mutex_unlock(&(encoder->lock));
+    if (cancelled) {
+      return;
+    }
+  }
+  z->avail_in = strip->length - (z->next_in - (filtered + dict));
+  const int ret = deflate(z, last ? Z_FINISH : Z_FULL_FLUSH);
+  if ((ret != (last ? Z_STREAM_END : Z_OK)) || (z->avail_in != 0)) {
+    LOG_FATAL("Can't deflate the strip %d (%d)", s, ret);
+    exit(1);
+  }
+  strip->size = bound - z->avail_out;
+  pthread_mutex_lock(&(encoder->lock));
+  encoder->done += strip->size;
+  encoder->cancelled |= (limit > 0) && (encoder->overhead + encoder->done > limit);
+  pthread_mutex_unlock(&(encoder->lock));
+
+  // the zlib header belongs to the first IDAT
+  if (s == 0) {
+    data -= ZLIB_HEADER;
+    memcpy(data, encoder->header, ZLIB_HEADER);
+    strip->size += ZLIB_HEADER;
+  }
+  if (data != strip->buffer) {
+    memmove(strip->buffer, data, strip->size);
+  }
+  strip->crc = chunk_crc("IDAT", strip->buffer, strip->size);
+}
+
+/**
+ * @brief Deflate strips until there is none left, with the zlib state of a lane
+ * @param[in,out] arg The encoder
+ * @param[in] lane Index of the lane (unused: the strips are taken in order by any lane)
+ */
+static void deflate_strips(void *arg, uint32_t lane) {
+  (void) lane;
+  struct png_encoder *encoder = arg;
+  const struct png_options *options = encoder->options;
+  const uint32_t length = encoder->lsize + 1;
+  uint32_t dict_rows = options->dictionary ? (PNG_WINDOW + length - 1) / length : 0;
+  if (options->dictionary && (options->filter == FILTER_BRUTE)) {
+    dict_rows = encoder->strip_rows;
+  }
+
+  struct png_worker worker;
+  const size_t size = (size_t) (encoder->strip_rows + dict_rows) * length + 2 * (size_t) encoder->lsize;
+  worker.filtered = malloc(size);
+  if (worker.filtered == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to filter strips", size);
+    exit(1);
+  }
+  worker.tmp = worker.filtered + size - 2 * (size_t) encoder->lsize;
+  row_filter_init(&(worker.filter), options->filter, options->filter_type, options->level, encoder->lsize, encoder->bpp);
+
+  memset(&(worker.z), 0, sizeof(z_stream));
+  const uint8_t unfiltered = (encoder->nb_type == 1) || ((options->filter == FILTER_FIXED) && (options->filter_type == 0));
+  int strategy = options->strategy;
+  if (strategy == PNG_AUTO_STRATEGY) {
+    strategy = unfiltered ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+  }
+  const int window_bits = (options->window_bits > 0) ? options->window_bits : MAX_WBITS;
+  if (deflateInit2(&(worker.z), options->level, Z_DEFLATED, -window_bits, 8, strategy) != Z_OK) {
+    LOG_FATAL("Can't init deflate (level %d)", options->level);
+    exit(1);
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&(encoder->lock));
+    const uint32_t s = encoder->next++;
+    const uint8_t cancelled = encoder->cancelled;
+    pthread_mutex_unlock(&(encoder->lock));
+    if ((s >= encoder->nb_strip) || cancelled) {
+      break;
+    }
+    deflate_strip(encoder, s, &worker);
+  }
+
+  deflateEnd(&(worker.z));
+  row_filter_free(&(worker.filter));
+  free(worker.filtered);
+}
+
+/**
+ * @brief Deflate every strip, on lanes run by the workers of the scheduler
+ */
+static void deflate_image(struct png_encoder *encoder) {
+  // more lanes than workers would only set up zlib states for nothing
+  const uint8_t threads = encoder->options->threads;
+  uint32_t max = sched_current()->nb_worker;
+  max = ((threads > 0) && (threads < max)) ? threads : max;
+  max = (max < encoder->nb_strip) ? max : encoder->nb_strip;
+  max = (max < PNG_MAX_THREAD) ? max : PNG_MAX_THREAD;
+  const uint64_t pixels = (uint64_t) encoder->image->width * encoder->image->height;
+  const uint32_t nb_lane = sched_pieces(pixels, PNG_THREAD_PIXELS, max);
+  LOG_INFO("Deflate %d strips of %d rows on %d lanes", encoder->nb_strip, encoder->strip_rows, nb_lane);
+  sched_run(NULL, nb_lane, deflate_strips, encoder);
+}
+
+
+
+uint64_t write_png_chunk(int fd, const char *filename, const char *type, const uint8_t *data, uint32_t length,
+                         const uint32_t *crc) {
+  const uint64_t size = 12 + (uint64_t) length;
+  if (fd < 0) {
+    return size;
+  }
+  uint8_t head[8], tail[4];
+  put32(head, length);
+  memcpy(head + 4, type, 4);
+  put32(tail, (crc != NULL) ? *crc : chunk_crc(type, data, length));
+
+  struct iovec iov[3] = {
+    {.iov_base = head, .iov_len = 8},
+    {.iov_base = (void *) data, .iov_len = length},
+    {.iov_base = tail, .iov_len = 4},
+  };
+  uint64_t done = 0;
+  int first = 0;
+  while (done < size) {
+    const ssize_t n = writev(fd, iov + first, 3 - first);
+    if (n < 0) {
+      LOG_ERROR("Can't write %s (%s)", filename, strerror(errno));
+      return 0;
+    }
+    done += n;
+    // skip what is written
+    for (size_t left = n; left > 0;) {
+      if (left >= iov[first].iov_len) {
+        left -= iov[first].iov_len;
+        iov[first].iov_len = 0;
+        first++;
+      }
+      else {
+        iov[first].iov_base = ((uint8_t *) iov[first].iov_base) + left;
+        iov[first].iov_len -= left;
+        left = 0;
+      }
+    }
+  }
+  return size;
+}
+
+/**
+ * @brief Add the size of a chunk to the size of a file
+ * @return The sum, 0 if the file or the chunk could not be written
+ */
+static uint64_t add_size(uint64_t size, uint64_t chunk) {
+  return ((size > 0) && (chunk > 0)) ? size + chunk : 0;
+}
+
+/**
+ * @brief PNG color type of the image
+ */
+static uint8_t color_type(const struct image *image) {
+  if (image->palette != NULL) {
+    return PLTE_INDEX;
+  }
+  switch (image->sample) {
+  case 1:
+    return GRAYSCALE;
+  case 2:
+    return GRAYSCALE_ALPHA;
+  case 3:
+    return RGB_TRIPLE;
+  default:
+    return RGB_TRIPLE_ALPHA;
+  }
+}
+
+/**
+ * @brief Number of colors of the palette used by the image
+ */
+static uint32_t palette_length(const struct image *image) {
+  const uint32_t lsize = line_size(image);
+  const uint8_t depth = image->depth;
+  const uint8_t mask = (1U << depth) - 1;
+  uint8_t max = 0;
+  for (uint32_t i = 0; i < image->height; i++) {
+    const uint8_t *row = ((const uint8_t *) image->data) + (size_t) i * lsize;
+    for (uint32_t j = 0; j < image->width; j++) {
+      const uint32_t bit = j * depth;
+      const uint8_t index = (row[bit / 8] >> (8 - depth - bit % 8)) & mask;
+      max = (index > max) ? index : max;
+    }
+  }
+  return max + 1;
+}
+
+/**
+ * @brief Write the chunks before the image data
+ * @param[in] fd Or -1 to only get the size
+ * @param[in] filename
+ * @param[in] image
+ * @param[in] color PNG color type of the image
+ * @param[in] options For the chunks copied as they are
+ * @return Size of the chunks, 0 if they can't be written
+ */
+static uint64_t write_header(int fd, const char *filename, const struct image *image, uint8_t color,
+                             const struct png_options *options) {
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+  uint64_t size = 8;
+  if ((fd >= 0) && (write(fd, signature, 8) != 8)) {
+    LOG_ERROR("Can't write %s (%s)", filename, strerror(errno));
+    size = 0;
+  }
+
+  uint8_t ihdr[13];
+  put32(ihdr, image->width);
+  put32(ihdr + 4, image->height);
+  ihdr[8]  = image->depth;
+  ihdr[9]  = color;
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filters
+  ihdr[12] = 0; // no interlace
+  size = add_size(size, write_png_chunk(fd, filename, "IHDR", ihdr, 13, NULL));
+
+  if (image->gamma != 0) {
+    uint8_t gama[4];
+    put32(gama, image->gamma);
+    size = add_size(size, write_png_chunk(fd, filename, "gAMA", gama, 4, NULL));
+  }
+
+  if (options->chunks_size > 0) {
+    if ((fd >= 0) && (write(fd, options->chunks, options->chunks_size) != (ssize_t) options->chunks_size)) {
+      LOG_ERROR("Can't write %s (%s)", filename, strerror(errno));
+      size = 0;
+    }
+    size = add_size(size, options->chunks_size);
+  }
+
+  uint32_t nb_color = 0;
+  if (color == PLTE_INDEX) {
+    nb_color = palette_length(image);
+    size = add_size(size, write_png_chunk(fd, filename, "PLTE", image->palette, nb_color * 3, NULL));
+  }
+
+  if (options->transparency != NULL) {
+    // no alpha past the last color of the palette
+    const uint32_t length = ((color == PLTE_INDEX) && (options->transparency_length > nb_color))
+      ? nb_color : options->transparency_length;
+    size = add_size(size, write_png_chunk(fd, filename, "tRNS", options->transparency, length, NULL));
+  }
+
+  if (image->has_background) {
+    const uint16_t *bg = image->background;
+    uint8_t bkgd[6];
+    uint32_t length = 0;
+    if (color == PLTE_INDEX) {
+      // the first color of the palette, if any
+      for (uint32_t c = 0; (length == 0) && (c < nb_color); c++) {
+        const uint8_t *rgb = image->palette + 3 * c;
+        if ((rgb[0] * 257 == bg[0]) && (rgb[1] * 257 == bg[1]) && (rgb[2] * 257 == bg[2])) {
+          bkgd[0] = c;
+          length = 1;
+        }
+      }
+    }
+    else if ((color == GRAYSCALE) || (color == GRAYSCALE_ALPHA)) {
+      const uint32_t max = (1U << image->depth) - 1;
+      const uint16_t gray = ((uint32_t) bg[0] * max + 32767) / 65535;
+      bkgd[0] = gray >> 8;
+      bkgd[1] = gray;
+      length = 2;
+    }
+    else {
+      for (uint8_t k = 0; k < 3; k++) {
+        const uint16_t v = (image->depth == 8) ? bg[k] / 257 : bg[k];
+        bkgd[2 * k]     = v >> 8;
+        bkgd[2 * k + 1] = v;
+      }
+      length = 6;
+    }
+    if (length > 0) {
+      size = add_size(size, write_png_chunk(fd, filename, "bKGD", bkgd, length, NULL));
+    }
+  }
+  return size;
+}
+
+
+
+struct png_options png_default_options(void) {
+  const struct png_options options = {
+    .level       = PNG_DEFAULT_LEVEL,
+    .filter      = FILTER_HEURISTIC,
+    .filter_type = 0,
+    .strategy    = PNG_AUTO_STRATEGY,
+    .window_bits = 0,
+    .strip_rows  = 0,
+    .threads     = 0,
+    .dictionary  = 0,
+    .limit       = 0,
+    .chunks      = NULL,
+    .chunks_size = 0,
+    .transparency        = NULL,
+    .transparency_length = 0,
+  };
+  return options;
+}
+
+
+/**
+ * @brief Filter and deflate the whole image
+ * @param[out] encoder
+ * @param[in] image
+ * @param[in] options
+ * @return 1 if the strips are ready to be written, 0 if the file would exceed the limit (nothing to free)
+ */
+static uint8_t encode_image(struct png_encoder *encoder, const struct image *image, const struct png_options *options) {
+  if ((options->level < 0) || (options->level > 9)) {
+    LOG_FATAL("No zlib level %d", options->level);
+    exit(1);
+  }
+  const uint8_t window_bits = (options->window_bits > 0) ? options->window_bits : MAX_WBITS;
+  if ((window_bits < 9) || (window_bits > MAX_WBITS)) {
+    LOG_FATAL("No deflate window of %d bits", window_bits);
+    exit(1);
+  }
+
+  const struct png_encoder init = {
+    .image   = image,
+    .options = options,
+    .lsize   = line_size(image),
+    .bpp     = (image->depth * image->sample + 7) / 8,
+    // the heuristic does not filter palettes and sub-byte samples, as the specification suggests
+    .nb_type = ((options->filter == FILTER_HEURISTIC) && ((image->palette != NULL) || (image->depth < 8))) ? 1 : NB_FILTER,
+    .done      = 0,
+    .cancelled = 0,
+    .next      = 0,
+  };
+  *encoder = init;
+  const uint32_t length = encoder->lsize + 1;
+
+  // zlib header: the window in CINFO, the level in FLEVEL (the header is a multiple of 31)
+  const uint8_t flevel = (options->level < 2) ? 0 : (options->level < 6) ? 1 : (options->level == 6) ? 2 : 3;
+  encoder->header[0] = ((window_bits - 8) << 4) | Z_DEFLATED;
+  encoder->header[1] = flevel << 6;
+  encoder->header[1] += 31 - ((encoder->header[0] << 8) | encoder->header[1]) % 31;
+
+  encoder->strip_rows = options->strip_rows;
+  if (encoder->strip_rows == 0) {
+    encoder->strip_rows = (length < PNG_STRIP_SIZE) ? PNG_STRIP_SIZE / length : 1;
+  }
+  if (encoder->strip_rows > image->height) {
+    encoder->strip_rows = image->height;
+  }
+  if ((uint64_t) encoder->strip_rows * length > PNG_MAX_STRIP) {
+    LOG_FATAL("Strips of %d rows of %d bytes are too large", encoder->strip_rows, length);
+    exit(1);
+  }
+  encoder->nb_strip = (image->height + encoder->strip_rows - 1) / encoder->strip_rows;
+
+  // everything but the IDAT data: header, stRP, IDAT chunks and IEND
+  encoder->overhead = write_header(-1, NULL, image, color_type(image), options)
+    + 12 * (uint64_t) encoder->nb_strip + 12;
+  if ((encoder->nb_strip > 1) && !options->dictionary) {
+    encoder->overhead += 12 + 4 + 4 * (uint64_t) encoder->nb_strip;
+  }
+
+  encoder->strip = calloc(encoder->nb_strip, sizeof(struct png_strip));
+  if (encoder->strip == NULL) {
+    LOG_FATAL("Can't calloc %d strips", encoder->nb_strip);
+    exit(1);
+  }
+  for (uint32_t s = 0; s < encoder->nb_strip; s++) {
+    encoder->strip[s].row0  = s * encoder->strip_rows;
+    encoder->strip[s].nrows = (image->height - encoder->strip[s].row0 < encoder->strip_rows)
+      ? image->height - encoder->strip[s].row0 : encoder->strip_rows;
+  }
+
+  pthread_mutex_init(&(encoder->lock), NULL);
+  deflate_image(encoder);
+  pthread_mutex_destroy(&(encoder->lock));
+
+  if (encoder->cancelled) {
+    LOG_INFO("Stop deflating, the file would be larger than %lu bytes", (unsigned long) options->limit);
+    for (uint32_t s = 0; s < encoder->nb_strip; s++) {
+      free(encoder->strip[s].buffer);
+    }
+    free(encoder->strip);
+    return 0;
+  }
+
+  // adler32 of the whole stream after the last strip
+  struct png_strip *last = encoder->strip + encoder->nb_strip - 1;
+  uint32_t adler = encoder->strip[0].adler;
+  for (uint32_t s = 1; s < encoder->nb_strip; s++) {
+    adler = adler32_combine(adler, encoder->strip[s].adler, encoder->strip[s].length);
+  }
+  put32(last->buffer + last->size, adler);
+  last->crc = crc32(last->crc, last->buffer + last->size, ZLIB_TRAILER);
+  last->size += ZLIB_TRAILER;
+  return 1;
+}
+
+/**
+ * @brief Write the file from the deflated strips, and free them
+ * @param[in] fd Or -1 to only get the size
+ * @param[in] filename
+ * @param[in,out] encoder
+ * @return Size of the file, 0 if it can't be written
+ */
+static uint64_t write_encoded(int fd, const char *filename, struct png_encoder *encoder) {
+  uint64_t size = write_header(fd, filename, encoder->image, color_type(encoder->image), encoder->options);
+
+  // where each strip starts, if they decode alone
+  if ((encoder->nb_strip > 1) && !encoder->options->dictionary) {
+    const uint32_t strp_length = 4 + 4 * encoder->nb_strip;
+    uint8_t *strp = malloc(strp_length);
+    if (strp == NULL) {
+      LOG_FATAL("Can't malloc(%d) for %s", strp_length, PNG_STRIP_CHUNK);
+      exit(1);
+    }
+    put32(strp, encoder->strip_rows);
+    uint64_t offset = 12 + (uint64_t) strp_length;
+    for (uint32_t s = 0; s < encoder->nb_strip; s++) {
+      if (offset > UINT32_MAX) {
+        LOG_FATAL("Strip %d too far from %s", s, PNG_STRIP_CHUNK);
+        exit(1);
+      }
+      put32(strp + 4 + 4 * s, offset);
+      offset += 12 + (uint64_t) encoder->strip[s].size;
+    }
+    size = add_size(size, write_png_chunk(fd, filename, PNG_STRIP_CHUNK, strp, strp_length, NULL));
+    free(strp);
+  }
+
+  for (uint32_t s = 0; s < encoder->nb_strip; s++) {
+    const struct png_strip *strip = encoder->strip + s;
+    // once a write failed, the strips are only freed
+    const int out = (size > 0) ? fd : -1;
+    size = add_size(size, write_png_chunk(out, filename, "IDAT", strip->buffer, strip->size, &(strip->crc)));
+    free(strip->buffer);
+  }
+  size = add_size(size, write_png_chunk(fd, filename, "IEND", NULL, 0, NULL));
+  free(encoder->strip);
+  return size;
+}
+
+
+uint64_t write_png(const struct image *image, const char *filename, const struct png_options *options) {
+  const struct png_options defaults = png_default_options();
+  if (options == NULL) {
+    options = &defaults;
+  }
+  struct png_encoder encoder;
+  if (!encode_image(&encoder, image, options)) {
+    return 0;
+  }
+
+  const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Can't open %s (%s)", filename, strerror(errno));
+    write_encoded(-1, filename, &encoder); // only frees the strips
+    return 0;
+  }
+  uint64_t size = write_encoded(fd, filename, &encoder);
+  if (close(fd) != 0) {
+    LOG_ERROR("Can't close %s (%s)", filename, strerror(errno));
+    size = 0;
+  }
+  if (size == 0) {
+    return 0;
+  }
+  LOG_INFO("Write %s: %lu bytes of image data deflated in %lu bytes", filename,
+           (unsigned long) ((uint64_t) image->height * (encoder.lsize + 1)), (unsigned long) encoder.done);
+  return size;
+}
+
+
+uint8_t *png_source_chunks(const struct mfile *file, struct png_options *options, uint32_t *iccp) {
+  static const enum chunk_type kept[] = {SRGB, CHRM, ICCP};
+  uint8_t *chunks = NULL;
+  uint32_t size = 0, last = 0;
+  for (uint8_t k = 0; k < sizeof(kept) / sizeof(kept[0]); k++) {
+    // from the signature to the image data
+    for (size_t offset = 8;;) {
+      const uint8_t *ptr = ((const uint8_t *) file->data) + offset;
+      const struct chunk current = get_chunk_unchecked(file->size - offset, ptr);
+      if ((current.type == IDAT) || (current.type == IEND)) {
+        break;
+      }
+      const uint32_t length = 12 + current.length;
+      if ((k == 0) && (current.type == TRNS)) {
+        options->transparency        = current.data;
+        options->transparency_length = current.length;
+      }
+      if (current.type == kept[k]) {
+        uint8_t *bigger = realloc(chunks, size + length);
+        if (bigger == NULL) {
+          LOG_FATAL("Can't realloc(%u) for the chunks of %s", size + length, file->pathname);
+          exit(1);
+        }
+        chunks = bigger;
+        memcpy(chunks + size, ptr, length);
+        size += length;
+        last = (current.type == ICCP) ? length : 0;
+      }
+      offset += length;
+    }
+  }
+  options->chunks      = chunks;
+  options->chunks_size = size;
+  if (iccp != NULL) {
+    *iccp = last;
+  }
+  return chunks;
+}
+
+
+uint64_t png_size(const struct image *image, const struct png_options *options) {
+  const struct png_options defaults = png_default_options();
+  if (options == NULL) {
+    options = &defaults;
+  }
+  struct png_encoder encoder;
+  if (!encode_image(&encoder, image, options)) {
+    return 0;
+  }
+  return write_encoded(-1, NULL, &encoder);
+}
@@ -0,0 +1,133 @@
+/**
+ * @file png.h
+ * @brief Write PNG files, strips of rows deflated in parallel
+ * @details The rows are cut in strips, each strip is filtered and deflated on its own worker
+ * (as pigz does) into a raw deflate stream ended by a full flush, so the strips put end to end
+ * make one zlib stream. The adler32 of the whole stream is combined from the adler32 of each strip.
+ * Each strip is one IDAT chunk. The first row of a strip is only filtered with None or Sub
+ * (it never refers to the row above), so without dictionary a strip decodes on its own:
+ * the private chunk stRP (as Apple's iDOT) gives where each strip starts, for readers that
+ * decode the strips in parallel. Files are valid PNG for any other reader.
+ *
+ * stRP layout (big endian), before the first IDAT:
+ * - 4 bytes: number of rows of a strip (the last one may be shorter)
+ * - 4 bytes per strip: offset of its IDAT chunk from the start of the stRP chunk (its length field)
+ *
+ * The first strip starts with the 2-byte zlib header, the last one ends with the adler32.
+ * The output does not depend on the number of threads.
+ */
+
+#ifndef __PNG_H__
+#define __PNG_H__
+
+#include <stdint.h>
+
+#include "filter.h"
+#include "image.h"
+#include "mfile.h"
+
+
+/** @brief Type of the chunk listing the strips */
+#define PNG_STRIP_CHUNK "stRP"
+/** @brief Number of filtered bytes of a strip (when the rows of a strip are not given) */
+#define PNG_STRIP_SIZE (1U << 18)
+/** @brief Default zlib level */
+#define PNG_DEFAULT_LEVEL (6)
+/** @brief zlib strategy chosen from the filters: Z_FILTERED, or Z_DEFAULT_STRATEGY for unfiltered rows */
+#define PNG_AUTO_STRATEGY (-1)
+
+
+/**
+ * @brief Options of the encoder
+ */
+struct png_options {
+  /** @brief zlib level (0 to 9) */
+  int level;
+  /** @brief How rows are filtered (palettes and sub-byte samples are not filtered by FILTER_HEURISTIC) */
+  enum filter_strategy filter;
+  /** @brief Filter type of FILTER_FIXED */
+  uint8_t filter_type;
+  /** @brief zlib strategy (Z_FILTERED, Z_RLE...) or PNG_AUTO_STRATEGY */
+  int strategy;
+  /** @brief Deflate window of 2^window_bits bytes (9 to 15), 0 for 15 */
+  uint8_t window_bits;
+  /** @brief Number of rows of a strip, 0 for about PNG_STRIP_SIZE bytes */
+  uint32_t strip_rows;
+  /** @brief Max number of strips deflated at once (at most the workers of the scheduler), 0 for no other limit */
+  uint8_t threads;
+  /**
+   * @brief Flag: each strip starts with the last 32 KiB of the strip before as dictionary
+   * @details Smaller files, but a strip can't be decoded alone anymore: no stRP chunk
+   */
+  uint8_t dictionary;
+  /** @brief Max size of the file, 0 for no limit: deflate stops as soon as the file would be larger */
+  uint64_t limit;
+  /** @brief Whole chunks (length, type, data and CRC) written as they are after gAMA, before PLTE, or NULL */
+  const uint8_t *chunks;
+  /** @brief Size of chunks */
+  uint32_t chunks_size;
+  /**
+   * @brief Data of a tRNS chunk written after PLTE, or NULL
+   * @details Copied from a source with the color type and depth of the image (cut to the palette written)
+   */
+  const uint8_t *transparency;
+  /** @brief Length of transparency */
+  uint32_t transparency_length;
+};
+
+
+/**
+ * @brief Default options: PNG_DEFAULT_LEVEL, FILTER_HEURISTIC, PNG_AUTO_STRATEGY, 32 KiB window,
+ * strips of PNG_STRIP_SIZE, every core, no dictionary, no limit, no chunk copied, no tRNS
+ * @return The options
+ */
+struct png_options png_default_options(void);
+
+/**
+ * @brief Save the image in a PNG file
+ * @details The color type follows the image (palette, gray or RGB, with alpha or not), as well as the depth.
+ * gAMA and bKGD are written from the image, other chunks only from options->chunks (sRGB, cHRM, iCCP...)
+ * and options->transparency (see png_source_chunks).
+ * @param[in] image Any image returned by get_image (16-bit samples in any byte order)
+ * @param[in] filename Name of the file to write
+ * @param[in] options Options or NULL for png_default_options
+ * @return Size of the file, 0 if it would be larger than options->limit (nothing is written) or if it can't
+ * be written (the file may be incomplete)
+ */
+uint64_t write_png(const struct image *image, const char *filename, const struct png_options *options);
+
+/**
+ * @brief Size of the file write_png would write, nothing is written
+ * @param[in] image
+ * @param[in] options Options or NULL for png_default_options
+ * @return Size of the file, 0 if it would be larger than options->limit
+ */
+uint64_t png_size(const struct image *image, const struct png_options *options);
+
+/**
+ * @brief Options to write an image as its source: the chunks write_png does not get from the image
+ * @details sRGB, cHRM and iCCP (last) go to options->chunks, tRNS to options->transparency: the image
+ * must keep the color type and depth of the source, as get_image_native gives it.
+ * @param[in] file Source, mapped as long as the options are used
+ * @param[in,out] options
+ * @param[out] iccp Size of the iCCP chunk at the end of options->chunks (0 if none), or NULL
+ * @return The copy of the chunks to free once the file is written, NULL if none
+ */
+uint8_t *png_source_chunks(const struct mfile *file, struct png_options *options, uint32_t *iccp);
+
+/**
+ * @brief Write a whole chunk (length, type, data and CRC) with one writev
+ * @param[in] fd Or -1 to only get the size
+ * @param[in] filename Name of the file (for the error message)
+ * @param[in] type Chunk type (4 characters)
+ * @param[in] data
+ * @param[in] length Length of data
+ * @param[in] crc CRC of the type and data if already known (a chunk copied as it is), NULL otherwise
+ * @return Size of the chunk, 0 if it can't be written
+ */
+uint64_t write_png_chunk(int fd, const char *filename, const char *type, const uint8_t *data, uint32_t length,
+                         const uint32_t *crc);
+
+
+
+#endif // __PNG_H__
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "convert.h"
+#include "gamma.h"
+#include "log.h"
+#include "pnm.h"
+#include "render.h"
+#include "stream.h"
+
+
+/** @brief Max size of a header */
+#define PNM_HEADER (128U)
+
+
+
+/**
+ * @brief Write the whole buffer, unless a write already failed
+ */
+static void write_all(struct pnm_writer *writer, const uint8_t *buffer, size_t size) {
+  while ((size > 0) && !writer->failed) {
+    const ssize_t n = write(writer->fd, buffer, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("Can't write %s (%s)", writer->filename, strerror(errno));
+      writer->failed = 1;
+      return;
+    }
+    buffer += n;
+    size   -= n;
+  }
+}
+
+/**
+ * @brief Hand the pages of the buffer over to the pipe (write() if not possible)
+ * @details The pipe reads the pages later: they must not change until pipe_size more bytes are spliced
+ */
+static void splice_all(struct pnm_writer *writer, const uint8_t *buffer, size_t size) {
+#ifdef __linux__
+  while ((writer->pipe_size > 0) && (size > 0) && !writer->failed) {
+    struct iovec iov = {.iov_base = (void *) buffer, .iov_len = size};
+    const ssize_t n = vmsplice(writer->fd, &iov, 1, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EPIPE) {
+        LOG_ERROR("Can't write %s (%s)", writer->filename, strerror(errno));
+        writer->failed = 1;
+        return;
+      }
+      LOG_WARN("Can't vmsplice to %s, write instead", writer->filename);
+      writer->pipe_size = 0;
+      break;
+    }
+    buffer += n;
+    size   -= n;
+    writer->spliced += n;
+  }
+#endif
+  write_all(writer, buffer, size);
+}
+
+/**
+ * @brief Write the next rows
+ * @param[in,out] writer
+ * @param[in] rows Rows in the layout of the file
+ * @param[in] nrows Number of rows
+ * @param[in] lent Flag: rows are left untouched long enough to be spliced (see image_stream)
+ */
+static void write_rows(struct pnm_writer *writer, const uint8_t *rows, uint32_t nrows, uint8_t lent) {
+  if (writer->row + nrows > writer->height) {
+    LOG_FATAL("Too many rows for %s (%d + %d > %d)", writer->filename, writer->row, nrows, writer->height);
+    exit(1);
+  }
+  const size_t size = (size_t) nrows * writer->pitch;
+  if (lent && (writer->pipe_size > 0)) {
+    splice_all(writer, rows, size);
+  }
+  else {
+    write_all(writer, rows, size);
+  }
+  writer->row += nrows;
+}
+
+/**
+ * @brief Drop the alpha sample of consecutive pixels, in place
+ * @param[in,out] pixels RGBA pixels, packed RGB pixels at the end
+ * @param[in] count Number of pixels
+ * @param[in] bytes Bytes per sample (1 or 2)
+ */
+static void drop_alpha(uint8_t *pixels, size_t count, uint8_t bytes) {
+  const uint8_t *src = pixels;
+  uint8_t *dst = pixels;
+
+  // dst never passes src: a forward copy is safe
+  if (bytes == 1) {
+    for (size_t j = 0; j < count; j++, src += 4, dst += 3) {
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+    }
+    return;
+  }
+  for (size_t j = 0; j < count; j++, src += 8, dst += 6) {
+    for (uint8_t k = 0; k < 6; k++) {
+      dst[k] = src[k];
+    }
+  }
+}
+
+
+
+uint8_t pnm_open(struct pnm_writer *writer, const char *filename, enum pnm_format format,
+              uint32_t width, uint32_t height, uint8_t depth) {
+  if ((depth != 8) && (depth != 16)) {
+    LOG_FATAL("No %d-bit samples in %s", depth, filename);
+    exit(1);
+  }
+  const uint8_t bytes = depth / 8;
+  const size_t stride = (size_t) width * 4 * bytes;
+
+  writer->filename  = filename;
+  writer->format    = format;
+  writer->width     = width;
+  writer->height    = height;
+  writer->depth     = depth;
+  writer->pitch     = width * ((format == PNM_PPM) ? 3 : 4) * bytes;
+  writer->row       = 0;
+  writer->pipe_size = 0;
+  writer->spliced   = 0;
+  writer->failed    = 0;
+  writer->batch_rows = ((stride > 0) && (stride < PNM_BATCH_SIZE)) ? PNM_BATCH_SIZE / stride : 1;
+  if (writer->batch_rows > height) {
+    writer->batch_rows = (height > 0) ? height : 1;
+  }
+
+  writer->rgba = malloc(writer->batch_rows * stride);
+  if (writer->rgba == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to write %s", writer->batch_rows * stride, filename);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc PNM batch %p (%d rows)", writer->rgba, writer->batch_rows);
+
+  if (strcmp(filename, PNM_STDOUT) == 0) {
+    writer->fd = STDOUT_FILENO;
+  }
+  else {
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+      LOG_ERROR("Can't open %s (%s)", filename, strerror(errno));
+      free(writer->rgba);
+      return 0;
+    }
+  }
+
+#ifdef __linux__
+  struct stat st;
+  if ((fstat(writer->fd, &st) == 0) && S_ISFIFO(st.st_mode)) {
+    const int size = fcntl(writer->fd, F_GETPIPE_SZ);
+    writer->pipe_size = (size > 0) ? size : 0;
+  }
+#endif
+
+  char header[PNM_HEADER];
+  const uint32_t maxval = (1U << depth) - 1;
+  int length = 0;
+  switch (format) {
+  case PNM_PPM:
+    length = snprintf(header, PNM_HEADER, "P6\n%u %u\n%u\n", width, height, maxval);
+    break;
+  case PNM_PAM:
+    length = snprintf(header, PNM_HEADER, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL %u\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+                      width, height, maxval);
+    break;
+  case PNM_RAW:
+    break;
+  }
+  write_all(writer, (const uint8_t *) header, length);
+  return 1;
+}
+
+
+void pnm_write_rows(struct pnm_writer *writer, const uint8_t *rows, uint32_t nrows) {
+  write_rows(writer, rows, nrows, 0);
+}
+
+
+void pnm_write_image(struct pnm_writer *writer, const struct image *image, uint32_t row0, uint32_t nrows) {
+  const uint8_t bytes = writer->depth / 8;
+  const size_t stride = (size_t) writer->width * 4 * bytes;
+  const enum pixel_format format = (bytes == 2) ? FORMAT_RGBA16 : FORMAT_RGBA8;
+  const enum alpha_mode mode = (writer->format == PNM_PPM) ? ALPHA_BACKGROUND : ALPHA_STRAIGHT;
+
+  while (nrows > 0) {
+    const uint32_t n = (nrows < writer->batch_rows) ? nrows : writer->batch_rows;
+    render_rows(image, row0, n, format, mode, writer->rgba, stride);
+
+    // rows are contiguous: one run of pixels
+    if (writer->format == PNM_PPM) {
+      drop_alpha(writer->rgba, (size_t) n * writer->width, bytes);
+    }
+    if ((bytes == 2) && (writer->format != PNM_RAW)) {
+      samples_to_native(writer->rgba, n * (writer->pitch / 2)); // native to big endian: the same swap
+    }
+    write_rows(writer, writer->rgba, n, 0);
+    row0  += n;
+    nrows -= n;
+  }
+}
+
+
+uint8_t pnm_passthrough(const struct image *image, enum pnm_format format, uint8_t depth) {
+  const uint8_t sample = (format == PNM_PPM) ? 3 : 4;
+  const uint8_t native = (format == PNM_RAW); // byte order of 16-bit samples in the file
+
+  return (image->palette == NULL) && (image->sample == sample) && (image->depth == depth)
+    && ((depth == 8) || (image->native == native))
+    && (image->profile == NULL) && gamma_identity(image->gamma, TRANSFER_DISPLAY);
+}
+
+
+uint8_t pnm_close(struct pnm_writer *writer) {
+  if (!writer->failed && (writer->row != writer->height)) {
+    LOG_FATAL("Only %d rows of %d written to %s", writer->row, writer->height, writer->filename);
+    exit(1);
+  }
+  if ((writer->fd != STDOUT_FILENO) && (close(writer->fd) != 0)) {
+    LOG_ERROR("Can't close %s (%s)", writer->filename, strerror(errno));
+    writer->failed = 1;
+  }
+  LOG_ALLOC("Free PNM batch %p", writer->rgba);
+  free(writer->rgba);
+  LOG_INFO("Write %s (%lu bytes spliced)", writer->filename, (unsigned long) writer->spliced);
+  return !writer->failed;
+}
+
+
+uint8_t save_file_as_pnm(const struct mfile *file, const char *filename, enum pnm_format format, uint8_t depth,
+                         uint64_t *spliced) {
+  // IHDR is the first chunk, right after the signature
+  const struct chunk chunk = get_chunk(file->size - 8, ((const uint8_t *) file->data) + 8);
+  const struct IHDR hdr = IHDR_chunk(&chunk);
+  if (depth == 0) {
+    depth = (hdr.depth == 16) ? 16 : 8;
+  }
+
+  struct pnm_writer writer;
+  if (!pnm_open(&writer, filename, format, hdr.width, hdr.height, depth)) {
+    return 0;
+  }
+
+  // a band must fill the pipe, so the band before is consumed when the next one is decoded
+  const size_t band_size = (writer.pipe_size > PNM_BATCH_SIZE) ? writer.pipe_size : PNM_BATCH_SIZE;
+  const uint32_t lsize = byte_per_line(hdr.depth, count_sample(hdr.color_type), hdr.width);
+  const size_t band_rows = (band_size + lsize - 1) / lsize;
+
+  struct image_stream is;
+  image_stream_open(&is, file, (band_rows < hdr.height) ? band_rows : hdr.height, format == PNM_RAW);
+  const uint8_t passthrough = pnm_passthrough(&(is.band), format, depth);
+  LOG_INFO("%s rows to %s", passthrough ? "Decoded" : "Rendered", filename);
+
+  uint32_t nrows;
+  // nothing more to decode once the reader is gone
+  while (!writer.failed && ((nrows = image_stream_read(&is)) > 0)) {
+    if (passthrough) {
+      write_rows(&writer, is.band.data, nrows, 1);
+    }
+    else {
+      pnm_write_image(&writer, &(is.band), 0, nrows);
+    }
+  }
+  image_stream_close(&is);
+  const uint8_t written = pnm_close(&writer);
+  if (spliced != NULL) {
+    *spliced = writer.spliced;
+  }
+  return written;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file pnm.h
+ * @brief Write PPM, PAM and raw RGBA files row by row
+ * @details PPM (P6) is RGB composited onto the background, PAM (P7, RGB_ALPHA) and raw files keep
+ * the straight alpha. 16-bit samples are big endian in PPM and PAM files (as the Netpbm formats want),
+ * in the native byte order in raw files.
+ * When the decoded rows already are the rows of the file (same layout, nothing to correct),
+ * they go from the decoder buffer to the file descriptor as they are: write() for files,
+ * vmsplice() when the output is a pipe, so the pages are never copied.
+ */
+
+#ifndef __PNM_H__
+#define __PNM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "mfile.h"
+
+
+/** @brief Size of the rows rendered at once */
+#define PNM_BATCH_SIZE (1U << 20)
+
+/** @brief File name of the standard output */
+#define PNM_STDOUT "-"
+
+
+/**
+ * @brief Output formats
+ */
+enum pnm_format {
+  /** @brief Netpbm P6: red, green, blue */
+  PNM_PPM = 0,
+  /** @brief Netpbm P7, TUPLTYPE RGB_ALPHA: red, green, blue, alpha */
+  PNM_PAM = 1,
+  /** @brief No header: red, green, blue, alpha */
+  PNM_RAW = 2,
+};
+
+/**
+ * @brief PNM file being written
+ */
+struct pnm_writer {
+  /** @brief File descriptor */
+  int fd;
+  /** @brief Name of the file */
+  const char *filename;
+  /** @brief Format of the file */
+  enum pnm_format format;
+  /** @brief Width of the image */
+  uint32_t width;
+  /** @brief Height of the image */
+  uint32_t height;
+  /** @brief Bits per sample: 8 or 16 */
+  uint8_t depth;
+  /** @brief Length of a row in the file */
+  uint32_t pitch;
+  /** @brief Number of rows written so far */
+  uint32_t row;
+  /** @brief Size of the pipe when the output is a pipe vmsplice accepts, 0 otherwise */
+  size_t pipe_size;
+  /** @brief Number of bytes handed over without copy (vmsplice) */
+  uint64_t spliced;
+  /** @brief Flag: a write failed (full disk, closed pipe), nothing more is written */
+  uint8_t failed;
+  /** @brief Max number of rows rendered at once by pnm_write_image */
+  uint32_t batch_rows;
+  /** @brief Rows rendered by pnm_write_image (RGBA8 or RGBA16) */
+  uint8_t *rgba;
+};
+
+
+/**
+ * @brief Create the file and write the header
+ * @param[out] writer
+ * @param[in] filename Name of the file, PNM_STDOUT for the standard output
+ * @param[in] format
+ * @param[in] width
+ * @param[in] height
+ * @param[in] depth Bits per sample: 8 or 16
+ * @return 1 if the file is created, 0 otherwise (no pnm_close then)
+ */
+uint8_t pnm_open(struct pnm_writer *writer, const char *filename, enum pnm_format format,
+              uint32_t width, uint32_t height, uint8_t depth);
+
+/**
+ * @brief Write the next rows, already in the layout of the file
+ * @param[in,out] writer
+ * @param[in] rows Area of nrows * writer->pitch bytes
+ * @param[in] nrows Number of rows
+ */
+void pnm_write_rows(struct pnm_writer *writer, const uint8_t *rows, uint32_t nrows);
+
+/**
+ * @brief Render rows of an image (see render_rows) and write them as the next rows
+ * @param[in,out] writer
+ * @param[in] image An image as wide as the file (a whole image, or the band of a stream)
+ * @param[in] row0 First row of the image to write
+ * @param[in] nrows Number of rows
+ */
+void pnm_write_image(struct pnm_writer *writer, const struct image *image, uint32_t row0, uint32_t nrows);
+
+/**
+ * @brief Check if the rows of an image are the rows of the file
+ * @param[in] image
+ * @param[in] format
+ * @param[in] depth Bits per sample of the file
+ * @return 1 if the rows can be written as they are, 0 if they need render_rows
+ */
+uint8_t pnm_passthrough(const struct image *image, enum pnm_format format, uint8_t depth);
+
+/**
+ * @brief Check every row has been written and close the file
+ * @param[in,out] writer
+ * @return 1 if every write succeeded, 0 otherwise
+ */
+uint8_t pnm_close(struct pnm_writer *writer);
+
+/**
+ * @brief Decode a PNG file band by band into a PPM, PAM or raw file
+ * @details Only two bands of rows are in memory, whatever the size of the image
+ * @param[in] file A PNG file without interlace
+ * @param[in] filename Name of the file to write, PNM_STDOUT for the standard output
+ * @param[in] format
+ * @param[in] depth Bits per sample (8 or 16), 0 for 16 with 16-bit files and 8 otherwise
+ * @param[out] spliced Number of bytes handed over to a pipe without copy, or NULL
+ * @return 1 if written, 0 if the file can't be created or written (the decode stops)
+ */
+uint8_t save_file_as_pnm(const struct mfile *file, const char *filename, enum pnm_format format, uint8_t depth,
+                         uint64_t *spliced);
+
+
+
+#endif // __PNM_H__
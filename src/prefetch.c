@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include "log.h"
+#include "prefetch.h"
+
+
+/** @brief Max length of one read (the kernel reads less than 2 GiB at once) */
+#define PREFETCH_READ_SIZE (1U << 30)
+
+
+#ifdef __linux__
+/**
+ * @brief Rings of an io_uring mapped in memory
+ */
+struct prefetch_ring {
+  /** @brief Descriptor of the io_uring */
+  int fd;
+  /** @brief Submission queue: head (moved by the kernel), tail, mask and array of indexes */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  /** @brief Completion queue: head, tail (moved by the kernel) and mask */
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  /** @brief Submission entries */
+  struct io_uring_sqe *sqe;
+  /** @brief Completion entries */
+  struct io_uring_cqe *cqe;
+  /** @brief Mapping of the submission queue and its size */
+  void *sq_ring;
+  size_t sq_size;
+  /** @brief Mapping of the completion queue (the same one with IORING_FEAT_SINGLE_MMAP) and its size */
+  void *cq_ring;
+  size_t cq_size;
+  /** @brief Size of the mapping of the submission entries */
+  size_t sqe_size;
+  /** @brief Number of entries queued and not submitted yet */
+  uint32_t to_submit;
+};
+#endif
+
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Size of the mapping of a file, as map_file does (unmap_file frees both)
+ */
+static size_t mapping_size(size_t size) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  return ((size / page) + 1) * page;
+}
+
+/**
+ * @brief A read starts, the prefetch must be locked
+ */
+static void io_enter_locked(struct prefetch *prefetch) {
+  if (prefetch->reading++ == 0) {
+    prefetch->io_start = now();
+  }
+}
+
+/**
+ * @brief A read ends with the state of its file, the prefetch must be locked
+ */
+static void io_leave_locked(struct prefetch *prefetch, uint32_t rank, enum prefetch_state state) {
+  struct prefetch_file *file = prefetch->file + rank;
+  file->state = state;
+  if (state == PREFETCH_READY) {
+    prefetch->stats.nb_file++;
+    prefetch->stats.bytes += file->file.size;
+  }
+  if (--prefetch->reading == 0) {
+    prefetch->stats.io += now() - prefetch->io_start;
+  }
+  pthread_cond_broadcast(&(prefetch->ready));
+}
+
+/**
+ * @brief Flag: a rank is to be read now, the prefetch must be locked
+ * @details Not more than depth reads in flight either: files asked for may still be read, and
+ * the io_uring has room for depth reads.
+ */
+static int to_read_locked(const struct prefetch *prefetch) {
+  return !prefetch->stop && (prefetch->next < prefetch->nb) && (prefetch->next < prefetch->wanted + prefetch->depth)
+         && (prefetch->reading < prefetch->depth);
+}
+
+/**
+ * @brief Open a file to read ahead
+ * @param[in] prefetch
+ * @param[in] rank
+ * @param[out] size Size of the file
+ * @return The descriptor, -1 if the file is not read ahead (empty, too large or an error)
+ */
+static int open_file(const struct prefetch *prefetch, uint32_t rank, size_t *size) {
+  const char *name = prefetch->names[(prefetch->order != NULL) ? prefetch->order[rank] : rank];
+  const int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (st.st_size == 0) || ((uint64_t) st.st_size > PREFETCH_MAX_SIZE)) {
+    close(fd);
+    return -1;
+  }
+  struct prefetch_file *file = prefetch->file + rank;
+  file->file.pathname       = name;
+  file->file.size           = st.st_size;
+  file->file.allocated_size = mapping_size(st.st_size);
+  *size = st.st_size;
+  return fd;
+}
+
+
+
+#ifdef __linux__
+
+/*
+ * io_uring
+ */
+
+/**
+ * @brief Set up an io_uring
+ * @param[in] entries Number of reads in flight
+ * @return The rings, NULL if io_uring is not available
+ */
+static struct prefetch_ring *ring_open(uint32_t entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    LOG_INFO("No io_uring (%s)", strerror(errno));
+    return NULL;
+  }
+  struct prefetch_ring *ring = calloc(1, sizeof(struct prefetch_ring));
+  if (ring == NULL) {
+    LOG_FATAL("Can't calloc an io_uring");
+    exit(1);
+  }
+  ring->fd = fd;
+  ring->sq_size  = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size  = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqe_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  const int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    ring->sq_size = (ring->sq_size > ring->cq_size) ? ring->sq_size : ring->cq_size;
+    ring->cq_size = ring->sq_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = single ? ring->sq_ring
+                         : mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  ring->sqe = mmap(NULL, ring->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if ((ring->sq_ring == MAP_FAILED) || (ring->cq_ring == MAP_FAILED) || (ring->sqe == MAP_FAILED)) {
+    LOG_WARN("Can't map the rings of an io_uring");
+    if (ring->sq_ring != MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_size);
+    }
+    if (!single && (ring->cq_ring != MAP_FAILED)) {
+      munmap(ring->cq_ring, ring->cq_size);
+    }
+    if (ring->sqe != MAP_FAILED) {
+      munmap(ring->sqe, ring->sqe_size);
+    }
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+
+  uint8_t *sq = ring->sq_ring, *cq = ring->cq_ring;
+  ring->sq_head  = (unsigned *) (sq + params.sq_off.head);
+  ring->sq_tail  = (unsigned *) (sq + params.sq_off.tail);
+  ring->sq_mask  = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+  ring->cq_head  = (unsigned *) (cq + params.cq_off.head);
+  ring->cq_tail  = (unsigned *) (cq + params.cq_off.tail);
+  ring->cq_mask  = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqe      = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+  return ring;
+}
+
+static void ring_close(struct prefetch_ring *ring) {
+  munmap(ring->sqe, ring->sqe_size);
+  if (ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_size);
+  }
+  munmap(ring->sq_ring, ring->sq_size);
+  close(ring->fd);
+  free(ring);
+}
+
+/**
+ * @brief Queue a read (submitted by ring_enter)
+ * @param[in,out] ring
+ * @param[in] fd File to read
+ * @param[out] buffer
+ * @param[in] length
+ * @param[in] offset Offset in the file
+ * @param[in] rank Rank of the file, given back by the completion
+ */
+static void ring_read(struct prefetch_ring *ring, int fd, uint8_t *buffer, uint32_t length, uint64_t offset,
+                      uint32_t rank) {
+  // only this thread moves the tail, the kernel reads it
+  const unsigned tail = *(ring->sq_tail);
+  const unsigned index = tail & *(ring->sq_mask);
+  struct io_uring_sqe *sqe = ring->sqe + index;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode    = IORING_OP_READ;
+  sqe->fd        = fd;
+  sqe->addr      = (uintptr_t) buffer;
+  sqe->len       = length;
+  sqe->off       = offset;
+  sqe->user_data = rank;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+/**
+ * @brief Submit the reads queued and wait for at least one completion
+ */
+static void ring_enter(struct prefetch_ring *ring) {
+  for (;;) {
+    const int n = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n >= 0) {
+      ring->to_submit -= ((uint32_t) n < ring->to_submit) ? (uint32_t) n : ring->to_submit;
+      return;
+    }
+    if (errno != EINTR) {
+      LOG_FATAL("Can't enter the io_uring (%s)", strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+/**
+ * @brief Start reading a file
+ * @return 1 if a read was queued, 0 if the file is not read ahead
+ */
+static int uring_start(struct prefetch *prefetch, uint32_t rank) {
+  struct prefetch_file *file = prefetch->file + rank;
+  size_t size;
+  file->fd = open_file(prefetch, rank, &size);
+  if (file->fd < 0) {
+    return 0;
+  }
+  file->file.data = mmap(NULL, file->file.allocated_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (file->file.data == MAP_FAILED) {
+    close(file->fd);
+    return 0;
+  }
+  file->done = 0;
+  ring_read(prefetch->ring, file->fd, file->file.data, (size < PREFETCH_READ_SIZE) ? size : PREFETCH_READ_SIZE, 0, rank);
+  return 1;
+}
+
+/**
+ * @brief A read of a file is complete
+ * @return The state of the file: PREFETCH_READING if the rest of the file was queued
+ */
+static enum prefetch_state uring_complete(struct prefetch *prefetch, uint32_t rank, int32_t res) {
+  struct prefetch_file *file = prefetch->file + rank;
+  // an error, or the file was shortened
+  if (res <= 0) {
+    LOG_INFO("Read ahead of %s failed (%d)", file->file.pathname, res);
+    munmap(file->file.data, file->file.allocated_size);
+    close(file->fd);
+    return PREFETCH_SKIPPED;
+  }
+  file->done += res;
+  if (file->done < file->file.size) {
+    const size_t left = file->file.size - file->done;
+    ring_read(prefetch->ring, file->fd, ((uint8_t *) file->file.data) + file->done,
+              (left < PREFETCH_READ_SIZE) ? left : PREFETCH_READ_SIZE, file->done, rank);
+    return PREFETCH_READING;
+  }
+  close(file->fd);
+  return PREFETCH_READY;
+}
+
+/**
+ * @brief Submit reads and reap their completions until stopped
+ * @param[in,out] arg The struct prefetch
+ * @return NULL
+ */
+static void *uring_loop(void *arg) {
+  struct prefetch *prefetch = arg;
+  struct prefetch_ring *ring = prefetch->ring;
+
+  pthread_mutex_lock(&(prefetch->lock));
+  for (;;) {
+    while (to_read_locked(prefetch)) {
+      const uint32_t rank = prefetch->next++;
+      prefetch->file[rank].state = PREFETCH_READING;
+      io_enter_locked(prefetch);
+      pthread_mutex_unlock(&(prefetch->lock));
+      const int started = uring_start(prefetch, rank);
+      pthread_mutex_lock(&(prefetch->lock));
+      if (!started) {
+        io_leave_locked(prefetch, rank, PREFETCH_SKIPPED);
+      }
+    }
+    if (prefetch->reading == 0) {
+      if (prefetch->stop) {
+        break;
+      }
+      pthread_cond_wait(&(prefetch->ask), &(prefetch->lock));
+      continue;
+    }
+
+    pthread_mutex_unlock(&(prefetch->lock));
+    ring_enter(ring);
+    unsigned head = *(ring->cq_head);
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = ring->cqe + (head & *(ring->cq_mask));
+      const uint32_t rank = cqe->user_data;
+      const enum prefetch_state state = uring_complete(prefetch, rank, cqe->res);
+      if (state != PREFETCH_READING) {
+        pthread_mutex_lock(&(prefetch->lock));
+        io_leave_locked(prefetch, rank, state);
+        pthread_mutex_unlock(&(prefetch->lock));
+      }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&(prefetch->lock));
+  }
+  pthread_mutex_unlock(&(prefetch->lock));
+  return NULL;
+}
+
+#endif // __linux__
+
+
+
+/*
+ * Fallback
+ */
+
+/**
+ * @brief Read a file in the page cache, then map it with every page present
+ * @return The state of the file
+ */
+static enum prefetch_state advise_file(struct prefetch *prefetch, uint32_t rank) {
+  struct prefetch_file *file = prefetch->file + rank;
+  size_t size;
+  const int fd = open_file(prefetch, rank, &size);
+  if (fd < 0) {
+    return PREFETCH_SKIPPED;
+  }
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+#ifdef __linux__
+  readahead(fd, 0, size);
+  file->file.data = mmap(NULL, file->file.allocated_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+  file->file.data = mmap(NULL, file->file.allocated_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (file->file.data != MAP_FAILED) {
+    // no MAP_POPULATE: fault each page in
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const volatile uint8_t *data = file->file.data;
+    for (size_t offset = 0; offset < size; offset += page) {
+      (void) data[offset];
+    }
+  }
+#endif
+  close(fd);
+  return (file->file.data == MAP_FAILED) ? PREFETCH_SKIPPED : PREFETCH_READY;
+}
+
+/**
+ * @brief Read files one at a time until stopped
+ * @param[in,out] arg The struct prefetch
+ * @return NULL
+ */
+static void *advise_loop(void *arg) {
+  struct prefetch *prefetch = arg;
+
+  pthread_mutex_lock(&(prefetch->lock));
+  for (;;) {
+    if (!to_read_locked(prefetch)) {
+      if (prefetch->stop) {
+        break;
+      }
+      pthread_cond_wait(&(prefetch->ask), &(prefetch->lock));
+      continue;
+    }
+    const uint32_t rank = prefetch->next++;
+    prefetch->file[rank].state = PREFETCH_READING;
+    io_enter_locked(prefetch);
+    pthread_mutex_unlock(&(prefetch->lock));
+    const enum prefetch_state state = advise_file(prefetch, rank);
+    pthread_mutex_lock(&(prefetch->lock));
+    io_leave_locked(prefetch, rank, state);
+  }
+  pthread_mutex_unlock(&(prefetch->lock));
+  return NULL;
+}
+
+
+
+void prefetch_open(struct prefetch *prefetch, char *const *names, const uint32_t *order, uint32_t nb,
+                   uint32_t depth, enum prefetch_mode mode) {
+  memset(prefetch, 0, sizeof(struct prefetch));
+  prefetch->names = names;
+  prefetch->order = order;
+  prefetch->nb    = nb;
+  prefetch->depth = (depth < 1) ? 1 : (depth > PREFETCH_MAX_DEPTH) ? PREFETCH_MAX_DEPTH : depth;
+  prefetch->file  = calloc((nb > 0) ? nb : 1, sizeof(struct prefetch_file));
+  if (prefetch->file == NULL) {
+    LOG_FATAL("Can't calloc the read ahead of %u files", nb);
+    exit(1);
+  }
+  pthread_mutex_init(&(prefetch->lock), NULL);
+  pthread_cond_init(&(prefetch->ask), NULL);
+  pthread_cond_init(&(prefetch->ready), NULL);
+
+  void *(*loop)(void *) = advise_loop;
+#ifdef __linux__
+  if (mode == PREFETCH_URING) {
+    prefetch->ring = ring_open(prefetch->depth);
+    mode = (prefetch->ring != NULL) ? PREFETCH_URING : PREFETCH_ADVISE;
+    loop = (prefetch->ring != NULL) ? uring_loop : advise_loop;
+  }
+#else
+  mode = (mode == PREFETCH_URING) ? PREFETCH_ADVISE : mode; // io_uring is Linux only
+#endif
+  // one thread drives the io_uring, the fallback blocks in each read
+  const uint32_t nb_thread = (mode == PREFETCH_URING) ? 1 : (mode == PREFETCH_ADVISE) ? PREFETCH_THREADS : 0;
+  for (; prefetch->nb_thread < nb_thread; prefetch->nb_thread++) {
+    if (pthread_create(prefetch->thread + prefetch->nb_thread, NULL, loop, prefetch) != 0) {
+      LOG_WARN("Can't start the read ahead thread %u", prefetch->nb_thread);
+      break;
+    }
+  }
+  if (prefetch->nb_thread == 0) {
+    mode = PREFETCH_OFF;
+  }
+  prefetch->stats.mode = mode;
+  LOG_INFO("Read ahead of %u files on %u threads (mode %d)", prefetch->depth, prefetch->nb_thread, mode);
+}
+
+
+uint8_t prefetch_get(struct prefetch *prefetch, uint32_t rank, struct mfile *mapped) {
+  struct prefetch_file *file = prefetch->file + rank;
+  const char *name = prefetch->names[(prefetch->order != NULL) ? prefetch->order[rank] : rank];
+  if (prefetch->stats.mode == PREFETCH_OFF) {
+    return try_map_file(name, mapped);
+  }
+
+  pthread_mutex_lock(&(prefetch->lock));
+  if (rank >= prefetch->wanted) {
+    prefetch->wanted = rank + 1;
+    pthread_cond_broadcast(&(prefetch->ask));
+  }
+  if ((file->state == PREFETCH_WAITING) || (file->state == PREFETCH_READING)) {
+    if (prefetch->waiting++ == 0) {
+      prefetch->wait_start = now();
+    }
+    while ((file->state == PREFETCH_WAITING) || (file->state == PREFETCH_READING)) {
+      pthread_cond_wait(&(prefetch->ready), &(prefetch->lock));
+    }
+    if (--prefetch->waiting == 0) {
+      prefetch->stats.wait += now() - prefetch->wait_start;
+    }
+  }
+  const enum prefetch_state state = file->state;
+  file->state = PREFETCH_TAKEN;
+  pthread_mutex_unlock(&(prefetch->lock));
+
+  if (state != PREFETCH_READY) {
+    return try_map_file(name, mapped);
+  }
+  *mapped = file->file;
+  return 1;
+}
+
+
+struct prefetch_stats prefetch_close(struct prefetch *prefetch) {
+  pthread_mutex_lock(&(prefetch->lock));
+  prefetch->stop = 1;
+  pthread_cond_broadcast(&(prefetch->ask));
+  pthread_mutex_unlock(&(prefetch->lock));
+  for (uint32_t t = 0; t < prefetch->nb_thread; t++) {
+    pthread_join(prefetch->thread[t], NULL);
+  }
+#ifdef __linux__
+  if (prefetch->ring != NULL) {
+    ring_close(prefetch->ring);
+  }
+#endif
+  for (uint32_t r = 0; r < prefetch->nb; r++) {
+    if (prefetch->file[r].state == PREFETCH_READY) {
+      unmap_file(&(prefetch->file[r].file));
+    }
+  }
+  LOG_INFO("Read ahead %u files (%llu bytes): I/O %.3f s, waited %.3f s", prefetch->stats.nb_file,
+           (unsigned long long) prefetch->stats.bytes, prefetch->stats.io, prefetch->stats.wait);
+  pthread_cond_destroy(&(prefetch->ready));
+  pthread_cond_destroy(&(prefetch->ask));
+  pthread_mutex_destroy(&(prefetch->lock));
+  free(prefetch->file);
+  return prefetch->stats;
+}
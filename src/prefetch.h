@@ -0,0 +1,174 @@
+/**
+ * @file prefetch.h
+ * @brief Read the next files of a batch ahead of the workers decoding them
+ * @details Mapped files are read by page faults, one page at a time from the point of view of the
+ * disk: on cold or network storage the decode workers wait on each fault. Here an I/O stage keeps
+ * the next files of a list (in the order they will be decoded) loading while the workers decode the
+ * previous ones, and hands them fully resident.
+ *
+ * With io_uring (raw system calls, no liburing), one thread submits a read of each whole file into
+ * an anonymous mapping and reaps the completions: up to depth files are in flight at once.
+ * Where io_uring can't be set up (old kernel, seccomp, not Linux), a few threads each hint the kernel
+ * with posix_fadvise and readahead, then map the file with MAP_POPULATE, which returns once every page
+ * is in memory (outside Linux: posix_fadvise where there is one, then each page touched). Either way
+ * the file comes back as a struct mfile freed by unmap_file.
+ *
+ * The stage times how long at least one read is in flight and how long at least one worker waits
+ * for its file: the rest of the I/O time was overlapped with decoding.
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "mfile.h"
+
+
+/** @brief Max number of files read ahead */
+#define PREFETCH_MAX_DEPTH (64U)
+/** @brief Number of threads of the fallback */
+#define PREFETCH_THREADS (4U)
+/** @brief Largest file read ahead (a larger one is mapped by its worker) */
+#define PREFETCH_MAX_SIZE (1ULL << 31)
+
+
+/** @brief Mapped rings of an io_uring (see prefetch.c) */
+struct prefetch_ring;
+
+
+/**
+ * @brief How the files are read ahead
+ */
+enum prefetch_mode {
+  /** @brief Not read ahead: each worker maps its file */
+  PREFETCH_OFF = 0,
+  /** @brief Reads submitted to io_uring (PREFETCH_ADVISE if it can't be set up) */
+  PREFETCH_URING = 1,
+  /** @brief posix_fadvise, readahead and a populated mapping on a few threads */
+  PREFETCH_ADVISE = 2,
+};
+
+/**
+ * @brief Where a file is
+ */
+enum prefetch_state {
+  /** @brief Not read yet */
+  PREFETCH_WAITING = 0,
+  /** @brief Being read */
+  PREFETCH_READING = 1,
+  /** @brief In memory */
+  PREFETCH_READY = 2,
+  /** @brief Not read ahead (error or too large): its worker maps it */
+  PREFETCH_SKIPPED = 3,
+  /** @brief Given to its worker */
+  PREFETCH_TAKEN = 4,
+};
+
+/**
+ * @brief A file of the list
+ */
+struct prefetch_file {
+  /** @brief Where it is */
+  enum prefetch_state state;
+  /** @brief The file once read */
+  struct mfile file;
+  /** @brief Descriptor while read by io_uring */
+  int fd;
+  /** @brief Number of bytes read so far by io_uring */
+  size_t done;
+};
+
+/**
+ * @brief Time spent on I/O, and how much of it the workers waited for
+ */
+struct prefetch_stats {
+  /** @brief Mode actually used */
+  enum prefetch_mode mode;
+  /** @brief Number of files read ahead */
+  uint32_t nb_file;
+  /** @brief Number of bytes read ahead */
+  uint64_t bytes;
+  /** @brief Wall time with at least one read in flight, in seconds */
+  double io;
+  /** @brief Wall time with at least one worker waiting for its file, in seconds */
+  double wait;
+};
+
+/**
+ * @brief Files read ahead (must not move while open)
+ */
+struct prefetch {
+  /** @brief Names of the files */
+  char *const *names;
+  /** @brief Index in names of each rank */
+  const uint32_t *order;
+  /** @brief Number of files */
+  uint32_t nb;
+  /** @brief Max number of files read ahead of the last one asked for */
+  uint32_t depth;
+  /** @brief State of each file, by rank */
+  struct prefetch_file *file;
+  /** @brief Next rank to read */
+  uint32_t next;
+  /** @brief Ranks below are asked for, or were */
+  uint32_t wanted;
+  /** @brief Number of reads in flight */
+  uint32_t reading;
+  /** @brief Number of workers waiting */
+  uint32_t waiting;
+  /** @brief Start of the current time with reads in flight */
+  double io_start;
+  /** @brief Start of the current time with workers waiting */
+  double wait_start;
+  /** @brief Counters */
+  struct prefetch_stats stats;
+  /** @brief Flag: the threads must end */
+  uint8_t stop;
+  /** @brief Number of threads */
+  uint32_t nb_thread;
+  /** @brief The threads */
+  pthread_t thread[PREFETCH_THREADS];
+  /** @brief The io_uring (PREFETCH_URING) */
+  struct prefetch_ring *ring;
+  /** @brief Lock of everything but names and order */
+  pthread_mutex_t lock;
+  /** @brief Signaled when more files are asked for or on stop */
+  pthread_cond_t ask;
+  /** @brief Signaled when a file is ready */
+  pthread_cond_t ready;
+};
+
+
+/**
+ * @brief Start reading the first files
+ * @param[out] prefetch
+ * @param[in] names Names of the files (must stay valid until prefetch_close)
+ * @param[in] order Index in names of the file of each rank, NULL for the order of names
+ * @param[in] nb Number of ranks
+ * @param[in] depth Max number of files read ahead (1 to PREFETCH_MAX_DEPTH)
+ * @param[in] mode How (with PREFETCH_OFF, prefetch_get only maps the files)
+ */
+void prefetch_open(struct prefetch *prefetch, char *const *names, const uint32_t *order, uint32_t nb,
+                   uint32_t depth, enum prefetch_mode mode);
+
+/**
+ * @brief Get a file, waiting for it to be read if needed (each rank once)
+ * @details The files after it up to the depth are read meanwhile.
+ * @param[in,out] prefetch
+ * @param[in] rank Rank of the file
+ * @param[out] mapped The file, to free with unmap_file
+ * @return 1 if mapped, 0 if the file can't be read (gone since the list was made)
+ */
+uint8_t prefetch_get(struct prefetch *prefetch, uint32_t rank, struct mfile *mapped);
+
+/**
+ * @brief Stop the threads, free the files read and not taken
+ * @param[in,out] prefetch
+ * @return The counters
+ */
+struct prefetch_stats prefetch_close(struct prefetch *prefetch);
+
+
+#endif // __PREFETCH_H__
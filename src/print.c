@@ -1,11 +1,13 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
-#include <SDL2/SDL.h>
 #include <zlib.h>
 
 #include "crc.h"
 #include "print.h"
+#ifndef HEADLESS
+#include "sdl.h"
+#endif
 
 
 
@@ -22,10 +24,20 @@ static const char *basename(const char *exec) {
 void print_version(const char *exec) {
   printf("version: 0.0.1 (DEV)\n");
   printf("  using: zlib %s\n", zlibVersion());
-  
-  SDL_version compiled;
-  SDL_VERSION(&compiled);
-  printf("         sdl2 %d.%d.%d\n", compiled.major, compiled.minor, compiled.patch);
+
+#ifdef HEADLESS
+  printf("         no sdl2 (headless build)\n");
+#else
+  // the library --display would load, not the headers
+  if (sdl_load()) {
+    SDL_version linked;
+    sdl.GetVersion(&linked);
+    printf("         sdl2 %d.%d.%d (loaded by --display)\n", linked.major, linked.minor, linked.patch);
+  }
+  else {
+    printf("         sdl2 not found (no --display)\n");
+  }
+#endif
 }
 
 
@@ -37,9 +49,35 @@ void print_help(const char *exec) {
   printf("        --version              Print version\n");
   printf("        --help                 List available commandes\n");
   printf("        --chunk                Print all chunks in the file\n");
+#ifndef HEADLESS
   printf("        --display              Display the file\n");
+#endif
   printf("        --bmp=<filename>       Save file into a BMP file\n");
+  printf("        --bmp32=<filename>     Save file into a 32-bit BMP file with alpha\n");
+  printf("        --ppm=<filename>       Save file into a PPM file (- for the standard output)\n");
+  printf("        --pam=<filename>       Save file into a PAM file with alpha (- for the standard output)\n");
+  printf("        --raw=<filename>       Save file as raw RGBA, 8-bit samples (- for the standard output)\n");
+  printf("        --raw16=<filename>     Save file as raw RGBA, 16-bit samples in the native byte order\n");
+  printf("        --png=<filename>       Save file into a PNG file (strips deflated in parallel)\n");
+  printf("        --plte=<filename>      Reduce to 256 colors (Floyd-Steinberg dithering) and save into a PNG file\n");
+  printf("        --optimize=<filename>  Save into the smallest lossless PNG file found (color reduction, trials)\n");
+  printf("        --clean=<filename>     Copy without text, time and unknown chunks, IDAT merged (- for the standard output)\n");
+  printf("        --transcode=<target>   Convert to PNG a few rows at a time, <target> is [<type>[@<w>x<h>+<x>+<y>]:]<filename>\n");
+  printf("                               with type gray, graya, rgb or rgba and depth 8 or 16: rgb8:out.png (- for the standard output)\n");
+  printf("        --batch=<options>      The file is a directory, a glob or - (list on the standard input): decode\n");
+  printf("                               each file on a pool of workers, <options> are decode or bmp, ordered or\n");
+  printf("                               completed, a number of workers, ahead<n> files read ahead (ahead0 for\n");
+  printf("                               none), uring or advise to read them, limits of each file mpx<megapixels>,\n");
+  printf("                               mb<MB> and ms<timeout>: bmp,4,completed,ahead16,mpx50,ms50\n");
+  printf("        --serve=<options>      The file is the path of a Unix socket: answer probe, decode and convert\n");
+  printf("                               requests until SIGINT or SIGTERM, pixels in a memfd (see serve.h),\n");
+  printf("                               <options> are a number of threads, cache<MB> of answers, idle<seconds>\n");
+  printf("                               before a silent connection is closed (idle0 for never), mode<octal> of\n");
+  printf("                               the socket (600 by default), limits of each decode mpx<megapixels>,\n");
+  printf("                               mb<MB> and ms<timeout>: 8,cache256,mode660,mb512,ms50\n");
+  printf("        --stats                Print color statistics (colors, opacity, gray, histograms)\n");
   printf("        --passes               Save all passes as <file>(i).bmp (must be an interlaced image)\n");
+  printf("        --index=<filename>     Save IDAT checkpoints to decode lines from anywhere (no interlace)\n");
   printf("\n");
 
   printf("source: https://github.com/gloutch/png-plte\n");
@@ -134,6 +172,12 @@ static void print_PHYS(const struct PHYS *chunk) {
   }
 }
 
+static void print_CHRM(const struct CHRM *chunk) {
+  printf("white (%d,%d)  red (%d,%d)  green (%d,%d)  blue (%d,%d) /100000",
+         chunk->white_x, chunk->white_y, chunk->red_x, chunk->red_y,
+         chunk->green_x, chunk->green_y, chunk->blue_x, chunk->blue_y);
+}
+
 static void print_TIME(const struct TIME *chunk) {
   printf("%d/%02d/%02d ", chunk->day, chunk->month, chunk->year);
   printf("%02d:%02d:%02d", chunk->hour, chunk->minute, chunk->second);
@@ -168,6 +212,17 @@ void print_chunk(const struct chunk *chunk, const struct IHDR *header) {
       printf("gamma %d/100000", gamma);
       break;
     }
+    case SRGB: {
+      const char *intent[] = {"perceptual", "relative colorimetric", "saturation", "absolute colorimetric"};
+      enum rendering_intent t = SRGB_chunk(chunk);
+      printf("intent %s", (t <= INTENT_ABSOLUTE) ? intent[t] : "unknown");
+      break;
+    }
+    case CHRM: {
+      const struct CHRM t = CHRM_chunk(chunk);
+      print_CHRM(&t);
+      break;
+    }
     case BKGD: {
       const struct BKGD t = BKGD_chunk(chunk, header);
       print_BKGD(&t);
@@ -228,3 +283,127 @@ void print_PNG_file(const struct mfile *file) {
   }
   print_chunk(&current, NULL);
 }
+
+
+
+void print_color_stats(const struct color_stats *stats) {
+  static const char *channel[4] = {"red", "green", "blue", "alpha"};
+
+  if (stats->nb_color > STATS_MAX_COLOR) {
+    printf("colors     more than %d\n", STATS_MAX_COLOR);
+  } else {
+    printf("colors     %d\n", stats->nb_color);
+  }
+  printf("opaque     %s\n", stats->opaque ? "yes" : "no");
+  printf("gray       %s\n", stats->gray ? "yes" : "no");
+  if (stats->alpha_box.width == 0) {
+    printf("alpha box  none\n");
+  } else {
+    printf("alpha box  [%d,%d] %dx%d\n", stats->alpha_box.x, stats->alpha_box.y,
+           stats->alpha_box.width, stats->alpha_box.height);
+  }
+
+  for (uint8_t c = 0; c < 4; c++) {
+    printf("%-6s    ", channel[c]);
+    for (uint32_t v = 0; v < 256; v++) {
+      printf(" %llu", (unsigned long long) stats->histogram[c][v]);
+    }
+    printf("\n");
+  }
+}
+
+
+
+void print_optimize_report(const struct optimize_report *report) {
+  static const char *filters[] = {"none", "sub", "up", "average", "paeth"};
+  static const char *types[] = {"gray", "gray+alpha", "rgb", "rgb+alpha"};
+
+  printf("trial  image           filter     level  strategy  window        size      time\n");
+  for (uint32_t t = 0; t < report->nb_trial; t++) {
+    const struct optimize_trial *trial = report->trial + t;
+    const struct image *image = report->image + trial->image;
+    const struct png_options *options = &(trial->options);
+
+    char type[32];
+    snprintf(type, sizeof(type), "%s %d", (image->palette != NULL) ? "palette" : types[image->sample - 1],
+             image->depth);
+    const char *filter = (options->filter == FILTER_HEURISTIC) ? "heuristic"
+      : (options->filter == FILTER_BRUTE) ? "brute" : filters[options->filter_type];
+    const char *strategy = (options->strategy == Z_FILTERED) ? "filtered"
+      : (options->strategy == Z_RLE) ? "rle" : "default";
+
+    printf("%5d  %-14s  %-9s  %5d  %-8s  %6d  ", t, type, filter, options->level, strategy, 1 << options->window_bits);
+    if (trial->size > 0) {
+      printf("%10llu", (unsigned long long) trial->size);
+    } else {
+      printf("%10s", "stopped");
+    }
+    printf("  %6.1f ms%s\n", trial->seconds * 1e3, (!report->copied && (t == report->best)) ? "  <- best" : "");
+  }
+  if (report->copied) {
+    printf("source written as it is (%s)\n", (report->nb_trial == 0) ? "tRNS" : "no smaller trial");
+  }
+  const uint64_t best = report->copied ? report->input_size : report->trial[report->best].size;
+  printf("%llu -> %llu bytes (%.2f%%) in %.2f s\n", (unsigned long long) report->input_size,
+         (unsigned long long) best, (report->input_size > 0) ? 100.0 * best / report->input_size : 0.0,
+         report->seconds);
+}
+
+
+
+void print_batch_result(const struct batch_result *result) {
+  switch (result->status) {
+  case BATCH_OK:
+    printf("%s  %ux%u  %llu bytes  %.2f ms\n", result->filename, result->width, result->height,
+           (unsigned long long) result->size, result->seconds * 1e3);
+    break;
+  case BATCH_NOT_FOUND:
+    printf("%s  not a file\n", result->filename);
+    break;
+  case BATCH_NOT_PNG:
+    printf("%s  not a PNG\n", result->filename);
+    break;
+  case BATCH_INTERLACED:
+    printf("%s  %ux%u  interlaced, not decoded\n", result->filename, result->width, result->height);
+    break;
+  case BATCH_CORRUPT:
+    printf("%s  corrupt, not decoded\n", result->filename);
+    break;
+  case BATCH_TOO_LARGE:
+    printf("%s  %ux%u  over the limits, not decoded\n", result->filename, result->width, result->height);
+    break;
+  case BATCH_TIMEOUT:
+    printf("%s  %ux%u  timeout after %.2f ms\n", result->filename, result->width, result->height,
+           result->seconds * 1e3);
+    break;
+  case BATCH_NOT_WRITTEN:
+    printf("%s  %ux%u  decoded, its BMP not written\n", result->filename, result->width, result->height);
+    break;
+  }
+}
+
+
+void print_batch_stats(const struct batch_stats *stats) {
+  const double seconds = (stats->seconds > 0) ? stats->seconds : 1e-9;
+  printf("%u files (%u failed) on %d workers in %.3f s, %llu pieces stolen\n", stats->nb_file, stats->nb_failed,
+         stats->threads, stats->seconds, (unsigned long long) stats->stolen);
+  printf("%.1f files/s  %.1f MB/s  %.1f Mpixels/s  (workers busy %.1f%% of the time)\n",
+         stats->nb_file / seconds, stats->bytes / seconds * 1e-6, stats->pixels / seconds * 1e-6,
+         100.0 * stats->busy / (seconds * stats->threads));
+  if (stats->io != PREFETCH_OFF) {
+    // the I/O time the workers did not wait for was overlapped with decoding
+    const double overlap = (stats->io_time > stats->io_wait) ? stats->io_time - stats->io_wait : 0;
+    printf("read ahead (%s): %u files, %.1f MB, I/O %.3f s, waited %.3f s, %.1f%% overlapped\n",
+           (stats->io == PREFETCH_URING) ? "io_uring" : "fadvise", stats->io_files, stats->io_bytes * 1e-6,
+           stats->io_time, stats->io_wait, (stats->io_time > 0) ? 100.0 * overlap / stats->io_time : 100.0);
+  }
+}
+
+
+void print_serve_stats(const struct serve_stats *stats) {
+  printf("%llu requests (%llu errors) on %llu connections (%llu closed idle), %llu from the cache, %.1f MB of pixels, "
+         "busy %.3f s\n",
+         (unsigned long long) stats->requests, (unsigned long long) stats->errors,
+         (unsigned long long) stats->connections, (unsigned long long) stats->idle, (unsigned long long) stats->hits,
+         stats->bytes * 1e-6, stats->busy);
+}
@@ -7,8 +7,12 @@
 #ifndef __PRINT_H__
 #define __PRINT_H__
 
+#include "batch.h"
+#include "serve.h"
 #include "chunk.h"
 #include "mfile.h"
+#include "optimize.h"
+#include "stats.h"
 
 
 /**
@@ -36,5 +40,36 @@ void print_chunk(const struct chunk *chunk, const struct IHDR *header);
  */
 void print_PNG_file(const struct mfile *file);
 
+/**
+ * @brief Print the color statistics of an image
+ * @details Summary lines then one line of 256 counts per channel histogram
+ * @param[in] stats
+ */
+void print_color_stats(const struct color_stats *stats);
+
+/**
+ * @brief Print what the optimizer tried: each trial with its size (or stopped) and its time
+ * @param[in] report
+ */
+void print_optimize_report(const struct optimize_report *report);
+
+/**
+ * @brief Print the result of one file of a batch: size of the image and time, or what went wrong
+ * @param[in] result
+ */
+void print_batch_result(const struct batch_result *result);
+
+/**
+ * @brief Print the summary of a batch: files, throughput, use of the workers and of the read ahead
+ * @param[in] stats
+ */
+void print_batch_stats(const struct batch_stats *stats);
+
+/**
+ * @brief Print the counters of a daemon: requests, errors, cache hits and bytes handed over
+ * @param[in] stats
+ */
+void print_serve_stats(const struct serve_stats *stats);
+
 
 #endif // __PRINT_H__
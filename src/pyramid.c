@@ -0,0 +1,242 @@
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "log.h"
+#include "pyramid.h"
+#include "render.h"
+
+
+
+/**
+ * @brief Downscale two BGRA8 rows by 2 into one
+ * @details Each pixel is round((a + b + c + d) / 4), a last odd column is averaged with itself
+ * @param[in] top
+ * @param[in] bottom Row below top (may be top for a last odd row)
+ * @param[in] width Number of pixels of top and bottom
+ * @param[out] dst Row of (width + 1) / 2 pixels
+ */
+static void downscale_row(const uint8_t *top, const uint8_t *bottom, uint32_t width, uint8_t *dst) {
+  uint32_t j = 0;
+
+#ifdef __SSE2__
+  // 4 pixels in, 2 pixels out: sums on 16-bit lanes
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two  = _mm_set1_epi16(2);
+  for (; j + 4 <= width; j += 4) {
+    const __m128i a = _mm_loadu_si128((const __m128i *) (top + 4 * j));
+    const __m128i b = _mm_loadu_si128((const __m128i *) (bottom + 4 * j));
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // pixels 0, 1
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // pixels 2, 3
+    // add each pixel to its neighbour: pixel 0 + 1 in the low half, 2 + 3 in the high half
+    const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    const __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    _mm_storel_epi64((__m128i *) (dst + 2 * j), _mm_packus_epi16(avg, avg));
+  }
+#endif
+
+  for (; j < width; j += 2) {
+    const uint32_t next = (j + 1 < width) ? 4 : 0;
+    for (uint8_t c = 0; c < 4; c++) {
+      const uint32_t sum = top[4 * j + c] + top[4 * j + next + c] + bottom[4 * j + c] + bottom[4 * j + next + c];
+      dst[2 * j + c] = (sum + 2) >> 2;
+    }
+  }
+}
+
+/**
+ * @brief Build the rows of a level whose rows below are built
+ * @param[in] below Level below
+ * @param[in,out] level Level to complete
+ */
+static void build_level(const struct pyramid_level *below, struct pyramid_level *level) {
+  const uint32_t rows = (below->rows == below->height) ? level->height : below->rows / 2;
+  const size_t below_pitch = (size_t) below->width * 4;
+
+  for (; level->rows < rows; level->rows++) {
+    const uint8_t *top = below->pixels + 2 * level->rows * below_pitch;
+    const uint8_t *bottom = (2 * level->rows + 1 < below->height) ? top + below_pitch : top;
+    downscale_row(top, bottom, below->width, level->pixels + (size_t) level->rows * level->width * 4);
+  }
+}
+
+
+
+void pyramid_init(struct pyramid *pyramid, const struct image *image) {
+  pyramid->image = image;
+  uint32_t width  = image->width;
+  uint32_t height = image->height;
+
+  uint8_t l = 0;
+  for (;; l++) {
+    struct pyramid_level *level = pyramid->level + l;
+    level->width  = width;
+    level->height = height;
+    level->rows   = 0;
+    level->pixels = malloc((size_t) width * height * 4);
+    if (level->pixels == NULL) {
+      LOG_FATAL("Can't malloc(%zu) for the level %d of the pyramid", (size_t) width * height * 4, l);
+      exit(1);
+    }
+    LOG_ALLOC("Malloc pyramid level %d %p", l, level->pixels);
+
+    if (((width <= PYRAMID_TILE) && (height <= PYRAMID_TILE)) || (l + 1 == PYRAMID_MAX_LEVEL)) {
+      break;
+    }
+    width  = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+  pyramid->nb_level = l + 1;
+}
+
+
+uint8_t pyramid_build(struct pyramid *pyramid, uint32_t nrows) {
+  struct pyramid_level *base = pyramid->level;
+  if (nrows > base->height - base->rows) {
+    nrows = base->height - base->rows;
+  }
+
+  // level 0 in bulk, right at its place
+  const size_t pitch = (size_t) base->width * 4;
+  render_rows(pyramid->image, base->rows, nrows, FORMAT_BGRA8, ALPHA_BACKGROUND, base->pixels + base->rows * pitch, pitch);
+  base->rows += nrows;
+
+  for (uint8_t l = 1; l < pyramid->nb_level; l++) {
+    build_level(pyramid->level + l - 1, pyramid->level + l);
+  }
+  return pyramid_done(pyramid);
+}
+
+
+uint8_t pyramid_done(const struct pyramid *pyramid) {
+  const struct pyramid_level *top = pyramid->level + pyramid->nb_level - 1;
+  return top->rows == top->height;
+}
+
+
+void pyramid_free(struct pyramid *pyramid) {
+  for (uint8_t l = 0; l < pyramid->nb_level; l++) {
+    LOG_ALLOC("Free pyramid level %d %p", l, pyramid->level[l].pixels);
+    free(pyramid->level[l].pixels);
+  }
+}
+
+
+
+/**
+ * @brief Zoom showing the whole image, at most 1
+ */
+static double fit_zoom(const struct view *view) {
+  const double zx = (double) view->width / view->image_width;
+  const double zy = (double) view->height / view->image_height;
+  const double zoom = (zx < zy) ? zx : zy;
+  return (zoom < 1.0) ? zoom : 1.0;
+}
+
+/**
+ * @brief Center the image along an axis shorter than the window, keep the window covered otherwise
+ * @param[in,out] origin Image coordinate of the window edge
+ * @param[in] shown Number of image pixels across the window
+ * @param[in] size Size of the image
+ */
+static void clamp_axis(double *origin, double shown, uint32_t size) {
+  if (shown >= size) {
+    *origin = (size - shown) / 2;
+  }
+  else if (*origin < 0) {
+    *origin = 0;
+  }
+  else if (*origin > size - shown) {
+    *origin = size - shown;
+  }
+}
+
+static void clamp_view(struct view *view) {
+  clamp_axis(&(view->x), view->width / view->zoom, view->image_width);
+  clamp_axis(&(view->y), view->height / view->zoom, view->image_height);
+}
+
+
+
+void view_init(struct view *view, uint32_t image_width, uint32_t image_height, uint32_t width, uint32_t height) {
+  view->image_width  = image_width;
+  view->image_height = image_height;
+  view->width  = width;
+  view->height = height;
+  view_fit(view);
+}
+
+
+void view_fit(struct view *view) {
+  view->zoom = fit_zoom(view);
+  view->x = 0;
+  view->y = 0;
+  clamp_view(view);
+}
+
+
+void view_zoom(struct view *view, double zoom, double wx, double wy) {
+  const double min = fit_zoom(view);
+  zoom = (zoom < min) ? min : (zoom > VIEW_MAX_ZOOM) ? VIEW_MAX_ZOOM : zoom;
+
+  // the image point under (wx, wy) stays there
+  const double ix = view->x + wx / view->zoom;
+  const double iy = view->y + wy / view->zoom;
+  view->zoom = zoom;
+  view->x = ix - wx / zoom;
+  view->y = iy - wy / zoom;
+  clamp_view(view);
+}
+
+
+void view_pan(struct view *view, double dx, double dy) {
+  view->x -= dx / view->zoom;
+  view->y -= dy / view->zoom;
+  clamp_view(view);
+}
+
+
+void view_resize(struct view *view, uint32_t width, uint32_t height) {
+  const double cx = view->x + view->width / (2 * view->zoom);
+  const double cy = view->y + view->height / (2 * view->zoom);
+  view->width  = width;
+  view->height = height;
+
+  const double min = fit_zoom(view);
+  if (view->zoom < min) {
+    view->zoom = min;
+  }
+  view->x = cx - width / (2 * view->zoom);
+  view->y = cy - height / (2 * view->zoom);
+  clamp_view(view);
+}
+
+
+uint8_t view_level(const struct view *view, uint8_t nb_level) {
+  if (view->zoom >= 1.0) {
+    return 0;
+  }
+  // zoom * 2^level >= 1
+  const int level = (int) floor(log2(1.0 / view->zoom) + 1e-9);
+  return (level < nb_level) ? level : nb_level - 1;
+}
+
+
+void view_tiles(const struct view *view, uint8_t level, int64_t tile[4]) {
+  const double size = (double) PYRAMID_TILE * (1U << level); // image pixels per tile
+  const int64_t columns = (view->image_width + size - 1) / size;
+  const int64_t rows    = (view->image_height + size - 1) / size;
+
+  int64_t first_x = floor(view->x / size);
+  int64_t last_x  = ceil((view->x + view->width / view->zoom) / size) - 1;
+  int64_t first_y = floor(view->y / size);
+  int64_t last_y  = ceil((view->y + view->height / view->zoom) / size) - 1;
+
+  tile[0] = (first_x < 0) ? 0 : first_x;
+  tile[1] = (last_x >= columns) ? columns - 1 : last_x;
+  tile[2] = (first_y < 0) ? 0 : first_y;
+  tile[3] = (last_y >= rows) ? rows - 1 : last_y;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file pyramid.h
+ * @brief Mip pyramid of an image rendered for display, and the view over it
+ * @details Level 0 is the image rendered in BGRA8 (see render_rows), each level above is the one below
+ * downscaled by 2 (box filter), up to a level that fits in one tile. Levels are cut in square tiles
+ * of PYRAMID_TILE pixels, so a view only needs the tiles it shows, at the level closest to its zoom.
+ * The pyramid is built by bands of rows: a viewer shows the rows already built while the next ones are rendered.
+ */
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include <stdint.h>
+
+#include "image.h"
+
+
+/** @brief Width and height of a tile */
+#define PYRAMID_TILE (512U)
+/** @brief Max number of levels (2^31 pixels wide images) */
+#define PYRAMID_MAX_LEVEL (24U)
+/** @brief Number of pixels rendered by a call of pyramid_build */
+#define PYRAMID_BUILD_PIXELS (1U << 20)
+
+/** @brief Max zoom (window pixels per image pixel) */
+#define VIEW_MAX_ZOOM (32.0)
+
+
+/**
+ * @brief One level of the pyramid
+ */
+struct pyramid_level {
+  /** @brief Width in pixels */
+  uint32_t width;
+  /** @brief Height in pixels */
+  uint32_t height;
+  /** @brief Number of rows built */
+  uint32_t rows;
+  /** @brief BGRA8 pixels, width * 4 bytes per row */
+  uint8_t *pixels;
+};
+
+/**
+ * @brief Mip pyramid of an image
+ */
+struct pyramid {
+  /** @brief The image */
+  const struct image *image;
+  /** @brief Number of levels (>= 1) */
+  uint8_t nb_level;
+  /** @brief Levels, 0 is the full size image */
+  struct pyramid_level level[PYRAMID_MAX_LEVEL];
+};
+
+/**
+ * @brief Part of the image shown in a window
+ */
+struct view {
+  /** @brief Width of the window */
+  uint32_t width;
+  /** @brief Height of the window */
+  uint32_t height;
+  /** @brief Width of the image */
+  uint32_t image_width;
+  /** @brief Height of the image */
+  uint32_t image_height;
+  /** @brief Window pixels per image pixel */
+  double zoom;
+  /** @brief Image coordinates of the top left corner of the window */
+  double x, y;
+};
+
+
+/**
+ * @brief Allocate every level of the pyramid, nothing is built yet
+ * @param[out] pyramid
+ * @param[in] image Image which must live as long as the pyramid
+ */
+void pyramid_init(struct pyramid *pyramid, const struct image *image);
+
+/**
+ * @brief Build the next rows of the pyramid
+ * @details Rows of level 0 are rendered in bulk, rows of the upper levels follow as soon as
+ * the two rows below are built
+ * @param[in,out] pyramid
+ * @param[in] nrows Number of rows of the image to render
+ * @return 1 once the whole pyramid is built, 0 otherwise
+ */
+uint8_t pyramid_build(struct pyramid *pyramid, uint32_t nrows);
+
+/**
+ * @brief Check if the whole pyramid is built
+ * @param[in] pyramid
+ * @return 1 if every row of every level is built
+ */
+uint8_t pyramid_done(const struct pyramid *pyramid);
+
+/**
+ * @brief Free the levels
+ * @param[in,out] pyramid
+ */
+void pyramid_free(struct pyramid *pyramid);
+
+
+
+/**
+ * @brief View of the whole image in a window
+ * @param[out] view
+ * @param[in] image_width
+ * @param[in] image_height
+ * @param[in] width Width of the window
+ * @param[in] height Height of the window
+ */
+void view_init(struct view *view, uint32_t image_width, uint32_t image_height, uint32_t width, uint32_t height);
+
+/**
+ * @brief Fit the whole image in the window (never magnified), centered
+ * @param[in,out] view
+ */
+void view_fit(struct view *view);
+
+/**
+ * @brief Zoom around a point of the window, which stays over the same point of the image
+ * @param[in,out] view
+ * @param[in] zoom The new zoom (clamped from the fitting zoom to VIEW_MAX_ZOOM)
+ * @param[in] wx Column of the window
+ * @param[in] wy Row of the window
+ */
+void view_zoom(struct view *view, double zoom, double wx, double wy);
+
+/**
+ * @brief Move the image in the window
+ * @details An image smaller than the window is centered, a larger one always covers the window
+ * @param[in,out] view
+ * @param[in] dx Number of window pixels to the right
+ * @param[in] dy Number of window pixels down
+ */
+void view_pan(struct view *view, double dx, double dy);
+
+/**
+ * @brief Change the size of the window, the center of the view stays in the center
+ * @param[in,out] view
+ * @param[in] width
+ * @param[in] height
+ */
+void view_resize(struct view *view, uint32_t width, uint32_t height);
+
+/**
+ * @brief Best level of the pyramid for the zoom of the view
+ * @details The coarsest level still as detailed as the window: it is shown at 1:1 or downscaled by less than 2
+ * @param[in] view
+ * @param[in] nb_level Number of levels of the pyramid
+ * @return Level
+ */
+uint8_t view_level(const struct view *view, uint8_t nb_level);
+
+/**
+ * @brief Tiles of a level shown in the window
+ * @param[in] view
+ * @param[in] level Level of the pyramid
+ * @param[out] tile First and last column of tiles, first and last row of tiles (empty if first > last)
+ */
+void view_tiles(const struct view *view, uint8_t level, int64_t tile[4]);
+
+
+
+#endif // __PYRAMID_H__
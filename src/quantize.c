@@ -0,0 +1,541 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "composite.h"
+#include "convert.h"
+#include "icc.h"
+#include "log.h"
+#include "quantize.h"
+#include "scheduler.h"
+
+
+/** @brief Bits per channel in the histogram */
+#define HIST_BITS (5U)
+/** @brief Number of bins of the histogram */
+#define HIST_SIZE (1U << (3 * HIST_BITS))
+
+/** @brief Bits per channel of the cells of the nearest color cache */
+#define CACHE_BITS (6U)
+/** @brief Number of cells of the nearest color cache */
+#define CACHE_SIZE (1U << (3 * CACHE_BITS))
+/** @brief Cell not computed yet */
+#define CACHE_EMPTY (0xffffU)
+
+/** @brief Number of k-means passes after the median cut */
+#define KMEANS_PASS (4U)
+
+/** @brief Slots of the hash set of exact colors (power of 2, more than twice QUANTIZE_MAX_COLOR) */
+#define EXACT_SLOT (1024U)
+
+/** @brief Max number of bands (each one has its own histogram) */
+#define QUANTIZE_MAX_PIECES (8U)
+/** @brief Min number of pixels of a band */
+#define QUANTIZE_PIECE_PIXELS (1U << 16)
+
+
+/**
+ * @brief Ordered dithering matrix (Bayer 4x4), thresholds 0 to 15
+ */
+static const uint8_t bayer[4][4] =
+  {{ 0,  8,  2, 10},
+   {12,  4, 14,  6},
+   { 3, 11,  1,  9},
+   {15,  7, 13,  5}};
+
+
+/**
+ * @brief Colors of a bin (histogram) or of a box (median cut)
+ */
+struct bin {
+  /** @brief Number of pixels */
+  uint64_t count;
+  /** @brief Sum of red, green, blue of the pixels */
+  uint64_t sum[3];
+};
+
+/**
+ * @brief Non-empty bin with its mean color
+ */
+struct entry {
+  /** @brief Pixels and sums of the bin */
+  struct bin bin;
+  /** @brief Mean red, green, blue */
+  uint8_t color[3];
+};
+
+/**
+ * @brief Range of entries split by the median cut
+ */
+struct box {
+  /** @brief First entry */
+  uint32_t first;
+  /** @brief Entry after the last one */
+  uint32_t last;
+  /** @brief Longest axis (0: red, 1: green, 2: blue) */
+  uint8_t axis;
+  /** @brief Pixels times the length of the longest axis (0: can't be split) */
+  uint64_t score;
+};
+
+/**
+ * @brief Band of rows
+ */
+struct quantize_job {
+  /** @brief RGBA8 pixels of the whole image */
+  const uint8_t *rgba;
+  /** @brief Number of pixels per row */
+  uint32_t width;
+  /** @brief First row of the band */
+  uint32_t row0;
+  /** @brief Number of rows */
+  uint32_t nrows;
+  /** @brief Histogram of the band (HIST_SIZE bins) */
+  struct bin *hist;
+  /** @brief Palette to map the pixels to */
+  const uint8_t *palette;
+  /** @brief Number of colors of the palette */
+  uint16_t nb_color;
+  /** @brief Dithering mode */
+  enum dither_mode dither;
+  /** @brief Palette index of the whole image */
+  uint8_t *index;
+};
+
+
+
+static void *quantize_malloc(size_t size) {
+  void *ptr = malloc(size);
+  if (ptr == NULL) {
+    LOG_FATAL("Can't malloc(%zu) to quantize", size);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc(%zu) at %p", size, ptr);
+  return ptr;
+}
+
+static inline uint8_t clamp8(int32_t v) {
+  return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+/**
+ * @brief Nearest color of the palette (squared euclidean distance)
+ */
+static uint8_t nearest(const uint8_t *palette, uint16_t nb_color, const uint8_t color[3]) {
+  uint32_t best = UINT32_MAX;
+  uint8_t k_best = 0;
+  for (uint16_t k = 0; k < nb_color; k++, palette += 3) {
+    const int32_t dr = palette[0] - color[0];
+    const int32_t dg = palette[1] - color[1];
+    const int32_t db = palette[2] - color[2];
+    const uint32_t d = dr * dr + dg * dg + db * db;
+    if (d < best) {
+      best = d;
+      k_best = k;
+    }
+  }
+  return k_best;
+}
+
+/**
+ * @brief Nearest color of the center of the cell of a color, computed once per cell
+ */
+static inline uint8_t cached_nearest(uint16_t *cache, const uint8_t *palette, uint16_t nb_color, const uint8_t color[3]) {
+  const uint32_t shift = 8 - CACHE_BITS;
+  const uint32_t key = ((color[0] >> shift) << (2 * CACHE_BITS)) | ((color[1] >> shift) << CACHE_BITS) | (color[2] >> shift);
+  if (cache[key] == CACHE_EMPTY) {
+    const uint8_t half = 1 << (shift - 1);
+    const uint8_t center[3] = {
+      (color[0] & (0xff << shift)) | half,
+      (color[1] & (0xff << shift)) | half,
+      (color[2] & (0xff << shift)) | half,
+    };
+    cache[key] = nearest(palette, nb_color, center);
+  }
+  return cache[key];
+}
+
+
+/**
+ * @brief Split the rows in bands, run by the workers of the scheduler
+ * @return Number of bands
+ */
+static uint32_t split_jobs(const uint8_t *rgba, uint32_t width, uint32_t height, struct quantize_job *job) {
+  const uint32_t nb_job = sched_pieces((uint64_t) width * height, QUANTIZE_PIECE_PIXELS, QUANTIZE_MAX_PIECES);
+
+  const uint32_t band = (height + nb_job - 1) / nb_job;
+  for (uint32_t t = 0; t < nb_job; t++) {
+    memset(job + t, 0, sizeof(struct quantize_job));
+    job[t].rgba  = rgba;
+    job[t].width = width;
+    job[t].row0  = t * band;
+    job[t].nrows = (job[t].row0 >= height) ? 0 : (height - job[t].row0 < band) ? height - job[t].row0 : band;
+  }
+  return nb_job;
+}
+
+
+
+/*
+ * Exact colors
+ */
+
+/**
+ * @brief Palette of the exact colors of the image, if there are few enough
+ * @param[in] rgba Pixels
+ * @param[in] size Number of pixels
+ * @param[in] max_color
+ * @param[out] palette
+ * @param[out] nb_color
+ * @param[out] index Palette index of each pixel
+ * @return 1 if the image has at most max_color colors, 0 otherwise (stops at the first extra color)
+ */
+static int exact_palette(const uint8_t *rgba, size_t size, uint16_t max_color,
+                         uint8_t *palette, uint16_t *nb_color, uint8_t *index) {
+  uint32_t key[EXACT_SLOT]; // color + 1 << 24, 0 for an empty slot
+  uint8_t value[EXACT_SLOT];
+  memset(key, 0, sizeof(key));
+  *nb_color = 0;
+
+  uint32_t last = 0; // runs of the same color skip the hash set
+  uint8_t last_index = 0;
+  for (size_t p = 0; p < size; p++, rgba += 4) {
+    const uint32_t color = (1U << 24) | (rgba[0] << 16) | (rgba[1] << 8) | rgba[2];
+    if (color != last) {
+      uint32_t slot = (color * 2654435761U) >> 22; // 10 bits
+      while ((key[slot] != 0) && (key[slot] != color)) {
+        slot = (slot + 1) & (EXACT_SLOT - 1);
+      }
+      if (key[slot] == 0) {
+        if (*nb_color == max_color) {
+          return 0;
+        }
+        key[slot]   = color;
+        value[slot] = *nb_color;
+        memcpy(palette + 3 * (*nb_color), rgba, 3);
+        (*nb_color)++;
+      }
+      last = color;
+      last_index = value[slot];
+    }
+    index[p] = last_index;
+  }
+  return 1;
+}
+
+
+
+/*
+ * Histogram, median cut and k-means
+ */
+
+/**
+ * @brief Histogram of a band
+ * @param[in,out] arg The struct quantize_job of every band
+ * @param[in] index Index of the band
+ */
+static void histogram_band(void *arg, uint32_t index) {
+  struct quantize_job *job = ((struct quantize_job *) arg) + index;
+  const uint32_t shift = 8 - HIST_BITS;
+  const uint8_t *pixel = job->rgba + (size_t) job->row0 * job->width * 4;
+
+  memset(job->hist, 0, HIST_SIZE * sizeof(struct bin));
+  for (size_t p = 0; p < (size_t) job->nrows * job->width; p++, pixel += 4) {
+    const uint32_t key = ((pixel[0] >> shift) << (2 * HIST_BITS)) | ((pixel[1] >> shift) << HIST_BITS) | (pixel[2] >> shift);
+    struct bin *bin = job->hist + key;
+    bin->count++;
+    bin->sum[0] += pixel[0];
+    bin->sum[1] += pixel[1];
+    bin->sum[2] += pixel[2];
+  }
+}
+
+/**
+ * @brief Mean color of a bin
+ */
+static void bin_mean(const struct bin *bin, uint8_t color[3]) {
+  for (uint8_t c = 0; c < 3; c++) {
+    color[c] = (bin->sum[c] + bin->count / 2) / bin->count;
+  }
+}
+
+static int compare_red(const void *a, const void *b) {
+  return ((const struct entry *) a)->color[0] - ((const struct entry *) b)->color[0];
+}
+
+static int compare_green(const void *a, const void *b) {
+  return ((const struct entry *) a)->color[1] - ((const struct entry *) b)->color[1];
+}
+
+static int compare_blue(const void *a, const void *b) {
+  return ((const struct entry *) a)->color[2] - ((const struct entry *) b)->color[2];
+}
+
+/**
+ * @brief Longest axis and score of a box
+ */
+static void box_stat(const struct entry *entry, struct box *box) {
+  uint8_t min[3] = {255, 255, 255};
+  uint8_t max[3] = {0, 0, 0};
+  uint64_t count = 0;
+  for (uint32_t e = box->first; e < box->last; e++) {
+    for (uint8_t c = 0; c < 3; c++) {
+      min[c] = (entry[e].color[c] < min[c]) ? entry[e].color[c] : min[c];
+      max[c] = (entry[e].color[c] > max[c]) ? entry[e].color[c] : max[c];
+    }
+    count += entry[e].bin.count;
+  }
+  box->axis = 0;
+  for (uint8_t c = 1; c < 3; c++) {
+    if (max[c] - min[c] > max[box->axis] - min[box->axis]) {
+      box->axis = c;
+    }
+  }
+  box->score = (box->last - box->first > 1) ? count * (max[box->axis] - min[box->axis]) : 0;
+}
+
+/**
+ * @brief Median cut of the histogram entries
+ * @param[in,out] entry Entries (sorted in place)
+ * @param[in] nb_entry Number of entries (> 0)
+ * @param[in] max_color
+ * @param[out] palette Mean color of each box
+ * @return Number of boxes
+ */
+static uint16_t median_cut(struct entry *entry, uint32_t nb_entry, uint16_t max_color, uint8_t *palette) {
+  static int (*const compare[3])(const void *, const void *) = {compare_red, compare_green, compare_blue};
+  struct box box[QUANTIZE_MAX_COLOR];
+  uint16_t nb_box = 1;
+  box[0].first = 0;
+  box[0].last  = nb_entry;
+  box_stat(entry, box);
+
+  while (nb_box < max_color) {
+    // box with the highest score
+    uint16_t b = 0;
+    for (uint16_t k = 1; k < nb_box; k++) {
+      b = (box[k].score > box[b].score) ? k : b;
+    }
+    if (box[b].score == 0) {
+      break; // each box is a single entry or a single color
+    }
+
+    // split at the median pixel along the longest axis
+    struct box *split = box + b;
+    qsort(entry + split->first, split->last - split->first, sizeof(struct entry), compare[split->axis]);
+    uint64_t total = 0;
+    for (uint32_t e = split->first; e < split->last; e++) {
+      total += entry[e].bin.count;
+    }
+    uint64_t count = entry[split->first].bin.count;
+    uint32_t median = split->first + 1;
+    while ((median < split->last - 1) && (2 * count < total)) {
+      count += entry[median++].bin.count;
+    }
+
+    box[nb_box].first = median;
+    box[nb_box].last  = split->last;
+    split->last = median;
+    box_stat(entry, split);
+    box_stat(entry, box + nb_box);
+    nb_box++;
+  }
+
+  for (uint16_t b = 0; b < nb_box; b++) {
+    struct bin sum = {0, {0, 0, 0}};
+    for (uint32_t e = box[b].first; e < box[b].last; e++) {
+      sum.count += entry[e].bin.count;
+      for (uint8_t c = 0; c < 3; c++) {
+        sum.sum[c] += entry[e].bin.sum[c];
+      }
+    }
+    bin_mean(&sum, palette + 3 * b);
+  }
+  return nb_box;
+}
+
+/**
+ * @brief Move each color of the palette to the mean of the entries nearest to it
+ */
+static void kmeans(const struct entry *entry, uint32_t nb_entry, uint8_t *palette, uint16_t nb_color) {
+  struct bin cluster[QUANTIZE_MAX_COLOR];
+
+  for (uint8_t pass = 0; pass < KMEANS_PASS; pass++) {
+    memset(cluster, 0, sizeof(cluster));
+    for (uint32_t e = 0; e < nb_entry; e++) {
+      struct bin *nearest_bin = cluster + nearest(palette, nb_color, entry[e].color);
+      nearest_bin->count += entry[e].bin.count;
+      for (uint8_t c = 0; c < 3; c++) {
+        nearest_bin->sum[c] += entry[e].bin.sum[c];
+      }
+    }
+    for (uint16_t k = 0; k < nb_color; k++) {
+      if (cluster[k].count > 0) { // an empty cluster keeps its color
+        bin_mean(cluster + k, palette + 3 * k);
+      }
+    }
+  }
+}
+
+
+
+/*
+ * Mapping
+ */
+
+/**
+ * @brief Map a band of rows to the palette
+ * @param[in,out] arg The struct quantize_job of every band
+ * @param[in] index Index of the band
+ */
+static void map_band(void *arg, uint32_t index) {
+  const struct quantize_job *job = ((const struct quantize_job *) arg) + index;
+  const uint32_t w = job->width;
+
+  uint16_t *cache = quantize_malloc(CACHE_SIZE * sizeof(uint16_t));
+  memset(cache, 0xff, CACHE_SIZE * sizeof(uint16_t));
+  // Floyd-Steinberg errors (times 16) of the current and the next row, one pixel of margin each side
+  int32_t *error = NULL;
+  if (job->dither == DITHER_FLOYD_STEINBERG) {
+    error = quantize_malloc(2 * (w + 2) * 3 * sizeof(int32_t));
+    memset(error, 0, (w + 2) * 3 * sizeof(int32_t));
+  }
+  // ordered dithering amplitude: about the distance between two colors of the palette
+  const int32_t spread = (int32_t) (256.0 / cbrt(job->nb_color));
+
+  for (uint32_t y = job->row0; y < job->row0 + job->nrows; y++) {
+    const uint8_t *row = job->rgba + (size_t) y * w * 4;
+    uint8_t *index = job->index + (size_t) y * w;
+
+    switch (job->dither) {
+    case DITHER_NONE:
+      for (uint32_t x = 0; x < w; x++) {
+        index[x] = cached_nearest(cache, job->palette, job->nb_color, row + 4 * x);
+      }
+      break;
+
+    case DITHER_ORDERED:
+      for (uint32_t x = 0; x < w; x++) {
+        const int32_t offset = ((2 * bayer[y & 3][x & 3] - 15) * spread) / 32;
+        const uint8_t color[3] = {clamp8(row[4 * x] + offset), clamp8(row[4 * x + 1] + offset), clamp8(row[4 * x + 2] + offset)};
+        index[x] = cached_nearest(cache, job->palette, job->nb_color, color);
+      }
+      break;
+
+    case DITHER_FLOYD_STEINBERG: {
+      // serpentine: odd rows of the band right to left
+      const int32_t dir = ((y - job->row0) & 1) ? -1 : 1;
+      int32_t *cur  = error + (((y - job->row0) & 1) ? (w + 2) * 3 : 0);
+      int32_t *next = error + (((y - job->row0) & 1) ? 0 : (w + 2) * 3);
+      memset(next, 0, (w + 2) * 3 * sizeof(int32_t));
+
+      for (uint32_t n = 0; n < w; n++) {
+        const uint32_t x = (dir > 0) ? n : w - 1 - n;
+        int32_t *e = cur + 3 * (x + 1);
+        int32_t *f = next + 3 * (x + 1);
+        uint8_t color[3];
+        for (uint8_t c = 0; c < 3; c++) {
+          color[c] = clamp8(row[4 * x + c] + e[c] / 16);
+        }
+        index[x] = cached_nearest(cache, job->palette, job->nb_color, color);
+        const uint8_t *chosen = job->palette + 3 * index[x];
+        for (uint8_t c = 0; c < 3; c++) {
+          const int32_t diff = color[c] - chosen[c];
+          e[3 * dir + c] += 7 * diff;
+          f[-3 * dir + c] += 3 * diff;
+          f[c] += 5 * diff;
+          f[3 * dir + c] += diff;
+        }
+      }
+      break;
+    }
+    }
+  }
+  free(error);
+  free(cache);
+}
+
+
+
+struct image quantize_image(const struct image *image, uint16_t max_color, enum dither_mode dither, uint16_t *nb_color) {
+  assert((max_color >= 2) && (max_color <= QUANTIZE_MAX_COLOR));
+  const uint32_t w = image->width;
+  const uint32_t h = image->height;
+  const size_t size = (size_t) w * h;
+
+  // straight RGBA8 composited onto the background
+  const uint16_t white[3] = {65535, 65535, 65535};
+  uint16_t background[3];
+  get_background(image, white, background);
+  uint8_t *rgba = quantize_malloc(size * 4 + 1);
+  convert_rows(image, 0, h, FORMAT_RGBA8, rgba, (size_t) w * 4);
+  composite_rows(ALPHA_BACKGROUND, background, FORMAT_RGBA8, rgba, w, h, (size_t) w * 4);
+
+  uint8_t *data = quantize_malloc(size + PALETTE_SIZE);
+  uint8_t *palette = data + size;
+  memset(palette, 0, PALETTE_SIZE);
+
+  if (exact_palette(rgba, size, max_color, palette, nb_color, data)) {
+    LOG_INFO("Quantize: %d exact colors", *nb_color);
+  }
+  else {
+    struct quantize_job job[QUANTIZE_MAX_PIECES];
+    const uint32_t nb_job = split_jobs(rgba, w, h, job);
+
+    // one histogram per band, merged in the first one
+    struct bin *hist = quantize_malloc(nb_job * HIST_SIZE * sizeof(struct bin));
+    for (uint32_t t = 0; t < nb_job; t++) {
+      job[t].hist = hist + t * HIST_SIZE;
+    }
+    sched_run(NULL, nb_job, histogram_band, job);
+
+    struct entry *entry = quantize_malloc(HIST_SIZE * sizeof(struct entry));
+    uint32_t nb_entry = 0;
+    for (uint32_t k = 0; k < HIST_SIZE; k++) {
+      for (uint32_t t = 1; t < nb_job; t++) {
+        hist[k].count += hist[t * HIST_SIZE + k].count;
+        for (uint8_t c = 0; c < 3; c++) {
+          hist[k].sum[c] += hist[t * HIST_SIZE + k].sum[c];
+        }
+      }
+      if (hist[k].count > 0) {
+        entry[nb_entry].bin = hist[k];
+        bin_mean(hist + k, entry[nb_entry].color);
+        nb_entry++;
+      }
+    }
+    free(hist);
+
+    *nb_color = median_cut(entry, nb_entry, max_color, palette);
+    kmeans(entry, nb_entry, palette, *nb_color);
+    free(entry);
+    LOG_INFO("Quantize: %d colors from %d histogram bins", *nb_color, nb_entry);
+
+    for (uint32_t t = 0; t < nb_job; t++) {
+      job[t].palette  = palette;
+      job[t].nb_color = *nb_color;
+      job[t].dither   = dither;
+      job[t].index    = data;
+    }
+    sched_run(NULL, nb_job, map_band, job);
+  }
+  free(rgba);
+
+  struct image r = {
+    .width   = w,
+    .height  = h,
+    .depth   = 8,
+    .sample  = 1,
+    .native  = 0,
+    .gamma   = image->gamma,
+    .profile = icc_retain(image->profile),
+    .has_background = image->has_background,
+    .palette = palette,
+    .data    = data,
+  };
+  memcpy(r.background, image->background, sizeof(r.background));
+  return r;
+}
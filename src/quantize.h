@@ -0,0 +1,50 @@
+/**
+ * @file quantize.h
+ * @brief Reduce an image to a palette of at most 256 colors (--plte)
+ * @details Images with few enough distinct colors keep them exactly. Otherwise colors are counted
+ * in a 15-bit histogram (one per band, then merged), boxes of the histogram are split at the
+ * median of their longest axis (median cut) and the box means are refined by a few k-means passes
+ * over the histogram. Pixels are mapped to the palette through a nearest color cache (18-bit cells),
+ * optionally with ordered or Floyd-Steinberg dithering. Bands of rows are mapped by the workers,
+ * Floyd-Steinberg errors are not carried over from one band to the next.
+ * Transparent pixels are composited onto the background first (the palette has no alpha).
+ */
+
+#ifndef __QUANTIZE_H__
+#define __QUANTIZE_H__
+
+#include <stdint.h>
+
+#include "image.h"
+
+
+/** @brief Max number of colors of a palette */
+#define QUANTIZE_MAX_COLOR (256U)
+
+
+/**
+ * @brief Dithering while mapping pixels to the palette
+ */
+enum dither_mode {
+  /** @brief Nearest color */
+  DITHER_NONE = 0,
+  /** @brief Threshold from a 4x4 Bayer matrix (no error carried, same result on any thread count) */
+  DITHER_ORDERED = 1,
+  /** @brief Error diffusion (serpentine scan) */
+  DITHER_FLOYD_STEINBERG = 2,
+};
+
+
+/**
+ * @brief Quantize an image
+ * @param[in] image Any image returned by get_image
+ * @param[in] max_color Max number of colors of the palette (2 to QUANTIZE_MAX_COLOR)
+ * @param[in] dither
+ * @param[out] nb_color Number of colors actually used in the palette
+ * @return A palette image of depth 8 (free it with free_image)
+ */
+struct image quantize_image(const struct image *image, uint16_t max_color, enum dither_mode dither, uint16_t *nb_color);
+
+
+
+#endif // __QUANTIZE_H__
@@ -0,0 +1,25 @@
+#include "gamma.h"
+#include "icc.h"
+#include "render.h"
+
+
+
+void render_rows(const struct image *image, uint32_t row0, uint32_t nrows, enum pixel_format format,
+                 enum alpha_mode mode, void *dst, size_t stride) {
+  const uint8_t alpha = (image->sample == 2) || (image->sample == 4);
+
+  convert_rows(image, row0, nrows, format, dst, stride);
+
+  // the background is in the color space of the samples
+  if (alpha && (mode == ALPHA_BACKGROUND)) {
+    uint16_t background[3];
+    get_background(image, default_background, background);
+    composite_rows(mode, background, format, dst, image->width, nrows, stride);
+  }
+  if (!icc_rows(image, format, dst, nrows, stride)) {
+    gamma_rows(image, TRANSFER_DISPLAY, format, dst, nrows, stride);
+  }
+  if (alpha && (mode == ALPHA_PREMULTIPLIED)) {
+    composite_rows(mode, NULL, format, dst, image->width, nrows, stride);
+  }
+}
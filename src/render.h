@@ -0,0 +1,42 @@
+/**
+ * @file render.h
+ * @brief Rows of an image ready for an sRGB display
+ * @details The whole output pipeline in one call: convert_rows, alpha compositing onto the background
+ * (bKGD or default_background), then the color correction (iCCP, or gAMA/sRGB).
+ * Shared by the viewer and the file writers so they all give the same pixels.
+ */
+
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "composite.h"
+#include "convert.h"
+#include "image.h"
+
+
+/**
+ * @brief Default background color (16-bit red, green, blue)
+ * @details Used when the file has no bKGD chunk
+ */
+static const uint16_t default_background[3] = {65535, 65535, 65535};
+
+
+/**
+ * @brief Convert consecutive rows of the image for an sRGB display
+ * @param[in] image Any image returned by get_image (or a crop, a downscale, an Adam7 pass)
+ * @param[in] row0 First row to convert
+ * @param[in] nrows Number of rows (row0 + nrows <= image height)
+ * @param[in] format Pixel format of dst
+ * @param[in] mode Alpha compositing (ALPHA_BACKGROUND before the color correction, ALPHA_PREMULTIPLIED after)
+ * @param[out] dst Area of nrows * stride bytes
+ * @param[in] stride Distance in bytes between two rows of dst
+ */
+void render_rows(const struct image *image, uint32_t row0, uint32_t nrows, enum pixel_format format,
+                 enum alpha_mode mode, void *dst, size_t stride);
+
+
+
+#endif // __RENDER_H__
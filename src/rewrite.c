@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "chunk.h"
+#include "log.h"
+#include "rewrite.h"
+
+
+/** @brief Size of the PNG signature */
+#define SIGNATURE_SIZE (8U)
+
+
+/**
+ * @brief How bytes of the source go to the output, from the fastest
+ */
+enum copy_mode {
+  /** @brief copy_file_range: no copy at all on file systems sharing extents */
+  COPY_RANGE = 0,
+  /** @brief sendfile: from the page cache of the source to the output */
+  COPY_SENDFILE = 1,
+  /** @brief write from the mapping */
+  COPY_WRITE = 2,
+};
+
+/**
+ * @brief A chunk of the source
+ */
+struct rewrite_chunk {
+  /** @brief Offset of the chunk in the source (its length field) */
+  size_t offset;
+  /** @brief Length of its data */
+  uint32_t length;
+  /** @brief Type as in the file */
+  char type[4];
+  /** @brief Type */
+  enum chunk_type kind;
+  /** @brief CRC of the file */
+  uint32_t crc;
+  /** @brief Flag: the chunk is not written */
+  uint8_t drop;
+};
+
+/**
+ * @brief Output being written
+ */
+struct rewriter {
+  /** @brief Source */
+  const struct mfile *file;
+  /** @brief Descriptor of the source */
+  int in;
+  /** @brief Name of the output */
+  const char *filename;
+  /** @brief Descriptor of the output */
+  int out;
+  /** @brief Current copy mode */
+  enum copy_mode mode;
+  /** @brief What is done so far */
+  struct rewrite_stats stats;
+};
+
+
+
+static void put32(uint8_t *ptr, uint32_t v) {
+  ptr[0] = v >> 24;
+  ptr[1] = v >> 16;
+  ptr[2] = v >> 8;
+  ptr[3] = v;
+}
+
+/**
+ * @brief Write bytes which are not in the source
+ */
+static void write_bytes(struct rewriter *w, const uint8_t *data, size_t length) {
+  w->stats.size += length;
+  while (length > 0) {
+    const ssize_t n = write(w->out, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_FATAL("Can't write %s", w->filename);
+      exit(1);
+    }
+    data   += n;
+    length -= n;
+  }
+}
+
+/**
+ * @brief Copy bytes of the source, in the kernel if possible
+ * @param[in,out] w
+ * @param[in] offset Offset in the source
+ * @param[in] length Number of bytes
+ */
+static void copy_source(struct rewriter *w, size_t offset, size_t length) {
+#ifdef __linux__
+  while ((length > 0) && (w->mode != COPY_WRITE)) {
+    ssize_t n;
+    if (w->mode == COPY_RANGE) {
+      loff_t in_offset = offset;
+      n = copy_file_range(w->in, &in_offset, w->out, NULL, length, 0);
+    }
+    else {
+      off_t in_offset = offset;
+      n = sendfile(w->out, w->in, &in_offset, length);
+    }
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (n <= 0) {
+      // not between these files (pipe, other file system, old kernel...): next mode
+      LOG_INFO("Can't %s to %s, fall back", (w->mode == COPY_RANGE) ? "copy_file_range" : "sendfile", w->filename);
+      w->mode++;
+      continue;
+    }
+    w->stats.copied += n;
+    w->stats.size   += n;
+    offset += n;
+    length -= n;
+  }
+#endif
+  if (length > 0) {
+    write_bytes(w, ((const uint8_t *) w->file->data) + offset, length);
+  }
+}
+
+/**
+ * @brief Copy consecutive IDAT chunks as one
+ * @details The CRC of "IDAT" + data is combined from the CRC of each chunk, none of the data is read
+ * @param[in,out] w
+ * @param[in] chunk The chunks
+ * @param[in] nb Number of chunks (their total length fits in one chunk)
+ */
+static void copy_idat(struct rewriter *w, const struct rewrite_chunk *const *chunk, uint32_t nb) {
+  w->stats.idat_out++;
+  if (nb == 1) {
+    copy_source(w, chunk[0]->offset, 12 + (size_t) chunk[0]->length);
+    return;
+  }
+
+  // crc("IDAT" + d) = shift(crc("IDAT"), |d|) ^ crc(d), and shift(c, n) = crc32_combine(c, 0, n)
+  const uint32_t type_crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *) "IDAT", 4);
+  uint32_t crc = type_crc;
+  uint32_t length = 0;
+  for (uint32_t k = 0; k < nb; k++) {
+    const uint32_t data_crc = chunk[k]->crc ^ crc32_combine(type_crc, 0, chunk[k]->length);
+    crc = crc32_combine(crc, data_crc, chunk[k]->length);
+    length += chunk[k]->length;
+  }
+
+  uint8_t head[8], tail[4];
+  put32(head, length);
+  memcpy(head + 4, "IDAT", 4);
+  put32(tail, crc);
+  write_bytes(w, head, 8);
+  for (uint32_t k = 0; k < nb; k++) {
+    copy_source(w, chunk[k]->offset + 8, chunk[k]->length);
+  }
+  write_bytes(w, tail, 4);
+}
+
+/**
+ * @brief Walk the chunks of the file, up to IEND
+ * @param[in] file
+ * @param[out] nb Number of chunks
+ * @return The chunks (to free)
+ */
+static struct rewrite_chunk *walk_chunks(const struct mfile *file, uint32_t *nb) {
+  uint32_t allocated = 64;
+  struct rewrite_chunk *chunk = malloc(allocated * sizeof(struct rewrite_chunk));
+  if (chunk == NULL) {
+    LOG_FATAL("Can't malloc %d chunks", allocated);
+    exit(1);
+  }
+
+  *nb = 0;
+  size_t offset = SIGNATURE_SIZE;
+  for (;;) {
+    const uint8_t *ptr = ((const uint8_t *) file->data) + offset;
+    const struct chunk current = get_chunk_unchecked(file->size - offset, ptr);
+    if (*nb == allocated) {
+      allocated *= 2;
+      chunk = realloc(chunk, allocated * sizeof(struct rewrite_chunk));
+      if (chunk == NULL) {
+        LOG_FATAL("Can't realloc %d chunks", allocated);
+        exit(1);
+      }
+    }
+    struct rewrite_chunk *c = chunk + (*nb)++;
+    c->offset = offset;
+    c->length = current.length;
+    memcpy(c->type, ptr + 4, 4);
+    c->kind = current.type;
+    c->crc  = current.crc;
+    c->drop = 0;
+
+    offset += 12 + (size_t) current.length;
+    if (current.type == IEND) {
+      return chunk;
+    }
+  }
+}
+
+/**
+ * @brief Check if a chunk is an index of the IDAT chunks (stRP or iDOT)
+ */
+static uint8_t is_index(const struct rewrite_chunk *chunk) {
+  return (memcmp(chunk->type, "stRP", 4) == 0) || (memcmp(chunk->type, "iDOT", 4) == 0);
+}
+
+/**
+ * @brief Check if a chunk is text or time (allowed anywhere)
+ */
+static uint8_t is_metadata(const struct rewrite_chunk *chunk) {
+  return (chunk->kind == TEXT) || (chunk->kind == ZTXT) || (chunk->kind == ITXT) || (chunk->kind == TIME);
+}
+
+
+
+struct rewrite_stats rewrite_png(const struct mfile *file, const char *filename, uint32_t flags) {
+  uint32_t nb;
+  struct rewrite_chunk *chunk = walk_chunks(file, &nb);
+
+  // chunks dropped
+  uint32_t first_idat = nb, last_idat = 0, nb_idat = 0;
+  for (uint32_t k = 0; k < nb; k++) {
+    struct rewrite_chunk *c = chunk + k;
+    const uint8_t ancillary = (c->type[0] & 0x20) != 0;
+    c->drop = ((flags & REWRITE_TEXT) && ((c->kind == TEXT) || (c->kind == ZTXT) || (c->kind == ITXT)))
+      || ((flags & REWRITE_TIME) && (c->kind == TIME))
+      || ((flags & REWRITE_UNKNOWN) && (c->kind == UKWN) && ancillary);
+    if (c->kind == IDAT) {
+      first_idat = (k < first_idat) ? k : first_idat;
+      last_idat  = k;
+      nb_idat++;
+    }
+  }
+  if (nb_idat == 0) {
+    LOG_FATAL("No IDAT in %s", file->pathname);
+    exit(1);
+  }
+
+  // order of the output: metadata after the image data goes before the index or the first IDAT
+  uint32_t *order = malloc(nb * sizeof(uint32_t));
+  if (order == NULL) {
+    LOG_FATAL("Can't malloc the order of %d chunks", nb);
+    exit(1);
+  }
+  uint32_t insert = first_idat;
+  while ((insert > 0) && is_index(chunk + insert - 1)) {
+    insert--;
+  }
+  uint32_t moved = 0;
+  uint32_t n = 0;
+  for (uint32_t k = 0; k < insert; k++) {
+    order[n++] = k;
+  }
+  if (flags & REWRITE_METADATA_FIRST) {
+    for (uint32_t k = last_idat + 1; k < nb; k++) {
+      if (is_metadata(chunk + k) && !chunk[k].drop) {
+        order[n++] = k;
+        moved++;
+      }
+    }
+  }
+  for (uint32_t k = insert; k < nb; k++) {
+    if (!((flags & REWRITE_METADATA_FIRST) && (k > last_idat) && is_metadata(chunk + k) && !chunk[k].drop)) {
+      order[n++] = k;
+    }
+  }
+
+  // the index points to the IDAT chunks: dropped once they move
+  uint8_t layout = (flags & REWRITE_MERGE_IDAT) && (nb_idat > 1);
+  for (uint32_t k = insert; k < last_idat; k++) {
+    layout |= chunk[k].drop;
+  }
+  for (uint32_t k = insert; k < first_idat; k++) {
+    chunk[k].drop |= layout && is_index(chunk + k);
+  }
+
+  // output
+  struct rewriter w = {
+    .file     = file,
+    .filename = filename,
+    .mode     = COPY_RANGE,
+  };
+  memset(&(w.stats), 0, sizeof(struct rewrite_stats));
+  w.stats.nb_chunk = nb;
+  w.stats.moved    = moved;
+  w.stats.idat_in  = nb_idat;
+
+  w.in = open(file->pathname, O_RDONLY);
+  if (w.in < 0) {
+    LOG_FATAL("Can't open %s again", file->pathname);
+    exit(1);
+  }
+  if (strcmp(filename, REWRITE_STDOUT) == 0) {
+    w.out = STDOUT_FILENO;
+  }
+  else {
+    // truncating the source would change the mapping
+    struct stat src, dst;
+    if ((fstat(w.in, &src) == 0) && (stat(filename, &dst) == 0)
+        && (src.st_dev == dst.st_dev) && (src.st_ino == dst.st_ino)) {
+      LOG_FATAL("Can't rewrite %s over itself", filename);
+      exit(1);
+    }
+    w.out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.out < 0) {
+      LOG_FATAL("Can't open %s", filename);
+      exit(1);
+    }
+  }
+
+  write_bytes(&w, file->data, SIGNATURE_SIZE);
+  const struct rewrite_chunk **group = malloc(nb_idat * sizeof(struct rewrite_chunk *));
+  if (group == NULL) {
+    LOG_FATAL("Can't malloc %d IDAT", nb_idat);
+    exit(1);
+  }
+  for (uint32_t o = 0; o < nb; o++) {
+    const struct rewrite_chunk *c = chunk + order[o];
+    if (c->drop) {
+      w.stats.dropped++;
+      continue;
+    }
+    if (c->kind != IDAT) {
+      copy_source(&w, c->offset, 12 + (size_t) c->length);
+      continue;
+    }
+    if (!(flags & REWRITE_MERGE_IDAT)) {
+      copy_idat(&w, &c, 1);
+      continue;
+    }
+
+    // as many consecutive IDAT as fit in one
+    uint32_t nb_group = 0;
+    uint64_t length = 0;
+    while ((o < nb) && (chunk[order[o]].kind == IDAT)) {
+      const struct rewrite_chunk *next = chunk + order[o];
+      if ((nb_group > 0) && (length + next->length > REWRITE_MAX_IDAT)) {
+        copy_idat(&w, group, nb_group);
+        nb_group = 0;
+        length = 0;
+      }
+      group[nb_group++] = next;
+      length += next->length;
+      o++;
+    }
+    copy_idat(&w, group, nb_group);
+    o--;
+  }
+  free(group);
+  free(order);
+  free(chunk);
+
+  close(w.in);
+  if ((w.out != STDOUT_FILENO) && (close(w.out) != 0)) {
+    LOG_FATAL("Can't close %s", filename);
+    exit(1);
+  }
+  LOG_INFO("Rewrite %s: %lu bytes, %lu copied by the kernel, %d chunks dropped, %d IDAT in %d",
+           filename, (unsigned long) w.stats.size, (unsigned long) w.stats.copied, w.stats.dropped,
+           w.stats.idat_in, w.stats.idat_out);
+  return w.stats;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file rewrite.h
+ * @brief Rewrite a PNG file chunk by chunk, without decoding the image
+ * @details Chunks are walked with get_chunk_unchecked: the data of a chunk is never read.
+ * Metadata chunks can be dropped, text and time chunks after the image data moved before it,
+ * and consecutive IDAT chunks merged. Chunks kept as they are go from the source file to the
+ * output in the kernel (copy_file_range, or sendfile), with their CRC. A merged IDAT only gets
+ * a new header and a CRC combined from the CRCs of its parts (crc32_combine), its data is copied
+ * in the kernel as well. So the CRC of no chunk is computed, and a wrong CRC stays wrong.
+ * The strip index (stRP, Apple's iDOT) is dropped once the IDAT chunks it points to move.
+ */
+
+#ifndef __REWRITE_H__
+#define __REWRITE_H__
+
+#include <stdint.h>
+
+#include "mfile.h"
+
+
+/** @brief File name of the standard output */
+#define REWRITE_STDOUT "-"
+/** @brief Max length of a merged IDAT (the PNG limit is 2^31 - 1) */
+#define REWRITE_MAX_IDAT (0x7fffffffU)
+
+/** @brief Drop tEXt, zTXt and iTXt */
+#define REWRITE_TEXT (1U << 0)
+/** @brief Drop tIME */
+#define REWRITE_TIME (1U << 1)
+/** @brief Drop the ancillary chunks unknown to the specification (private or not, eXIf...) */
+#define REWRITE_UNKNOWN (1U << 2)
+/** @brief Move the text and time chunks after the image data before the first IDAT */
+#define REWRITE_METADATA_FIRST (1U << 3)
+/** @brief Merge consecutive IDAT chunks */
+#define REWRITE_MERGE_IDAT (1U << 4)
+/** @brief Metadata stripped, IDAT merged (--clean) */
+#define REWRITE_CLEAN (REWRITE_TEXT | REWRITE_TIME | REWRITE_UNKNOWN | REWRITE_MERGE_IDAT)
+
+
+/**
+ * @brief What the rewriter did
+ */
+struct rewrite_stats {
+  /** @brief Number of chunks of the source */
+  uint32_t nb_chunk;
+  /** @brief Number of chunks dropped */
+  uint32_t dropped;
+  /** @brief Number of chunks moved */
+  uint32_t moved;
+  /** @brief Number of IDAT chunks of the source */
+  uint32_t idat_in;
+  /** @brief Number of IDAT chunks written */
+  uint32_t idat_out;
+  /** @brief Size of the output */
+  uint64_t size;
+  /** @brief Bytes copied from the source by the kernel (copy_file_range or sendfile) */
+  uint64_t copied;
+};
+
+
+/**
+ * @brief Rewrite a PNG file
+ * @details Bytes after IEND are dropped. The output can't be the source.
+ * @param[in] file A PNG file (its pathname is opened again to copy from it)
+ * @param[in] filename Name of the output, REWRITE_STDOUT for the standard output
+ * @param[in] flags REWRITE_* flags
+ * @return What was done
+ */
+struct rewrite_stats rewrite_png(const struct mfile *file, const char *filename, uint32_t flags);
+
+
+#endif // __REWRITE_H__
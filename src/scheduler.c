@@ -0,0 +1,343 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "scheduler.h"
+
+
+/** @brief Key of the struct sched_worker of a thread (NULL outside any task) */
+static pthread_key_t worker_key;
+/** @brief Once flag of worker_key */
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+/** @brief Scheduler of the kernels called outside any task */
+static struct sched default_sched;
+/** @brief Once flag of default_sched */
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * @brief Index taken from a task
+ */
+struct sched_piece {
+  /** @brief Function to run */
+  sched_work work;
+  /** @brief Its argument */
+  void *arg;
+  /** @brief Index to run */
+  uint32_t index;
+  /** @brief Group of the index */
+  struct sched_group *group;
+};
+
+
+
+static void make_key(void) {
+  if (pthread_key_create(&worker_key, NULL) != 0) {
+    LOG_FATAL("Can't create the key of the workers");
+    exit(1);
+  }
+}
+
+static void make_default(void) {
+  sched_open(&default_sched, 0);
+}
+
+/**
+ * @brief Push a task on a deque and wake the sleepers
+ */
+static void push(struct sched *sched, struct sched_deque *deque, const struct sched_task *task) {
+  pthread_mutex_lock(&(deque->lock));
+  if (deque->nb == deque->allocated) {
+    deque->allocated = (deque->allocated > 0) ? 2 * deque->allocated : 8;
+    deque->task = realloc(deque->task, deque->allocated * sizeof(struct sched_task));
+    if (deque->task == NULL) {
+      LOG_FATAL("Can't realloc a deque of %u tasks", deque->allocated);
+      exit(1);
+    }
+  }
+  deque->task[deque->nb] = *task;
+  __atomic_store_n(&(deque->nb), deque->nb + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&(deque->lock));
+
+  pthread_mutex_lock(&(sched->lock));
+  __atomic_add_fetch(&(sched->pushed), 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&(sched->wake));
+  pthread_mutex_unlock(&(sched->lock));
+}
+
+/**
+ * @brief Take the next index of a task of a deque, the deque must be locked
+ * @param[in,out] deque
+ * @param[in] t Index of the task
+ * @param[out] piece
+ */
+static void take_from(struct sched_deque *deque, uint32_t t, struct sched_piece *piece) {
+  struct sched_task *task = deque->task + t;
+  piece->work  = task->work;
+  piece->arg   = task->arg;
+  piece->index = task->next++;
+  piece->group = task->group;
+  if (task->next == task->last) {
+    memmove(task, task + 1, (deque->nb - t - 1) * sizeof(struct sched_task));
+    __atomic_store_n(&(deque->nb), deque->nb - 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief Take an index from a deque
+ * @param[in,out] deque
+ * @param[in] newest Flag: from the newest task (the own deque), otherwise from the oldest one
+ * @param[in] group Group waited for or NULL for any
+ * @param[out] piece
+ * @return 1 if an index was taken, 0 otherwise
+ */
+static int take_deque(struct sched_deque *deque, uint8_t newest, const struct sched_group *group,
+                      struct sched_piece *piece) {
+  if (__atomic_load_n(&(deque->nb), __ATOMIC_ACQUIRE) == 0) {
+    return 0;
+  }
+  int taken = 0;
+  pthread_mutex_lock(&(deque->lock));
+  for (uint32_t k = 0; !taken && (k < deque->nb); k++) {
+    const uint32_t t = newest ? deque->nb - 1 - k : k;
+    if ((group == NULL) || (deque->task[t].group == group)) {
+      take_from(deque, t, piece);
+      taken = 1;
+    }
+  }
+  pthread_mutex_unlock(&(deque->lock));
+  return taken;
+}
+
+/**
+ * @brief Find an index to run
+ * @details The newest task of the own deque, then the oldest one of the others, starting after
+ * the own one. With a group, only its tasks. Only one deque is locked at a time.
+ * @param[in,out] sched
+ * @param[in] self Deque of the caller
+ * @param[in] group Group waited for or NULL for any
+ * @param[out] piece
+ * @return 1 if an index was taken, 0 otherwise
+ */
+static int take(struct sched *sched, uint32_t self, const struct sched_group *group, struct sched_piece *piece) {
+  if (take_deque(sched->deque + self, 1, group, piece)) {
+    return 1;
+  }
+  const uint32_t nb_worker = __atomic_load_n(&(sched->nb_worker), __ATOMIC_ACQUIRE);
+  for (uint32_t v = 1; v < nb_worker; v++) {
+    if (take_deque(sched->deque + (self + v) % nb_worker, 0, group, piece)) {
+      __atomic_add_fetch(&(sched->stolen), 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Count an index done, wake the thread waiting for the group if it was the last one
+ */
+static void done(struct sched *sched, struct sched_group *group) {
+  if (__atomic_sub_fetch(&(group->left), 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&(sched->lock));
+    pthread_cond_broadcast(&(sched->wake));
+    pthread_mutex_unlock(&(sched->lock));
+  }
+}
+
+/**
+ * @brief Sleep until a task is pushed, a group is done or the scheduler stops
+ * @param[in,out] sched
+ * @param[in] pushed Value of sched->pushed read before looking for a task
+ * @param[in] group Group waited for (no sleep once done) or NULL
+ */
+static void sleep_until(struct sched *sched, uint64_t pushed, const struct sched_group *group) {
+  pthread_mutex_lock(&(sched->lock));
+  if ((__atomic_load_n(&(sched->pushed), __ATOMIC_ACQUIRE) == pushed) && !sched->stop
+      && ((group == NULL) || (__atomic_load_n(&(group->left), __ATOMIC_ACQUIRE) > 0))) {
+    pthread_cond_wait(&(sched->wake), &(sched->lock));
+  }
+  pthread_mutex_unlock(&(sched->lock));
+}
+
+/**
+ * @brief Flag: the scheduler stops
+ */
+static uint8_t stopping(struct sched *sched) {
+  pthread_mutex_lock(&(sched->lock));
+  const uint8_t stop = sched->stop;
+  pthread_mutex_unlock(&(sched->lock));
+  return stop;
+}
+
+/**
+ * @brief Run tasks until the scheduler stops
+ * @param[in] arg The struct sched_worker of the thread
+ * @return NULL
+ */
+static void *worker_loop(void *arg) {
+  struct sched_worker *worker = arg;
+  struct sched *sched = worker->sched;
+  pthread_setspecific(worker_key, worker);
+
+  struct sched_piece piece;
+  for (;;) {
+    const uint64_t pushed = __atomic_load_n(&(sched->pushed), __ATOMIC_ACQUIRE);
+    if (take(sched, worker->index, NULL, &piece)) {
+      piece.work(piece.arg, piece.index);
+      done(sched, piece.group);
+    }
+    else if (stopping(sched)) {
+      break;
+    }
+    else {
+      sleep_until(sched, pushed, NULL);
+    }
+  }
+  return NULL;
+}
+
+
+
+void sched_open(struct sched *sched, uint32_t nb_worker) {
+  pthread_once(&key_once, make_key);
+  if (nb_worker == 0) {
+    const long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nb_worker = (nb_cpu > 0) ? (uint32_t) nb_cpu : 1;
+  }
+  nb_worker = (nb_worker < SCHED_MAX_THREAD) ? nb_worker : SCHED_MAX_THREAD;
+
+  memset(sched, 0, sizeof(struct sched));
+  pthread_mutex_init(&(sched->lock), NULL);
+  pthread_cond_init(&(sched->wake), NULL);
+  for (uint32_t w = 0; w < SCHED_MAX_THREAD; w++) {
+    pthread_mutex_init(&(sched->deque[w].lock), NULL);
+  }
+  sched->nb_worker = 1;
+  for (uint32_t w = 1; w < nb_worker; w++) {
+    struct sched_worker *worker = sched->worker + w;
+    worker->sched      = sched;
+    worker->index      = w;
+    worker->max_pieces = SCHED_PIECES * nb_worker;
+    // a worker counts once its thread runs: the others never get tasks
+    __atomic_store_n(&(sched->nb_worker), w + 1, __ATOMIC_RELEASE);
+    if (pthread_create(sched->thread + w, NULL, worker_loop, worker) != 0) {
+      LOG_WARN("Can't start worker %u, %u only", w, w);
+      __atomic_store_n(&(sched->nb_worker), w, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+  LOG_INFO("Scheduler of %u workers", sched->nb_worker);
+}
+
+
+void sched_close(struct sched *sched) {
+  pthread_mutex_lock(&(sched->lock));
+  sched->stop = 1;
+  pthread_cond_broadcast(&(sched->wake));
+  pthread_mutex_unlock(&(sched->lock));
+  for (uint32_t w = 1; w < sched->nb_worker; w++) {
+    pthread_join(sched->thread[w], NULL);
+  }
+  for (uint32_t w = 0; w < SCHED_MAX_THREAD; w++) {
+    free(sched->deque[w].task);
+    pthread_mutex_destroy(&(sched->deque[w].lock));
+  }
+  pthread_cond_destroy(&(sched->wake));
+  pthread_mutex_destroy(&(sched->lock));
+}
+
+
+struct sched *sched_current(void) {
+  pthread_once(&key_once, make_key);
+  const struct sched_worker *worker = pthread_getspecific(worker_key);
+  if (worker != NULL) {
+    return worker->sched;
+  }
+  pthread_once(&default_once, make_default);
+  return &default_sched;
+}
+
+
+void sched_run(struct sched *sched, uint32_t nb, sched_work work, void *arg) {
+  if (sched == NULL) {
+    sched = sched_current();
+  }
+  if (nb == 0) {
+    return;
+  }
+
+  // a thread outside the scheduler is one of its workers for a while, on the deque 0
+  struct sched_worker *previous = pthread_getspecific(worker_key);
+  struct sched_worker outside = {
+    .sched      = sched,
+    .index      = 0,
+    .max_pieces = SCHED_PIECES * sched->nb_worker,
+  };
+  struct sched_worker *self = previous;
+  if ((previous == NULL) || (previous->sched != sched)) {
+    outside.max_pieces = ((previous != NULL) && (previous->max_pieces < outside.max_pieces)) ? previous->max_pieces
+                                                                                             : outside.max_pieces;
+    self = &outside;
+    pthread_setspecific(worker_key, self);
+  }
+
+  if ((nb == 1) || (sched->nb_worker == 1)) {
+    for (uint32_t k = 0; k < nb; k++) {
+      work(arg, k);
+    }
+  }
+  else {
+    struct sched_group group = {
+      .left = nb,
+    };
+    const struct sched_task task = {
+      .work  = work,
+      .arg   = arg,
+      .next  = 0,
+      .last  = nb,
+      .group = &group,
+    };
+    struct sched_piece piece;
+    push(sched, sched->deque + self->index, &task);
+    while (__atomic_load_n(&(group.left), __ATOMIC_ACQUIRE) > 0) {
+      const uint64_t pushed = __atomic_load_n(&(sched->pushed), __ATOMIC_ACQUIRE);
+      if (take(sched, self->index, &group, &piece)) {
+        piece.work(piece.arg, piece.index);
+        done(sched, &group);
+      }
+      else {
+        sleep_until(sched, pushed, &group);
+      }
+    }
+  }
+  if (self != previous) {
+    pthread_setspecific(worker_key, previous);
+  }
+}
+
+
+uint32_t sched_pieces(uint64_t cost, uint64_t grain, uint32_t max) {
+  pthread_once(&key_once, make_key);
+  const struct sched_worker *worker = pthread_getspecific(worker_key);
+  uint64_t limit = (worker != NULL) ? worker->max_pieces : SCHED_PIECES * (uint64_t) sched_current()->nb_worker;
+  limit = (limit < max) ? limit : max;
+
+  const uint64_t nb = (grain > 0) ? cost / grain : 1;
+  return (nb < 1) ? 1 : (nb > limit) ? (uint32_t) limit : (uint32_t) nb;
+}
+
+
+uint32_t sched_limit_pieces(uint32_t max) {
+  pthread_once(&key_once, make_key);
+  struct sched_worker *worker = pthread_getspecific(worker_key);
+  if (worker == NULL) {
+    return 0;
+  }
+  const uint32_t previous = worker->max_pieces;
+  worker->max_pieces = (max > 0) ? max : 1;
+  return previous;
+}
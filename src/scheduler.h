@@ -0,0 +1,165 @@
+/**
+ * @file scheduler.h
+ * @brief Work-stealing scheduler shared by the batch mode and the parallel kernels
+ * @details A scheduler is a pool of workers, each with its own deque of tasks. A task is a range of
+ * indexes [next, last) of one function: whoever takes it runs the next index and leaves the rest in
+ * the deque, so indexes start in order. A worker takes from the newest task of its own deque first
+ * (the bands of the image it is working on, still in cache), then steals from the oldest task of the
+ * other deques (the next file of a batch, or the bands of a large image when no file is left).
+ *
+ * sched_run waits for its indexes, running them meanwhile: a kernel called from a task (ICC bands
+ * of an image of a batch) pushes its bands on the deque of the worker, so idle workers can steal
+ * them while the others are still busy with their own files. While waiting, a worker runs only
+ * the indexes it waits for: the stack does not grow with unrelated tasks.
+ *
+ * Kernels called outside any scheduler run on a default one (one worker per core), started on the
+ * first call. The threads outside a scheduler share its deque 0. Each deque has its own lock, so
+ * workers taking from their own deque never wait for each other; the lock of the scheduler is only
+ * taken to sleep and to wake the sleepers (a task pushed, a group done, the end).
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+
+/** @brief Max number of workers of a scheduler */
+#define SCHED_MAX_THREAD (64U)
+/** @brief Number of pieces per worker a kernel may split its work into (more than 1 to balance) */
+#define SCHED_PIECES (4U)
+
+
+/**
+ * @brief Function run for each index of a task
+ * @param[in,out] arg Argument given to sched_run
+ * @param[in] index Index in [0, nb)
+ */
+typedef void (*sched_work)(void *arg, uint32_t index);
+
+/**
+ * @brief Indexes of a sched_run, until all are done
+ */
+struct sched_group {
+  /** @brief Number of indexes not done yet (atomic) */
+  uint32_t left;
+};
+
+/**
+ * @brief Range of indexes in a deque
+ */
+struct sched_task {
+  /** @brief Function run for each index */
+  sched_work work;
+  /** @brief Its argument */
+  void *arg;
+  /** @brief Next index to take */
+  uint32_t next;
+  /** @brief Index after the last one */
+  uint32_t last;
+  /** @brief Group of the indexes */
+  struct sched_group *group;
+};
+
+/**
+ * @brief Tasks of a worker, the oldest first
+ */
+struct sched_deque {
+  /** @brief Tasks */
+  struct sched_task *task;
+  /** @brief Number of tasks (written under the lock, read atomically to skip empty deques) */
+  uint32_t nb;
+  /** @brief Number of tasks the array can hold */
+  uint32_t allocated;
+  /** @brief Lock of the tasks */
+  pthread_mutex_t lock;
+};
+
+/**
+ * @brief Context of a thread running tasks
+ */
+struct sched_worker {
+  /** @brief Its scheduler */
+  struct sched *sched;
+  /** @brief Its deque */
+  uint32_t index;
+  /** @brief Max number of pieces of a kernel called by the thread (see sched_pieces) */
+  uint32_t max_pieces;
+};
+
+/**
+ * @brief Pool of workers (must not move while open)
+ */
+struct sched {
+  /** @brief Number of workers, the threads outside included (their deque is 0), atomic while opening */
+  uint32_t nb_worker;
+  /** @brief Threads of the workers 1 to nb_worker - 1 */
+  pthread_t thread[SCHED_MAX_THREAD];
+  /** @brief Context of the workers 1 to nb_worker - 1 */
+  struct sched_worker worker[SCHED_MAX_THREAD];
+  /** @brief Deque of each worker */
+  struct sched_deque deque[SCHED_MAX_THREAD];
+  /** @brief Number of indexes run by a worker other than the one which pushed them (atomic) */
+  uint64_t stolen;
+  /** @brief Number of tasks pushed (atomic, changed under the lock): a sleeper missed none if unchanged */
+  uint64_t pushed;
+  /** @brief Flag: the threads must end */
+  uint8_t stop;
+  /** @brief Lock of pushed, stop and the sleepers */
+  pthread_mutex_t lock;
+  /** @brief Signaled when a task is pushed or a group is done */
+  pthread_cond_t wake;
+};
+
+
+/**
+ * @brief Start a scheduler
+ * @details Threads that can't be started are left out: with none, sched_run runs every index itself.
+ * @param[out] sched
+ * @param[in] nb_worker Number of workers (the caller of sched_run is one), 0 for one per core
+ */
+void sched_open(struct sched *sched, uint32_t nb_worker);
+
+/**
+ * @brief Stop the threads of a scheduler (no sched_run must be running)
+ * @param[in,out] sched
+ */
+void sched_close(struct sched *sched);
+
+/**
+ * @brief Scheduler of the calling thread
+ * @return The one running the current task, the default one outside any task
+ */
+struct sched *sched_current(void);
+
+/**
+ * @brief Run work(arg, k) for each k in [0, nb) on the workers, return when all are done
+ * @details The caller runs indexes too. The same scheduler can be used by several threads at once.
+ * @param[in,out] sched A scheduler or NULL for sched_current
+ * @param[in] nb Number of indexes
+ * @param[in] work
+ * @param[in,out] arg
+ */
+void sched_run(struct sched *sched, uint32_t nb, sched_work work, void *arg);
+
+/**
+ * @brief Number of pieces a kernel splits its work into
+ * @details One per grain of cost, at least 1, at most SCHED_PIECES per worker of sched_current,
+ * max and the limit of the calling thread (see sched_limit_pieces)
+ * @param[in] cost Cost of the work, in the unit of grain (pixels, bytes...)
+ * @param[in] grain Least cost worth a piece
+ * @param[in] max Max number of pieces of the kernel
+ * @return The number of pieces
+ */
+uint32_t sched_pieces(uint64_t cost, uint64_t grain, uint32_t max);
+
+/**
+ * @brief Limit the number of pieces of the kernels called by the current task
+ * @param[in] max The limit (1 to keep the kernels in the thread)
+ * @return The previous limit, to restore (0 if the thread runs no task: nothing is limited)
+ */
+uint32_t sched_limit_pieces(uint32_t max);
+
+
+#endif // __SCHEDULER_H__
@@ -0,0 +1,57 @@
+#include <dlfcn.h>
+#include <stddef.h>
+
+#include "log.h"
+#include "sdl.h"
+
+
+struct sdl_library sdl = {.handle = NULL};
+
+
+/**
+ * @brief Names of the library, tried in order
+ */
+static const char *const sdl_names[] = {
+#ifdef __APPLE__
+  "libSDL2-2.0.0.dylib",
+  "libSDL2.dylib",
+#else
+  "libSDL2-2.0.so.0",
+  "libSDL2.so",
+#endif
+};
+
+
+
+uint8_t sdl_load(void) {
+  if (sdl.handle != NULL) {
+    return 1;
+  }
+
+  void *handle = NULL;
+  for (size_t n = 0; (handle == NULL) && (n < sizeof(sdl_names) / sizeof(sdl_names[0])); n++) {
+    handle = dlopen(sdl_names[n], RTLD_NOW | RTLD_LOCAL);
+  }
+  if (handle == NULL) {
+    LOG_WARN("Can't load SDL2: %s", dlerror());
+    return 0;
+  }
+
+  struct sdl_library library = {.handle = handle};
+#define SDL_RESOLVE(type, name, args)                                   \
+  library.name = (type (*) args) dlsym(handle, "SDL_" #name);           \
+  if (library.name == NULL) {                                           \
+    LOG_WARN("Can't find SDL_%s in SDL2: %s", #name, dlerror());        \
+    dlclose(handle);                                                    \
+    return 0;                                                           \
+  }
+  SDL_FUNCTIONS(SDL_RESOLVE)
+#undef SDL_RESOLVE
+
+  // optional: added in 2.0.12
+  library.SetTextureScaleMode = (int (*)(SDL_Texture *, int)) dlsym(handle, "SDL_SetTextureScaleMode");
+
+  sdl = library;
+  LOG_INFO("SDL2 loaded");
+  return 1;
+}
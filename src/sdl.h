@@ -0,0 +1,73 @@
+/**
+ * @file sdl.h
+ * @brief SDL2 loaded at run time
+ * @details Only --display needs SDL: the library is opened with dlopen the first time it is needed (sdl_load),
+ * so the other commands do not pay for loading libSDL2 and its own dependencies at startup.
+ * SDL functions are called through the table sdl, each member named after the function without its prefix
+ * (sdl.CreateWindow is SDL_CreateWindow). Only the headers are needed to compile, nothing is linked.
+ * A headless build (make headless) compiles neither this file nor the viewer.
+ */
+
+#ifndef __SDL_H__
+#define __SDL_H__
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+
+/**
+ * @brief Functions of SDL used by the viewer (and its tests): X(type, name, arguments)
+ */
+#define SDL_FUNCTIONS(X)                                                                         \
+  X(int, Init, (Uint32))                                                                         \
+  X(void, Quit, (void))                                                                          \
+  X(const char *, GetError, (void))                                                              \
+  X(void, GetVersion, (SDL_version *))                                                           \
+  X(int, GetDisplayUsableBounds, (int, SDL_Rect *))                                              \
+  X(SDL_Window *, CreateWindow, (const char *, int, int, int, int, Uint32))                      \
+  X(void, DestroyWindow, (SDL_Window *))                                                         \
+  X(void, GetWindowSize, (SDL_Window *, int *, int *))                                           \
+  X(void, SetWindowTitle, (SDL_Window *, const char *))                                          \
+  X(SDL_Renderer *, CreateRenderer, (SDL_Window *, int, Uint32))                                 \
+  X(void, DestroyRenderer, (SDL_Renderer *))                                                     \
+  X(int, GetRendererOutputSize, (SDL_Renderer *, int *, int *))                                  \
+  X(int, SetRenderDrawColor, (SDL_Renderer *, Uint8, Uint8, Uint8, Uint8))                       \
+  X(int, RenderClear, (SDL_Renderer *))                                                          \
+  X(int, RenderCopy, (SDL_Renderer *, SDL_Texture *, const SDL_Rect *, const SDL_Rect *))        \
+  X(void, RenderPresent, (SDL_Renderer *))                                                       \
+  X(int, RenderReadPixels, (SDL_Renderer *, const SDL_Rect *, Uint32, void *, int))              \
+  X(SDL_Texture *, CreateTexture, (SDL_Renderer *, Uint32, int, int, int))                       \
+  X(void, DestroyTexture, (SDL_Texture *))                                                       \
+  X(int, SetTextureBlendMode, (SDL_Texture *, SDL_BlendMode))                                    \
+  X(int, UpdateTexture, (SDL_Texture *, const SDL_Rect *, const void *, int))                    \
+  X(Uint32, GetMouseState, (int *, int *))                                                       \
+  X(int, WaitEvent, (SDL_Event *))                                                               \
+  X(int, PollEvent, (SDL_Event *))
+
+
+/**
+ * @brief SDL functions, valid once sdl_load succeeded
+ */
+struct sdl_library {
+  /** @brief Handle of dlopen, NULL until loaded */
+  void *handle;
+#define SDL_MEMBER(type, name, args) type (*name) args;
+  SDL_FUNCTIONS(SDL_MEMBER)
+#undef SDL_MEMBER
+  /** @brief SDL_SetTextureScaleMode (scale mode as an int), NULL before SDL 2.0.12 */
+  int (*SetTextureScaleMode)(SDL_Texture *, int);
+};
+
+/** @brief The SDL library */
+extern struct sdl_library sdl;
+
+
+/**
+ * @brief Load SDL, if not already done
+ * @details Not thread safe: the viewer runs in the main thread
+ * @return 1 if SDL is loaded, 0 if it can't be (a warning tells why)
+ */
+uint8_t sdl_load(void);
+
+
+#endif // __SDL_H__
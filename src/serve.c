@@ -0,0 +1,922 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "convert.h"
+#include "image.h"
+#include "log.h"
+#include "mfile.h"
+#include "serve.h"
+
+
+/** @brief Size of the head of a file read to probe it: signature and IHDR */
+#define SERVE_HEAD_SIZE (33U)
+/** @brief Number of pixel formats of convert */
+#define SERVE_NB_FORMAT (6U)
+/** @brief Default size of the cache in MB */
+#define SERVE_CACHE_MB (64U)
+/** @brief Default time a connection may stay idle in seconds */
+#define SERVE_IDLE_S (30U)
+/** @brief Default permissions of the socket */
+#define SERVE_MODE (0600U)
+
+
+/**
+ * @brief Thread of the daemon, alive as long as the daemon
+ */
+struct serve_worker {
+  /** @brief The daemon */
+  struct serve *server;
+  /** @brief Index of the thread */
+  uint32_t index;
+  /** @brief Bytes received and not handled yet */
+  char buffer[SERVE_LINE_SIZE];
+  /** @brief Number of bytes in buffer */
+  size_t filled;
+};
+
+/**
+ * @brief Answer to a request
+ */
+struct serve_answer {
+  /** @brief What happened */
+  enum serve_status status;
+  /** @brief The line, end of line included */
+  char line[128];
+  /** @brief The memfd of the pixels, -1 if none */
+  int fd;
+  /** @brief Size of the memfd */
+  size_t bytes;
+};
+
+
+/** @brief Names of the pixel formats, by enum pixel_format */
+static const char *format_names[SERVE_NB_FORMAT] = {"rgba8", "bgra8", "rgb8", "rgba16", "gray8", "float32"};
+/** @brief Reason of each status */
+static const char *status_reasons[] = {"ok", "bad request", "not a regular file", "not a PNG", "interlaced",
+                                       "no memory for the pixels", "corrupt file", "over the limits",
+                                       "deadline passed", "server stopping"};
+
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Set the answer of an error
+ */
+static void answer_error(struct serve_answer *answer, enum serve_status status) {
+  answer->status = status;
+  answer->fd     = -1;
+  answer->bytes  = 0;
+  snprintf(answer->line, sizeof(answer->line), "error %d %s\n", status, status_reasons[status]);
+}
+
+/**
+ * @brief Read the IHDR of a file
+ * @param[in] fd The file
+ * @param[out] header
+ * @return SERVE_OK, SERVE_NOT_PNG or SERVE_CORRUPT
+ */
+static enum serve_status read_header(int fd, struct IHDR *header) {
+  uint8_t data[SERVE_HEAD_SIZE];
+  const ssize_t n = pread(fd, data, SERVE_HEAD_SIZE, 0);
+  const struct mfile head = {
+    .pathname       = "request",
+    .data           = data,
+    .size           = (n > 0) ? (size_t) n : 0,
+    .allocated_size = 0,
+  };
+  if ((head.size < SERVE_HEAD_SIZE) || !mfile_is_png(&head)) {
+    return SERVE_NOT_PNG;
+  }
+  const struct chunk first = get_chunk_unchecked(head.size - 8, data + 8);
+  if ((first.type != IHDR) || (first.length != 13)) {
+    return SERVE_NOT_PNG;
+  }
+  // values IHDR_chunk asserts, color types count_sample does not know
+  const uint8_t *values = first.data;
+  if ((values[9] > RGB_TRIPLE_ALPHA) || (values[9] == 1) || (values[9] == 5) || (values[10] != 0)
+      || (values[11] != 0)) {
+    return SERVE_CORRUPT;
+  }
+  *header = IHDR_chunk(&first);
+  return SERVE_OK;
+}
+
+/**
+ * @brief Map an open file, as map_file does
+ * @return 1 if mapped
+ */
+static uint8_t map_fd(int fd, const struct stat *st, const char *path, struct mfile *file) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  file->pathname       = path;
+  file->size           = st->st_size;
+  file->allocated_size = ((file->size / page) + 1) * page;
+  file->data           = mmap(NULL, file->allocated_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  return file->data != MAP_FAILED;
+}
+
+#ifndef __linux__
+/**
+ * @brief Set close-on-exec on a descriptor
+ * @return The descriptor
+ */
+static int set_cloexec(int fd) {
+  if (fd >= 0) {
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+  }
+  return fd;
+}
+#endif
+
+/**
+ * @brief Create a socket of the daemon, close-on-exec
+ * @return The socket, -1 if it can't be created
+ */
+static int unix_socket(void) {
+#if defined(__linux__) || defined(SOCK_CLOEXEC)
+  return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+  return set_cloexec(socket(AF_UNIX, SOCK_STREAM, 0));
+#endif
+}
+
+#ifndef __linux__
+/**
+ * @brief Create an anonymous shared memory object, as memfd_create does
+ * @param[out] rw The object, opened for writing
+ * @return The object opened read only, for the clients, -1 if it can't be created
+ */
+static int create_shm(int *rw) {
+  static uint32_t count = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "/png-plte-%ld-%u", (long) getpid(), __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED));
+  *rw = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (*rw < 0) {
+    return -1;
+  }
+  // without seals, the clients get a descriptor they can't write with
+  const int fd = shm_open(name, O_RDONLY, 0);
+  shm_unlink(name);
+  if (fd < 0) {
+    close(*rw);
+  }
+  return set_cloexec(fd);
+}
+#endif
+
+/**
+ * @brief Create a memfd for the pixels, mapped for writing
+ * @param[in] bytes Size
+ * @param[out] fd The memfd
+ * @return The mapping, NULL if the memfd can't be created
+ */
+static uint8_t *create_memfd(size_t bytes, int *fd) {
+#ifdef __linux__
+  *fd = memfd_create("png-plte", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  const int rw = *fd;
+#else
+  int rw;
+  *fd = create_shm(&rw);
+#endif
+  if (*fd < 0) {
+    LOG_WARN("Can't create a memfd (%s)", strerror(errno));
+    return NULL;
+  }
+  void *data = MAP_FAILED;
+  if (ftruncate(rw, bytes) == 0) {
+    data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, rw, 0);
+  }
+  if (data == MAP_FAILED) {
+    LOG_WARN("Can't size a memfd of %zu bytes (%s)", bytes, strerror(errno));
+    close(*fd);
+    *fd = -1;
+  }
+#ifndef __linux__
+  close(rw);
+#endif
+  return (data != MAP_FAILED) ? data : NULL;
+}
+
+/**
+ * @brief Unmap a memfd once written and seal it: the clients can only read it
+ */
+static void seal_memfd(int fd, uint8_t *data, size_t bytes) {
+  munmap(data, bytes);
+#ifdef __linux__
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    LOG_WARN("Can't seal a memfd (%s)", strerror(errno));
+  }
+#else
+  // opened read only by create_shm
+  (void) fd;
+#endif
+}
+
+/**
+ * @brief Look for an answer in the cache, the daemon must be locked
+ * @return The entry or NULL
+ */
+static struct serve_entry *find_locked(struct serve *server, const struct stat *st, uint8_t request) {
+  const int64_t ctime = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+  for (uint32_t e = 0; e < SERVE_CACHE_ENTRIES; e++) {
+    struct serve_entry *entry = server->cache + e;
+    if ((entry->fd >= 0) && (entry->request == request) && (entry->ino == st->st_ino) && (entry->dev == st->st_dev)
+        && (entry->size == st->st_size) && (entry->ctime == ctime)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Keep an answer in the cache, the least recently used ones are dropped to make room
+ */
+static void cache_answer(struct serve *server, const struct stat *st, uint8_t request,
+                         const struct serve_answer *answer) {
+  const size_t capacity = (size_t) server->options.cache_mb << 20;
+  if (answer->bytes > capacity) {
+    return;
+  }
+  pthread_mutex_lock(&(server->lock));
+  // the same request decoded by another thread meanwhile
+  if (find_locked(server, st, request) != NULL) {
+    pthread_mutex_unlock(&(server->lock));
+    return;
+  }
+  struct serve_entry *slot = NULL;
+  for (;;) {
+    struct serve_entry *oldest = NULL;
+    slot = NULL;
+    for (uint32_t e = 0; e < SERVE_CACHE_ENTRIES; e++) {
+      struct serve_entry *entry = server->cache + e;
+      if (entry->fd < 0) {
+        slot = entry;
+      }
+      else if ((oldest == NULL) || (entry->used < oldest->used)) {
+        oldest = entry;
+      }
+    }
+    if ((slot != NULL) && (server->cached + answer->bytes <= capacity)) {
+      break;
+    }
+    close(oldest->fd);
+    oldest->fd = -1;
+    server->cached -= oldest->bytes;
+  }
+  const int fd = dup(answer->fd);
+  if (fd >= 0) {
+    slot->dev     = st->st_dev;
+    slot->ino     = st->st_ino;
+    slot->size    = st->st_size;
+    slot->ctime   = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+    slot->request = request;
+    slot->fd      = fd;
+    slot->bytes   = answer->bytes;
+    slot->used    = ++server->tick;
+    memcpy(slot->line, answer->line, sizeof(slot->line));
+    server->cached += answer->bytes;
+  }
+  pthread_mutex_unlock(&(server->lock));
+}
+
+/**
+ * @brief Decode a file into a memfd
+ * @param[in] file
+ * @param[in] request 0 for the samples as decoded, 1 + format for a pixel format
+ * @param[in] limits Budget of the decode
+ * @param[out] answer
+ */
+static void decode_file(const struct mfile *file, uint8_t request, const struct decode_limits *limits,
+                        struct serve_answer *answer) {
+  struct image image;
+  switch (get_image_checked(file, 1, limits, &image)) {
+  case DECODE_OK:
+    break;
+  case DECODE_TOO_MANY_PIXELS:
+  case DECODE_OVER_BUDGET:
+    answer_error(answer, SERVE_TOO_LARGE);
+    return;
+  case DECODE_DEADLINE:
+    answer_error(answer, SERVE_TIMEOUT);
+    return;
+  case DECODE_CANCELLED:
+    answer_error(answer, SERVE_CANCELLED);
+    return;
+  default:
+    answer_error(answer, SERVE_CORRUPT);
+    return;
+  }
+  const uint8_t palette = (request == 0) && (image.palette != NULL);
+  const size_t stride = (request == 0) ? line_size(&image) : (size_t) image.width * format_size(request - 1);
+  const size_t bytes = stride * image.height + (palette ? PALETTE_SIZE : 0);
+
+  uint8_t *data = create_memfd(bytes, &(answer->fd));
+  if (data == NULL) {
+    free_image(&image);
+    answer_error(answer, SERVE_NO_MEMORY);
+    return;
+  }
+  if (request == 0) {
+    memcpy(data, image.data, stride * image.height);
+    if (palette) {
+      memcpy(data + stride * image.height, image.palette, PALETTE_SIZE);
+    }
+    snprintf(answer->line, sizeof(answer->line), "ok %u %u %u %u %zu %zu %u\n", image.width, image.height,
+             image.depth, image.sample, stride, bytes, palette);
+  }
+  else {
+    convert_rows(&image, 0, image.height, (enum pixel_format) (request - 1), data, stride);
+    snprintf(answer->line, sizeof(answer->line), "ok %u %u %s %zu %zu\n", image.width, image.height,
+             format_names[request - 1], stride, bytes);
+  }
+  seal_memfd(answer->fd, data, bytes);
+  free_image(&image);
+  answer->status = SERVE_OK;
+  answer->bytes  = bytes;
+}
+
+/**
+ * @brief Answer a request
+ * @param[in,out] server
+ * @param[in] request The line, without end of line
+ * @param[out] answer
+ */
+static void answer_request(struct serve *server, char *request, struct serve_answer *answer) {
+  // the command, then the path
+  uint8_t code;
+  const char *path = NULL;
+  if (strncmp(request, "probe ", 6) == 0) {
+    code = 255;
+    path = request + 6;
+  }
+  else if (strncmp(request, "decode ", 7) == 0) {
+    code = 0;
+    path = request + 7;
+  }
+  else if (strncmp(request, "convert ", 8) == 0) {
+    code = 0;
+    for (uint8_t f = 0; f < SERVE_NB_FORMAT; f++) {
+      const size_t length = strlen(format_names[f]);
+      if ((strncmp(request + 8, format_names[f], length) == 0) && (request[8 + length] == ' ')) {
+        code = 1 + f;
+        path = request + 8 + length + 1;
+      }
+    }
+    if (code == 0) {
+      answer_error(answer, SERVE_BAD_REQUEST);
+      return;
+    }
+  }
+  else {
+    answer_error(answer, SERVE_BAD_REQUEST);
+    return;
+  }
+
+  struct stat st;
+  const int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if ((fd < 0) || (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+    answer_error(answer, SERVE_NOT_FOUND);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+  struct IHDR header;
+  const enum serve_status status = read_header(fd, &header);
+  if (status != SERVE_OK) {
+    answer_error(answer, status);
+  }
+  else if (code == 255) {
+    answer->status = SERVE_OK;
+    answer->fd     = -1;
+    answer->bytes  = 0;
+    snprintf(answer->line, sizeof(answer->line), "ok %u %u %u %u %u\n", header.width, header.height, header.depth,
+             header.color_type, header.interlace);
+  }
+  else if (header.interlace != 0) {
+    answer_error(answer, SERVE_INTERLACED);
+  }
+  else if (check_header_limits(&header, &(server->options.limits)) != DECODE_OK) {
+    answer_error(answer, SERVE_TOO_LARGE);
+  }
+  else {
+    // a copy of the answer cached, or decode the file
+    pthread_mutex_lock(&(server->lock));
+    struct serve_entry *entry = find_locked(server, &st, code);
+    if (entry != NULL) {
+      answer->status = SERVE_OK;
+      answer->fd     = dup(entry->fd);
+      answer->bytes  = entry->bytes;
+      memcpy(answer->line, entry->line, sizeof(answer->line));
+      entry->used = ++server->tick;
+      server->stats.hits++;
+    }
+    pthread_mutex_unlock(&(server->lock));
+
+    struct mfile file;
+    if (entry != NULL) {
+      if (answer->fd < 0) {
+        answer_error(answer, SERVE_NO_MEMORY);
+      }
+    }
+    else if (!map_fd(fd, &st, path, &file)) {
+      answer_error(answer, SERVE_NOT_FOUND);
+    }
+    else {
+      struct decode_limits limits = server->options.limits;
+      limits.cancel = &(server->stop);
+      decode_file(&file, code, &limits, answer);
+      unmap_file(&file);
+      if ((answer->status == SERVE_OK) && (server->options.cache_mb > 0)) {
+        cache_answer(server, &st, code, answer);
+      }
+    }
+  }
+  close(fd);
+}
+
+/**
+ * @brief Send an answer, with its memfd
+ * @return 1 if sent
+ */
+static uint8_t send_answer(int client, const struct serve_answer *answer) {
+  const size_t length = strlen(answer->line);
+  struct iovec iov = {
+    .iov_base = (void *) answer->line,
+    .iov_len  = length,
+  };
+  union {
+    struct cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+  if (answer->fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control    = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &(answer->fd), sizeof(int));
+  }
+  // the memfd goes with the first byte, the rest of the line (rarely) after
+  ssize_t n;
+  while (((n = sendmsg(client, &msg, MSG_NOSIGNAL)) < 0) && (errno == EINTR)) {
+  }
+  if (n < 0) {
+    return 0;
+  }
+  for (size_t sent = n; sent < length; sent += n) {
+    while (((n = send(client, answer->line + sent, length - sent, MSG_NOSIGNAL)) < 0) && (errno == EINTR)) {
+    }
+    if (n <= 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Count a request answered
+ */
+static void count_request(struct serve *server, const struct serve_answer *answer, double start) {
+  pthread_mutex_lock(&(server->lock));
+  server->stats.requests++;
+  server->stats.errors += (answer->status != SERVE_OK);
+  server->stats.bytes  += answer->bytes;
+  server->stats.busy   += now() - start;
+  pthread_mutex_unlock(&(server->lock));
+}
+
+/**
+ * @brief Serve a connection until it is closed
+ * @param[in,out] worker
+ * @param[in] client The connection
+ */
+static void serve_client(struct serve_worker *worker, int client) {
+  struct serve *server = worker->server;
+  worker->filled = 0;
+  for (;;) {
+    // one request per line
+    char *end;
+    while ((end = memchr(worker->buffer, '\n', worker->filled)) == NULL) {
+      if (worker->filled == SERVE_LINE_SIZE) {
+        // the rest of the line can't be told from the next request
+        struct serve_answer answer;
+        answer_error(&answer, SERVE_BAD_REQUEST);
+        send_answer(client, &answer);
+        count_request(server, &answer, now());
+        return;
+      }
+      const ssize_t n = recv(client, worker->buffer + worker->filled, SERVE_LINE_SIZE - worker->filled, 0);
+      if ((n < 0) && (errno == EINTR)) {
+        continue;
+      }
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        LOG_INFO("Connection idle for %u s closed", server->options.idle_s);
+        pthread_mutex_lock(&(server->lock));
+        server->stats.idle++;
+        pthread_mutex_unlock(&(server->lock));
+        return;
+      }
+      if (n <= 0) {
+        return;
+      }
+      worker->filled += n;
+    }
+    *end = '\0';
+    if ((end > worker->buffer) && (end[-1] == '\r')) {
+      end[-1] = '\0';
+    }
+
+    const double start = now();
+    struct serve_answer answer;
+    answer_request(server, worker->buffer, &answer);
+    const uint8_t sent = send_answer(client, &answer);
+    if (answer.fd >= 0) {
+      close(answer.fd);
+    }
+    count_request(server, &answer, start);
+    if (!sent) {
+      return;
+    }
+
+    const size_t used = end + 1 - worker->buffer;
+    memmove(worker->buffer, worker->buffer + used, worker->filled - used);
+    worker->filled -= used;
+  }
+}
+
+/**
+ * @brief Take the connections one at a time until stopped
+ * @param[in,out] arg The struct serve_worker
+ * @return NULL
+ */
+static void *serve_loop(void *arg) {
+  struct serve_worker *worker = arg;
+  struct serve *server = worker->server;
+  for (;;) {
+#ifdef __linux__
+    const int client = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+#else
+    const int client = set_cloexec(accept(server->listen_fd, NULL, NULL));
+#endif
+    pthread_mutex_lock(&(server->lock));
+    if (server->stop) {
+      pthread_mutex_unlock(&(server->lock));
+      if (client >= 0) {
+        close(client);
+      }
+      break;
+    }
+    if (client < 0) {
+      pthread_mutex_unlock(&(server->lock));
+      if ((errno != EINTR) && (errno != ECONNABORTED)) {
+        LOG_WARN("Can't accept a connection (%s)", strerror(errno));
+      }
+      continue;
+    }
+    server->client[worker->index] = client;
+    server->stats.connections++;
+    pthread_mutex_unlock(&(server->lock));
+    if (server->options.idle_s > 0) {
+      // a silent client, or one that does not read its answers, gives the thread back
+      const struct timeval timeout = {.tv_sec = server->options.idle_s, .tv_usec = 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    serve_client(worker, client);
+
+    pthread_mutex_lock(&(server->lock));
+    server->client[worker->index] = -1;
+    pthread_mutex_unlock(&(server->lock));
+    close(client);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Address of a socket
+ * @return 1 on success, 0 if the path is too long (errno set)
+ */
+static uint8_t socket_address(const char *path, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    errno = ENAMETOOLONG;
+    return 0;
+  }
+  strcpy(address->sun_path, path);
+  return 1;
+}
+
+
+/**
+ * @brief Undo serve_open after an error on the socket
+ * @param[in] bound 1 if the socket file is ours
+ * @return 0
+ */
+static uint8_t serve_abort(struct serve *server, uint8_t bound) {
+  const int err = errno;
+  if (server->listen_fd >= 0) {
+    close(server->listen_fd);
+  }
+  if (bound) {
+    unlink(server->path);
+  }
+  pthread_mutex_destroy(&(server->lock));
+  errno = err;
+  return 0;
+}
+
+
+
+struct serve_options serve_default_options(void) {
+  const struct serve_options options = {
+    .threads  = 0,
+    .cache_mb = SERVE_CACHE_MB,
+    .idle_s   = SERVE_IDLE_S,
+    .mode     = SERVE_MODE,
+    .limits   = {0, 0, 0, NULL},
+  };
+  return options;
+}
+
+
+uint8_t parse_serve(const char *arg, struct serve_options *options) {
+  *options = serve_default_options();
+  while (*arg != '\0') {
+    const char *comma = strchr(arg, ',');
+    const size_t length = (comma != NULL) ? (size_t) (comma - arg) : strlen(arg);
+    if ((length > 5) && (length <= 10) && (strncmp(arg, "cache", 5) == 0)
+        && (strspn(arg + 5, "0123456789") >= length - 5)) {
+      options->cache_mb = 0;
+      for (size_t k = 5; k < length; k++) {
+        options->cache_mb = 10 * options->cache_mb + (arg[k] - '0');
+      }
+    }
+    else if ((length > 4) && (length <= 9) && (strncmp(arg, "idle", 4) == 0)
+             && (strspn(arg + 4, "0123456789") >= length - 4)) {
+      options->idle_s = 0;
+      for (size_t k = 4; k < length; k++) {
+        options->idle_s = 10 * options->idle_s + (arg[k] - '0');
+      }
+    }
+    else if ((length > 4) && (length <= 8) && (strncmp(arg, "mode", 4) == 0)
+             && (strspn(arg + 4, "01234567") >= length - 4)) {
+      options->mode = 0;
+      for (size_t k = 4; k < length; k++) {
+        options->mode = 8 * options->mode + (arg[k] - '0');
+      }
+      if (options->mode > 0777) {
+        return 0;
+      }
+    }
+    else if ((length > 0) && (length <= 2) && (strspn(arg, "0123456789") >= length)) {
+      const uint32_t threads = (length == 2) ? 10 * (arg[0] - '0') + (arg[1] - '0') : (uint32_t) (arg[0] - '0');
+      if ((threads == 0) || (threads > SERVE_MAX_THREAD)) {
+        return 0;
+      }
+      options->threads = threads;
+    }
+    else if (parse_decode_limit(arg, length, &(options->limits))) {
+      // mpx<N>, mb<N> or ms<N>
+    }
+    else {
+      return 0;
+    }
+    arg += length + (comma != NULL);
+  }
+  return 1;
+}
+
+
+uint8_t serve_open(struct serve *server, const char *path, const struct serve_options *options) {
+  memset(server, 0, sizeof(struct serve));
+  server->path    = path;
+  server->options = (options != NULL) ? *options : serve_default_options();
+  for (uint32_t e = 0; e < SERVE_CACHE_ENTRIES; e++) {
+    server->cache[e].fd = -1;
+  }
+  for (uint32_t t = 0; t < SERVE_MAX_THREAD; t++) {
+    server->client[t] = -1;
+  }
+  pthread_mutex_init(&(server->lock), NULL);
+
+  struct sockaddr_un address;
+  server->listen_fd = socket_address(path, &address) ? unix_socket() : -1;
+  if (server->listen_fd < 0) {
+    LOG_ERROR("Can't create a socket on %s (%s)", path, strerror(errno));
+    return serve_abort(server, 0);
+  }
+  if (bind(server->listen_fd, (const struct sockaddr *) &address, sizeof(address)) != 0) {
+    // the socket of a daemon gone, unless one still listens
+    const int err = errno;
+    const int other = (err == EADDRINUSE) ? serve_connect(path) : -1;
+    if ((err != EADDRINUSE) || (other >= 0)) {
+      LOG_ERROR("Can't listen on %s (%s)", path, (other >= 0) ? "already served" : strerror(err));
+      if (other >= 0) {
+        close(other);
+      }
+      errno = err;
+      return serve_abort(server, 0);
+    }
+    struct stat st;
+    if ((lstat(path, &st) != 0) || !S_ISSOCK(st.st_mode)) {
+      LOG_ERROR("Can't listen on %s (not a socket)", path);
+      errno = EADDRINUSE;
+      return serve_abort(server, 0);
+    }
+    if ((unlink(path) != 0) || (bind(server->listen_fd, (const struct sockaddr *) &address, sizeof(address)) != 0)) {
+      LOG_ERROR("Can't listen on %s (%s)", path, strerror(errno));
+      return serve_abort(server, 0);
+    }
+  }
+  // not the umask: nobody can connect before listen
+  if (chmod(path, server->options.mode) != 0) {
+    LOG_ERROR("Can't set the mode of %s (%s)", path, strerror(errno));
+    return serve_abort(server, 1);
+  }
+  if (listen(server->listen_fd, SOMAXCONN) != 0) {
+    LOG_ERROR("Can't listen on %s (%s)", path, strerror(errno));
+    return serve_abort(server, 1);
+  }
+
+  long nb_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t nb_thread = (server->options.threads > 0) ? server->options.threads : (nb_cpu > 0) ? (uint32_t) nb_cpu : 1;
+  nb_thread = (nb_thread < SERVE_MAX_THREAD) ? nb_thread : SERVE_MAX_THREAD;
+  server->worker = calloc(nb_thread, sizeof(struct serve_worker));
+  if (server->worker == NULL) {
+    LOG_FATAL("Can't calloc %u threads", nb_thread);
+    exit(1);
+  }
+  for (; server->nb_thread < nb_thread; server->nb_thread++) {
+    struct serve_worker *worker = server->worker + server->nb_thread;
+    worker->server = server;
+    worker->index  = server->nb_thread;
+    if (pthread_create(server->thread + server->nb_thread, NULL, serve_loop, worker) != 0) {
+      LOG_FATAL("Can't start the thread %u", server->nb_thread);
+      exit(1);
+    }
+  }
+  LOG_INFO("Serving %s on %u threads, cache of %u MB", path, server->nb_thread, server->options.cache_mb);
+  return 1;
+}
+
+
+struct serve_stats serve_close(struct serve *server) {
+  // wake up the threads: in accept, in recv on their connection, and in a decode (its cancel flag)
+  pthread_mutex_lock(&(server->lock));
+  __atomic_store_n(&(server->stop), 1, __ATOMIC_RELAXED);
+  for (uint32_t t = 0; t < server->nb_thread; t++) {
+    if (server->client[t] >= 0) {
+      shutdown(server->client[t], SHUT_RDWR);
+    }
+  }
+  pthread_mutex_unlock(&(server->lock));
+  shutdown(server->listen_fd, SHUT_RDWR);
+  for (uint32_t t = 0; t < server->nb_thread; t++) {
+    pthread_join(server->thread[t], NULL);
+  }
+  close(server->listen_fd);
+  unlink(server->path);
+
+  for (uint32_t e = 0; e < SERVE_CACHE_ENTRIES; e++) {
+    if (server->cache[e].fd >= 0) {
+      close(server->cache[e].fd);
+    }
+  }
+  free(server->worker);
+  pthread_mutex_destroy(&(server->lock));
+  LOG_INFO("Served %llu requests on %llu connections", (unsigned long long) server->stats.requests,
+           (unsigned long long) server->stats.connections);
+  return server->stats;
+}
+
+
+uint8_t run_serve(const char *path, const struct serve_options *options, struct serve_stats *stats) {
+  // the threads inherit the mask: only sigwait gets the signals
+  sigset_t set, previous;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &set, &previous);
+
+  struct serve *server = malloc(sizeof(struct serve));
+  if (server == NULL) {
+    LOG_FATAL("Can't malloc a daemon");
+    exit(1);
+  }
+  const uint8_t served = serve_open(server, path, options);
+  if (served) {
+    int sig;
+    while (sigwait(&set, &sig) != 0) {
+    }
+    *stats = serve_close(server);
+  }
+  free(server);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  return served;
+}
+
+
+
+int serve_connect(const char *path) {
+  struct sockaddr_un address;
+  const int fd = socket_address(path, &address) ? unix_socket() : -1;
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (const struct sockaddr *) &address, sizeof(address)) != 0) {
+    const int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+
+uint8_t serve_request(int fd, const char *request, char *line, size_t size, int *memfd) {
+  *memfd  = -1;
+  line[0] = '\0';
+  const size_t length = strlen(request);
+  char newline = '\n';
+  struct iovec out[2] = {{(void *) request, length}, {&newline, 1}};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = out;
+  msg.msg_iovlen = 2;
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t) length + 1) {
+    return 0;
+  }
+
+  // the answer of this request only: nothing is read past its end of line
+  size_t got = 0;
+  while ((got == 0) || (line[got - 1] != '\n')) {
+    if (got + 1 >= size) {
+      line[0] = '\0';
+      return 0;
+    }
+    union {
+      struct cmsghdr header;
+      char data[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec in = {line + got, size - 1 - got};
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &in;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.data;
+    msg.msg_controllen = sizeof(control.data);
+#ifdef __linux__
+    const ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+#else
+    const ssize_t n = recvmsg(fd, &msg, 0);
+#endif
+    if ((n < 0) && (errno == EINTR)) {
+      continue;
+    }
+    if (n <= 0) {
+      line[0] = '\0';
+      return 0;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+        memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+#ifndef __linux__
+        set_cloexec(*memfd);
+#endif
+      }
+    }
+    got += n;
+  }
+  line[got - 1] = '\0';
+  return strncmp(line, "ok ", 3) == 0;
+}
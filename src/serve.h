@@ -0,0 +1,238 @@
+/**
+ * @file serve.h
+ * @brief Decode daemon on a Unix domain socket, pixels handed over in a memfd
+ * @details A client connects to the socket and sends requests, one line each, and reads one line
+ * back for each, in order:
+ *
+ *     probe <path>              ok <width> <height> <depth> <color type> <interlace>
+ *     decode <path>             ok <width> <height> <depth> <sample> <stride> <size> <palette>
+ *     convert <format> <path>   ok <width> <height> <format> <stride> <size>
+ *     anything wrong            error <status> <reason>
+ *
+ * where format is rgba8, bgra8, rgb8, rgba16, gray8 or float32 (see convert.h) and the path is the
+ * rest of the line. The answer of decode and convert comes with a memfd (SCM_RIGHTS) holding size
+ * bytes: the rows (stride bytes each) as get_image_native gives them (16-bit samples in the native
+ * byte order), then the 768 bytes of the palette if palette is 1, or the rows in the pixel format.
+ * The memfd is sealed: the client maps it read-only, no byte is copied through the socket. Outside
+ * Linux it is a POSIX shared memory object, unlinked at once, and the client gets it opened read-only.
+ *
+ * Each of the threads of the daemon serves one connection at a time, for as long as it lasts, and
+ * keeps its request buffer from one connection to the next. A connection idle for longer than the
+ * option idle (no request, or its answer not read) is closed, so that it does not hold the thread. As with --batch, the CRC and expand
+ * tables and the caches of gamma and ICC transforms are paid for once, by the first request. The memfds of the last answers are kept
+ * in an LRU cache, by file (device, inode, size, time of change) and request: a hit sends the same
+ * memfd again without decoding.
+ *
+ * Interlaced images are not decoded (as by get_image_native). A file over the limits of the options
+ * is refused from its IHDR, before being mapped; a decode past the timeout stops within a scanline or
+ * an IDAT chunk and answers an error. A corrupt file is an error answer, not the end of the daemon.
+ */
+
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "image.h"
+
+
+/** @brief Max number of threads */
+#define SERVE_MAX_THREAD (64U)
+/** @brief Max number of answers in the cache */
+#define SERVE_CACHE_ENTRIES (256U)
+/** @brief Max length of a request, end of line included */
+#define SERVE_LINE_SIZE (4096U)
+
+
+/** @brief Thread of the daemon and its request buffer (see serve.c) */
+struct serve_worker;
+
+/**
+ * @brief What is wrong with a request
+ */
+enum serve_status {
+  /** @brief Done */
+  SERVE_OK = 0,
+  /** @brief Unknown command or format, line too long */
+  SERVE_BAD_REQUEST = 1,
+  /** @brief Not a regular file */
+  SERVE_NOT_FOUND = 2,
+  /** @brief No PNG signature or no IHDR */
+  SERVE_NOT_PNG = 3,
+  /** @brief Interlaced image, not decoded */
+  SERVE_INTERLACED = 4,
+  /** @brief No memfd for the pixels */
+  SERVE_NO_MEMORY = 5,
+  /** @brief Wrong header, chunks or compressed data */
+  SERVE_CORRUPT = 6,
+  /** @brief Over the pixels or the memory of the limits (known from the IHDR) */
+  SERVE_TOO_LARGE = 7,
+  /** @brief Not decoded within the timeout of the limits */
+  SERVE_TIMEOUT = 8,
+  /** @brief Decode stopped by serve_close */
+  SERVE_CANCELLED = 9,
+};
+
+/**
+ * @brief Options of the daemon
+ */
+struct serve_options {
+  /** @brief Number of threads (connections served at once), 0 for one per core */
+  uint8_t threads;
+  /** @brief Max size of the answers cached in MB, 0 for no cache */
+  uint32_t cache_mb;
+  /** @brief Seconds a connection may wait on a receive or a send before it is closed, 0 for no limit */
+  uint32_t idle_s;
+  /** @brief Permissions of the socket file, 0600 (only the owner connects) by default */
+  mode_t mode;
+  /** @brief Budget of each decode (the cancel flag is set by the daemon) */
+  struct decode_limits limits;
+};
+
+/**
+ * @brief Counters of the daemon
+ */
+struct serve_stats {
+  /** @brief Number of connections */
+  uint64_t connections;
+  /** @brief Number of requests */
+  uint64_t requests;
+  /** @brief Number of requests answered with an error */
+  uint64_t errors;
+  /** @brief Number of answers found in the cache */
+  uint64_t hits;
+  /** @brief Number of connections closed idle */
+  uint64_t idle;
+  /** @brief Number of bytes of pixels sent (memfd) */
+  uint64_t bytes;
+  /** @brief Time spent on the requests by all the threads in seconds */
+  double busy;
+};
+
+/**
+ * @brief Answer kept in the cache
+ */
+struct serve_entry {
+  /** @brief Device and inode of the file */
+  dev_t dev;
+  ino_t ino;
+  /** @brief Size of the file */
+  off_t size;
+  /** @brief Time of the last change of the file, in nanoseconds */
+  int64_t ctime;
+  /** @brief Request: 0 for decode, 1 + format for convert */
+  uint8_t request;
+  /** @brief The sealed memfd, -1 for an empty entry */
+  int fd;
+  /** @brief Size of the memfd */
+  size_t bytes;
+  /** @brief The answer line */
+  char line[128];
+  /** @brief Time of the last use (a counter) */
+  uint64_t used;
+};
+
+/**
+ * @brief A daemon (must not move while open)
+ */
+struct serve {
+  /** @brief Path of the socket */
+  const char *path;
+  /** @brief Listening socket */
+  int listen_fd;
+  /** @brief Options */
+  struct serve_options options;
+  /** @brief Number of threads */
+  uint32_t nb_thread;
+  /** @brief The threads */
+  pthread_t thread[SERVE_MAX_THREAD];
+  /** @brief Context of each thread */
+  struct serve_worker *worker;
+  /** @brief Connection served by each thread, -1 if none */
+  int client[SERVE_MAX_THREAD];
+  /** @brief Flag: the threads must end */
+  uint8_t stop;
+  /** @brief Answers cached */
+  struct serve_entry cache[SERVE_CACHE_ENTRIES];
+  /** @brief Size of the memfds cached */
+  size_t cached;
+  /** @brief Counter of the uses of the cache */
+  uint64_t tick;
+  /** @brief Counters */
+  struct serve_stats stats;
+  /** @brief Lock of client, stop, the cache and the counters */
+  pthread_mutex_t lock;
+};
+
+
+/**
+ * @brief Default options: one thread per core, 64 MB of cache, connections closed after 30 s idle, socket
+ * for the owner only
+ * @return The options
+ */
+struct serve_options serve_default_options(void);
+
+/**
+ * @brief Read the options from the argument of --serve
+ * @details Comma separated words: a number of threads, cache and a size in MB (cache0 for none), idle
+ * and a number of seconds (idle0 for none), mode and the octal permissions of the socket (up to 0777),
+ * the limits of each decode (see parse_decode_limit), such as "8,cache256,idle10,mode660,mpx40,ms50".
+ * Words not given
+ * keep their default.
+ * @param[in] arg The argument
+ * @param[out] options
+ * @return 1 if every word is known, 0 otherwise
+ */
+uint8_t parse_serve(const char *arg, struct serve_options *options);
+
+/**
+ * @brief Listen on a socket and start the threads
+ * @details A file already at path is removed if it is a socket nobody listens to. The socket gets
+ * the mode of the options before it listens.
+ * @param[out] server
+ * @param[in] path Path of the socket (must stay valid until serve_close)
+ * @param[in] options Options or NULL for serve_default_options
+ * @return 1 if the daemon listens, 0 otherwise (path taken or served, socket error): no serve_close then
+ */
+uint8_t serve_open(struct serve *server, const char *path, const struct serve_options *options);
+
+/**
+ * @brief Close the connections, stop the threads, remove the socket and empty the cache
+ * @param[in,out] server
+ * @return The counters
+ */
+struct serve_stats serve_close(struct serve *server);
+
+/**
+ * @brief Serve until SIGINT or SIGTERM
+ * @param[in] path Path of the socket
+ * @param[in] options Options or NULL for serve_default_options
+ * @param[out] stats The counters, set if it served
+ * @return 1 if it served, 0 if it could not listen
+ */
+uint8_t run_serve(const char *path, const struct serve_options *options, struct serve_stats *stats);
+
+
+
+/**
+ * @brief Connect to a daemon
+ * @param[in] path Path of the socket
+ * @return The connection, -1 if the daemon can't be reached
+ */
+int serve_connect(const char *path);
+
+/**
+ * @brief Send a request and read its answer
+ * @param[in] fd The connection
+ * @param[in] request The request, without end of line
+ * @param[out] line The answer, without end of line
+ * @param[in] size Size of line
+ * @param[out] memfd The memfd of the answer (close it), -1 if none
+ * @return 1 if the answer is ok, 0 for an error answer or if the connection is lost (line empty)
+ */
+uint8_t serve_request(int fd, const char *request, char *line, size_t size, int *memfd);
+
+
+#endif // __SERVE_H__
@@ -0,0 +1,245 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "convert.h"
+#include "log.h"
+#include "scheduler.h"
+#include "stats.h"
+
+
+/** @brief Number of rows converted at once */
+#define STATS_ROWS (16U)
+
+/** @brief Slots of the hash set of colors (power of 2, more than twice STATS_MAX_COLOR) */
+#define COLOR_SLOT (1024U)
+
+/** @brief Max number of bands */
+#define STATS_MAX_PIECES (32U)
+/** @brief Min number of pixels of a band */
+#define STATS_PIECE_PIXELS (1U << 16)
+
+
+/**
+ * @brief Open addressing hash set of RGBA16 colors
+ */
+struct color_set {
+  /** @brief Colors (the 4 samples of a pixel) */
+  uint64_t key[COLOR_SLOT];
+  /** @brief Flag: the slot holds a color */
+  uint8_t used[COLOR_SLOT];
+  /** @brief Number of colors, STATS_MAX_COLOR + 1 when full */
+  uint32_t count;
+};
+
+/**
+ * @brief Band of rows
+ */
+struct stats_job {
+  /** @brief The image */
+  const struct image *image;
+  /** @brief First row */
+  uint32_t row0;
+  /** @brief Number of rows */
+  uint32_t nrows;
+  /** @brief Histograms and flags of the band */
+  struct color_stats stats;
+  /** @brief Colors of the band */
+  struct color_set set;
+  /** @brief Bounds of the pixels not fully transparent (min > max if none) */
+  uint32_t min_x, max_x, min_y, max_y;
+};
+
+
+
+/**
+ * @brief Add a color to the set (nothing once the set is full)
+ */
+static void set_insert(struct color_set *set, uint64_t key) {
+  if (set->count > STATS_MAX_COLOR) {
+    return;
+  }
+  uint32_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 54; // 10 bits
+  while (set->used[slot]) {
+    if (set->key[slot] == key) {
+      return;
+    }
+    slot = (slot + 1) & (COLOR_SLOT - 1);
+  }
+  set->key[slot]  = key;
+  set->used[slot] = 1;
+  set->count++;
+}
+
+/**
+ * @brief Round a 16-bit sample to 8 bits (see reduce_sample in convert.c)
+ */
+static inline uint8_t round8(uint16_t v) {
+  return (uint16_t) (v - (v >> 8) - ((v >> 7) & 1) + 128) >> 8;
+}
+
+/**
+ * @brief Check a RGBA16 row is gray and opaque
+ * @param[in] row
+ * @param[in] width Number of pixels
+ * @param[in,out] gray Cleared if a pixel is not gray
+ * @param[in,out] opaque Cleared if a pixel is not opaque
+ */
+static void check_row(const uint16_t *row, uint32_t width, uint8_t *gray, uint8_t *opaque) {
+  uint32_t j = 0;
+
+#ifdef __SSE2__
+  // 2 pixels at once: (r, g, b, a) == (r, r, r, a) and a == 0xffff
+  const __m128i alpha = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  __m128i is_gray   = _mm_set1_epi8(-1);
+  __m128i is_opaque = _mm_set1_epi8(-1);
+  for (; j + 2 <= width; j += 2) {
+    const __m128i px  = _mm_loadu_si128((const __m128i *) (row + 4 * j));
+    const __m128i red = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xc0), 0xc0);
+    is_gray   = _mm_and_si128(is_gray, _mm_cmpeq_epi16(px, red));
+    is_opaque = _mm_and_si128(is_opaque, _mm_or_si128(px, _mm_andnot_si128(alpha, _mm_set1_epi8(-1))));
+  }
+  *gray   &= (_mm_movemask_epi8(_mm_cmpeq_epi8(is_gray, _mm_set1_epi8(-1))) == 0xffff);
+  *opaque &= (_mm_movemask_epi8(_mm_cmpeq_epi8(is_opaque, _mm_set1_epi8(-1))) == 0xffff);
+#endif
+
+  for (const uint16_t *px = row + 4 * j; j < width; j++, px += 4) {
+    *gray   &= (px[0] == px[1]) && (px[1] == px[2]);
+    *opaque &= (px[3] == 0xffff);
+  }
+}
+
+/**
+ * @brief Analyse a band of rows
+ * @param[in,out] arg The struct stats_job of every band
+ * @param[in] index Index of the band
+ */
+static void stats_band(void *arg, uint32_t index) {
+  struct stats_job *job = ((struct stats_job *) arg) + index;
+  const uint32_t w = job->image->width;
+  struct color_stats *stats = &(job->stats);
+
+  memset(stats, 0, sizeof(struct color_stats));
+  memset(&(job->set), 0, sizeof(struct color_set));
+  stats->gray   = 1;
+  stats->opaque = 1;
+  job->min_x = UINT32_MAX;
+  job->min_y = UINT32_MAX;
+  job->max_x = 0;
+  job->max_y = 0;
+
+  uint16_t *rows = malloc((size_t) w * 8 * STATS_ROWS);
+  if (rows == NULL) {
+    LOG_FATAL("Can't malloc(%zu) for the statistics", (size_t) w * 8 * STATS_ROWS);
+    exit(1);
+  }
+  uint64_t last = 0; // runs of the same color skip the hash set
+  uint8_t has_last = 0;
+
+  for (uint32_t r0 = job->row0; r0 < job->row0 + job->nrows; r0 += STATS_ROWS) {
+    const uint32_t n = (job->row0 + job->nrows - r0 < STATS_ROWS) ? job->row0 + job->nrows - r0 : STATS_ROWS;
+    convert_rows(job->image, r0, n, FORMAT_RGBA16, rows, (size_t) w * 8);
+
+    for (uint32_t i = 0; i < n; i++) {
+      const uint16_t *row = rows + (size_t) i * w * 4;
+      if (stats->gray || stats->opaque) {
+        check_row(row, w, &(stats->gray), &(stats->opaque));
+      }
+
+      // first and last pixels not fully transparent
+      uint32_t first = 0;
+      while ((first < w) && (row[4 * first + 3] == 0)) {
+        first++;
+      }
+      if (first < w) {
+        uint32_t end = w - 1;
+        while (row[4 * end + 3] == 0) {
+          end--;
+        }
+        job->min_x = (first < job->min_x) ? first : job->min_x;
+        job->max_x = (end > job->max_x) ? end : job->max_x;
+        job->min_y = (r0 + i < job->min_y) ? r0 + i : job->min_y;
+        job->max_y = r0 + i;
+      }
+
+      for (const uint16_t *px = row; px < row + 4 * w; px += 4) {
+        for (uint8_t c = 0; c < 4; c++) {
+          stats->histogram[c][round8(px[c])]++;
+        }
+        if (job->set.count <= STATS_MAX_COLOR) {
+          uint64_t key;
+          memcpy(&key, px, sizeof(key));
+          if (!has_last || (key != last)) {
+            set_insert(&(job->set), key);
+            last = key;
+            has_last = 1;
+          }
+        }
+      }
+    }
+  }
+  free(rows);
+}
+
+
+
+struct color_stats get_color_stats(const struct image *image) {
+  const uint32_t h = image->height;
+
+  // bands stolen by the idle workers
+  const uint32_t nb_job = sched_pieces((uint64_t) image->width * h, STATS_PIECE_PIXELS, STATS_MAX_PIECES);
+  struct stats_job *job = malloc(nb_job * sizeof(struct stats_job));
+  if (job == NULL) {
+    LOG_FATAL("Can't malloc(%zu) for the statistics", nb_job * sizeof(struct stats_job));
+    exit(1);
+  }
+  const uint32_t band = (h + nb_job - 1) / nb_job;
+  for (uint32_t t = 0; t < nb_job; t++) {
+    job[t].image = image;
+    job[t].row0  = t * band;
+    job[t].nrows = (job[t].row0 >= h) ? 0 : (h - job[t].row0 < band) ? h - job[t].row0 : band;
+  }
+  sched_run(NULL, nb_job, stats_band, job);
+
+  // merge in the first band
+  struct color_stats r = job[0].stats;
+  struct color_set *set = &(job[0].set);
+  for (uint32_t t = 1; t < nb_job; t++) {
+    for (uint8_t c = 0; c < 4; c++) {
+      for (uint32_t v = 0; v < 256; v++) {
+        r.histogram[c][v] += job[t].stats.histogram[c][v];
+      }
+    }
+    r.gray   &= job[t].stats.gray;
+    r.opaque &= job[t].stats.opaque;
+
+    job[0].min_x = (job[t].min_x < job[0].min_x) ? job[t].min_x : job[0].min_x;
+    job[0].max_x = (job[t].max_x > job[0].max_x) ? job[t].max_x : job[0].max_x;
+    job[0].min_y = (job[t].min_y < job[0].min_y) ? job[t].min_y : job[0].min_y;
+    job[0].max_y = (job[t].max_y > job[0].max_y) ? job[t].max_y : job[0].max_y;
+
+    if (job[t].set.count > STATS_MAX_COLOR) {
+      set->count = STATS_MAX_COLOR + 1;
+    }
+    for (uint32_t s = 0; (s < COLOR_SLOT) && (set->count <= STATS_MAX_COLOR); s++) {
+      if (job[t].set.used[s]) {
+        set_insert(set, job[t].set.key[s]);
+      }
+    }
+  }
+  r.nb_color = set->count;
+
+  if (job[0].min_x <= job[0].max_x) {
+    r.alpha_box.x      = job[0].min_x;
+    r.alpha_box.y      = job[0].min_y;
+    r.alpha_box.width  = job[0].max_x - job[0].min_x + 1;
+    r.alpha_box.height = job[0].max_y - job[0].min_y + 1;
+  }
+  free(job);
+  return r;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file stats.h
+ * @brief Color statistics of an image in a single pass
+ * @details Rows are converted to RGBA16 a few at a time (O(row) memory), so every image type goes
+ * through the same checks on its exact samples. Bands of rows are analysed by the workers of the
+ * scheduler and merged. Opaque and gray checks are vectorized and skipped as soon as they fail.
+ * Distinct colors go in a small open addressing hash set, counting stops past STATS_MAX_COLOR colors.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+#include "image.h"
+
+
+/** @brief Max number of distinct colors counted */
+#define STATS_MAX_COLOR (256U)
+
+
+/**
+ * @brief Statistics of an image
+ */
+struct color_stats {
+  /** @brief Number of pixels per 8-bit value of red, green, blue and alpha (16-bit samples rounded) */
+  uint64_t histogram[4][256];
+  /** @brief Number of distinct RGBA colors, STATS_MAX_COLOR + 1 if more */
+  uint32_t nb_color;
+  /** @brief Flag: every pixel is opaque */
+  uint8_t opaque;
+  /** @brief Flag: every pixel has red = green = blue */
+  uint8_t gray;
+  /** @brief Bounding box of the pixels not fully transparent (width and height 0 if none) */
+  struct {
+    /** @brief First column */
+    uint32_t x;
+    /** @brief First row */
+    uint32_t y;
+    /** @brief Number of columns */
+    uint32_t width;
+    /** @brief Number of rows */
+    uint32_t height;
+  } alpha_box;
+};
+
+
+/**
+ * @brief Analyse the image
+ * @param[in] image Any image returned by get_image
+ * @return The statistics
+ */
+struct color_stats get_color_stats(const struct image *image);
+
+
+
+#endif // __STATS_H__
@@ -0,0 +1,415 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "filter.h"
+#include "log.h"
+#include "stream.h"
+
+
+
+/**
+ * @brief Move to the next chunk and feed zlib if it is an IDAT
+ * @param[in,out] stream
+ * @return 1 if the next chunk is an IDAT, 0 otherwise
+ */
+static int next_IDAT(struct idat_stream *stream) {
+  // its CRC was checked when the stream reached it
+  const struct chunk current = get_chunk_unchecked(stream->fsize, stream->fptr);
+
+  stream->fsize -= (current.length + 12);
+  stream->fptr  += (current.length + 12);
+
+  const struct chunk next = get_chunk(stream->fsize, stream->fptr);
+  if (next.type != IDAT) {
+    return 0;
+  }
+  stream->zstream.next_in  = (z_const Bytef *) next.data; // drop the const but it's ok (z_const)
+  stream->zstream.avail_in = next.length;
+  return 1;
+}
+
+
+
+/**
+ * @brief Inflate exactly size bytes
+ * @param[in,out] stream
+ * @param[out] dst Area of size bytes
+ * @param[in] size Number of bytes to inflate
+ * @return 1 if done, 0 if the compressed data is wrong or the check stopped it
+ */
+static uint8_t idat_inflate(struct idat_stream *stream, uint8_t *dst, uint32_t size) {
+  z_stream *zs = &(stream->zstream);
+  zs->next_out  = dst;
+  zs->avail_out = size;
+
+  while (zs->avail_out > 0) {
+
+    if (stream->end) {
+      LOG_ERROR("Inflating IDAT didn't take as much space as expected, remaind %d byte", zs->avail_out);
+      return 0;
+    }
+    if (zs->avail_in == 0) {
+      if ((stream->check != NULL) && stream->check(stream->check_arg)) {
+        return 0;
+      }
+      if (!next_IDAT(stream)) {
+        LOG_ERROR("Missing IDAT, remaind %d byte to inflate", zs->avail_out);
+        return 0;
+      }
+    }
+
+    int err = inflate(zs, Z_NO_FLUSH);
+    if (err == Z_STREAM_END) {
+      stream->end = 1; // zlib know it is the last IDAT
+    }
+    else if ((err != Z_OK) && (err != Z_BUF_ERROR)) {
+      LOG_ERROR("Inflate failed, returned %d", err);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Flag: a chunk is complete in the rest of the file
+ */
+static int chunk_fits(size_t fsize, const uint8_t *fptr) {
+  if (fsize < 12) {
+    return 0;
+  }
+  const uint32_t length = ((uint32_t) fptr[0] << 24) | ((uint32_t) fptr[1] << 16) | ((uint32_t) fptr[2] << 8) | fptr[3];
+  return length <= fsize - 12;
+}
+
+/**
+ * @brief Flag: the values of the header are valid (size, color type and depth, methods)
+ */
+static int header_valid(const struct chunk *chunk) {
+  const uint8_t *ptr = chunk->data;
+  const uint32_t width  = ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | ptr[3];
+  const uint32_t height = ((uint32_t) ptr[4] << 24) | ((uint32_t) ptr[5] << 16) | ((uint32_t) ptr[6] << 8) | ptr[7];
+  const uint8_t depth = ptr[8], color_type = ptr[9];
+  // depths allowed by each color type, as bits of a mask
+  static const uint8_t depths[7] = {0x1F, 0, 0x18, 0x0F, 0x18, 0, 0x18};
+  const uint8_t bit = (depth == 1) ? 0x01 : (depth == 2) ? 0x02 : (depth == 4) ? 0x04 : (depth == 8) ? 0x08
+                    : (depth == 16) ? 0x10 : 0;
+  return (width > 0) && (width <= INT32_MAX) && (height > 0) && (height <= INT32_MAX) && (color_type < 7)
+         && ((depths[color_type] & bit) != 0) && (ptr[10] == 0) && (ptr[11] == 0) && (ptr[12] <= 1);
+}
+
+
+
+void idat_open(struct idat_stream *stream, size_t fsize, const uint8_t *fptr) {
+  // the first IDAT chunk of the file (its CRC checked by scanline_open)
+  const struct chunk current = get_chunk_unchecked(fsize, fptr);
+  assert(current.type == IDAT);
+
+  stream->fsize = fsize;
+  stream->fptr  = fptr;
+  stream->end   = 0;
+  stream->check = NULL;
+
+  // init z_stream value
+  stream->zstream.zalloc    = Z_NULL;
+  stream->zstream.zfree     = Z_NULL;
+  stream->zstream.opaque    = (voidpf) 0;
+  stream->zstream.next_in   = (z_const Bytef *) current.data;
+  stream->zstream.avail_in  = current.length;
+  stream->zstream.next_out  = Z_NULL;
+  stream->zstream.avail_out = 0;
+  LOG_INFO("Inflate IDAT ...");
+
+  int err = inflateInit(&(stream->zstream));
+  if (err != Z_OK) {
+    LOG_FATAL("InflateInit failed, returned %d", err);
+    exit(1);
+  }
+}
+
+
+void idat_read(struct idat_stream *stream, uint8_t *dst, uint32_t size) {
+  if (!idat_inflate(stream, dst, size)) {
+    LOG_FATAL("Can't inflate %u bytes of IDAT", size);
+    exit(1);
+  }
+}
+
+
+uint32_t idat_read_block(struct idat_stream *stream, uint8_t *dst, uint32_t size) {
+  z_stream *zs = &(stream->zstream);
+  zs->next_out  = dst;
+  zs->avail_out = size;
+
+  if (stream->end) {
+    return 0;
+  }
+  if ((zs->avail_in == 0) && !next_IDAT(stream)) {
+    LOG_FATAL("Missing IDAT, compressed stream not over");
+    exit(1);
+  }
+
+  int err = inflate(zs, Z_BLOCK);
+  if (err == Z_STREAM_END) {
+    stream->end = 1;
+  }
+  else if ((err != Z_OK) && (err != Z_BUF_ERROR)) {
+    LOG_FATAL("Inflate failed, returned %d", err);
+    exit(1);
+  }
+  return size - zs->avail_out;
+}
+
+
+void idat_resume(struct idat_stream *stream, size_t fsize, const uint8_t *fptr, uint32_t offset,
+                 uint8_t bits, uint8_t byte, const uint8_t *window, uint32_t wsize) {
+  const struct chunk current = get_chunk(fsize, fptr);
+  assert(current.type == IDAT);
+  assert(offset <= current.length);
+
+  z_stream *zs = &(stream->zstream);
+  inflateEnd(zs);
+
+  stream->fsize = fsize;
+  stream->fptr  = fptr;
+  stream->end   = 0;
+
+  zs->zalloc    = Z_NULL;
+  zs->zfree     = Z_NULL;
+  zs->opaque    = (voidpf) 0;
+  zs->next_in   = ((z_const Bytef *) current.data) + offset;
+  zs->avail_in  = current.length - offset;
+
+  int err = inflateInit2(zs, -15); // raw deflate, no zlib header in the middle
+  if (err != Z_OK) {
+    LOG_FATAL("InflateInit2 failed, returned %d", err);
+    exit(1);
+  }
+  if (bits > 0) {
+    err = inflatePrime(zs, bits, byte >> (8 - bits));
+  }
+  if (err == Z_OK) {
+    err = inflateSetDictionary(zs, window, wsize);
+  }
+  if (err != Z_OK) {
+    LOG_FATAL("Can't resume inflate at offset %d (%d bits), returned %d", offset, bits, err);
+    exit(1);
+  }
+  LOG_INFO("Resume inflate at offset %d of IDAT %p", offset, fptr);
+}
+
+
+void idat_close(struct idat_stream *stream) {
+  int err = inflateEnd(&(stream->zstream));
+  if (err != Z_OK) {
+    LOG_FATAL("InflateEnd failed, returned %d", err);
+    exit(1);
+  }
+  LOG_INFO("Inflate IDAT done");
+}
+
+
+
+
+uint8_t count_sample(enum color_type type) {
+  switch (type) {
+  case PLTE_INDEX:
+  case GRAYSCALE:
+    return 1;
+  case GRAYSCALE_ALPHA:
+    return 2;
+  case RGB_TRIPLE:
+    return 3;
+  case RGB_TRIPLE_ALPHA:
+    return 4;
+  }
+  LOG_FATAL("Unknown color type %d", type);
+  exit(1);
+}
+
+
+uint32_t byte_per_line(uint8_t depth, uint8_t sample, uint32_t width) {
+  uint32_t bit_per_line = depth * sample * width;
+  return (bit_per_line + 7) / 8; // round up to one if % 8 != 0
+}
+
+
+/**
+ * @brief Check the length of an ancillary chunk scanline_open reads (its parser asserts on it)
+ * @param[in] chunk
+ * @param[in] header For the length of bKGD
+ * @return 1 if its parser can read it (or it is not read), 0 otherwise
+ */
+static uint8_t ancillary_valid(const struct chunk *chunk, const struct IHDR *header) {
+  static const uint8_t bkgd_length[7] = {2, 0, 6, 1, 2, 0, 6};
+  switch (chunk->type) {
+  case GAMA:
+    return chunk->length == 4;
+  case SRGB:
+    return chunk->length == 1;
+  case CHRM:
+    return chunk->length == 32;
+  case BKGD:
+    return (header->color_type < 7) && (chunk->length == bkgd_length[header->color_type]);
+  default:
+    return 1;
+  }
+}
+
+
+void scanline_open(struct scanline_stream *stream, const struct mfile *file) {
+  assert(mfile_is_png(file) == 1);
+
+  // skip the 8 byte signature
+  size_t fsize  = file->size - 8;
+  uint8_t *fptr = ((uint8_t *) file->data) + 8;
+
+  // get the header chunk
+  struct chunk current = get_chunk(fsize, fptr);
+  stream->header   = IHDR_chunk(&current);
+  stream->has_plte = 0;
+  stream->gamma    = 0;
+  stream->srgb     = 0;
+  stream->has_chrm = 0;
+  stream->has_bkgd = 0;
+  stream->iccp     = NULL;
+  stream->iccp_length = 0;
+
+  // find the first IDAT chunk (and the palette and color space chunks before it)
+  while (current.type != IDAT) {
+    // an ancillary chunk of the wrong length is skipped, as if it were not there
+    if (!ancillary_valid(&current, &(stream->header))) {
+      LOG_WARN("Chunk %.4s of %u bytes skipped: wrong length", (const char *) fptr + 4, current.length);
+    }
+    switch (ancillary_valid(&current, &(stream->header)) ? current.type : UKWN) {
+    case PLTE:
+      stream->plte     = PLTE_chunk(&current, &(stream->header));
+      stream->has_plte = 1;
+      break;
+    case GAMA:
+      stream->gamma = GAMA_chunk(&current);
+      break;
+    case SRGB:
+      SRGB_chunk(&current);
+      stream->srgb = 1;
+      break;
+    case CHRM:
+      stream->chrm     = CHRM_chunk(&current);
+      stream->has_chrm = 1;
+      break;
+    case BKGD:
+      stream->bkgd     = BKGD_chunk(&current, &(stream->header));
+      stream->has_bkgd = 1;
+      break;
+    case ICCP:
+      stream->iccp        = current.data;
+      stream->iccp_length = current.length;
+      break;
+    default:;
+    }
+    fsize -= (current.length + 12); // chunk size
+    fptr  += (current.length + 12);
+    current = get_chunk(fsize, fptr);
+  }
+  if ((stream->header.color_type == PLTE_INDEX) && !stream->has_plte) {
+    LOG_FATAL("Missing PLTE chunk before IDAT");
+    exit(1);
+  }
+
+  stream->sample = count_sample(stream->header.color_type);
+  stream->bpp    = (stream->header.depth * stream->sample + 7) / 8;
+  stream->lsize  = byte_per_line(stream->header.depth, stream->sample, stream->header.width);
+  stream->row    = 0;
+  idat_open(&(stream->idat), fsize, fptr);
+}
+
+
+void scanline_read_line(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior, uint32_t lsize) {
+  uint8_t type;
+  idat_read(&(stream->idat), &type, 1);
+  idat_read(&(stream->idat), line, lsize);
+
+  LOG_TRACE("line %-3d   filter %d", stream->row, type);
+  unfilter_line(type, line, prior, lsize, stream->bpp);
+  stream->row++;
+}
+
+
+uint8_t scanline_try_read(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior) {
+  assert(stream->header.interlace == 0);
+  assert(stream->row < stream->header.height);
+
+  uint8_t type;
+  if (!idat_inflate(&(stream->idat), &type, 1) || (type > 4) || !idat_inflate(&(stream->idat), line, stream->lsize)) {
+    return 0;
+  }
+  unfilter_line(type, line, (stream->row == 0) ? NULL : prior, stream->lsize, stream->bpp);
+  stream->row++;
+  return 1;
+}
+
+
+void scanline_read(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior) {
+  assert(stream->header.interlace == 0);
+  assert(stream->row < stream->header.height);
+
+  scanline_read_line(stream, line, (stream->row == 0) ? NULL : prior, stream->lsize);
+}
+
+
+uint8_t scanline_check(const struct mfile *file) {
+  if (!mfile_is_png(file)) {
+    return 0;
+  }
+  size_t fsize = file->size - 8;
+  const uint8_t *fptr = ((const uint8_t *) file->data) + 8;
+  if (!chunk_fits(fsize, fptr)) {
+    return 0;
+  }
+  struct chunk current = get_chunk_unchecked(fsize, fptr);
+  if ((current.type != IHDR) || (current.length != 13) || !header_valid(&current)) {
+    return 0;
+  }
+  const struct IHDR header = IHDR_chunk(&current);
+
+  // the palette as scanline_open reads it, up to the first IDAT
+  uint8_t has_plte = 0;
+  for (;;) {
+    fsize -= (current.length + 12);
+    fptr  += (current.length + 12);
+    if (!chunk_fits(fsize, fptr)) {
+      return 0;
+    }
+    current = get_chunk_unchecked(fsize, fptr);
+    // gAMA, sRGB, cHRM and bKGD of the wrong length are skipped by scanline_open
+    if (current.type == PLTE) {
+      if ((current.length == 0) || (current.length > 3 * 256) || ((current.length % 3) != 0)) {
+        return 0;
+      }
+      has_plte = 1;
+    }
+    if (current.type == IDAT) {
+      break;
+    }
+  }
+  if ((header.color_type == PLTE_INDEX) && !has_plte) {
+    return 0;
+  }
+  // every IDAT chunk, then the chunk after them (read to know the IDAT are over)
+  while (current.type == IDAT) {
+    fsize -= (current.length + 12);
+    fptr  += (current.length + 12);
+    if (!chunk_fits(fsize, fptr)) {
+      return 0;
+    }
+    current = get_chunk_unchecked(fsize, fptr);
+  }
+  return 1;
+}
+
+
+void scanline_close(struct scanline_stream *stream) {
+  if (stream->row < stream->header.height) {
+    LOG_INFO("Stop at line %d/%d", stream->row, stream->header.height);
+  }
+  idat_close(&(stream->idat));
+}
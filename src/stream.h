@@ -0,0 +1,195 @@
+/**
+ * @file stream.h
+ * @brief Inflate and unfilter an image scanline by scanline
+ * @details IDAT chunks are inflated on demand, so the caller decides where each scanline goes
+ * and can stop in the middle of the image. Only the previous scanline is needed to unfilter the next one.
+ */
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "chunk.h"
+#include "mfile.h"
+
+
+/**
+ * @brief Inflate state across consecutive IDAT chunks
+ */
+struct idat_stream {
+  /** @brief zlib state */
+  z_stream zstream;
+  /** @brief Remaining size of the file from fptr */
+  size_t fsize;
+  /** @brief Current IDAT chunk in the file */
+  const uint8_t *fptr;
+  /** @brief Flag: zlib reached the end of the compressed stream */
+  uint8_t end;
+  /** @brief Called before each IDAT chunk but the first, inflating stops if it returns nonzero (NULL for none) */
+  int (*check)(void *arg);
+  /** @brief Argument of check */
+  void *check_arg;
+};
+
+/**
+ * @brief Start inflating from the first IDAT chunk
+ * @param[out] stream
+ * @param[in] fsize Remaining size of the file starting at fptr
+ * @param[in] fptr Pointer to the first IDAT chunk
+ */
+void idat_open(struct idat_stream *stream, size_t fsize, const uint8_t *fptr);
+
+/**
+ * @brief Inflate exactly size bytes
+ * @details Abort if the compressed stream ends before, or if the data is wrong
+ * @param[in,out] stream
+ * @param[out] dst Area of size bytes
+ * @param[in] size Number of bytes to inflate
+ */
+void idat_read(struct idat_stream *stream, uint8_t *dst, uint32_t size);
+
+/**
+ * @brief Inflate at most size bytes, stopping at the end of each deflate block
+ * @details Right after a block, zstream.data_type & 128 is set and zstream.data_type & 7 is the number
+ * of unused bits in the last consumed byte (see Z_BLOCK in zlib.h)
+ * @param[in,out] stream
+ * @param[out] dst Area of size bytes
+ * @param[in] size Max number of bytes to inflate
+ * @return Number of bytes inflated (0 once the compressed stream is over)
+ */
+uint32_t idat_read_block(struct idat_stream *stream, uint8_t *dst, uint32_t size);
+
+/**
+ * @brief Restart inflating at a deflate block boundary in the middle of the IDAT chunks
+ * @details The stream must be opened, its zlib state is replaced by a raw inflate state
+ * @param[in,out] stream
+ * @param[in] fsize Remaining size of the file starting at fptr
+ * @param[in] fptr Pointer to the IDAT chunk holding the next compressed byte
+ * @param[in] offset Offset of the next compressed byte in the chunk data
+ * @param[in] bits Number of unused bits (0 to 7) in the previous compressed byte
+ * @param[in] byte The previous compressed byte (only used if bits > 0)
+ * @param[in] window The last inflated bytes before the boundary
+ * @param[in] wsize Size of window (up to 32 KiB)
+ */
+void idat_resume(struct idat_stream *stream, size_t fsize, const uint8_t *fptr, uint32_t offset,
+                 uint8_t bits, uint8_t byte, const uint8_t *window, uint32_t wsize);
+
+/**
+ * @brief End inflating (the stream may not be fully consumed)
+ * @param[in,out] stream
+ */
+void idat_close(struct idat_stream *stream);
+
+
+
+/**
+ * @brief Scanline reader of a PNG file
+ */
+struct scanline_stream {
+  /** @brief Header of the file */
+  struct IHDR header;
+  /** @brief Palette of the file (valid only if has_plte) */
+  struct PLTE plte;
+  /** @brief Flag: a PLTE chunk is before IDAT */
+  uint8_t has_plte;
+  /** @brief gAMA of the file times 100000 (0 if none) */
+  uint32_t gamma;
+  /** @brief Flag: a sRGB chunk is before IDAT */
+  uint8_t srgb;
+  /** @brief Flag: a cHRM chunk is before IDAT */
+  uint8_t has_chrm;
+  /** @brief Chromaticities of the file (valid only if has_chrm) */
+  struct CHRM chrm;
+  /** @brief Flag: a bKGD chunk is before IDAT */
+  uint8_t has_bkgd;
+  /** @brief Background color of the file (valid only if has_bkgd) */
+  struct BKGD bkgd;
+  /** @brief Data of the iCCP chunk before IDAT (in the mapped file) or NULL */
+  const uint8_t *iccp;
+  /** @brief Length of the iCCP chunk data */
+  uint32_t iccp_length;
+  /** @brief Number of sample per pixel */
+  uint8_t sample;
+  /** @brief Byte per pixel (round up to one), needed to unfilter */
+  uint8_t bpp;
+  /** @brief Length of a full width scanline (without the filter type-byte) */
+  uint32_t lsize;
+  /** @brief Number of scanlines read (every pass for Adam7) */
+  uint32_t row;
+  /** @brief Inflate state */
+  struct idat_stream idat;
+};
+
+/**
+ * @brief Number of sample of a pixel
+ * @param[in] type Color type
+ * @return Count of sample
+ */
+uint8_t count_sample(enum color_type type);
+
+/**
+ * @brief Compute the length of a scanline (in byte)
+ * @param[in] depth Count of bit per sample
+ * @param[in] sample Count of sample per pixel
+ * @param[in] width Count of pixel
+ * @return Number of byte for a scanline in the image
+ */
+uint32_t byte_per_line(uint8_t depth, uint8_t sample, uint32_t width);
+
+/**
+ * @brief Read the chunks before IDAT and get ready to inflate
+ * @param[out] stream
+ * @param[in] file A PNG file (must stay mapped until scanline_close)
+ */
+void scanline_open(struct scanline_stream *stream, const struct mfile *file);
+
+/**
+ * @brief Inflate and unfilter the next scanline (NO interlace image)
+ * @param[in,out] stream
+ * @param[out] line Area of stream->lsize bytes for the unfiltered scanline
+ * @param[in] prior The previous unfiltered scanline (ignored for the first one)
+ */
+void scanline_read(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior);
+
+/**
+ * @brief Same as scanline_read, but a wrong scanline is reported instead of ending the process
+ * @details The file must pass scanline_check. The check of the inflate state (if any) may also stop it.
+ * @param[in,out] stream
+ * @param[out] line Area of stream->lsize bytes for the unfiltered scanline
+ * @param[in] prior The previous unfiltered scanline (ignored for the first one)
+ * @return 1 if read, 0 if the compressed data or the filter type is wrong, or the check stopped it
+ */
+uint8_t scanline_try_read(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior);
+
+/**
+ * @brief Inflate and unfilter the next scanline of any length
+ * @details Needed for Adam7 passes whose scanlines are shorter than the image
+ * @param[in,out] stream
+ * @param[out] line Area of lsize bytes for the unfiltered scanline
+ * @param[in] prior The previous unfiltered scanline of the same length or NULL for the first one
+ * @param[in] lsize Length of the scanline (without the filter type-byte)
+ */
+void scanline_read_line(struct scanline_stream *stream, uint8_t *line, const uint8_t *prior, uint32_t lsize);
+
+/**
+ * @brief Check that scanline_open and the IDAT chunks can't end the process on a file
+ * @details Signature, then IHDR values, the chunks up to the IDAT chunks complete, PLTE, gAMA, sRGB,
+ * cHRM and bKGD of the right length, PLTE before IDAT for palette images, then a complete chunk after
+ * the IDAT chunks. The compressed data itself is not checked (see scanline_try_read).
+ * @param[in] file
+ * @return 1 if the file can be opened, 0 otherwise
+ */
+uint8_t scanline_check(const struct mfile *file);
+
+/**
+ * @brief Stop reading, remaining scanlines are never inflated
+ * @param[in,out] stream
+ */
+void scanline_close(struct scanline_stream *stream);
+
+
+
+#endif // __STREAM_H__
@@ -0,0 +1,622 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "chunk.h"
+#include "convert.h"
+#include "filter.h"
+#include "image.h"
+#include "log.h"
+#include "transcode.h"
+
+
+/** @brief Size of the PNG signature */
+#define SIGNATURE_SIZE (8U)
+/** @brief Weight of red in the luma (on 65536) */
+#define LUMA16_RED   (19595U)
+/** @brief Weight of green in the luma (on 65536) */
+#define LUMA16_GREEN (38470U)
+/** @brief Weight of blue in the luma (on 65536) */
+#define LUMA16_BLUE  (7471U)
+
+
+/**
+ * @brief tRNS of the source
+ */
+struct transparency {
+  /** @brief Flag: the source has tRNS */
+  uint8_t present;
+  /** @brief Transparent color as 16-bit red, green, blue (gray and RGB sources) */
+  uint16_t key[3];
+  /** @brief Alpha of each index (palette sources) */
+  uint8_t alpha[256];
+};
+
+/**
+ * @brief Output being written
+ */
+struct transcoder {
+  /** @brief Name of the output */
+  const char *filename;
+  /** @brief Descriptor of the output */
+  int fd;
+  /** @brief Size written so far */
+  uint64_t size;
+  /** @brief Deflate state of the image data */
+  z_stream z;
+  /** @brief Deflated bytes waiting to be written (TRANSCODE_IDAT_SIZE bytes) */
+  uint8_t *idat;
+  /** @brief Number of IDAT chunks written */
+  uint32_t nb_idat;
+};
+
+
+
+/**
+ * @brief Luma of a 16-bit color (exact for gray)
+ */
+static inline uint16_t luma16(uint16_t red, uint16_t green, uint16_t blue) {
+  return (LUMA16_RED * red + LUMA16_GREEN * green + LUMA16_BLUE * blue + 32768) >> 16;
+}
+
+/**
+ * @brief Nearest 8-bit sample of a 16-bit sample, round(v / 257)
+ */
+static inline uint8_t to_depth8(uint16_t v) {
+  return ((uint32_t) v * 255 + 32895) >> 16;
+}
+
+/**
+ * @brief Pack RGBA16 pixels in the target color type and depth (samples big endian)
+ * @param[in] rgba Pixels in FORMAT_RGBA16
+ * @param[in] width Number of pixels
+ * @param[in] sample Number of samples of the target
+ * @param[in] depth Depth of the target (8 or 16)
+ * @param[out] dst The scanline
+ */
+static void pack_row(const uint16_t *rgba, uint32_t width, uint8_t sample, uint8_t depth, uint8_t *dst) {
+  for (uint32_t j = 0; j < width; j++, rgba += 4) {
+    uint16_t v[4];
+    uint8_t n = 0;
+    if (sample <= 2) {
+      v[n++] = luma16(rgba[0], rgba[1], rgba[2]);
+    }
+    else {
+      v[n++] = rgba[0];
+      v[n++] = rgba[1];
+      v[n++] = rgba[2];
+    }
+    if ((sample & 1) == 0) {
+      v[n++] = rgba[3];
+    }
+    if (depth == 16) {
+      for (uint8_t k = 0; k < n; k++) {
+        *dst++ = v[k] >> 8;
+        *dst++ = v[k];
+      }
+    }
+    else {
+      for (uint8_t k = 0; k < n; k++) {
+        *dst++ = to_depth8(v[k]);
+      }
+    }
+  }
+}
+
+/**
+ * @brief PNG color type of a number of samples
+ */
+static uint8_t color_type(uint8_t sample) {
+  static const uint8_t type[4] = {GRAYSCALE, GRAYSCALE_ALPHA, RGB_TRIPLE, RGB_TRIPLE_ALPHA};
+  return type[sample - 1];
+}
+
+/**
+ * @brief Check if an ancillary chunk of the source still holds for the output
+ * @param[in] chunk
+ * @param[in] type Type as in the file
+ * @param[in] iccp Flag: the ICC profile still holds (gray stays gray, color stays color)
+ */
+static uint8_t keep_chunk(const struct chunk *chunk, const uint8_t *type, uint8_t iccp) {
+  switch (chunk->type) {
+  case GAMA:
+  case CHRM:
+  case SRGB:
+  case PHYS:
+  case SPLT:
+  case TEXT:
+  case ZTXT:
+  case ITXT:
+  case TIME:
+    return 1;
+  case ICCP:
+    return iccp;
+  case UKWN:
+    // ancillary and safe to copy
+    return ((type[0] & 0x20) != 0) && ((type[3] & 0x20) != 0);
+  default:
+    // IHDR, PLTE, IDAT, IEND, and the chunks of the color type (tRNS, bKGD, sBIT, hIST)
+    return 0;
+  }
+}
+
+/**
+ * @brief Write a chunk of the output
+ * @param[in,out] t
+ * @param[in] type, data, length, crc As for write_png_chunk
+ */
+static void write_chunk(struct transcoder *t, const char *type, const uint8_t *data, uint32_t length,
+                        const uint32_t *crc) {
+  const uint64_t size = write_png_chunk(t->fd, t->filename, type, data, length, crc);
+  if (size == 0) {
+    LOG_FATAL("Can't write %s", t->filename);
+    exit(1);
+  }
+  t->size += size;
+}
+
+/**
+ * @brief Copy the ancillary chunks kept from an offset of the source, up to IDAT or IEND
+ * @param[in,out] t
+ * @param[in] file
+ * @param[in] offset Offset of a chunk in the source
+ * @param[in] iccp See keep_chunk
+ * @return Offset of the first IDAT or of IEND
+ */
+static size_t copy_chunks(struct transcoder *t, const struct mfile *file, size_t offset, uint8_t iccp) {
+  for (;;) {
+    const uint8_t *ptr = ((const uint8_t *) file->data) + offset;
+    const struct chunk current = get_chunk_unchecked(file->size - offset, ptr);
+    if ((current.type == IDAT) || (current.type == IEND)) {
+      return offset;
+    }
+    if (keep_chunk(&current, ptr + 4, iccp)) {
+      write_chunk(t, (const char *) ptr + 4, current.data, current.length, &(current.crc));
+    }
+    offset += 12 + (size_t) current.length;
+  }
+}
+
+/**
+ * @brief Skip the IDAT chunks of the source
+ * @param[in] file
+ * @param[in] offset Offset of the first IDAT
+ * @return Offset of the chunk after the last IDAT
+ */
+static size_t skip_idat(const struct mfile *file, size_t offset) {
+  for (;;) {
+    const struct chunk current = get_chunk_unchecked(file->size - offset, ((const uint8_t *) file->data) + offset);
+    if (current.type != IDAT) {
+      return offset;
+    }
+    offset += 12 + (size_t) current.length;
+  }
+}
+
+/**
+ * @brief Write the deflated bytes waiting as an IDAT chunk
+ * @param[in,out] t
+ */
+static void write_idat(struct transcoder *t) {
+  const uint32_t length = TRANSCODE_IDAT_SIZE - t->z.avail_out;
+  if (length > 0) {
+    write_chunk(t, "IDAT", t->idat, length, NULL);
+    t->nb_idat++;
+  }
+  t->z.next_out  = t->idat;
+  t->z.avail_out = TRANSCODE_IDAT_SIZE;
+}
+
+/**
+ * @brief Deflate bytes of the image data, write the IDAT chunks filled
+ * @param[in,out] t
+ * @param[in] data
+ * @param[in] length Length of data
+ * @param[in] flush Z_NO_FLUSH, or Z_FINISH for the end of the stream
+ */
+static void deflate_bytes(struct transcoder *t, const uint8_t *data, uint32_t length, int flush) {
+  t->z.next_in  = (Bytef *) data;
+  t->z.avail_in = length;
+  int ret, full;
+  do {
+    ret = deflate(&(t->z), flush);
+    if (ret == Z_STREAM_ERROR) {
+      LOG_FATAL("Can't deflate the image data of %s", t->filename);
+      exit(1);
+    }
+    full = (t->z.avail_out == 0);
+    if (full || (ret == Z_STREAM_END)) {
+      write_idat(t);
+    }
+  } while (full || (t->z.avail_in > 0) || ((flush == Z_FINISH) && (ret != Z_STREAM_END)));
+}
+
+/**
+ * @brief Write the bKGD chunk of the source in the color type of the output
+ * @param[in,out] t
+ * @param[in] bg Background as 16-bit red, green, blue
+ * @param[in] sample Number of samples of the output
+ * @param[in] depth Depth of the output
+ */
+static void write_background(struct transcoder *t, const uint16_t bg[3], uint8_t sample, uint8_t depth) {
+  uint8_t bkgd[6];
+  uint32_t length = 0;
+  const uint16_t gray = luma16(bg[0], bg[1], bg[2]);
+  for (uint8_t k = 0; k < ((sample <= 2) ? 1 : 3); k++) {
+    const uint16_t v = (sample <= 2) ? gray : bg[k];
+    const uint16_t s = (depth == 16) ? v : to_depth8(v);
+    bkgd[length++] = s >> 8;
+    bkgd[length++] = s;
+  }
+  write_chunk(t, "bKGD", bkgd, length, NULL);
+}
+
+/**
+ * @brief Read the tRNS chunk of the source (before the image data)
+ * @param[in] file Source
+ * @param[in] hdr Header of the source
+ * @param[out] trns
+ */
+static void read_transparency(const struct mfile *file, const struct IHDR *hdr, struct transparency *trns) {
+  memset(trns, 0, sizeof(struct transparency));
+  memset(trns->alpha, 255, sizeof(trns->alpha));
+  for (size_t offset = SIGNATURE_SIZE;;) {
+    const uint8_t *ptr = ((const uint8_t *) file->data) + offset;
+    const struct chunk current = get_chunk_unchecked(file->size - offset, ptr);
+    if ((current.type == IDAT) || (current.type == IEND)) {
+      return;
+    }
+    offset += 12 + (size_t) current.length;
+    if (current.type != TRNS) {
+      continue;
+    }
+
+    const uint8_t *data = current.data;
+    const uint32_t scale = 65535 / ((1U << hdr->depth) - 1);
+    if (hdr->color_type == PLTE_INDEX) {
+      const uint32_t length = (current.length < 256) ? current.length : 256;
+      memcpy(trns->alpha, data, length);
+      trns->present = 1;
+    }
+    else if ((hdr->color_type == GRAYSCALE) && (current.length >= 2)) {
+      const uint16_t gray = ((data[0] << 8) | data[1]) & ((1U << hdr->depth) - 1);
+      trns->key[0] = trns->key[1] = trns->key[2] = gray * scale;
+      trns->present = 1;
+    }
+    else if ((hdr->color_type == RGB_TRIPLE) && (current.length >= 6)) {
+      for (uint8_t k = 0; k < 3; k++) {
+        trns->key[k] = (((data[2 * k] << 8) | data[2 * k + 1]) & ((1U << hdr->depth) - 1)) * scale;
+      }
+      trns->present = 1;
+    }
+    return;
+  }
+}
+
+/**
+ * @brief Turn the tRNS of the source into the alpha of converted rows
+ * @param[in] trns
+ * @param[in] band Band of the source
+ * @param[in] row Row of the band
+ * @param[in,out] rgba The row converted to RGBA16
+ */
+static void apply_transparency(const struct transparency *trns, const struct image *band, uint32_t row,
+                               uint16_t *rgba) {
+  if (band->palette != NULL) {
+    const uint8_t *src = ((const uint8_t *) band->data) + (size_t) row * line_size(band);
+    const uint8_t depth = band->depth;
+    const uint8_t mask = (1U << depth) - 1;
+    for (uint32_t j = 0; j < band->width; j++, rgba += 4) {
+      const uint32_t bit = j * depth;
+      rgba[3] = trns->alpha[(src[bit / 8] >> (8 - depth - bit % 8)) & mask] * 257;
+    }
+    return;
+  }
+  for (uint32_t j = 0; j < band->width; j++, rgba += 4) {
+    if ((rgba[0] == trns->key[0]) && (rgba[1] == trns->key[1]) && (rgba[2] == trns->key[2])) {
+      rgba[3] = 0;
+    }
+  }
+}
+
+/**
+ * @brief Write the tRNS chunk of the source in the color type of the output (no alpha)
+ * @param[in,out] t
+ * @param[in] trns Transparent color of a gray or RGB source
+ * @param[in] sample Number of samples of the output (1 or 3)
+ * @param[in] depth Depth of the output
+ */
+static void write_transparency(struct transcoder *t, const struct transparency *trns, uint8_t sample,
+                               uint8_t depth) {
+  uint8_t data[6];
+  uint32_t length = 0;
+  uint8_t rounded = 0;
+  for (uint8_t k = 0; k < sample; k++) {
+    const uint16_t s = (depth == 16) ? trns->key[k] : to_depth8(trns->key[k]);
+    rounded |= (depth == 8) && (trns->key[k] % 257 != 0);
+    data[length++] = s >> 8;
+    data[length++] = s;
+  }
+  if (rounded) {
+    LOG_WARN("tRNS of %s rounded to 8 bits: more pixels may be transparent", t->filename);
+  }
+  write_chunk(t, "tRNS", data, length, NULL);
+}
+
+/**
+ * @brief Open the output
+ * @param[in,out] t
+ * @param[in] file Source (can't be the output)
+ */
+static void open_output(struct transcoder *t, const struct mfile *file) {
+  if (strcmp(t->filename, TRANSCODE_STDOUT) == 0) {
+    t->fd = STDOUT_FILENO;
+    return;
+  }
+  struct stat src, dst;
+  if ((stat(file->pathname, &src) == 0) && (stat(t->filename, &dst) == 0)
+      && (src.st_dev == dst.st_dev) && (src.st_ino == dst.st_ino)) {
+    LOG_FATAL("Can't transcode %s into itself", file->pathname);
+    exit(1);
+  }
+  t->fd = open(t->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (t->fd < 0) {
+    LOG_FATAL("Can't open %s", t->filename);
+    exit(1);
+  }
+}
+
+/**
+ * @brief Write the signature and IHDR
+ * @param[in,out] t
+ * @param[in] width
+ * @param[in] height
+ * @param[in] sample Number of samples of the output
+ * @param[in] depth Depth of the output
+ */
+static void write_signature(struct transcoder *t, uint32_t width, uint32_t height, uint8_t sample, uint8_t depth) {
+  static const uint8_t signature[SIGNATURE_SIZE] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+  if (write(t->fd, signature, SIGNATURE_SIZE) != SIGNATURE_SIZE) {
+    LOG_FATAL("Can't write %s", t->filename);
+    exit(1);
+  }
+  t->size += SIGNATURE_SIZE;
+
+  const uint8_t ihdr[13] = {
+    width >> 24, width >> 16, width >> 8, width,
+    height >> 24, height >> 16, height >> 8, height,
+    depth, color_type(sample),
+    0, // deflate
+    0, // adaptive filters
+    0, // no interlace
+  };
+  write_chunk(t, "IHDR", ihdr, 13, NULL);
+}
+
+/**
+ * @brief Read a decimal number
+ * @param[in,out] ptr Moved after the digits
+ * @param[out] value
+ * @return 1 if a number was read (at least one digit, no overflow)
+ */
+static uint8_t parse_number(const char **ptr, uint32_t *value) {
+  uint64_t v = 0;
+  const char *c = *ptr;
+  for (; (*c >= '0') && (*c <= '9'); c++) {
+    v = 10 * v + (*c - '0');
+    if (v > UINT32_MAX) {
+      return 0;
+    }
+  }
+  if (c == *ptr) {
+    return 0;
+  }
+  *value = v;
+  *ptr = c;
+  return 1;
+}
+
+
+
+struct transcode_options transcode_default_options(void) {
+  const struct transcode_options options = {
+    .sample = 0,
+    .depth  = 0,
+    .x      = 0,
+    .y      = 0,
+    .width  = 0,
+    .height = 0,
+    .png    = png_default_options(),
+  };
+  return options;
+}
+
+
+const char *parse_transcode(const char *arg, struct transcode_options *options) {
+  static const char *names[4] = {"graya", "gray", "rgba", "rgb"};
+  static const uint8_t samples[4] = {2, 1, 4, 3};
+
+  *options = transcode_default_options();
+  const char *colon = strchr(arg, ':');
+  if ((colon == NULL) || (colon == arg) || (colon[1] == '\0')) {
+    return arg;
+  }
+
+  struct transcode_options target = *options;
+  const char *ptr = arg;
+  for (uint8_t n = 0; n < 4; n++) {
+    const size_t length = strlen(names[n]);
+    if (strncmp(ptr, names[n], length) == 0) {
+      target.sample = samples[n];
+      ptr += length;
+      if (strncmp(ptr, "16", 2) == 0) {
+        target.depth = 16;
+        ptr += 2;
+      }
+      else if (*ptr == '8') {
+        target.depth = 8;
+        ptr++;
+      }
+      break;
+    }
+  }
+  if (*ptr == '@') {
+    ptr++;
+    if (!parse_number(&ptr, &(target.width)) || (*ptr++ != 'x') || !parse_number(&ptr, &(target.height))
+        || (*ptr++ != '+') || !parse_number(&ptr, &(target.x)) || (*ptr++ != '+')
+        || !parse_number(&ptr, &(target.y)) || (target.width == 0) || (target.height == 0)) {
+      return arg;
+    }
+  }
+  if (ptr != colon) {
+    return arg;
+  }
+  *options = target;
+  return colon + 1;
+}
+
+
+uint64_t transcode_png(const struct mfile *file, const char *filename, const struct transcode_options *options) {
+  const struct transcode_options defaults = transcode_default_options();
+  if (options == NULL) {
+    options = &defaults;
+  }
+
+  struct image_stream is;
+  image_stream_open(&is, file, TRANSCODE_ROWS, 1);
+  const struct IHDR *hdr = &(is.stream.header);
+
+  // target (a palette with tRNS turns into RGBA)
+  struct transparency trns;
+  read_transparency(file, hdr, &trns);
+  const uint8_t source_gray = (hdr->color_type == GRAYSCALE) || (hdr->color_type == GRAYSCALE_ALPHA);
+  const uint8_t sample = (options->sample > 0) ? options->sample
+                         : (hdr->color_type == PLTE_INDEX) ? (trns.present ? 4 : 3) : is.stream.sample;
+  const uint8_t depth = (options->depth > 0) ? options->depth : (hdr->depth < 8) ? 8 : hdr->depth;
+  if ((sample > 4) || ((depth != 8) && (depth != 16))) {
+    LOG_FATAL("Can't transcode to %d samples of %d bits", sample, depth);
+    exit(1);
+  }
+  uint32_t x = 0, y = 0, width = hdr->width, height = hdr->height;
+  if (options->width > 0) {
+    x = options->x;
+    y = options->y;
+    width  = options->width;
+    height = options->height;
+    if ((height == 0) || ((uint64_t) x + width > hdr->width) || ((uint64_t) y + height > hdr->height)) {
+      LOG_FATAL("Crop %ux%u+%u+%u out of the image %ux%u", width, height, x, y, hdr->width, hdr->height);
+      exit(1);
+    }
+  }
+  const struct png_options *png = &(options->png);
+  const int window_bits = (png->window_bits > 0) ? png->window_bits : MAX_WBITS;
+  if ((png->level < 0) || (png->level > 9) || (window_bits < 9) || (window_bits > MAX_WBITS)) {
+    LOG_FATAL("No zlib level %d with a window of %d bits", png->level, window_bits);
+    exit(1);
+  }
+  int strategy = png->strategy;
+  if (strategy == PNG_AUTO_STRATEGY) {
+    const uint8_t unfiltered = (png->filter == FILTER_FIXED) && (png->filter_type == 0);
+    strategy = unfiltered ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+  }
+
+  // rows of the pipeline
+  const uint8_t bpp = sample * depth / 8;
+  const uint32_t lsize = width * bpp;
+  const size_t wide_stride = (size_t) hdr->width * format_size(FORMAT_RGBA16);
+  uint16_t *wide = malloc(wide_stride * is.band_rows);
+  uint8_t *raw = malloc(3 * (size_t) lsize + 1);
+  struct transcoder t = {
+    .filename = filename,
+    .fd       = -1,
+    .size     = 0,
+    .idat     = malloc(TRANSCODE_IDAT_SIZE),
+    .nb_idat  = 0,
+  };
+  if ((wide == NULL) || (raw == NULL) || (t.idat == NULL)) {
+    LOG_FATAL("Can't malloc the rows to transcode %s", file->pathname);
+    exit(1);
+  }
+  LOG_ALLOC("Malloc(%zu) transcode rows %p", wide_stride * is.band_rows, wide);
+  uint8_t *current  = raw;
+  uint8_t *prior    = raw + lsize;
+  uint8_t *filtered = raw + 2 * (size_t) lsize;
+
+  memset(&(t.z), 0, sizeof(z_stream));
+  if (deflateInit2(&(t.z), png->level, Z_DEFLATED, window_bits, 8, strategy) != Z_OK) {
+    LOG_FATAL("Can't init deflate (level %d)", png->level);
+    exit(1);
+  }
+  t.z.next_out  = t.idat;
+  t.z.avail_out = TRANSCODE_IDAT_SIZE;
+  struct row_filter filter;
+  row_filter_init(&filter, png->filter, png->filter_type, png->level, lsize, bpp);
+
+  // chunks before the image data
+  open_output(&t, file);
+  write_signature(&t, width, height, sample, depth);
+  const uint8_t iccp = source_gray == (sample <= 2);
+  const size_t first_idat = copy_chunks(&t, file, SIGNATURE_SIZE, iccp);
+  if (is.band.has_background) {
+    write_background(&t, is.band.background, sample, depth);
+  }
+  // tRNS goes into the alpha of the output, or stays a transparent color of the same kind
+  const uint8_t to_alpha = trns.present && ((sample & 1) == 0);
+  if (trns.present && !to_alpha) {
+    if ((hdr->color_type == PLTE_INDEX) || (!source_gray && (sample == 1))) {
+      LOG_WARN("tRNS of %s dropped: no alpha in the output", file->pathname);
+    }
+    else {
+      write_transparency(&t, &trns, sample, depth);
+    }
+  }
+
+  // rows, as soon as decoded (none after the crop)
+  uint32_t nrows, done = 0;
+  while ((done < height) && ((nrows = image_stream_read(&is)) > 0)) {
+    const uint32_t row0 = is.row0;
+    const uint32_t first = (y > row0) ? y - row0 : 0;
+    if (first >= nrows) {
+      continue;
+    }
+    const uint32_t count = (nrows - first < height - done) ? nrows - first : height - done;
+    convert_rows(&(is.band), first, count, FORMAT_RGBA16, wide, wide_stride);
+    for (uint32_t k = 0; k < count; k++) {
+      if (to_alpha) {
+        apply_transparency(&trns, &(is.band), first + k, (uint16_t *) (((uint8_t *) wide) + k * wide_stride));
+      }
+      pack_row((const uint16_t *) (((const uint8_t *) wide) + k * wide_stride) + 4 * (size_t) x, width, sample,
+               depth, current);
+      filtered[0] = row_filter_apply(&filter, current, (done > 0) ? prior : NULL, NB_FILTER, filtered + 1);
+      deflate_bytes(&t, filtered, lsize + 1, Z_NO_FLUSH);
+      uint8_t *swap = prior;
+      prior = current;
+      current = swap;
+      done++;
+    }
+  }
+  deflate_bytes(&t, NULL, 0, Z_FINISH);
+
+  // chunks after the image data
+  copy_chunks(&t, file, skip_idat(file, first_idat), iccp);
+  write_chunk(&t, "IEND", NULL, 0, NULL);
+  if ((t.fd != STDOUT_FILENO) && (close(t.fd) != 0)) {
+    LOG_FATAL("Can't close %s", filename);
+    exit(1);
+  }
+  LOG_INFO("Transcoded %s into %s: %ux%u, %d x %d bits, %lu bytes in %u IDAT", file->pathname, filename, width,
+           height, sample, depth, (unsigned long) t.size, t.nb_idat);
+
+  row_filter_free(&filter);
+  deflateEnd(&(t.z));
+  image_stream_close(&is);
+  free(wide);
+  free(raw);
+  free(t.idat);
+  return t.size;
+}
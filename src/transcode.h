@@ -0,0 +1,88 @@
+/**
+ * @file transcode.h
+ * @brief Convert a PNG file to another PNG file (color type, depth, crop) a few rows at a time
+ * @details A pipeline of rows: the source is inflated and unfiltered a band of TRANSCODE_ROWS rows
+ * at a time (image_stream), each band is converted to RGBA16, cropped and packed in the target
+ * color type and depth, then each row is filtered (row_filter) and deflated into one zlib stream.
+ * An IDAT chunk is written each time TRANSCODE_IDAT_SIZE deflated bytes are ready. So the memory
+ * does not depend on the height of the image, only on its width.
+ *
+ * Ancillary chunks are copied as they are (with their CRC), before or after the image data as in
+ * the source, when they still hold for the new image: gAMA, cHRM, sRGB, pHYs, sPLT, text and time,
+ * iCCP unless the image turns from gray to color or back, and unknown chunks safe to copy.
+ * bKGD is written again in the new color type. sBIT and hIST are dropped, as well as
+ * the unknown chunks not safe to copy (stRP, iDOT: the strips are gone).
+ *
+ * tRNS goes into the alpha of a target with alpha (a palette with tRNS turns into RGBA by default).
+ * Without alpha, the transparent color of a gray or RGB source is written again at the new depth
+ * (gray to RGB as well), otherwise it is dropped with a warning. The alpha of the target is 65535
+ * for other sources without alpha.
+ * Interlaced sources are not handled (as image_stream).
+ */
+
+#ifndef __TRANSCODE_H__
+#define __TRANSCODE_H__
+
+#include <stdint.h>
+
+#include "mfile.h"
+#include "png.h"
+
+
+/** @brief Number of rows decoded at once */
+#define TRANSCODE_ROWS (4U)
+/** @brief Max length of an IDAT chunk written */
+#define TRANSCODE_IDAT_SIZE (1U << 16)
+/** @brief File name of the standard output */
+#define TRANSCODE_STDOUT "-"
+
+
+/**
+ * @brief Target of the conversion
+ */
+struct transcode_options {
+  /** @brief Number of samples: 1 gray, 2 gray and alpha, 3 RGB, 4 RGBA, 0 as the source (3 for a palette, 4 if tRNS) */
+  uint8_t sample;
+  /** @brief Depth: 8 or 16, 0 as the source (8 for less than 8 bits) */
+  uint8_t depth;
+  /** @brief First column of the crop */
+  uint32_t x;
+  /** @brief First row of the crop */
+  uint32_t y;
+  /** @brief Number of columns of the crop, 0 for the whole image (x and y are ignored) */
+  uint32_t width;
+  /** @brief Number of rows of the crop */
+  uint32_t height;
+  /** @brief zlib level, filters, zlib strategy and window (strips, threads, dictionary and limit are ignored) */
+  struct png_options png;
+};
+
+
+/**
+ * @brief Default options: same color type and depth, no crop, png_default_options
+ * @return The options
+ */
+struct transcode_options transcode_default_options(void);
+
+/**
+ * @brief Read the target from the argument of --transcode
+ * @details The argument is [<type>[<depth>][@<width>x<height>+<x>+<y>]:]<filename>, where the type
+ * is gray, graya, rgb or rgba and the depth 8 or 16, such as "rgb8:out.png" or "@64x64+0+0:out.png".
+ * When what is before the first ':' is not a target, the whole argument is the file name.
+ * @param[in] arg The argument
+ * @param[out] options The target (transcode_default_options when none)
+ * @return The file name in arg
+ */
+const char *parse_transcode(const char *arg, struct transcode_options *options);
+
+/**
+ * @brief Convert a PNG file
+ * @param[in] file A PNG file without interlace
+ * @param[in] filename Name of the output, TRANSCODE_STDOUT for the standard output (can't be the source)
+ * @param[in] options Target or NULL for transcode_default_options
+ * @return Size of the output
+ */
+uint64_t transcode_png(const struct mfile *file, const char *filename, const struct transcode_options *options);
+
+
+#endif // __TRANSCODE_H__
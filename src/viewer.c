@@ -1,8 +1,9 @@
-#include <assert.h>
+#include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "color.h"
 #include "log.h"
 #include "viewer.h"
 
@@ -13,115 +14,354 @@
 #define WINDOW_TITLE "PNG viewer"
 
 /**
- * @brief Sleeping time before polling event (ms)
+ * @brief Zoom factor of a mouse wheel step
  */
-#define DELAY (100)
+#define WHEEL_ZOOM (1.25)
+
+/**
+ * @brief Part of the window moved by an arrow key
+ */
+#define ARROW_PAN (8)
 
 
 /**
- * @brief Block until event SDL_QUIT
+ * @brief Get the texture of a tile, upload the rows built since the last call
+ * @param[in,out] viewer
+ * @param[in] level
+ * @param[in] column
+ * @param[in] row
+ * @return The cache entry of the tile (its rows may be 0 if nothing is built yet)
  */
-static void wait_until_close(void) {
+static struct viewer_tile *get_tile(struct viewer *viewer, uint8_t level, int64_t column, int64_t row) {
+  struct viewer_tile *tile = NULL;
+  struct viewer_tile *free_tile = NULL;
+  struct viewer_tile *oldest = viewer->tile;
 
-  SDL_Event event;
-  uint8_t live = 1;
+  for (uint32_t t = 0; t < VIEWER_MAX_TEXTURE; t++) {
+    struct viewer_tile *candidate = viewer->tile + t;
+    if (candidate->rows == 0) {
+      free_tile = (free_tile == NULL) ? candidate : free_tile;
+    }
+    else if ((candidate->level == level) && (candidate->column == column) && (candidate->row == row)) {
+      tile = candidate;
+      break;
+    }
+    else if (candidate->frame < oldest->frame) {
+      oldest = candidate;
+    }
+  }
 
-  while (live) {
+  if (tile == NULL) {
+    // a free entry (textures are created in order), or the least recently drawn tile
+    tile = (free_tile != NULL) ? free_tile : oldest;
+    if (tile->texture == NULL) {
+      tile->texture = sdl.CreateTexture(viewer->renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING,
+                                        PYRAMID_TILE, PYRAMID_TILE);
+      if (tile->texture == NULL) {
+        LOG_FATAL("Can't create a texture: %s", sdl.GetError());
+        exit(1);
+      }
+      sdl.SetTextureBlendMode(tile->texture, SDL_BLENDMODE_NONE);
+    }
+    tile->level  = level;
+    tile->column = column;
+    tile->row    = row;
+    tile->rows   = 0;
+  }
+  tile->frame = viewer->frame;
+
+  // rows built since the last upload
+  const struct pyramid_level *l = viewer->pyramid.level + level;
+  const uint32_t y0 = row * PYRAMID_TILE;
+  const uint32_t x0 = column * PYRAMID_TILE;
+  const uint32_t height = (l->height - y0 < PYRAMID_TILE) ? l->height - y0 : PYRAMID_TILE;
+  const uint32_t built  = (l->rows <= y0) ? 0 : (l->rows - y0 < height) ? l->rows - y0 : height;
 
-    SDL_PollEvent(&event);
-    if (event.type == SDL_QUIT) {
-      live = 0;
+  if (built > tile->rows) {
+    const SDL_Rect rect = {
+      .x = 0,
+      .y = tile->rows,
+      .w = (l->width - x0 < PYRAMID_TILE) ? l->width - x0 : PYRAMID_TILE,
+      .h = built - tile->rows,
+    };
+    const uint8_t *pixels = l->pixels + ((size_t) (y0 + tile->rows) * l->width + x0) * 4;
+    if (sdl.UpdateTexture(tile->texture, &rect, pixels, l->width * 4) != 0) {
+      LOG_FATAL("Can't update a texture: %s", sdl.GetError());
+      exit(1);
     }
-    SDL_Delay(DELAY);
+    tile->rows = built;
   }
+  return tile;
 }
 
+
 /**
- * @brief Copy image on an SDL_Surface
- * @param[in] image
- * @param[in,out] suface
+ * @brief Size of the renderer output, the view covers it
  */
-static void image_on_surface(const struct image *image, SDL_Surface *surface) {
-  assert(image->width  == surface->w);
-  assert(image->height == surface->h);
-  
-  struct color png_color;
-
-  for (uint32_t i = 0; i < image->height; i++) {
-    for (uint32_t j = 0; j < image->width; j++) {
-
-      get_color(image, i, j, &png_color);
-        
-      // png color [0, max] -> sdl [0, 255]
-      uint8_t red   = png_color.red   * 255.0 / png_color.max;
-      uint8_t green = png_color.green * 255.0 / png_color.max;
-      uint8_t blue  = png_color.blue  * 255.0 / png_color.max;
-      
-      // Transparency ratio [0:transparent, 1:opaque]
-      float a = (float) png_color.alpha / (float) png_color.max;
-
-      // Apply ransparency
-      red   = red   * a  + default_bg_color.r * (1.0 - a);
-      green = green * a  + default_bg_color.g * (1.0 - a);
-      blue  = blue  * a  + default_bg_color.b * (1.0 - a);
-      
-      uint32_t sdl_color = SDL_MapRGB(surface->format, red, green, blue);
-      ((uint32_t *) surface->pixels)[i * image->width + j] = sdl_color;
-    }
+static void output_size(struct viewer *viewer, uint32_t *width, uint32_t *height) {
+  int w, h;
+  if (sdl.GetRendererOutputSize(viewer->renderer, &w, &h) != 0) {
+    sdl.GetWindowSize(viewer->window, &w, &h);
   }
+  *width  = (w > 0) ? w : 1;
+  *height = (h > 0) ? h : 1;
+}
+
+/**
+ * @brief Mouse position in renderer pixels (high DPI windows have more pixels than points)
+ */
+static void mouse_position(struct viewer *viewer, double *x, double *y) {
+  int mx, my, w, h;
+  sdl.GetMouseState(&mx, &my);
+  sdl.GetWindowSize(viewer->window, &w, &h);
+  *x = (w > 0) ? (double) mx * viewer->view.width / w : 0;
+  *y = (h > 0) ? (double) my * viewer->view.height / h : 0;
 }
 
+/**
+ * @brief Zoom around the center of the window
+ */
+static void zoom_center(struct viewer *viewer, double zoom) {
+  view_zoom(&(viewer->view), zoom, viewer->view.width / 2.0, viewer->view.height / 2.0);
+}
 
+/**
+ * @brief Handle a key
+ * @return 0 to close the window
+ */
+static uint8_t key_event(struct viewer *viewer, SDL_Keycode key) {
+  struct view *view = &(viewer->view);
+  const double dx = (double) view->width / ARROW_PAN;
+  const double dy = (double) view->height / ARROW_PAN;
+
+  switch (key) {
+  case SDLK_ESCAPE:
+  case SDLK_q:
+    return 0;
+  case SDLK_LEFT:
+    view_pan(view, dx, 0);
+    break;
+  case SDLK_RIGHT:
+    view_pan(view, -dx, 0);
+    break;
+  case SDLK_UP:
+    view_pan(view, 0, dy);
+    break;
+  case SDLK_DOWN:
+    view_pan(view, 0, -dy);
+    break;
+  case SDLK_PLUS:
+  case SDLK_EQUALS:
+  case SDLK_KP_PLUS:
+    zoom_center(viewer, view->zoom * 2);
+    break;
+  case SDLK_MINUS:
+  case SDLK_KP_MINUS:
+    zoom_center(viewer, view->zoom / 2);
+    break;
+  case SDLK_0:
+    view_fit(view);
+    break;
+  case SDLK_1:
+    zoom_center(viewer, 1.0);
+    break;
+  default:
+    return 1;
+  }
+  viewer->dirty = 1;
+  return 1;
+}
 
-void view_image(const struct image *image) {
 
-  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-    LOG_FATAL("Can't init SDL: %s", SDL_GetError());
+
+void viewer_open(struct viewer *viewer, const struct image *image, uint32_t width, uint32_t height) {
+  if (!sdl_load()) {
+    LOG_FATAL("Can't display without SDL2 (libSDL2-2.0.so.0)");
+    exit(1);
+  }
+  if (sdl.Init(SDL_INIT_VIDEO) != 0) {
+    LOG_FATAL("Can't init SDL: %s", sdl.GetError());
     exit(1);
   }
 
-  SDL_Window *window = SDL_CreateWindow(
+  // the image, but not larger than the screen
+  SDL_Rect screen;
+  if (sdl.GetDisplayUsableBounds(0, &screen) != 0) {
+    screen.w = image->width;
+    screen.h = image->height;
+  }
+  const uint32_t max_width  = (screen.w > 10) ? (uint32_t) screen.w * 9 / 10 : image->width;
+  const uint32_t max_height = (screen.h > 10) ? (uint32_t) screen.h * 9 / 10 : image->height;
+  if (width == 0) {
+    width = (image->width < max_width) ? image->width : max_width;
+  }
+  if (height == 0) {
+    height = (image->height < max_height) ? image->height : max_height;
+  }
+
+  viewer->window = sdl.CreateWindow(
     WINDOW_TITLE,
     SDL_WINDOWPOS_UNDEFINED,
     SDL_WINDOWPOS_UNDEFINED,
-    image->width,
-    image->height,
-    SDL_WINDOW_SHOWN); // SDL_WINDOW_BORDERLESS
+    width,
+    height,
+    SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
 
-  if (window == NULL) {
-    LOG_FATAL("Can't create a window: %s", SDL_GetError());
+  if (viewer->window == NULL) {
+    LOG_FATAL("Can't create a window: %s", sdl.GetError());
     exit(1);
   }
 
-  SDL_Surface *screen = SDL_GetWindowSurface(window);
-  if (screen == NULL) {
-    LOG_FATAL("Can't get the window surface: %s", SDL_GetError());
+  viewer->renderer = sdl.CreateRenderer(viewer->window, -1, 0);
+  if (viewer->renderer == NULL) {
+    LOG_FATAL("Can't create a renderer: %s", sdl.GetError());
     exit(1);
   }
 
-  image_on_surface(image, screen);
+  memset(viewer->tile, 0, sizeof(viewer->tile));
+  viewer->frame = 0;
+  viewer->dirty = 1;
+  pyramid_init(&(viewer->pyramid), image);
 
-  SDL_UpdateWindowSurface(window);
-  wait_until_close();
-  SDL_DestroyWindow(window);
-  SDL_Quit();
+  uint32_t w, h;
+  output_size(viewer, &w, &h);
+  view_init(&(viewer->view), image->width, image->height, w, h);
+  LOG_INFO("Window %dx%d, %d levels", w, h, viewer->pyramid.nb_level);
 }
 
 
-void save_image_as_bmp(const struct image *image, const char *filename) {
+uint8_t viewer_event(struct viewer *viewer, const SDL_Event *event) {
+  switch (event->type) {
 
-  // create surface with default mask and depth
-  SDL_Surface *surface = SDL_CreateRGBSurface(0, image->width, image->height, 32, 0, 0, 0, 0);
-  if (surface == NULL) {
-    LOG_FATAL("Can't create the SDL_Surface: %s", SDL_GetError());
-    exit(1);
+  case SDL_QUIT:
+    return 0;
+
+  case SDL_KEYDOWN:
+    return key_event(viewer, event->key.keysym.sym);
+
+  case SDL_MOUSEWHEEL: {
+    double x, y;
+    mouse_position(viewer, &x, &y);
+    view_zoom(&(viewer->view), viewer->view.zoom * pow(WHEEL_ZOOM, event->wheel.y), x, y);
+    viewer->dirty = 1;
+    break;
   }
 
-  image_on_surface(image, surface);
+  case SDL_MOUSEMOTION:
+    if (event->motion.state & SDL_BUTTON_LMASK) {
+      int w, h;
+      sdl.GetWindowSize(viewer->window, &w, &h);
+      const double sx = (w > 0) ? (double) viewer->view.width / w : 1;
+      const double sy = (h > 0) ? (double) viewer->view.height / h : 1;
+      view_pan(&(viewer->view), event->motion.xrel * sx, event->motion.yrel * sy);
+      viewer->dirty = 1;
+    }
+    break;
 
-  if (SDL_SaveBMP(surface, filename) != 0) {
-    LOG_FATAL("Can't save surface as BMP: %s", SDL_GetError());
-    exit(1);
+  case SDL_WINDOWEVENT:
+    if (event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+      uint32_t w, h;
+      output_size(viewer, &w, &h);
+      view_resize(&(viewer->view), w, h);
+    }
+    viewer->dirty = 1;
+    break;
+
+  default:;
+  }
+  return 1;
+}
+
+
+void viewer_draw(struct viewer *viewer) {
+  const struct view *view = &(viewer->view);
+  const uint8_t level = view_level(view, viewer->pyramid.nb_level);
+  const struct pyramid_level *l = viewer->pyramid.level + level;
+  const double scale = (double) (1U << level); // image pixels per level pixel
+  viewer->frame++;
+
+  sdl.SetRenderDrawColor(viewer->renderer, 32, 32, 32, 255);
+  sdl.RenderClear(viewer->renderer);
+
+  int64_t tiles[4];
+  view_tiles(view, level, tiles);
+  for (int64_t row = tiles[2]; row <= tiles[3]; row++) {
+    for (int64_t column = tiles[0]; column <= tiles[1]; column++) {
+      const struct viewer_tile *tile = get_tile(viewer, level, column, row);
+      if (tile->rows == 0) {
+        continue;
+      }
+      const uint32_t x0 = column * PYRAMID_TILE;
+      const uint32_t y0 = row * PYRAMID_TILE;
+      const uint32_t width = (l->width - x0 < PYRAMID_TILE) ? l->width - x0 : PYRAMID_TILE;
+
+      // window edges of the tile: neighbour tiles share their edges
+      const double left   = floor((x0 * scale - view->x) * view->zoom);
+      const double right  = floor(((x0 + width) * scale - view->x) * view->zoom);
+      const double top    = floor((y0 * scale - view->y) * view->zoom);
+      const double bottom = floor(((y0 + tile->rows) * scale - view->y) * view->zoom);
+
+      const SDL_Rect src = {.x = 0, .y = 0, .w = width, .h = tile->rows};
+      const SDL_Rect dst = {.x = left, .y = top, .w = right - left, .h = bottom - top};
+      // pixels are sharp once magnified (the library may be newer than the headers: 0 nearest, 1 linear)
+      if (sdl.SetTextureScaleMode != NULL) {
+        sdl.SetTextureScaleMode(tile->texture, (view->zoom * scale >= 1.0) ? 0 : 1);
+      }
+      sdl.RenderCopy(viewer->renderer, tile->texture, &src, &dst);
+    }
+  }
+  sdl.RenderPresent(viewer->renderer);
+
+  char title[64];
+  snprintf(title, sizeof(title), "%s - %.0f%%", WINDOW_TITLE, view->zoom * 100);
+  sdl.SetWindowTitle(viewer->window, title);
+  viewer->dirty = 0;
+}
+
+
+void viewer_close(struct viewer *viewer) {
+  for (uint32_t t = 0; t < VIEWER_MAX_TEXTURE; t++) {
+    if (viewer->tile[t].texture != NULL) {
+      sdl.DestroyTexture(viewer->tile[t].texture);
+    }
+  }
+  pyramid_free(&(viewer->pyramid));
+  sdl.DestroyRenderer(viewer->renderer);
+  sdl.DestroyWindow(viewer->window);
+  sdl.Quit();
+}
+
+
+
+void view_image(const struct image *image) {
+  struct viewer viewer;
+  viewer_open(&viewer, image, 0, 0);
+  const uint32_t band = (image->width < PYRAMID_BUILD_PIXELS) ? PYRAMID_BUILD_PIXELS / image->width : 1;
+
+  uint8_t live = 1;
+  while (live) {
+    SDL_Event event;
+
+    if (pyramid_done(&(viewer.pyramid))) {
+      // sleep until something happens
+      if (sdl.WaitEvent(&event) == 0) {
+        LOG_FATAL("Can't wait for events: %s", sdl.GetError());
+        exit(1);
+      }
+      live = viewer_event(&viewer, &event);
+    }
+    else {
+      pyramid_build(&(viewer.pyramid), band);
+      viewer.dirty = 1;
+    }
+
+    // every pending event before drawing
+    while (live && sdl.PollEvent(&event)) {
+      live = viewer_event(&viewer, &event);
+    }
+    if (live && viewer.dirty) {
+      viewer_draw(&viewer);
+    }
   }
-  LOG_INFO("Write %s", filename);
+  viewer_close(&viewer);
 }
@@ -1,41 +1,102 @@
 /**
  * @file viewer.h
  * @brief Display a struct image
+ * @details The image goes into a mip pyramid (see pyramid.h) whose visible tiles are uploaded
+ * to streaming textures with SDL_UpdateTexture, so huge images open at once (rows show up
+ * while they are rendered) and zoom or pan only draws a few textures.
+ * Mouse wheel or +/- zoom, drag or arrows pan, 0 fits the image, 1 is actual size, Escape or q quits.
+ * The viewer runs headless with the SDL dummy video driver (SDL_VIDEODRIVER=dummy).
+ * SDL itself is only loaded when a viewer opens (see sdl.h).
  */
 
 #ifndef __VIEWER_H__
 #define __VIEWER_H__
 
-#include <SDL2/SDL.h>
+#include "sdl.h"
 
 #include "image.h"
+#include "pyramid.h"
 
 
+/** @brief Max number of tile textures */
+#define VIEWER_MAX_TEXTURE (256U)
+
+
+/**
+ * @brief Tile of the pyramid uploaded in a texture
+ */
+struct viewer_tile {
+  /** @brief Texture of PYRAMID_TILE x PYRAMID_TILE pixels or NULL */
+  SDL_Texture *texture;
+  /** @brief Level of the tile */
+  uint8_t level;
+  /** @brief Column of the tile in the level */
+  int64_t column;
+  /** @brief Row of the tile in the level */
+  int64_t row;
+  /** @brief Number of rows of the tile uploaded (0 if the texture holds no tile) */
+  uint32_t rows;
+  /** @brief Last frame the tile was drawn */
+  uint64_t frame;
+};
+
 /**
- * @brief Default background color
- * @details Alpha channel is unused
+ * @brief Window showing an image
  */
-static const SDL_Color default_bg_color = {
-  .r = 255,
-  .g = 255,
-  .b = 255,
-  .a = 255,
+struct viewer {
+  /** @brief The window */
+  SDL_Window *window;
+  /** @brief Its renderer */
+  SDL_Renderer *renderer;
+  /** @brief Pyramid of the image */
+  struct pyramid pyramid;
+  /** @brief Part of the image in the window */
+  struct view view;
+  /** @brief Texture cache */
+  struct viewer_tile tile[VIEWER_MAX_TEXTURE];
+  /** @brief Number of frames drawn */
+  uint64_t frame;
+  /** @brief Flag: the window must be drawn again */
+  uint8_t dirty;
 };
 
 
 /**
- * @brief Display the image
- * @details Blocking until the window is closed
- * @param[in] image
+ * @brief Open a window on the image
+ * @details Nothing of the pyramid is built yet (see pyramid_build)
+ * @param[out] viewer
+ * @param[in] image Image which must live as long as the viewer
+ * @param[in] width Width of the window, 0 for the image width (at most 90% of the screen)
+ * @param[in] height Height of the window, 0 for the image height (at most 90% of the screen)
  */
-void view_image(const struct image *image);
+void viewer_open(struct viewer *viewer, const struct image *image, uint32_t width, uint32_t height);
+
+/**
+ * @brief Handle an event
+ * @param[in,out] viewer
+ * @param[in] event
+ * @return 0 if the window must close, 1 otherwise
+ */
+uint8_t viewer_event(struct viewer *viewer, const SDL_Event *event);
+
+/**
+ * @brief Draw the visible tiles built so far
+ * @param[in,out] viewer
+ */
+void viewer_draw(struct viewer *viewer);
 
 /**
- * @brief Save image in a BMP file
+ * @brief Close the window
+ * @param[in,out] viewer
+ */
+void viewer_close(struct viewer *viewer);
+
+/**
+ * @brief Display the image
+ * @details Blocking until the window is closed
  * @param[in] image
- * @param[in] filename name of the file to write
  */
-void save_image_as_bmp(const struct image *image, const char *filename);
+void view_image(const struct image *image);
 
 
 #endif // __VIEWER_H__
@@ -0,0 +1,44 @@
+
+function usage() {
+    echo "$0 <png-plte> <suite folder> [<workers>]"
+}
+
+if [ $# -lt 2 ]; then
+    usage
+    exit 1
+fi
+
+
+PLTE_EXE=$1
+TST_SUITE=$2
+WORKERS=${3:-0}
+
+
+# wall time in milliseconds
+function now() {
+    echo $(( `date +%s%N` / 1000000 ))
+}
+
+
+# one process per file, as run-suite.sh
+START=`now`
+for file in $TST_SUITE/*.png
+do
+    "$PLTE_EXE" --bmp=${file/.png/.bmp} $file > /dev/null 2>&1
+done
+END=`now`
+COUNT=`ls $TST_SUITE/*.bmp | wc -l`
+echo "one process per file :" $(( END - START )) ms "  (" $COUNT .bmp ")"
+rm -f $TST_SUITE/*.bmp
+
+# one process for every file
+BATCH="bmp,completed"
+if [ $WORKERS -gt 0 ]; then
+    BATCH="$BATCH,$WORKERS"
+fi
+START=`now`
+"$PLTE_EXE" --batch=$BATCH $TST_SUITE | tail -2
+END=`now`
+COUNT=`ls $TST_SUITE/*.bmp | wc -l`
+echo "--batch=$BATCH :" $(( END - START )) ms "  (" $COUNT .bmp ")"
+rm -f $TST_SUITE/*.bmp
@@ -0,0 +1,33 @@
+
+function usage() {
+    echo "$0 <png-plte> <bench-serve> <suite folder> [<clients>]"
+}
+
+if [ $# -lt 3 ]; then
+    usage
+    exit 1
+fi
+
+
+PLTE_EXE=$1
+BENCH_EXE=$2
+TST_SUITE=$3
+CLIENTS=${4:-4}
+SOCKET=/tmp/png-plte-bench-$$.sock
+
+
+# the suite decoded again and again: without cache, then with the default cache
+for OPTIONS in cache0 cache64
+do
+    "$PLTE_EXE" --serve=$OPTIONS $SOCKET &
+    DAEMON=$!
+    while [ ! -S $SOCKET ]
+    do
+        sleep 0.1
+    done
+    echo "--serve=$OPTIONS"
+    "$BENCH_EXE" $SOCKET "$TST_SUITE/basn*.png" $CLIENTS 500 decode
+    "$BENCH_EXE" $SOCKET "$TST_SUITE/basn*.png" $CLIENTS 500 convert:rgba8
+    kill -TERM $DAEMON
+    wait $DAEMON
+done
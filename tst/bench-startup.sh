@@ -0,0 +1,39 @@
+
+function usage() {
+    echo "$0 <png file> <runs> <png-plte> [<png-plte>...]"
+}
+
+if [ $# -lt 3 ]; then
+    usage
+    exit 1
+fi
+
+
+PNG_FILE=$1
+RUNS=$2
+shift 2
+
+
+# mean wall time of a run in microseconds
+function bench() {
+    local start=`date +%s%N`
+    for ((i = 0; i < $RUNS; i++))
+    do
+        "$@" > /dev/null
+    done
+    local end=`date +%s%N`
+    echo $(( (end - start) / RUNS / 1000 ))
+}
+
+
+# the cost of fork + exec alone
+FLOOR=`bench $(type -P true)`
+echo "true" ":" $FLOOR us
+
+for PLTE_EXE in "$@"
+do
+    "$PLTE_EXE" --chunk "$PNG_FILE" > /dev/null || exit 1
+    TIME=`bench "$PLTE_EXE" --chunk "$PNG_FILE"`
+    LIBS=`ldd "$PLTE_EXE" 2> /dev/null | wc -l`
+    echo "$PLTE_EXE --chunk" ":" $TIME us "  (" $(( TIME - FLOOR )) us over true, $LIBS shared libraries ")"
+done
@@ -0,0 +1,118 @@
+/**
+ * @file bench-filter.c
+ * @brief Benchmark the filter strategies of the PNG writer
+ * @details For a PNG file: throughput of the five filters of each row at once (filter_all),
+ * then time and size of the file written with each fixed type, the heuristic and the brute force.
+ *
+ * usage: bench-filter <png file> [<output file>]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "filter.h"
+#include "image.h"
+#include "mfile.h"
+#include "png.h"
+
+
+/** @brief Output file by default */
+#define BENCH_OUTPUT "/tmp/bench-filter.png"
+/** @brief Min number of filtered bytes to time filter_all */
+#define BENCH_BYTES (1U << 28)
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/**
+ * @brief Time filter_all over every row, again and again
+ * @param[in] image
+ */
+static void bench_filter_all(const struct image *image) {
+  const uint32_t lsize = line_size(image);
+  const uint8_t bpp = (image->depth * image->sample + 7) / 8;
+  const uint8_t *data = image->data;
+  uint8_t *candidate = malloc((size_t) NB_FILTER * lsize);
+  uint64_t cost[NB_FILTER];
+  uint64_t total = 0;
+  uint64_t bytes = 0;
+
+  const double start = now();
+  do {
+    for (uint32_t r = 0; r < image->height; r++) {
+      filter_all(data + (size_t) r * lsize, (r > 0) ? data + (size_t) (r - 1) * lsize : NULL, lsize, bpp, candidate,
+                 cost);
+      total += cost[0];
+    }
+    bytes += (uint64_t) lsize * image->height;
+  } while (bytes < BENCH_BYTES);
+  const double elapsed = now() - start;
+
+  printf("filter_all   %8.1f MB/s  (%llu bytes, 5 types, checksum %llu)\n", bytes / elapsed * 1e-6,
+         (unsigned long long) bytes, (unsigned long long) total);
+  free(candidate);
+}
+
+/**
+ * @brief Write the file with some options
+ * @param[in] name Name of the strategy
+ * @param[in] image
+ * @param[in] options
+ * @param[in] output
+ */
+static void bench_write(const char *name, const struct image *image, const struct png_options *options,
+                        const char *output) {
+  const double start = now();
+  const uint64_t size = write_png(image, output, options);
+  const double elapsed = now() - start;
+  printf("%-12s %8.3f s  %12llu bytes\n", name, elapsed, (unsigned long long) size);
+}
+
+
+
+int main(int argc, char *argv[]) {
+  if ((argc < 2) || (argc > 3)) {
+    fprintf(stderr, "usage: %s <png file> [<output file>]\n", argv[0]);
+    return 1;
+  }
+  const char *output = (argc == 3) ? argv[2] : BENCH_OUTPUT;
+
+  const struct mfile file = map_file(argv[1]);
+  if (!mfile_is_png(&file)) {
+    fprintf(stderr, "%s is not a PNG\n", argv[1]);
+    return 1;
+  }
+  const struct image image = get_image(&file);
+  unmap_file(&file);
+  printf("%s: %ux%u, %d x %d bits\n", argv[1], image.width, image.height, image.sample, image.depth);
+
+  bench_filter_all(&image);
+
+  struct png_options options = png_default_options();
+  options.filter = FILTER_FIXED;
+  const char *names[NB_FILTER] = {"none", "sub", "up", "average", "paeth"};
+  for (uint8_t type = 0; type < NB_FILTER; type++) {
+    options.filter_type = type;
+    bench_write(names[type], &image, &options, output);
+  }
+  options.filter = FILTER_HEURISTIC;
+  bench_write("heuristic", &image, &options, output);
+  options.filter = FILTER_BRUTE;
+  bench_write("brute", &image, &options, output);
+
+  free_image(&image);
+  remove(output);
+  return 0;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file bench-serve.c
+ * @brief Load generator of the decode daemon (png-plte --serve)
+ * @details Each client is a thread with its own connection, sending requests one after the other
+ * over the files of a list (each client starts at another file). The pixels of each answer are read
+ * through the memfd mapping, one byte per page. Prints the throughput and the latencies.
+ *
+ * usage: bench-serve <socket> <directory, glob or -> [<clients> [<requests per client> [<request>]]]
+ * with request decode (default), probe or convert:<format>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "serve.h"
+
+
+/** @brief Default number of clients */
+#define BENCH_CLIENTS (4U)
+/** @brief Default number of requests of each client */
+#define BENCH_REQUESTS (1000U)
+/** @brief Max number of clients */
+#define BENCH_MAX_CLIENTS (256U)
+
+
+/**
+ * @brief A client
+ */
+struct client {
+  /** @brief Path of the socket */
+  const char *path;
+  /** @brief Files requested */
+  char **files;
+  /** @brief Number of files */
+  uint32_t nb_file;
+  /** @brief Command, with a space after it */
+  const char *command;
+  /** @brief Index of the client */
+  uint32_t index;
+  /** @brief Number of requests */
+  uint32_t nb;
+  /** @brief Latency of each request in seconds */
+  double *latency;
+  /** @brief Number of error answers */
+  uint32_t errors;
+  /** @brief Bytes of pixels received */
+  uint64_t bytes;
+  /** @brief Sum of the bytes read (so they are read) */
+  uint64_t checksum;
+};
+
+
+/**
+ * @brief Monotonic time
+ * @return Seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Compare two latencies for qsort
+ */
+static int compare_latency(const void *a, const void *b) {
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Send the requests of a client
+ * @param[in,out] arg The struct client
+ * @return NULL
+ */
+static void *run_client(void *arg) {
+  struct client *client = arg;
+  const int fd = serve_connect(client->path);
+  if (fd < 0) {
+    fprintf(stderr, "can't connect to %s\n", client->path);
+    client->errors = client->nb;
+    return NULL;
+  }
+  const size_t page = sysconf(_SC_PAGESIZE);
+  char request[SERVE_LINE_SIZE], line[256];
+  for (uint32_t r = 0; r < client->nb; r++) {
+    const char *file = client->files[(client->index + r) % client->nb_file];
+    snprintf(request, sizeof(request), "%s%s", client->command, file);
+
+    const double start = now();
+    int memfd;
+    if (!serve_request(fd, request, line, sizeof(line), &memfd)) {
+      client->errors++;
+    }
+    if (memfd >= 0) {
+      struct stat st;
+      if ((fstat(memfd, &st) == 0) && (st.st_size > 0)) {
+        const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, memfd, 0);
+        if (data != MAP_FAILED) {
+          for (off_t k = 0; k < st.st_size; k += page) {
+            client->checksum += data[k];
+          }
+          munmap((void *) data, st.st_size);
+        }
+        client->bytes += st.st_size;
+      }
+      close(memfd);
+    }
+    client->latency[r] = now() - start;
+  }
+  close(fd);
+  return NULL;
+}
+
+
+
+int main(int argc, char *argv[]) {
+  if ((argc < 3) || (argc > 6)) {
+    fprintf(stderr, "usage: %s <socket> <directory, glob or -> [<clients> [<requests per client> [<request>]]]\n",
+            argv[0]);
+    return 1;
+  }
+  const uint32_t nb_client = (argc > 3) ? (uint32_t) atoi(argv[3]) : BENCH_CLIENTS;
+  const uint32_t nb_request = (argc > 4) ? (uint32_t) atoi(argv[4]) : BENCH_REQUESTS;
+  if ((nb_client == 0) || (nb_client > BENCH_MAX_CLIENTS) || (nb_request == 0)) {
+    fprintf(stderr, "1 to %u clients, at least one request\n", BENCH_MAX_CLIENTS);
+    return 1;
+  }
+  // convert:rgba8 is sent as "convert rgba8 <file>"
+  char command[64] = "decode ";
+  if (argc > 5) {
+    snprintf(command, sizeof(command), "%s ", argv[5]);
+    char *colon = strchr(command, ':');
+    if (colon != NULL) {
+      *colon = ' ';
+    }
+  }
+  uint32_t nb_file;
+  char **files = list_batch(argv[2], &nb_file);
+  if (nb_file == 0) {
+    fprintf(stderr, "no file in %s\n", argv[2]);
+    return 1;
+  }
+
+  struct client client[BENCH_MAX_CLIENTS];
+  pthread_t thread[BENCH_MAX_CLIENTS];
+  double *latency = malloc((size_t) nb_client * nb_request * sizeof(double));
+  const double start = now();
+  for (uint32_t c = 0; c < nb_client; c++) {
+    const struct client init = {
+      .path     = argv[1],
+      .files    = files,
+      .nb_file  = nb_file,
+      .command  = command,
+      .index    = c * nb_file / nb_client,
+      .nb       = nb_request,
+      .latency  = latency + (size_t) c * nb_request,
+      .errors   = 0,
+      .bytes    = 0,
+      .checksum = 0,
+    };
+    client[c] = init;
+    pthread_create(thread + c, NULL, run_client, client + c);
+  }
+  uint32_t errors = 0;
+  uint64_t bytes = 0, checksum = 0;
+  for (uint32_t c = 0; c < nb_client; c++) {
+    pthread_join(thread[c], NULL);
+    errors   += client[c].errors;
+    bytes    += client[c].bytes;
+    checksum += client[c].checksum;
+  }
+  const double elapsed = now() - start;
+
+  const size_t total = (size_t) nb_client * nb_request;
+  qsort(latency, total, sizeof(double), compare_latency);
+  printf("%u clients x %u requests \"%s<file>\" over %u files: %.3f s (%u errors, checksum %llu)\n", nb_client,
+         nb_request, command, nb_file, elapsed, errors, (unsigned long long) checksum);
+  printf("%.1f requests/s  %.1f MB/s of pixels  latency p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+         total / elapsed, bytes / elapsed * 1e-6, latency[total / 2] * 1e3, latency[total * 99 / 100] * 1e3,
+         latency[total - 1] * 1e3);
+
+  free(latency);
+  free_batch_list(files, nb_file);
+  return errors > 0;
+}
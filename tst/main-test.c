@@ -14,6 +14,28 @@
 #include "test-chunk.h"
 #include "test-image.h"
 #include "test-filter.h"
+#include "test-expand.h"
+#include "test-index.h"
+#include "test-convert.h"
+#include "test-gamma.h"
+#include "test-icc.h"
+#include "test-composite.h"
+#include "test-quantize.h"
+#include "test-stats.h"
+#include "test-bmp.h"
+#include "test-pnm.h"
+#include "test-png.h"
+#include "test-optimize.h"
+#include "test-rewrite.h"
+#include "test-transcode.h"
+#include "test-batch.h"
+#include "test-scheduler.h"
+#include "test-prefetch.h"
+#include "test-serve.h"
+#include "test-pyramid.h"
+#ifndef HEADLESS
+#include "test-viewer.h"
+#endif
 
 
 CU_pSuite add_suite(const char* strName, CU_InitializeFunc pInit, CU_CleanupFunc pClean) {
@@ -63,12 +85,147 @@ int main() {
   add_test(pSuite4, "Image pixel per pixel basn2c16.png", test_image_basn2c16);
   add_test(pSuite4, "Image pixel per pixel basn4a08.png", test_image_basn4a08);
   add_test(pSuite4, "Image pixel per pixel pp0n6a08.png", test_image_pp0n6a08);
+  add_test(pSuite4, "Crop against full image", test_image_crop);
+  add_test(pSuite4, "Downscale against full image", test_image_scaled);
+  add_test(pSuite4, "Bands against full image", test_image_stream);
+  add_test(pSuite4, "Checked decode against full image", test_image_checked);
+  add_test(pSuite4, "Limits of a decode", test_image_limits);
+  add_test(pSuite4, "Corrupt files", test_image_corrupt);
+  add_test(pSuite4, "Chunks of the wrong length", test_image_bad_chunks);
 
   CU_pSuite pSuite5 = add_suite("Filter", init_test_filter, clean_test_filter);
   add_test(pSuite5, "Sub (1)", test_filter_sub);
   add_test(pSuite5, "Up (2)", test_filter_up);
   add_test(pSuite5, "Average (3)", test_filter_average);
   add_test(pSuite5, "Paeth (4)", test_filter_paeth);
+  add_test(pSuite5, "Five types at once", test_filter_all);
+  add_test(pSuite5, "Strategies", test_filter_strategy);
+
+  CU_pSuite pSuite6 = add_suite("Expand", init_test_expand, clean_test_expand);
+  add_test(pSuite6, "Expand packed bytes", test_expand_values);
+  add_test(pSuite6, "Expand gray 1 2 4 8", test_expand_gray);
+  add_test(pSuite6, "Expand palette index 1 2 4 8", test_expand_index);
+
+  CU_pSuite pSuite7 = add_suite("Index", init_test_index, clean_test_index);
+  add_test(pSuite7, "Crop from checkpoints", test_index_crop);
+  add_test(pSuite7, "Sidecar file", test_index_sidecar);
+
+  CU_pSuite pSuite8 = add_suite("Convert", init_test_convert, clean_test_convert);
+  add_test(pSuite8, "8-bit formats against get_color", test_convert_8bit);
+  add_test(pSuite8, "RGBA16 and float against get_color", test_convert_wide);
+  add_test(pSuite8, "Band of rows with stride", test_convert_rows);
+  add_test(pSuite8, "Rounded and dithered 16 to 8 bits", test_convert_reduce);
+
+  CU_pSuite pSuite9 = add_suite("Gamma", init_test_gamma, clean_test_gamma);
+  add_test(pSuite9, "Transfer curves", test_gamma_value);
+  add_test(pSuite9, "Gamma of the file", test_gamma_file);
+  add_test(pSuite9, "Correct converted rows", test_gamma_rows);
+  add_test(pSuite9, "Cached tables", test_gamma_cache);
+   
+  CU_pSuite pSuite10 = add_suite("ICC", init_test_icc, clean_test_icc);
+  add_test(pSuite10, "sRGB profile", test_icc_srgb);
+  add_test(pSuite10, "Wide gamut profile", test_icc_wide_gamut);
+  add_test(pSuite10, "Gray profile", test_icc_gray);
+  add_test(pSuite10, "Cached transforms", test_icc_cache);
+  add_test(pSuite10, "Threaded bands", test_icc_threads);
+   
+  CU_pSuite pSuite11 = add_suite("Composite", init_test_composite, clean_test_composite);
+  add_test(pSuite11, "Background of the file", test_background_file);
+  add_test(pSuite11, "8-bit compositing", test_composite_8);
+  add_test(pSuite11, "16-bit compositing", test_composite_16);
+  add_test(pSuite11, "Float compositing", test_composite_float);
+   
+  CU_pSuite pSuite12 = add_suite("Quantize", init_test_quantize, clean_test_quantize);
+  add_test(pSuite12, "Exact colors", test_quantize_exact);
+  add_test(pSuite12, "Error of the palette", test_quantize_error);
+  add_test(pSuite12, "Dithering", test_quantize_dither);
+   
+  CU_pSuite pSuite13 = add_suite("Stats", init_test_stats, clean_test_stats);
+  add_test(pSuite13, "Statistics of files", test_stats_file);
+  add_test(pSuite13, "Distinct colors", test_stats_colors);
+  add_test(pSuite13, "Alpha bounding box", test_stats_alpha_box);
+   
+  CU_pSuite pSuite14 = add_suite("BMP", init_test_bmp, clean_test_bmp);
+  add_test(pSuite14, "24-bit BMP", test_bmp_24);
+  add_test(pSuite14, "32-bit BMP", test_bmp_32);
+  add_test(pSuite14, "Batches of rows", test_bmp_batches);
+  add_test(pSuite14, "Files not written", test_bmp_errors);
+   
+  CU_pSuite pSuite15 = add_suite("PNM", init_test_pnm, clean_test_pnm);
+  add_test(pSuite15, "8-bit PPM, PAM and raw", test_pnm_8);
+  add_test(pSuite15, "16-bit PPM, PAM and raw", test_pnm_16);
+  add_test(pSuite15, "Rows written as decoded", test_pnm_passthrough);
+  add_test(pSuite15, "Output to a pipe", test_pnm_pipe);
+  add_test(pSuite15, "Files not written", test_pnm_errors);
+   
+  CU_pSuite pSuite16 = add_suite("Pyramid", init_test_pyramid, clean_test_pyramid);
+  add_test(pSuite16, "Levels by bands", test_pyramid_levels);
+  add_test(pSuite16, "Zoom and pan", test_view_zoom);
+  add_test(pSuite16, "Visible tiles", test_view_tiles);
+   
+#ifndef HEADLESS
+  CU_pSuite pSuite17 = add_suite("Viewer", init_test_viewer, clean_test_viewer);
+  add_test(pSuite17, "Draw the whole image", test_viewer_draw);
+  add_test(pSuite17, "Zoom on a large image", test_viewer_zoom);
+  add_test(pSuite17, "Events", test_viewer_events);
+#endif
+   
+  CU_pSuite pSuite18 = add_suite("PNG", init_test_png, clean_test_png);
+  add_test(pSuite18, "Files of the suite written back", test_png_suite);
+  add_test(pSuite18, "Same file on any number of threads", test_png_threads);
+  add_test(pSuite18, "Strips decoded alone", test_png_strips);
+  add_test(pSuite18, "Filter strategies", test_png_filters);
+  add_test(pSuite18, "Files not written", test_png_errors);
+  add_test(pSuite18, "tRNS and color space copied", test_png_transparency);
+   
+  CU_pSuite pSuite19 = add_suite("Optimize", init_test_optimize, clean_test_optimize);
+  add_test(pSuite19, "Lossless color reduction", test_optimize_reduce);
+  add_test(pSuite19, "Files of the suite optimized", test_optimize_suite);
+  add_test(pSuite19, "Same file on any number of threads", test_optimize_trials);
+  add_test(pSuite19, "Chunks copied, never larger than the source", test_optimize_chunks);
+   
+  CU_pSuite pSuite20 = add_suite("Rewrite", init_test_rewrite, clean_test_rewrite);
+  add_test(pSuite20, "Copied as it is", test_rewrite_copy);
+  add_test(pSuite20, "Metadata stripped, IDAT merged", test_rewrite_clean);
+  add_test(pSuite20, "Metadata moved before the image data", test_rewrite_metadata_first);
+  add_test(pSuite20, "Index of the strips", test_rewrite_index);
+   
+  CU_pSuite pSuite21 = add_suite("Transcode", init_test_transcode, clean_test_transcode);
+  add_test(pSuite21, "Same color type", test_transcode_same);
+  add_test(pSuite21, "Color type and depth converted", test_transcode_convert);
+  add_test(pSuite21, "Crop", test_transcode_crop);
+  add_test(pSuite21, "Ancillary chunks copied", test_transcode_chunks);
+  add_test(pSuite21, "tRNS written again or turned into alpha", test_transcode_trns);
+  add_test(pSuite21, "Target of --transcode", test_transcode_parse);
+   
+  CU_pSuite pSuite22 = add_suite("Batch", init_test_batch, clean_test_batch);
+  add_test(pSuite22, "Files of a directory, a glob or a list", test_batch_list);
+  add_test(pSuite22, "Results in order", test_batch_ordered);
+  add_test(pSuite22, "Results as completed", test_batch_completed);
+  add_test(pSuite22, "Images saved to BMP", test_batch_bmp);
+  add_test(pSuite22, "Options of --batch", test_batch_parse);
+  add_test(pSuite22, "Limits of each file", test_batch_limits);
+   
+  CU_pSuite pSuite23 = add_suite("Scheduler", init_test_sched, clean_test_sched);
+  add_test(pSuite23, "Every index run once", test_sched_run);
+  add_test(pSuite23, "Tasks pushed from tasks", test_sched_nested);
+  add_test(pSuite23, "One worker", test_sched_single);
+  add_test(pSuite23, "Pieces of a kernel", test_sched_pieces);
+   
+  CU_pSuite pSuite24 = add_suite("Read ahead", init_test_prefetch, clean_test_prefetch);
+  add_test(pSuite24, "Files read ahead", test_prefetch_files);
+  add_test(pSuite24, "Files in another order", test_prefetch_order);
+  add_test(pSuite24, "Files not taken", test_prefetch_close);
+  add_test(pSuite24, "Files missing", test_prefetch_missing);
+   
+  CU_pSuite pSuite25 = add_suite("Serve", init_test_serve, clean_test_serve);
+  add_test(pSuite25, "Probe, decode and convert", test_serve_requests);
+  add_test(pSuite25, "Wrong requests", test_serve_errors);
+  add_test(pSuite25, "Answers cached", test_serve_cache);
+  add_test(pSuite25, "Options of --serve", test_serve_parse);
+  add_test(pSuite25, "Limits and corrupt files", test_serve_limits);
+  add_test(pSuite25, "Idle connections", test_serve_idle);
+  add_test(pSuite25, "Socket path taken", test_serve_taken);
    
   /* Run all tests using the CUnit Basic interface */
   CU_basic_run_tests();
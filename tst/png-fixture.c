@@ -0,0 +1,79 @@
+/**
+ * @file png-fixture.c
+ * @brief Build and check PNG files byte by byte in the tests
+ * @details
+ */
+
+#include <string.h>
+#include <zlib.h>
+
+#include "png-fixture.h"
+
+#include "mfile.h"
+
+
+
+uint32_t get32(const uint8_t *ptr) {
+  return ((uint32_t) ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+}
+
+void put32(uint8_t *ptr, uint32_t v) {
+  ptr[0] = v >> 24;
+  ptr[1] = v >> 16;
+  ptr[2] = v >> 8;
+  ptr[3] = v;
+}
+
+
+uint32_t chunk_bytes(uint8_t *out, const char *type, const void *data, uint32_t length) {
+  put32(out, length);
+  memcpy(out + 4, type, 4);
+  if (length > 0) {
+    memcpy(out + 8, data, length);
+  }
+  put32(out + 8 + length, crc32(0L, out + 4, 4 + length));
+  return 12 + length;
+}
+
+void put_chunk(FILE *f, const char *type, const void *data, uint32_t length) {
+  uint8_t head[8], tail[4];
+  put32(head, length);
+  memcpy(head + 4, type, 4);
+  uLong crc = crc32(0L, (const Bytef *) type, 4);
+  fwrite(head, 1, 8, f);
+  if (length > 0) {
+    crc = crc32(crc, data, length);
+    fwrite(data, 1, length, f);
+  }
+  put32(tail, crc);
+  fwrite(tail, 1, 4, f);
+}
+
+
+uint32_t chunk_types(const char *filename, char *types, uint32_t *nb_idat) {
+  const struct mfile file = map_file(filename);
+  CU_ASSERT(mfile_is_png(&file));
+  const uint8_t *ptr = ((const uint8_t *) file.data) + 8;
+  uint32_t nb = 0, nb_type = 0, nb_data = 0;
+  for (;;) {
+    nb++;
+    const uint32_t length = get32(ptr);
+    CU_ASSERT_EQUAL(get32(ptr + 8 + length), crc32(0L, ptr + 4, 4 + length));
+    const uint8_t idat = (memcmp(ptr + 4, "IDAT", 4) == 0);
+    if (!idat || (nb_type == 0) || (memcmp(types + 4 * (nb_type - 1), "IDAT", 4) != 0)) {
+      memcpy(types + 4 * nb_type++, ptr + 4, 4);
+    }
+    nb_data += idat;
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      CU_ASSERT_EQUAL(ptr + 12, ((const uint8_t *) file.data) + file.size);
+      break;
+    }
+    ptr += 12 + length;
+  }
+  types[4 * nb_type] = '\0';
+  unmap_file(&file);
+  if (nb_idat != NULL) {
+    *nb_idat = nb_data;
+  }
+  return nb;
+}
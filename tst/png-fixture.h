@@ -0,0 +1,57 @@
+/**
+ * @file png-fixture.h
+ * @brief Build and check PNG files byte by byte in the tests
+ * @details
+ */
+
+#ifndef __PNG_FIXTURE_H__
+#define __PNG_FIXTURE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <CUnit/Basic.h>
+
+
+
+/**
+ * @brief Read a big endian 32-bit number
+ */
+uint32_t get32(const uint8_t *ptr);
+
+/**
+ * @brief Write a big endian 32-bit number
+ */
+void put32(uint8_t *ptr, uint32_t v);
+
+/**
+ * @brief Whole chunk (length, type, data and CRC) in memory
+ * @param[out] out At least 12 + length bytes
+ * @param[in] type
+ * @param[in] data Or NULL if length is 0
+ * @param[in] length
+ * @return Size of the chunk
+ */
+uint32_t chunk_bytes(uint8_t *out, const char *type, const void *data, uint32_t length);
+
+/**
+ * @brief Write a whole chunk in a file
+ * @param[in,out] f
+ * @param[in] type
+ * @param[in] data Or NULL if length is 0
+ * @param[in] length
+ */
+void put_chunk(FILE *f, const char *type, const void *data, uint32_t length);
+
+/**
+ * @brief Types of the chunks of a file, every CRC checked, consecutive IDAT listed once
+ * @param[in] filename
+ * @param[out] types The types one after the other, without separator
+ * @param[out] nb_idat Number of IDAT chunks, or NULL
+ * @return Number of chunks
+ */
+uint32_t chunk_types(const char *filename, char *types, uint32_t *nb_idat);
+
+
+
+#endif // __PNG_FIXTURE_H__
@@ -0,0 +1,283 @@
+/**
+ * @file test-batch.c
+ * @brief Test the batch mode
+ * @details
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test-batch.h"
+
+#include "batch.h"
+#include "image.h"
+#include "mfile.h"
+
+
+#define NB_FILE (8U)
+
+
+/** @brief Files of a batch: images, a missing file, a file not PNG, an interlaced image */
+static char *files[NB_FILE] = {"suite/basn0g01.png", "suite/basn2c16.png", "suite/missing.png",
+                               "suite/basn3p02.png", "suite/PngSuite.README", "suite/basi0g08.png",
+                               "suite/basn6a08.png", "suite/s01n2c08.png"};
+/** @brief Status of each file */
+static const enum batch_status status[NB_FILE] = {BATCH_OK, BATCH_OK, BATCH_NOT_FOUND, BATCH_OK, BATCH_NOT_PNG,
+                                                  BATCH_INTERLACED, BATCH_OK, BATCH_OK};
+
+/** @brief Indexes of the results, as given */
+static uint32_t reported[NB_FILE];
+/** @brief Number of results given */
+static uint32_t nb_reported;
+
+
+/**
+ * @brief Callback of the results
+ */
+static void report(const struct batch_result *result) {
+  if (nb_reported < NB_FILE) {
+    reported[nb_reported] = result->index;
+  }
+  nb_reported++;
+  CU_ASSERT_EQUAL(result->filename, files[result->index]);
+  CU_ASSERT_EQUAL(result->status, status[result->index]);
+}
+
+/**
+ * @brief Check the summary of the batch of files
+ */
+static void check_stats(const struct batch_stats *stats) {
+  CU_ASSERT_EQUAL(stats->nb_file, NB_FILE);
+  CU_ASSERT_EQUAL(stats->nb_failed, 3);
+  uint64_t pixels = 0, bytes = 0;
+  for (uint32_t k = 0; k < NB_FILE; k++) {
+    if (status[k] == BATCH_OK) {
+      const struct mfile file = map_file(files[k]);
+      const struct image image = get_image(&file);
+      pixels += (uint64_t) image.width * image.height;
+      bytes += file.size;
+      free_image(&image);
+      unmap_file(&file);
+    }
+  }
+  CU_ASSERT_EQUAL(stats->pixels, pixels);
+  CU_ASSERT_EQUAL(stats->bytes, bytes);
+}
+
+
+
+int init_test_batch(void) {
+  return 0;
+}
+
+int clean_test_batch(void) {
+  return 0;
+}
+
+
+
+void test_batch_list(void) {
+  uint32_t nb;
+
+  // a glob, sorted
+  char **list = list_batch("suite/basn0g0*.png", &nb);
+  CU_ASSERT_EQUAL(nb, 4);
+  for (uint32_t k = 0; k < nb; k++) {
+    char name[32];
+    snprintf(name, sizeof(name), "suite/basn0g0%d.png", 1 << k);
+    CU_ASSERT_EQUAL(strcmp(list[k], name), 0);
+  }
+  free_batch_list(list, nb);
+  list = list_batch("suite/nothing*.png", &nb);
+  CU_ASSERT_EQUAL(nb, 0);
+  free_batch_list(list, nb);
+
+  // a directory: every .png file, sorted
+  char **all = list_batch("suite/", &nb);
+  uint32_t nb_all;
+  list = list_batch("suite/*.png", &nb_all);
+  CU_ASSERT_EQUAL(nb, nb_all);
+  for (uint32_t k = 0; (k < nb) && (nb == nb_all); k++) {
+    CU_ASSERT_EQUAL(strcmp(all[k], list[k]), 0);
+  }
+  free_batch_list(all, nb);
+  free_batch_list(list, nb_all);
+
+  // lines (with carriage returns and empty lines) or NUL separated names
+  static const char lines[] = "a.png\r\n\nb c.png\nd.png";
+  static const char nul[] = "a.png\0b\nc.png\0\0d.png\0";
+  const char *text[2] = {lines, nul};
+  const size_t size[2] = {sizeof(lines) - 1, sizeof(nul) - 1};
+  const char *second[2] = {"b c.png", "b\nc.png"};
+  for (uint8_t t = 0; t < 2; t++) {
+    FILE *in = fmemopen((void *) text[t], size[t], "r");
+    list = read_batch_list(in, &nb);
+    fclose(in);
+    CU_ASSERT_EQUAL(nb, 3);
+    if (nb == 3) {
+      CU_ASSERT_EQUAL(strcmp(list[0], "a.png"), 0);
+      CU_ASSERT_EQUAL(strcmp(list[1], second[t]), 0);
+      CU_ASSERT_EQUAL(strcmp(list[2], "d.png"), 0);
+    }
+    free_batch_list(list, nb);
+  }
+}
+
+
+void test_batch_ordered(void) {
+  for (uint8_t threads = 1; threads <= 4; threads++) {
+    struct batch_options options = batch_default_options();
+    options.threads = threads;
+    // without read ahead, with io_uring and with its fallback
+    options.ahead = (threads == 1) ? 0 : threads;
+    options.io    = (threads == 4) ? PREFETCH_ADVISE : PREFETCH_URING;
+    nb_reported = 0;
+    const struct batch_stats stats = run_batch(files, NB_FILE, &options, report);
+    CU_ASSERT_EQUAL(nb_reported, NB_FILE);
+    for (uint32_t k = 0; k < NB_FILE; k++) {
+      CU_ASSERT_EQUAL(reported[k], k);
+    }
+    CU_ASSERT_EQUAL(stats.threads, threads);
+    // every file decoded was read ahead (io_uring may fall back)
+    CU_ASSERT_EQUAL(stats.io_files, (options.ahead > 0) ? 5 : 0);
+    CU_ASSERT((options.ahead > 0) ? stats.io != PREFETCH_OFF : stats.io == PREFETCH_OFF);
+    check_stats(&stats);
+  }
+}
+
+
+void test_batch_completed(void) {
+  struct batch_options options = batch_default_options();
+  options.order   = BATCH_COMPLETED;
+  options.threads = 3;
+  nb_reported = 0;
+  const struct batch_stats stats = run_batch(files, NB_FILE, &options, report);
+
+  // each file once
+  CU_ASSERT_EQUAL(nb_reported, NB_FILE);
+  uint8_t seen[NB_FILE] = {0};
+  for (uint32_t k = 0; k < NB_FILE; k++) {
+    seen[reported[k]]++;
+  }
+  for (uint32_t k = 0; k < NB_FILE; k++) {
+    CU_ASSERT_EQUAL(seen[k], 1);
+  }
+  check_stats(&stats);
+
+  // more workers than files, no file
+  options.threads = 16;
+  CU_ASSERT_EQUAL(run_batch(files, 2, &options, NULL).threads, 2);
+  CU_ASSERT_EQUAL(run_batch(files, 0, &options, NULL).nb_file, 0);
+}
+
+
+/**
+ * @brief Callback of the results of test_batch_bmp, the BMP of the first file blocked
+ */
+static void report_not_written(const struct batch_result *result) {
+  const uint8_t blocked = strcmp(result->filename, files[0]) == 0;
+  CU_ASSERT_EQUAL(result->status, blocked ? BATCH_NOT_WRITTEN : BATCH_OK);
+  CU_ASSERT_EQUAL(result->width, 32);
+}
+
+void test_batch_bmp(void) {
+  struct batch_options options = batch_default_options();
+  options.action  = BATCH_BMP;
+  options.threads = 2;
+  const struct batch_stats stats = run_batch(files, NB_FILE, &options, NULL);
+  CU_ASSERT_EQUAL(stats.nb_failed, 3);
+
+  // a BMP file for each image decoded
+  for (uint32_t k = 0; k < NB_FILE; k++) {
+    const size_t length = strlen(files[k]);
+    if (strcmp(files[k] + length - 4, ".png") != 0) {
+      continue;
+    }
+    char name[64];
+    memcpy(name, files[k], length - 4);
+    strcpy(name + length - 4, ".bmp");
+    CU_ASSERT_EQUAL(access(name, F_OK) == 0, status[k] == BATCH_OK);
+    remove(name);
+  }
+
+  // a BMP that can't be written fails its file, not the batch
+  CU_ASSERT_EQUAL(mkdir("suite/basn0g01.bmp", 0755), 0);
+  const struct batch_stats blocked = run_batch(files, 2, &options, report_not_written);
+  CU_ASSERT_EQUAL(blocked.nb_failed, 1);
+  rmdir("suite/basn0g01.bmp");
+  remove("suite/basn2c16.bmp");
+}
+
+
+void test_batch_parse(void) {
+  struct batch_options options;
+
+  CU_ASSERT(parse_batch("decode", &options));
+  CU_ASSERT_EQUAL(options.action, BATCH_DECODE);
+  CU_ASSERT_EQUAL(options.order, BATCH_ORDERED);
+  CU_ASSERT_EQUAL(options.threads, 0);
+  CU_ASSERT_EQUAL(options.ahead, 8);
+  CU_ASSERT_EQUAL(options.io, PREFETCH_URING);
+
+  CU_ASSERT(parse_batch("bmp,12,completed", &options));
+  CU_ASSERT_EQUAL(options.action, BATCH_BMP);
+  CU_ASSERT_EQUAL(options.order, BATCH_COMPLETED);
+  CU_ASSERT_EQUAL(options.threads, 12);
+
+  CU_ASSERT(parse_batch("3", &options));
+  CU_ASSERT_EQUAL(options.action, BATCH_DECODE);
+  CU_ASSERT_EQUAL(options.threads, 3);
+
+  CU_ASSERT(parse_batch("ahead0,2", &options));
+  CU_ASSERT_EQUAL(options.ahead, 0);
+  CU_ASSERT_EQUAL(options.threads, 2);
+  CU_ASSERT(parse_batch("advise,ahead64", &options));
+  CU_ASSERT_EQUAL(options.io, PREFETCH_ADVISE);
+  CU_ASSERT_EQUAL(options.ahead, 64);
+
+  CU_ASSERT(parse_batch("mpx12,4,ms50", &options));
+  CU_ASSERT_EQUAL(options.threads, 4);
+  CU_ASSERT_EQUAL(options.limits.max_pixels, 12000000);
+  CU_ASSERT_EQUAL(options.limits.max_memory, 0);
+  CU_ASSERT_EQUAL(options.limits.timeout_ms, 50);
+
+  const char *wrong[] = {"png", "bmp,,4", "0", "65", "123", "4x", "decode;bmp", "ahead", "ahead65", "ahead4x",
+                         "ms", "mb1x"};
+  for (uint8_t w = 0; w < 12; w++) {
+    CU_ASSERT_FALSE(parse_batch(wrong[w], &options));
+  }
+}
+
+
+/** @brief Number of results over the limits */
+static uint32_t nb_too_large;
+
+/**
+ * @brief Callback of the results of test_batch_limits
+ */
+static void report_limits(const struct batch_result *result) {
+  CU_ASSERT((result->status == BATCH_OK) || (result->status == BATCH_TOO_LARGE));
+  CU_ASSERT_EQUAL(result->width * result->height > 1023, result->status == BATCH_TOO_LARGE);
+  nb_too_large += (result->status == BATCH_TOO_LARGE);
+}
+
+void test_batch_limits(void) {
+  // 32x32, 1x1, 32x32
+  char *limited[3] = {"suite/basn2c16.png", "suite/s01n2c08.png", "suite/basn0g01.png"};
+  struct batch_options options = batch_default_options();
+  options.threads = 2;
+  options.limits.max_pixels = 1023;
+  options.limits.timeout_ms = 60000;
+  nb_too_large = 0;
+
+  const struct batch_stats stats = run_batch(limited, 3, &options, report_limits);
+  CU_ASSERT_EQUAL(stats.nb_failed, 2);
+  CU_ASSERT_EQUAL(nb_too_large, 2);
+  CU_ASSERT_EQUAL(stats.pixels, 1);
+  CU_ASSERT_EQUAL(stats.io_files, 1); // the others are never read ahead
+}
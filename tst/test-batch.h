@@ -0,0 +1,33 @@
+/**
+ * @file test-batch.h
+ * @brief Test the batch mode
+ * @details
+ */
+
+#ifndef __TEST_BATCH_H__
+#define __TEST_BATCH_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_batch(void);
+
+int clean_test_batch(void);
+
+
+void test_batch_list(void);
+
+void test_batch_ordered(void);
+
+void test_batch_completed(void);
+
+void test_batch_bmp(void);
+
+void test_batch_parse(void);
+
+void test_batch_limits(void);
+
+
+
+#endif // __TEST_BATCH_H__
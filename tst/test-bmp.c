@@ -0,0 +1,170 @@
+/**
+ * @file test-bmp.c
+ * @brief Test the BMP writer
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-bmp.h"
+
+#include "bmp.h"
+#include "image.h"
+#include "mfile.h"
+#include "render.h"
+
+
+#define BMP_FILE "suite/bmp.tmp"
+#define BMP_OTHER "suite/bmp2.tmp"
+
+
+static uint32_t get16le(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8);
+}
+
+static uint32_t get32le(const uint8_t *ptr) {
+  return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+/**
+ * @brief Check the headers and the pixels of a BMP file written from an image
+ */
+static void check_bmp(const char *filename, const struct image *img, uint8_t alpha) {
+  const struct mfile file = map_file(filename);
+  const uint8_t *bmp = file.data;
+  const uint32_t offset = alpha ? 122 : 54;
+  const uint32_t pitch  = alpha ? img->width * 4 : (img->width * 3 + 3) & ~3U;
+
+  CU_ASSERT_EQUAL(file.size, offset + img->height * pitch);
+  CU_ASSERT_EQUAL(bmp[0], 'B');
+  CU_ASSERT_EQUAL(bmp[1], 'M');
+  CU_ASSERT_EQUAL(get32le(bmp + 2), file.size);
+  CU_ASSERT_EQUAL(get32le(bmp + 6), 0);
+  CU_ASSERT_EQUAL(get32le(bmp + 10), offset);
+  CU_ASSERT_EQUAL(get32le(bmp + 14), offset - 14);
+  CU_ASSERT_EQUAL(get32le(bmp + 18), img->width);
+  CU_ASSERT_EQUAL(get32le(bmp + 22), img->height);
+  CU_ASSERT_EQUAL(get16le(bmp + 26), 1);
+  CU_ASSERT_EQUAL(get16le(bmp + 28), alpha ? 32 : 24);
+  CU_ASSERT_EQUAL(get32le(bmp + 30), alpha ? 3 : 0);
+  CU_ASSERT_EQUAL(get32le(bmp + 34), img->height * pitch);
+  for (int k = 38; k < 54; k++) {
+    CU_ASSERT_EQUAL(bmp[k], 0);
+  }
+  if (alpha) {
+    CU_ASSERT_EQUAL(get32le(bmp + 54), 0x00ff0000);
+    CU_ASSERT_EQUAL(get32le(bmp + 58), 0x0000ff00);
+    CU_ASSERT_EQUAL(get32le(bmp + 62), 0x000000ff);
+    CU_ASSERT_EQUAL(get32le(bmp + 66), 0xff000000);
+    CU_ASSERT_EQUAL(memcmp(bmp + 70, " niW", 4), 0);
+    for (int k = 74; k < 122; k++) {
+      CU_ASSERT_EQUAL(bmp[k], 0);
+    }
+  }
+
+  // bottom-up rows, what the viewer gets
+  uint8_t *bgra = malloc(img->width * 4);
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < img->height; i++) {
+    render_rows(img, i, 1, FORMAT_BGRA8, alpha ? ALPHA_STRAIGHT : ALPHA_BACKGROUND, bgra, img->width * 4);
+    const uint8_t *row = bmp + offset + (img->height - 1 - i) * pitch;
+    for (uint32_t j = 0; j < img->width; j++) {
+      wrong += (memcmp(row + j * (alpha ? 4 : 3), bgra + 4 * j, alpha ? 4 : 3) != 0);
+    }
+    for (uint32_t k = img->width * (alpha ? 4 : 3); k < pitch; k++) {
+      wrong += (row[k] != 0); // padding
+    }
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  free(bgra);
+  unmap_file(&file);
+}
+
+
+
+int init_test_bmp(void) {
+  return 0;
+}
+
+int clean_test_bmp(void) {
+  remove(BMP_FILE);
+  remove(BMP_OTHER);
+  return 0;
+}
+
+
+
+void test_bmp_24(void) {
+  // each padding (width % 4) and alpha composited
+  const char *files[] = {"suite/basn2c08.png", "suite/s01n2c08.png", "suite/s02n2c08.png", "suite/s03n2c08.png",
+                         "suite/basn6a16.png", "suite/bgwn6a08.png", "suite/basn3p04.png"};
+
+  for (int f = 0; f < 7; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image_native(&file);
+    unmap_file(&file);
+
+    save_image_as_bmp(&img, BMP_FILE);
+    check_bmp(BMP_FILE, &img, 0);
+    free_image(&img);
+  }
+}
+
+void test_bmp_32(void) {
+  const char *files[] = {"suite/basn6a08.png", "suite/basn4a16.png", "suite/s05n2c08.png"};
+
+  for (int f = 0; f < 3; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image_native(&file);
+    unmap_file(&file);
+
+    save_image_as_bmp32(&img, BMP_FILE);
+    check_bmp(BMP_FILE, &img, 1);
+    free_image(&img);
+  }
+}
+
+void test_bmp_batches(void) {
+  // several batches of rows
+  const uint32_t w = 2001, h = 600;
+  uint8_t *data = malloc(w * h * 3);
+  for (uint32_t k = 0; k < w * h * 3; k++) {
+    data[k] = (k * 2654435761U) >> 24;
+  }
+  const struct image img = {.width = w, .height = h, .depth = 8, .sample = 3, .data = data};
+  CU_ASSERT(save_image_as_bmp(&img, BMP_FILE));
+  check_bmp(BMP_FILE, &img, 0);
+
+  // rows given a few at a time, as a stream would: same file
+  struct bmp_writer writer;
+  CU_ASSERT(bmp_open(&writer, BMP_OTHER, w, h, 0));
+  CU_ASSERT(writer.batch_rows < h);
+  for (uint32_t y = 0; y < h; y += 7) {
+    bmp_write_image(&writer, &img, y, (h - y < 7) ? h - y : 7);
+  }
+  CU_ASSERT(bmp_close(&writer));
+
+  const struct mfile f1 = map_file(BMP_FILE);
+  const struct mfile f2 = map_file(BMP_OTHER);
+  CU_ASSERT_EQUAL(f1.size, f2.size);
+  CU_ASSERT_EQUAL(memcmp(f1.data, f2.data, f1.size), 0);
+  unmap_file(&f1);
+  unmap_file(&f2);
+  free(data);
+}
+
+
+void test_bmp_errors(void) {
+  const struct mfile file = map_file("suite/basn2c08.png");
+  const struct image img = get_image(&file);
+  unmap_file(&file);
+
+  // a file that can't be created, then one that can't be written
+  CU_ASSERT_FALSE(save_image_as_bmp(&img, "suite"));
+  CU_ASSERT_FALSE(save_image_as_bmp32(&img, "suite/missing/bmp.tmp"));
+#ifdef __linux__
+  CU_ASSERT_FALSE(save_image_as_bmp(&img, "/dev/full"));
+#endif
+  free_image(&img);
+}
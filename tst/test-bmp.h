@@ -0,0 +1,29 @@
+/**
+ * @file test-bmp.h
+ * @brief Test the BMP writer
+ * @details
+ */
+
+#ifndef __TEST_BMP_H__
+#define __TEST_BMP_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_bmp(void);
+
+int clean_test_bmp(void);
+
+
+void test_bmp_24(void);
+
+void test_bmp_32(void);
+
+void test_bmp_batches(void);
+
+void test_bmp_errors(void);
+
+
+
+#endif // __TEST_BMP_H__
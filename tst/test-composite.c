@@ -0,0 +1,143 @@
+/**
+ * @file test-composite.c
+ * @brief Test alpha compositing
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-composite.h"
+
+#include "composite.h"
+#include "convert.h"
+#include "image.h"
+#include "mfile.h"
+
+
+
+int init_test_composite(void) {
+  return 0;
+}
+
+int clean_test_composite(void) {
+  return 0;
+}
+
+
+
+void test_background_file(void) {
+  const char *files[] = {"suite/bgbn4a08.png", "suite/bgwn6a08.png", "suite/bgyn6a16.png", "suite/basn6a08.png"};
+  const uint16_t expected[][3] = {{0, 0, 0}, {65535, 65535, 65535}, {65535, 65535, 0}, {1, 2, 3}};
+  const uint16_t fallback[3] = {1, 2, 3};
+
+  for (int f = 0; f < 4; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image(&file);
+    unmap_file(&file);
+
+    uint16_t bg[3];
+    get_background(&img, fallback, bg);
+    CU_ASSERT_EQUAL(img.has_background, f < 3);
+    for (int k = 0; k < 3; k++) {
+      CU_ASSERT_EQUAL(bg[k], expected[f][k]);
+    }
+    free_image(&img);
+  }
+}
+
+void test_composite_8(void) {
+  const uint16_t background[3] = {0x1234, 0x8080, 0xffff};
+  const uint8_t bg[3] = {0x12, 0x80, 0xff}; // round(v / 257)
+
+  // every color and alpha, in rows of 255 pixels (SIMD and the remaining pixels)
+  uint8_t raw[256][255 * 4];
+  uint8_t row[256][255 * 4];
+  for (uint32_t c = 0; c < 256; c++) {
+    for (uint32_t a = 0; a < 255; a++) {
+      raw[c][4 * a]     = c;
+      raw[c][4 * a + 1] = 255 - c;
+      raw[c][4 * a + 2] = c ^ a;
+      raw[c][4 * a + 3] = a + (c & 1); // 0 and 255 too
+    }
+  }
+
+  for (int format = 0; format < 2; format++) {
+    const int r = format ? 2 : 0; // BGRA8: background swapped
+
+    memcpy(row, raw, sizeof(raw));
+    composite_rows(ALPHA_BACKGROUND, background, format ? FORMAT_BGRA8 : FORMAT_RGBA8, row, 255, 256, 255 * 4);
+    for (uint32_t c = 0; c < 256; c++) {
+      for (uint32_t j = 0; j < 4 * 255; j++) {
+        const uint32_t a = raw[c][j | 3];
+        const uint32_t k = j & 3;
+        if (k == 3) {
+          CU_ASSERT_EQUAL(row[c][j], 255);
+          continue;
+        }
+        const uint32_t b = bg[(k == 1) ? 1 : (k == 0) ? r : 2 - r];
+        CU_ASSERT_EQUAL(row[c][j], (2 * (raw[c][j] * a + b * (255 - a)) + 255) / 510);
+      }
+    }
+  }
+
+  memcpy(row, raw, sizeof(raw));
+  composite_rows(ALPHA_PREMULTIPLIED, background, FORMAT_RGBA8, row, 255, 256, 255 * 4);
+  for (uint32_t c = 0; c < 256; c++) {
+    for (uint32_t j = 0; j < 4 * 255; j++) {
+      const uint32_t a = raw[c][j | 3];
+      CU_ASSERT_EQUAL(row[c][j], ((j & 3) == 3) ? a : (2 * raw[c][j] * a + 255) / 510);
+    }
+  }
+
+  // straight: nothing to do
+  memcpy(row, raw, sizeof(raw));
+  composite_rows(ALPHA_STRAIGHT, background, FORMAT_RGBA8, row, 255, 256, 255 * 4);
+  CU_ASSERT_EQUAL(memcmp(row, raw, sizeof(raw)), 0);
+}
+
+void test_composite_16(void) {
+  const uint16_t background[3] = {0x1234, 0x8080, 0xffff};
+  const uint32_t width = 1001;
+  uint16_t *raw = malloc(width * 8);
+  uint16_t *row = malloc(width * 8);
+
+  for (uint32_t j = 0; j < 4 * width; j++) {
+    raw[j] = (j * 2654435761U) >> 16;
+  }
+  raw[3] = 0;
+  raw[7] = 65535;
+
+  for (int mode = ALPHA_PREMULTIPLIED; mode <= ALPHA_BACKGROUND; mode++) {
+    memcpy(row, raw, width * 8);
+    composite_rows(mode, background, FORMAT_RGBA16, row, width, 1, width * 8);
+    for (uint32_t j = 0; j < 4 * width; j++) {
+      const uint64_t a = raw[j | 3];
+      if ((j & 3) == 3) {
+        CU_ASSERT_EQUAL(row[j], (mode == ALPHA_BACKGROUND) ? 65535 : a);
+        continue;
+      }
+      const uint64_t b = (mode == ALPHA_BACKGROUND) ? background[j & 3] : 0;
+      CU_ASSERT_EQUAL(row[j], (2 * (raw[j] * a + b * (65535 - a)) + 65535) / 131070);
+    }
+  }
+  free(raw);
+  free(row);
+}
+
+void test_composite_float(void) {
+  const uint16_t background[3] = {0, 65535, 0};
+  float row[2][4] = {{1.0f, 0.0f, 0.5f, 0.25f}, {0.2f, 0.4f, 0.6f, 1.0f}};
+
+  composite_rows(ALPHA_BACKGROUND, background, FORMAT_FLOAT32, row, 2, 1, sizeof(row));
+  CU_ASSERT_DOUBLE_EQUAL(row[0][0], 0.25, 1e-6);
+  CU_ASSERT_DOUBLE_EQUAL(row[0][1], 0.75, 1e-6);
+  CU_ASSERT_DOUBLE_EQUAL(row[0][2], 0.125, 1e-6);
+  CU_ASSERT_DOUBLE_EQUAL(row[0][3], 1.0, 1e-6);
+  CU_ASSERT_DOUBLE_EQUAL(row[1][1], 0.4, 1e-6);
+
+  // no alpha: untouched
+  uint8_t rgb[3] = {1, 2, 3};
+  composite_rows(ALPHA_BACKGROUND, background, FORMAT_RGB8, rgb, 1, 1, 3);
+  CU_ASSERT_EQUAL(rgb[2], 3);
+}
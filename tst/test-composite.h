@@ -0,0 +1,29 @@
+/**
+ * @file test-composite.h
+ * @brief Test alpha compositing
+ * @details
+ */
+
+#ifndef __TEST_COMPOSITE_H__
+#define __TEST_COMPOSITE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_composite(void);
+
+int clean_test_composite(void);
+
+
+void test_background_file(void);
+
+void test_composite_8(void);
+
+void test_composite_16(void);
+
+void test_composite_float(void);
+
+
+
+#endif // __TEST_COMPOSITE_H__
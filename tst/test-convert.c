@@ -0,0 +1,233 @@
+/**
+ * @file test-convert.c
+ * @brief Test row conversion against get_color
+ * @details
+ */
+
+#include <string.h>
+
+#include "test-convert.h"
+
+#include "color.h"
+#include "convert.h"
+#include "image.h"
+#include "mfile.h"
+
+
+/** @brief Every color type and depth */
+static const char *files[] = {
+  "suite/basn0g01.png", "suite/basn0g02.png", "suite/basn0g04.png", "suite/basn0g08.png", "suite/basn0g16.png",
+  "suite/basn2c08.png", "suite/basn2c16.png",
+  "suite/basn3p01.png", "suite/basn3p02.png", "suite/basn3p04.png", "suite/basn3p08.png",
+  "suite/basn4a08.png", "suite/basn4a16.png", "suite/basn6a08.png", "suite/basn6a16.png",
+};
+
+/** @brief Number of files */
+#define NB_FILE (sizeof(files) / sizeof(files[0]))
+
+
+
+int init_test_convert(void) {
+  return 0;
+}
+
+int clean_test_convert(void) {
+  return 0;
+}
+
+
+/**
+ * @brief Expected RGBA on 16 bits of a pixel (8-bit samples are repeated: v * 257)
+ */
+static void expected_rgba16(const struct image *img, uint32_t i, uint32_t j, uint16_t rgba[4]) {
+  struct color c;
+  get_color(img, i, j, &c);
+
+  if (c.max == 0xffff) {
+    rgba[0] = c.red;
+    rgba[1] = c.green;
+    rgba[2] = c.blue;
+    rgba[3] = c.alpha;
+  } else {
+    rgba[0] = (c.red   * 255 / c.max) * 257;
+    rgba[1] = (c.green * 255 / c.max) * 257;
+    rgba[2] = (c.blue  * 255 / c.max) * 257;
+    rgba[3] = (c.alpha * 255 / c.max) * 257;
+  }
+}
+
+/**
+ * @brief Nearest 8-bit value of a 16-bit sample
+ */
+static uint8_t round_16_to_8(uint16_t v) {
+  return (v * 255 + 32895) >> 16;
+}
+
+/**
+ * @brief Compare the whole image converted in the 8-bit formats to get_color
+ */
+static void check_convert_8bit(const struct image img) {
+
+  const uint32_t w = img.width;
+  uint8_t rgba[img.height][4 * w];
+  uint8_t bgra[img.height][4 * w];
+  uint8_t rgb[img.height][3 * w];
+  uint8_t gray[img.height][w];
+
+  convert_rows(&img, 0, img.height, FORMAT_RGBA8, rgba, 4 * w);
+  convert_rows(&img, 0, img.height, FORMAT_BGRA8, bgra, 4 * w);
+  convert_rows(&img, 0, img.height, FORMAT_RGB8,  rgb,  3 * w);
+  convert_rows(&img, 0, img.height, FORMAT_GRAY8, gray, w);
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < w; j++) {
+      uint16_t e[4];
+      expected_rgba16(&img, i, j, e);
+      const uint8_t r = round_16_to_8(e[0]), g = round_16_to_8(e[1]);
+      const uint8_t b = round_16_to_8(e[2]), a = round_16_to_8(e[3]);
+
+      CU_ASSERT_EQUAL(rgba[i][4 * j],     r);
+      CU_ASSERT_EQUAL(rgba[i][4 * j + 1], g);
+      CU_ASSERT_EQUAL(rgba[i][4 * j + 2], b);
+      CU_ASSERT_EQUAL(rgba[i][4 * j + 3], a);
+
+      CU_ASSERT_EQUAL(bgra[i][4 * j],     b);
+      CU_ASSERT_EQUAL(bgra[i][4 * j + 1], g);
+      CU_ASSERT_EQUAL(bgra[i][4 * j + 2], r);
+      CU_ASSERT_EQUAL(bgra[i][4 * j + 3], a);
+
+      CU_ASSERT_EQUAL(rgb[i][3 * j],     r);
+      CU_ASSERT_EQUAL(rgb[i][3 * j + 1], g);
+      CU_ASSERT_EQUAL(rgb[i][3 * j + 2], b);
+
+      CU_ASSERT_EQUAL(gray[i][j], (77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+  }
+}
+
+/**
+ * @brief Compare the whole image converted in RGBA16 and float to get_color
+ */
+static void check_convert_wide(const struct image img) {
+
+  const uint32_t w = img.width;
+  uint16_t wide[img.height][4 * w];
+  float unit[img.height][4 * w];
+
+  convert_rows(&img, 0, img.height, FORMAT_RGBA16,  wide, 8 * w);
+  convert_rows(&img, 0, img.height, FORMAT_FLOAT32, unit, 16 * w);
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < w; j++) {
+      uint16_t e[4];
+      expected_rgba16(&img, i, j, e);
+
+      for (uint8_t k = 0; k < 4; k++) {
+        CU_ASSERT_EQUAL(wide[i][4 * j + k], e[k]);
+        CU_ASSERT_DOUBLE_EQUAL(unit[i][4 * j + k], e[k] / 65535.0, 1e-6);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Check a file with get_image and get_image_native
+ */
+static void check_convert_file(const char *pathname, void (*check)(const struct image)) {
+  const struct mfile file = map_file(pathname);
+  const struct image img  = get_image(&file);
+  const struct image nat  = get_image_native(&file);
+  unmap_file(&file);
+
+  CU_ASSERT_EQUAL(nat.native, img.depth == 16);
+  check(img);
+  check(nat);
+  free_image(&img);
+  free_image(&nat);
+}
+
+
+
+void test_convert_8bit(void) {
+  for (uint32_t f = 0; f < NB_FILE; f++) {
+    check_convert_file(files[f], check_convert_8bit);
+  }
+}
+
+void test_convert_wide(void) {
+  for (uint32_t f = 0; f < NB_FILE; f++) {
+    check_convert_file(files[f], check_convert_wide);
+  }
+}
+
+void test_convert_rows(void) {
+  const struct mfile file = map_file("suite/basn6a16.png");
+  const struct image img  = get_image(&file);
+  unmap_file(&file);
+
+  const uint32_t w = img.width;
+  const size_t stride = 4 * w + 5; // rows with a gap
+  uint8_t all[img.height][4 * w];
+  uint8_t band[10 * stride];
+  memset(band, 0xaa, sizeof(band));
+
+  convert_rows(&img, 0, img.height, FORMAT_RGBA8, all, 4 * w);
+  convert_rows(&img, 7, 10, FORMAT_RGBA8, band, stride);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    CU_ASSERT_EQUAL(memcmp(band + i * stride, all[7 + i], 4 * w), 0);
+    if (i < 9) {
+      CU_ASSERT_EQUAL(band[i * stride + 4 * w], 0xaa); // the gap is untouched
+    }
+  }
+  free_image(&img);
+}
+
+void test_convert_reduce(void) {
+  uint8_t src[2 * 65536];
+  uint8_t dst[65536];
+  for (uint32_t v = 0; v < 65536; v++) {
+    src[2 * v]     = v >> 8;
+    src[2 * v + 1] = v & 0xff;
+  }
+
+  // every value, with and without SIMD (odd count)
+  reduce_16_to_8(src, 65536, 1, 0, REDUCE_ROUND, 0, dst);
+  for (uint32_t v = 0; v < 65536; v++) {
+    CU_ASSERT_EQUAL(dst[v], round_16_to_8(v));
+  }
+  reduce_16_to_8(src + 2, 65535, 3, 0, REDUCE_ROUND, 0, dst);
+  for (uint32_t v = 1; v < 65536; v++) {
+    CU_ASSERT_EQUAL(dst[v - 1], round_16_to_8(v));
+  }
+
+  // native byte order
+  samples_to_native(src, 65536);
+  for (uint32_t v = 0; v < 65536; v++) {
+    uint16_t n;
+    memcpy(&n, src + 2 * v, 2);
+    CU_ASSERT_EQUAL(n, v);
+  }
+  reduce_16_to_8(src, 65536, 1, 1, REDUCE_ROUND, 0, dst);
+  for (uint32_t v = 0; v < 65536; v++) {
+    CU_ASSERT_EQUAL(dst[v], round_16_to_8(v));
+  }
+
+  // dithering: a 4x4 block of the same value averages to it (16 levels between two 8-bit values)
+  for (uint32_t v = 0; v < 65536; v += 97) {
+    uint16_t flat[16];
+    uint8_t out[16];
+    uint32_t sum = 0;
+    for (uint8_t k = 0; k < 16; k++) {
+      flat[k] = v;
+    }
+    for (uint32_t y = 0; y < 4; y++) {
+      reduce_16_to_8((const uint8_t *) flat, 4, 1, 1, REDUCE_DITHER, y, out);
+      for (uint8_t k = 0; k < 4; k++) {
+        CU_ASSERT((out[k] == v / 257) || (out[k] == v / 257 + 1));
+        sum += out[k];
+      }
+    }
+    CU_ASSERT_DOUBLE_EQUAL(sum / 16.0, v / 257.0, 1.0 / 16);
+  }
+}
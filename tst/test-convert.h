@@ -0,0 +1,29 @@
+/**
+ * @file test-convert.h
+ * @brief Test row conversion against get_color
+ * @details
+ */
+
+#ifndef __TEST_CONVERT_H__
+#define __TEST_CONVERT_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_convert(void);
+
+int clean_test_convert(void);
+
+
+void test_convert_8bit(void);
+
+void test_convert_wide(void);
+
+void test_convert_rows(void);
+
+void test_convert_reduce(void);
+
+
+
+#endif // __TEST_CONVERT_H__
@@ -0,0 +1,92 @@
+/**
+ * @file test-expand.c
+ * @brief Test sub-byte expansion against get_color
+ * @details
+ */
+
+#include "test-expand.h"
+
+#include "color.h"
+#include "expand.h"
+#include "image.h"
+#include "mfile.h"
+
+
+
+int init_test_expand(void) {
+  return 0;
+}
+
+int clean_test_expand(void) {
+  return 0;
+}
+
+
+/**
+ * @brief Compare each expanded line of the image to get_color
+ */
+static void check_expand_file(const char *pathname) {
+
+  const struct mfile file = map_file(pathname);
+  const struct image img  = get_image(&file);
+  unmap_file(&file);
+
+  uint8_t row[img.width];
+  struct color c;
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    expand_image_row(&img, i, row);
+
+    for (uint32_t j = 0; j < img.width; j++) {
+      get_color(&img, i, j, &c);
+
+      if (img.palette != NULL) {
+        const uint8_t *color = img.palette + row[j] * 3;
+        CU_ASSERT_EQUAL(color[0], c.red);
+        CU_ASSERT_EQUAL(color[1], c.green);
+        CU_ASSERT_EQUAL(color[2], c.blue);
+      } else {
+        CU_ASSERT_EQUAL(row[j], c.red * 255 / c.max);
+      }
+    }
+  }
+  free_image(&img);
+}
+
+
+
+void test_expand_values(void) {
+  const uint8_t packed[] = {0xb4, 0xe0}; // 1011 0100 1110 0000
+  uint8_t row[16];
+
+  expand_row(packed, 11, 1, EXPAND_INDEX, row);
+  const uint8_t bits[] = {1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 1};
+  for (int k = 0; k < 11; k++) {
+    CU_ASSERT_EQUAL(row[k], bits[k]);
+  }
+
+  expand_row(packed, 5, 2, EXPAND_GRAY, row);
+  const uint8_t gray2[] = {170, 255, 85, 0, 255};
+  for (int k = 0; k < 5; k++) {
+    CU_ASSERT_EQUAL(row[k], gray2[k]);
+  }
+
+  expand_row(packed, 3, 4, EXPAND_GRAY, row);
+  CU_ASSERT_EQUAL(row[0], 0xbb);
+  CU_ASSERT_EQUAL(row[1], 0x44);
+  CU_ASSERT_EQUAL(row[2], 0xee);
+}
+
+void test_expand_gray(void) {
+  check_expand_file("suite/basn0g01.png");
+  check_expand_file("suite/basn0g02.png");
+  check_expand_file("suite/basn0g04.png");
+  check_expand_file("suite/basn0g08.png");
+}
+
+void test_expand_index(void) {
+  check_expand_file("suite/basn3p01.png");
+  check_expand_file("suite/basn3p02.png");
+  check_expand_file("suite/basn3p04.png");
+  check_expand_file("suite/basn3p08.png");
+}
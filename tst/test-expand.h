@@ -0,0 +1,27 @@
+/**
+ * @file test-expand.h
+ * @brief Test sub-byte expansion against get_color
+ * @details
+ */
+
+#ifndef __TEST_EXPAND_H__
+#define __TEST_EXPAND_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_expand(void);
+
+int clean_test_expand(void);
+
+
+void test_expand_values(void);
+
+void test_expand_gray(void);
+
+void test_expand_index(void);
+
+
+
+#endif // __TEST_EXPAND_H__
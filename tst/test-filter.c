@@ -1,5 +1,10 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "test-filter.h"
 
+#include "filter.h"
+
 #include "mfile.h"
 #include "image.h"
 #include "color.h"
@@ -136,3 +141,80 @@ void test_filter_paeth(void) {
   free_image(&img);
   unmap_file(&file);
 }
+
+void test_filter_all(void) {
+  // every bpp, sizes around the 16-byte blocks
+  const uint8_t bpps[] = {1, 2, 3, 4, 6, 8};
+  const uint32_t sizes[] = {1, 5, 15, 16, 17, 31, 32, 33, 100, 257};
+  uint8_t raw[257], prior[257], row[257], expected[257];
+  uint8_t *candidate = malloc(NB_FILTER * 257);
+  uint32_t seed = 12345;
+
+  for (uint8_t b = 0; b < 6; b++) {
+    for (uint8_t z = 0; z < 10; z++) {
+      const uint8_t bpp   = bpps[b];
+      const uint32_t size = sizes[z] * bpp;
+      if (size > 257) {
+        continue;
+      }
+      for (uint32_t k = 0; k < size; k++) {
+        seed = seed * 1103515245U + 12345U;
+        raw[k]   = seed >> 24;
+        prior[k] = (k & 8) ? raw[k] + (seed >> 29) : (uint8_t) (seed >> 16);
+      }
+
+      for (uint8_t first = 0; first < 2; first++) {
+        const uint8_t *above = first ? NULL : prior;
+        uint64_t cost[NB_FILTER];
+        filter_all(raw, above, size, bpp, candidate, cost);
+
+        for (uint8_t t = 0; t < NB_FILTER; t++) {
+          // same as one type at a time, and unfiltered back
+          filter_line(t, raw, above, size, bpp, expected);
+          CU_ASSERT_EQUAL(memcmp(candidate + t * size, expected, size), 0);
+          memcpy(row, candidate + t * size, size);
+          unfilter_line(t, row, above, size, bpp);
+          CU_ASSERT_EQUAL(memcmp(row, raw, size), 0);
+
+          uint64_t sum = 0;
+          for (uint32_t k = 0; k < size; k++) {
+            sum += (expected[k] < 128) ? expected[k] : 256 - expected[k];
+          }
+          CU_ASSERT_EQUAL(cost[t], sum);
+        }
+      }
+    }
+  }
+  free(candidate);
+}
+
+void test_filter_strategy(void) {
+  const uint32_t size = 300;
+  const uint8_t bpp   = 3;
+  uint8_t rows[8][300];
+  uint8_t out[300];
+  for (uint32_t i = 0; i < 8; i++) {
+    for (uint32_t k = 0; k < size; k++) {
+      rows[i][k] = (uint8_t) (k * 3 + i * 7 + ((k * i) % 5));
+    }
+  }
+
+  for (uint8_t strategy = FILTER_FIXED; strategy <= FILTER_BRUTE; strategy++) {
+    for (uint8_t type = 0; type < NB_FILTER; type++) {
+      struct row_filter filter;
+      row_filter_init(&filter, strategy, type, 6, size, bpp);
+      for (uint32_t i = 0; i < 8; i++) {
+        // the first row only None or Sub
+        const uint8_t nb_type = (i == 0) ? 2 : NB_FILTER;
+        const uint8_t t = row_filter_apply(&filter, rows[i], (i == 0) ? NULL : rows[i - 1], nb_type, out);
+        CU_ASSERT(t < nb_type);
+        if (strategy == FILTER_FIXED) {
+          CU_ASSERT_EQUAL(t, (i > 0) ? type : ((type == 2) ? 0 : ((type > 2) ? 1 : type)));
+        }
+        unfilter_line(t, out, (i == 0) ? NULL : rows[i - 1], size, bpp);
+        CU_ASSERT_EQUAL(memcmp(out, rows[i], size), 0);
+      }
+      row_filter_free(&filter);
+    }
+  }
+}
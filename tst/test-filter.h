@@ -18,5 +18,9 @@ void test_filter_average(void);
 
 void test_filter_paeth(void);
 
+void test_filter_all(void);
+
+void test_filter_strategy(void);
+
 
 #endif // __TEST_FILTER_H__
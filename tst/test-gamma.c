@@ -0,0 +1,127 @@
+/**
+ * @file test-gamma.c
+ * @brief Test gAMA and sRGB correction
+ * @details
+ */
+
+#include <math.h>
+
+#include "test-gamma.h"
+
+#include "convert.h"
+#include "gamma.h"
+#include "image.h"
+#include "mfile.h"
+
+
+
+int init_test_gamma(void) {
+  return 0;
+}
+
+int clean_test_gamma(void) {
+  return 0;
+}
+
+
+
+void test_gamma_value(void) {
+  // sRGB to display is the identity
+  CU_ASSERT(gamma_identity(0, TRANSFER_DISPLAY));
+  CU_ASSERT(!gamma_identity(0, TRANSFER_LINEAR));
+  CU_ASSERT(!gamma_identity(45455, TRANSFER_DISPLAY));
+  for (int k = 0; k <= 100; k++) {
+    CU_ASSERT_DOUBLE_EQUAL(gamma_value(0, TRANSFER_DISPLAY, k / 100.0), k / 100.0, 1e-9);
+  }
+
+  // gAMA is the encoding exponent: 0.45455 decodes with 2.2
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(45455, TRANSFER_LINEAR, 0.5), pow(0.5, 1 / 0.45455), 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(100000, TRANSFER_LINEAR, 0.3), 0.3, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(0, TRANSFER_LINEAR, 0.5), 0.214041, 1e-6);
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(100000, TRANSFER_DISPLAY, 0.214041), 0.5, 1e-6);
+
+  // black and white stay
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(70000, TRANSFER_DISPLAY, 0.0), 0.0, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(gamma_value(70000, TRANSFER_DISPLAY, 1.0), 1.0, 1e-9);
+}
+
+void test_gamma_file(void) {
+  const char *files[] = {"suite/g03n2c08.png", "suite/g05n0g16.png", "suite/g07n2c08.png"};
+  const uint32_t gamma[] = {35000, 55000, 70000};
+
+  for (int f = 0; f < 3; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image(&file);
+    const struct image thumb = get_image_scaled(&file, 1);
+    unmap_file(&file);
+
+    CU_ASSERT_EQUAL(img.gamma, gamma[f]);
+    CU_ASSERT_EQUAL(thumb.gamma, gamma[f]);
+    free_image(&img);
+    free_image(&thumb);
+  }
+}
+
+void test_gamma_rows(void) {
+  const struct mfile file = map_file("suite/g05n0g16.png");
+  const struct image img  = get_image(&file);
+  unmap_file(&file);
+
+  const uint32_t w = img.width;
+  uint8_t raw8[img.height][4 * w];
+  uint8_t rgba8[img.height][4 * w];
+  uint16_t raw16[img.height][4 * w];
+  uint16_t rgba16[img.height][4 * w];
+  float unit[img.height][4 * w];
+
+  convert_rows(&img, 0, img.height, FORMAT_RGBA8, raw8, 4 * w);
+  convert_rows(&img, 0, img.height, FORMAT_RGBA8, rgba8, 4 * w);
+  gamma_rows(&img, TRANSFER_DISPLAY, FORMAT_RGBA8, rgba8, img.height, 4 * w);
+
+  convert_rows(&img, 0, img.height, FORMAT_RGBA16, raw16, 8 * w);
+  convert_rows(&img, 0, img.height, FORMAT_RGBA16, rgba16, 8 * w);
+  gamma_rows(&img, TRANSFER_LINEAR, FORMAT_RGBA16, rgba16, img.height, 8 * w);
+
+  convert_rows(&img, 0, img.height, FORMAT_FLOAT32, unit, 16 * w);
+  gamma_rows(&img, TRANSFER_LINEAR, FORMAT_FLOAT32, unit, img.height, 16 * w);
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < 4 * w; j++) {
+      if (j % 4 == 3) { // alpha untouched
+        CU_ASSERT_EQUAL(rgba8[i][j], raw8[i][j]);
+        CU_ASSERT_EQUAL(rgba16[i][j], raw16[i][j]);
+        CU_ASSERT_DOUBLE_EQUAL(unit[i][j], 1.0, 1e-6);
+        continue;
+      }
+      const double v8  = gamma_value(55000, TRANSFER_DISPLAY, raw8[i][j] / 255.0);
+      const double v16 = gamma_value(55000, TRANSFER_LINEAR, raw16[i][j] / 65535.0);
+      CU_ASSERT_EQUAL(rgba8[i][j], lround(255 * v8));
+      CU_ASSERT_EQUAL(rgba16[i][j], lround(65535 * v16));
+      CU_ASSERT_DOUBLE_EQUAL(unit[i][j], v16, 1e-6);
+    }
+  }
+  free_image(&img);
+}
+
+void test_gamma_cache(void) {
+  const struct gamma_table *t1 = get_gamma_table(70000, TRANSFER_DISPLAY);
+  const struct gamma_table *t2 = get_gamma_table(70000, TRANSFER_DISPLAY);
+  CU_ASSERT_PTR_EQUAL(t1, t2);
+  CU_ASSERT_EQUAL(t1->table8[0], 0);
+  CU_ASSERT_EQUAL(t1->table8[255], 255);
+  CU_ASSERT_EQUAL(t1->table8[128], lround(255 * gamma_value(70000, TRANSFER_DISPLAY, 128 / 255.0)));
+
+  const struct gamma_table *t3 = get_gamma_table(70000, TRANSFER_LINEAR);
+  CU_ASSERT_PTR_NOT_EQUAL(t1, t3);
+  CU_ASSERT_EQUAL(t3->transfer, TRANSFER_LINEAR);
+  release_gamma_table(t2);
+  release_gamma_table(t3);
+
+  // pushed out of the cache by other pairs: still valid while held
+  for (uint32_t g = 1; g <= 20; g++) {
+    release_gamma_table(get_gamma_table(g * 1000, TRANSFER_LINEAR));
+  }
+  CU_ASSERT_EQUAL(t1->refs, 1);
+  CU_ASSERT_EQUAL(t1->table8[128], lround(255 * gamma_value(70000, TRANSFER_DISPLAY, 128 / 255.0)));
+  release_gamma_table(t1);
+}
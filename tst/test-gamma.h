@@ -0,0 +1,29 @@
+/**
+ * @file test-gamma.h
+ * @brief Test gAMA and sRGB correction
+ * @details
+ */
+
+#ifndef __TEST_GAMMA_H__
+#define __TEST_GAMMA_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_gamma(void);
+
+int clean_test_gamma(void);
+
+
+void test_gamma_value(void);
+
+void test_gamma_file(void);
+
+void test_gamma_rows(void);
+
+void test_gamma_cache(void);
+
+
+
+#endif // __TEST_GAMMA_H__
@@ -0,0 +1,274 @@
+/**
+ * @file test-icc.c
+ * @brief Test ICC profiles (iCCP) to sRGB
+ * @details Profiles are built here: matrix/TRC profiles are a few tags
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "test-icc.h"
+#include "png-fixture.h"
+
+#include "convert.h"
+#include "icc.h"
+
+
+
+/** @brief sRGB primaries (D50) */
+static const double srgb_xyz[3][3] = {{0.4360747, 0.2225045, 0.0139322},
+                                      {0.3850649, 0.7168786, 0.0971045},
+                                      {0.1430804, 0.0606169, 0.7141733}};
+
+/** @brief Display P3 primaries (D50) */
+static const double p3_xyz[3][3] = {{0.5151, 0.2412, -0.0011},
+                                    {0.2920, 0.6922, 0.0419},
+                                    {0.1571, 0.0666, 0.7841}};
+
+
+static void put_tag(uint8_t *profile, uint32_t k, const char *signature, uint32_t offset, uint32_t length) {
+  memcpy(profile + 132 + 12 * k, signature, 4);
+  put32(profile + 136 + 12 * k, offset);
+  put32(profile + 140 + 12 * k, length);
+}
+
+/**
+ * @brief Build a RGB matrix/TRC profile with the sRGB curve
+ * @return Size of the profile
+ */
+static uint32_t rgb_profile(const double xyz[3][3], uint8_t profile[512]) {
+  static const char *xyz_tag[3] = {"rXYZ", "gXYZ", "bXYZ"};
+  static const char *trc_tag[3] = {"rTRC", "gTRC", "bTRC"};
+  static const double srgb_curve[5] = {2.4, 1 / 1.055, 0.055 / 1.055, 1 / 12.92, 0.04045};
+
+  memset(profile, 0, 512);
+  memcpy(profile + 16, "RGB XYZ ", 8);
+  memcpy(profile + 36, "acsp", 4);
+  put32(profile + 128, 6);
+
+  uint32_t offset = 132 + 6 * 12;
+  for (int c = 0; c < 3; c++) {
+    put_tag(profile, c, xyz_tag[c], offset, 20);
+    memcpy(profile + offset, "XYZ ", 4);
+    for (int k = 0; k < 3; k++) {
+      put32(profile + offset + 8 + 4 * k, (uint32_t) lround(xyz[c][k] * 65536));
+    }
+    offset += 20;
+  }
+  // the 3 curves share the same data
+  for (int c = 0; c < 3; c++) {
+    put_tag(profile, 3 + c, trc_tag[c], offset, 32);
+  }
+  memcpy(profile + offset, "para", 4);
+  profile[offset + 9] = 3;
+  for (int k = 0; k < 5; k++) {
+    put32(profile + offset + 12 + 4 * k, (uint32_t) lround(srgb_curve[k] * 65536));
+  }
+  offset += 32;
+  put32(profile, offset);
+  return offset;
+}
+
+/**
+ * @brief Build a GRAY profile with a linear curve
+ * @return Size of the profile
+ */
+static uint32_t gray_profile(uint8_t profile[512]) {
+  memset(profile, 0, 512);
+  memcpy(profile + 16, "GRAYXYZ ", 8);
+  memcpy(profile + 36, "acsp", 4);
+  put32(profile + 128, 1);
+  put_tag(profile, 0, "kTRC", 144, 14);
+  memcpy(profile + 144, "curv", 4);
+  put32(profile + 152, 1);
+  profile[156] = 1; // gamma 1.0 (u8Fixed8)
+  put32(profile, 160);
+  return 160;
+}
+
+/**
+ * @brief Build the data of an iCCP chunk
+ * @return Length of the data
+ */
+static uint32_t iccp_chunk(const char *name, const uint8_t *profile, uint32_t size, uint8_t data[1024]) {
+  const uint32_t len = strlen(name) + 1;
+  memcpy(data, name, len);
+  data[len] = 0; // compression method
+  uLongf zsize = 1024 - len - 1;
+  CU_ASSERT_EQUAL(compress2(data + len + 1, &zsize, profile, size, 9), Z_OK);
+  return len + 1 + zsize;
+}
+
+
+
+int init_test_icc(void) {
+  return 0;
+}
+
+int clean_test_icc(void) {
+  return 0;
+}
+
+
+
+void test_icc_srgb(void) {
+  uint8_t profile[512];
+  struct icc_transform *t = malloc(sizeof(struct icc_transform));
+  CU_ASSERT_EQUAL(icc_build(profile, rgb_profile(srgb_xyz, profile), t), 1);
+  CU_ASSERT_EQUAL(t->gray, 0);
+
+  // sRGB to sRGB: every 8-bit color is kept (within one for rounding in the cells)
+  uint8_t row[256 * 4];
+  for (uint32_t v = 0; v < 256; v++) {
+    row[4 * v]     = v;
+    row[4 * v + 1] = 255 - v;
+    row[4 * v + 2] = (v * 7) & 0xff;
+    row[4 * v + 3] = v;
+  }
+  icc_apply(t, FORMAT_RGBA8, row, 256, 1, sizeof(row));
+  for (uint32_t v = 0; v < 256; v++) {
+    CU_ASSERT(abs(row[4 * v] - (int) v) <= 1);
+    CU_ASSERT(abs(row[4 * v + 1] - (int) (255 - v)) <= 1);
+    CU_ASSERT(abs(row[4 * v + 2] - (int) ((v * 7) & 0xff)) <= 1);
+    CU_ASSERT_EQUAL(row[4 * v + 3], v);
+  }
+
+  // black and white fall on nodes
+  uint16_t wide[2][4] = {{0, 0, 0, 65535}, {65535, 65535, 65535, 0}};
+  icc_apply(t, FORMAT_RGBA16, wide, 2, 1, sizeof(wide));
+  CU_ASSERT_EQUAL(wide[0][0], 0);
+  CU_ASSERT_EQUAL(wide[0][3], 65535);
+  CU_ASSERT(wide[1][1] >= 65535 - 16);
+  CU_ASSERT_EQUAL(wide[1][3], 0);
+
+  // not a profile
+  memcpy(profile + 36, "nope", 4);
+  CU_ASSERT_EQUAL(icc_build(profile, 512, t), 0);
+  free(t);
+}
+
+void test_icc_wide_gamut(void) {
+  uint8_t profile[512];
+  struct icc_transform *t = malloc(sizeof(struct icc_transform));
+  CU_ASSERT_EQUAL(icc_build(profile, rgb_profile(p3_xyz, profile), t), 1);
+
+  uint8_t row[3][3] = {{255, 0, 0}, {128, 128, 128}, {200, 100, 100}};
+  icc_apply(t, FORMAT_RGB8, row, 3, 1, sizeof(row));
+
+  // P3 red is out of the sRGB gamut: clipped
+  CU_ASSERT_EQUAL(row[0][0], 255);
+  CU_ASSERT(row[0][1] <= 1);
+  CU_ASSERT(row[0][2] <= 1);
+  // same white point: gray stays
+  CU_ASSERT(abs(row[1][0] - 128) <= 1);
+  CU_ASSERT(abs(row[1][1] - 128) <= 1);
+  CU_ASSERT(abs(row[1][2] - 128) <= 1);
+  // a P3 color is more saturated in sRGB
+  CU_ASSERT(row[2][0] > 200);
+  CU_ASSERT(row[2][1] < 100);
+
+  // BGRA is the same transform
+  uint8_t bgra[4] = {100, 100, 200, 7};
+  icc_apply(t, FORMAT_BGRA8, bgra, 1, 1, sizeof(bgra));
+  CU_ASSERT_EQUAL(bgra[2], row[2][0]);
+  CU_ASSERT_EQUAL(bgra[1], row[2][1]);
+  CU_ASSERT_EQUAL(bgra[0], row[2][2]);
+  CU_ASSERT_EQUAL(bgra[3], 7);
+  free(t);
+}
+
+void test_icc_gray(void) {
+  uint8_t profile[512];
+  struct icc_transform *t = malloc(sizeof(struct icc_transform));
+  CU_ASSERT_EQUAL(icc_build(profile, gray_profile(profile), t), 1);
+  CU_ASSERT_EQUAL(t->gray, 1);
+
+  // linear gray to the sRGB curve
+  uint8_t gray[3] = {0, 128, 255};
+  icc_apply(t, FORMAT_GRAY8, gray, 3, 1, sizeof(gray));
+  CU_ASSERT_EQUAL(gray[0], 0);
+  CU_ASSERT(abs(gray[1] - 188) <= 1);
+  CU_ASSERT_EQUAL(gray[2], 255);
+
+  float unit[4] = {0.5f, 0.5f, 0.5f, 0.25f};
+  icc_apply(t, FORMAT_FLOAT32, unit, 1, 1, sizeof(unit));
+  CU_ASSERT_DOUBLE_EQUAL(unit[0], 0.7354, 0.002);
+  CU_ASSERT_DOUBLE_EQUAL(unit[3], 0.25, 1e-6);
+  free(t);
+}
+
+void test_icc_cache(void) {
+  uint8_t profile[512];
+  uint8_t data[1024];
+  const uint32_t length = iccp_chunk("Display P3", profile, rgb_profile(p3_xyz, profile), data);
+
+  const struct icc_transform *t1 = icc_prepare(data, length);
+  CU_ASSERT_PTR_NOT_EQUAL(t1, NULL);
+
+  // same profile, other name: the cached transform
+  const uint32_t length2 = iccp_chunk("P3", profile, rgb_profile(p3_xyz, profile), data);
+  const struct icc_transform *t2 = icc_prepare(data, length2);
+  CU_ASSERT_PTR_EQUAL(t2, t1);
+  CU_ASSERT_EQUAL(t1->refs, 3); // the cache, t1 and t2
+  icc_release(t2);
+
+  // other profile
+  const uint32_t length3 = iccp_chunk("sRGB", profile, rgb_profile(srgb_xyz, profile), data);
+  const struct icc_transform *t3 = icc_prepare(data, length3);
+  CU_ASSERT_PTR_NOT_EQUAL(t3, NULL);
+  CU_ASSERT_PTR_NOT_EQUAL(t3, t1);
+  CU_ASSERT_NOT_EQUAL(t3->hash, t1->hash);
+  CU_ASSERT_EQUAL(t3->zsize, length3 - 6); // after the name, separator and method
+
+  // same hash, other bytes: the bytes decide
+  const uint64_t p3_hash = t1->hash;
+  ((struct icc_transform *) t1)->hash = t3->hash;
+  const struct icc_transform *t4 = icc_prepare(data, length3);
+  CU_ASSERT_PTR_EQUAL(t4, t3);
+  icc_release(t4);
+  ((struct icc_transform *) t1)->hash = p3_hash;
+
+  // pushed out of the cache by other profiles: still valid while held
+  const int16_t p3_first = t1->grid[ICC_GRID - 1][0][0][0];
+  for (uint32_t k = 0; k < 40; k++) {
+    const double xyz[3][3] = {{0.4 + k * 0.001, 0.35, 0.18}, {0.2, 0.7, 0.08}, {0.02, 0.1, 0.7}};
+    const uint32_t size = iccp_chunk("other", profile, rgb_profile(xyz, profile), data);
+    icc_release(icc_prepare(data, size));
+  }
+  CU_ASSERT_EQUAL(t1->refs, 1);
+  CU_ASSERT_EQUAL(t1->grid[ICC_GRID - 1][0][0][0], p3_first);
+  icc_release(t1);
+  icc_release(t3);
+
+  // broken chunks
+  const uint32_t length4 = iccp_chunk("sRGB", profile, rgb_profile(srgb_xyz, profile), data);
+  data[length4 - 6] ^= 0xff;
+  CU_ASSERT_PTR_EQUAL(icc_prepare(data, length4), NULL);
+  CU_ASSERT_PTR_EQUAL(icc_prepare((const uint8_t *) "no separator", 12), NULL);
+}
+
+void test_icc_threads(void) {
+  uint8_t profile[512];
+  struct icc_transform *t = malloc(sizeof(struct icc_transform));
+  CU_ASSERT_EQUAL(icc_build(profile, rgb_profile(p3_xyz, profile), t), 1);
+
+  // large enough for several threads
+  const uint32_t w = 1024, h = 512;
+  uint8_t *all  = malloc(4 * w * h);
+  uint8_t *rows = malloc(4 * w * h);
+  for (uint32_t k = 0; k < 4 * w * h; k++) {
+    all[k] = (k * 2654435761U) >> 24;
+  }
+  memcpy(rows, all, 4 * w * h);
+
+  icc_apply(t, FORMAT_RGBA8, all, w, h, 4 * w);
+  for (uint32_t i = 0; i < h; i++) {
+    icc_apply(t, FORMAT_RGBA8, rows + 4 * w * i, w, 1, 4 * w);
+  }
+  CU_ASSERT_EQUAL(memcmp(all, rows, 4 * w * h), 0);
+  free(all);
+  free(rows);
+  free(t);
+}
@@ -0,0 +1,31 @@
+/**
+ * @file test-icc.h
+ * @brief Test ICC profiles (iCCP) to sRGB
+ * @details
+ */
+
+#ifndef __TEST_ICC_H__
+#define __TEST_ICC_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_icc(void);
+
+int clean_test_icc(void);
+
+
+void test_icc_srgb(void);
+
+void test_icc_wide_gamut(void);
+
+void test_icc_gray(void);
+
+void test_icc_cache(void);
+
+void test_icc_threads(void);
+
+
+
+#endif // __TEST_ICC_H__
@@ -1,10 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "test-image.h"
+#include "png-fixture.h"
 
 #include "chunk.h"
 #include "image.h"
 #include "color.h"
 
 
+/**
+ * @brief Copy of a file with chunks inserted after its IHDR
+ * @param[in] filename
+ * @param[in] chunks Whole chunks (see chunk_bytes)
+ * @param[in] size Size of chunks
+ * @return The copy, its data to free
+ */
+static struct mfile insert_chunks(const char *filename, const uint8_t *chunks, uint32_t size) {
+  const struct mfile file = map_file(filename);
+  const size_t head = 8 + 12 + 13; // signature and IHDR
+  uint8_t *data = malloc(file.size + size);
+  memcpy(data, file.data, head);
+  memcpy(data + head, chunks, size);
+  memcpy(data + head + size, (const uint8_t *) file.data + head, file.size - head);
+  const struct mfile copy = {filename, data, file.size + size, 0};
+  unmap_file(&file);
+  return copy;
+}
+
+/**
+ * @brief Check that a file with wrong chunks decodes as the file without them
+ */
+static void check_skipped(const char *filename, const uint8_t *chunks, uint32_t size) {
+  const struct mfile file = map_file(filename);
+  const struct mfile bad = insert_chunks(filename, chunks, size);
+  for (uint8_t native = 0; native < 2; native++) {
+    const struct image expected = native ? get_image_native(&file) : get_image(&file);
+    const struct image img = native ? get_image_native(&bad) : get_image(&bad);
+    CU_ASSERT_EQUAL(img.gamma, expected.gamma);
+    CU_ASSERT_EQUAL(img.has_background, expected.has_background);
+    CU_ASSERT_EQUAL(memcmp(img.data, expected.data, (size_t) line_size(&img) * img.height), 0);
+    free_image(&img);
+    free_image(&expected);
+
+    struct image checked;
+    CU_ASSERT_EQUAL(get_image_checked(&bad, native, NULL, &checked), DECODE_OK);
+    free_image(&checked);
+  }
+  free(bad.data);
+  unmap_file(&file);
+}
+
+
 
 int init_test_image(void) {
   return 0;
@@ -208,3 +255,317 @@ void test_image_pp0n6a08(void) {
   free_image(&img);
   unmap_file(&file);
 }
+
+
+/**
+ * @brief Compare each pixel of a crop to the full image
+ */
+static void check_crop(const char *pathname, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+
+  const struct mfile file = map_file(pathname);
+  const struct image full = get_image(&file);
+  const struct image crop = get_image_crop(&file, x, y, w, h);
+
+  CU_ASSERT_EQUAL(crop.width, w);
+  CU_ASSERT_EQUAL(crop.height, h);
+  CU_ASSERT_EQUAL(crop.depth, full.depth);
+  CU_ASSERT_EQUAL(crop.sample, full.sample);
+
+  struct color ref;
+  struct color c;
+
+  for (uint32_t i = 0; i < h; i++) {
+    for (uint32_t j = 0; j < w; j++) {
+
+      get_color(&full, y + i, x + j, &ref);
+      get_color(&crop, i, j, &c);
+
+      CU_ASSERT_EQUAL(c.red, ref.red);
+      CU_ASSERT_EQUAL(c.green, ref.green);
+      CU_ASSERT_EQUAL(c.blue, ref.blue);
+      CU_ASSERT_EQUAL(c.alpha, ref.alpha);
+    }
+  }
+
+  free_image(&crop);
+  free_image(&full);
+  unmap_file(&file);
+}
+
+
+void test_image_crop(void) {
+  check_crop("suite/basn0g08.png", 0, 0, 32, 32);
+  check_crop("suite/basn0g08.png", 5, 7, 10, 3);
+  check_crop("suite/basn0g01.png", 3, 30, 27, 2);
+  check_crop("suite/basn0g02.png", 1, 0, 1, 1);
+  check_crop("suite/basn0g04.png", 7, 9, 25, 23);
+  check_crop("suite/basn2c16.png", 31, 0, 1, 32);
+  check_crop("suite/basn3p04.png", 13, 2, 6, 6);
+  check_crop("suite/pp0n6a08.png", 16, 16, 16, 16);
+}
+
+
+/**
+ * @brief Compare a downscaled interlaced image to the top left pixel of each box of the same image not interlaced
+ */
+static void check_scaled_adam7(const char *interlaced, const char *reference, uint8_t scale) {
+
+  const struct mfile file = map_file(interlaced);
+  const struct image img  = get_image_scaled(&file, scale);
+  unmap_file(&file);
+  const struct mfile ref_file = map_file(reference);
+  const struct image ref_img  = get_image(&ref_file);
+  unmap_file(&ref_file);
+
+  CU_ASSERT_EQUAL(img.width, (ref_img.width + (1 << scale) - 1) >> scale);
+  CU_ASSERT_EQUAL(img.height, (ref_img.height + (1 << scale) - 1) >> scale);
+
+  struct color ref;
+  struct color c;
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < img.width; j++) {
+
+      get_color(&ref_img, i << scale, j << scale, &ref);
+      get_color(&img, i, j, &c);
+
+      CU_ASSERT_EQUAL(c.red * 255 / c.max, ref.red * 255 / ref.max);
+      CU_ASSERT_EQUAL(c.green * 255 / c.max, ref.green * 255 / ref.max);
+      CU_ASSERT_EQUAL(c.blue * 255 / c.max, ref.blue * 255 / ref.max);
+      CU_ASSERT_EQUAL(c.alpha * 255 / c.max, ref.alpha * 255 / ref.max);
+    }
+  }
+  free_image(&ref_img);
+  free_image(&img);
+}
+
+/**
+ * @brief Compare a downscaled image to the average of each box of the full image
+ */
+static void check_scaled_box(const char *pathname, uint8_t scale) {
+
+  const struct mfile file = map_file(pathname);
+  const struct image full = get_image(&file);
+  const struct image img  = get_image_scaled(&file, scale);
+  unmap_file(&file);
+
+  const uint32_t f = 1 << scale;
+  struct color ref;
+  struct color c;
+
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < img.width; j++) {
+
+      uint32_t red = 0, n = 0;
+      for (uint32_t y = i * f; (y < (i + 1) * f) && (y < full.height); y++) {
+        for (uint32_t x = j * f; (x < (j + 1) * f) && (x < full.width); x++) {
+          get_color(&full, y, x, &ref);
+          red += (ref.max < 255) ? ref.red * 255 / ref.max : ref.red;
+          n++;
+        }
+      }
+      get_color(&img, i, j, &c);
+      CU_ASSERT_EQUAL(c.red, (red + n / 2) / n);
+    }
+  }
+  free_image(&full);
+  free_image(&img);
+}
+
+
+void test_image_scaled(void) {
+  for (uint8_t scale = 1; scale <= 3; scale++) {
+    check_scaled_adam7("suite/basi0g01.png", "suite/basn0g01.png", scale);
+    check_scaled_adam7("suite/basi0g04.png", "suite/basn0g04.png", scale);
+    check_scaled_adam7("suite/basi2c16.png", "suite/basn2c16.png", scale);
+    check_scaled_adam7("suite/basi3p02.png", "suite/basn3p02.png", scale);
+    check_scaled_adam7("suite/basi6a08.png", "suite/basn6a08.png", scale);
+
+    check_scaled_box("suite/basn0g02.png", scale);
+    check_scaled_box("suite/basn0g08.png", scale);
+    check_scaled_box("suite/basn2c16.png", scale);
+    check_scaled_box("suite/basn4a08.png", scale);
+  }
+}
+
+
+/**
+ * @brief Decode by bands and compare with the whole image
+ */
+static void check_stream(const char *filename, uint32_t band_rows, uint8_t native) {
+  const struct mfile file = map_file(filename);
+  const struct image img  = native ? get_image_native(&file) : get_image(&file);
+  const uint32_t lsize = line_size(&img);
+
+  struct image_stream is;
+  image_stream_open(&is, &file, band_rows, native);
+  CU_ASSERT_EQUAL(is.band.width, img.width);
+  CU_ASSERT_EQUAL(is.band.native, img.native);
+  CU_ASSERT_EQUAL(is.band.gamma, img.gamma);
+  CU_ASSERT_EQUAL(is.band.has_background, img.has_background);
+  CU_ASSERT((img.palette == NULL) == (is.band.palette == NULL));
+  if (img.palette != NULL) {
+    CU_ASSERT_EQUAL(memcmp(is.band.palette, img.palette, PALETTE_SIZE), 0);
+  }
+
+  uint32_t row = 0;
+  const void *before = NULL;
+  uint32_t nrows;
+  while ((nrows = image_stream_read(&is)) > 0) {
+    CU_ASSERT_EQUAL(is.row0, row);
+    CU_ASSERT_EQUAL(is.band.height, nrows);
+    CU_ASSERT(nrows <= band_rows);
+    CU_ASSERT_EQUAL(memcmp(is.band.data, ((uint8_t *) img.data) + (size_t) row * lsize, (size_t) nrows * lsize), 0);
+    CU_ASSERT(is.band.data != before); // two buffers in turn
+    before = is.band.data;
+    row += nrows;
+  }
+  CU_ASSERT_EQUAL(row, img.height);
+  CU_ASSERT_EQUAL(image_stream_read(&is), 0);
+
+  image_stream_close(&is);
+  free_image(&img);
+  unmap_file(&file);
+}
+
+void test_image_stream(void) {
+  const char *files[] = {"suite/basn0g01.png", "suite/basn0g16.png", "suite/basn2c16.png", "suite/basn3p04.png",
+                         "suite/basn4a16.png", "suite/basn6a08.png", "suite/f04n0g08.png", "suite/s03n2c08.png"};
+  const uint32_t bands[] = {1, 5, 7, 32, 100};
+
+  for (uint8_t f = 0; f < 8; f++) {
+    for (uint8_t b = 0; b < 5; b++) {
+      check_stream(files[f], bands[b], 0);
+      check_stream(files[f], bands[b], 1);
+    }
+  }
+}
+
+
+
+void test_image_checked(void) {
+  const char *files[] = {"suite/basn0g01.png", "suite/basn0g16.png", "suite/basn2c16.png", "suite/basn3p04.png",
+                         "suite/basn4a16.png", "suite/basn6a08.png", "suite/f04n0g08.png", "suite/s03n2c08.png"};
+
+  for (uint8_t f = 0; f < 8; f++) {
+    for (uint8_t native = 0; native < 2; native++) {
+      const struct mfile file = map_file(files[f]);
+      const struct image img = native ? get_image_native(&file) : get_image(&file);
+      struct image checked;
+      CU_ASSERT_EQUAL(get_image_checked(&file, native, NULL, &checked), DECODE_OK);
+      CU_ASSERT_EQUAL(checked.width, img.width);
+      CU_ASSERT_EQUAL(checked.height, img.height);
+      CU_ASSERT_EQUAL(checked.native, img.native);
+      CU_ASSERT_EQUAL(memcmp(checked.data, img.data, (size_t) line_size(&img) * img.height), 0);
+      CU_ASSERT((img.palette == NULL) == (checked.palette == NULL));
+      if (img.palette != NULL) {
+        CU_ASSERT_EQUAL(memcmp(checked.palette, img.palette, PALETTE_SIZE), 0);
+      }
+      free_image(&checked);
+      free_image(&img);
+      unmap_file(&file);
+    }
+  }
+  const struct mfile file = map_file("suite/basi0g08.png");
+  struct image img;
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, NULL, &img), DECODE_INTERLACED);
+  unmap_file(&file);
+}
+
+
+void test_image_limits(void) {
+  // 32x32 RGB 16-bit: 6 KiB of pixels
+  const struct mfile file = map_file("suite/basn2c16.png");
+  const uint64_t memory = 32 * 32 * 6 + DECODE_INFLATE_MEMORY;
+  struct image img;
+
+  struct decode_limits limits = {1023, 0, 0, NULL};
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, &limits, &img), DECODE_TOO_MANY_PIXELS);
+  limits.max_pixels = 1024;
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, &limits, &img), DECODE_OK);
+  free_image(&img);
+
+  limits.max_memory = memory - 1;
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, &limits, &img), DECODE_OVER_BUDGET);
+  limits.max_memory = memory;
+  limits.timeout_ms = 60000;
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, &limits, &img), DECODE_OK);
+  free_image(&img);
+
+  // a flag set by another thread, here before the decode
+  const uint8_t cancel = 1;
+  limits.cancel = &cancel;
+  CU_ASSERT_EQUAL(get_image_checked(&file, 0, &limits, &img), DECODE_CANCELLED);
+
+  const struct IHDR header = {.width = 100000, .height = 100000, .depth = 16, .color_type = RGB_TRIPLE_ALPHA};
+  const struct decode_limits none = {0, 0, 0, NULL};
+  CU_ASSERT_EQUAL(check_header_limits(&header, &none), DECODE_OK);
+  const struct IHDR wide = {.width = 0x7FFFFFFF, .height = 1, .depth = 16, .color_type = RGB_TRIPLE_ALPHA};
+  CU_ASSERT_EQUAL(check_header_limits(&wide, &none), DECODE_OVER_BUDGET); // scanline over 32 bits
+  unmap_file(&file);
+
+  struct decode_limits parsed = none;
+  CU_ASSERT(parse_decode_limit("mpx40", 5, &parsed));
+  CU_ASSERT(parse_decode_limit("mb512", 5, &parsed));
+  CU_ASSERT(parse_decode_limit("ms50,", 4, &parsed));
+  CU_ASSERT_EQUAL(parsed.max_pixels, 40000000);
+  CU_ASSERT_EQUAL(parsed.max_memory, 512ULL << 20);
+  CU_ASSERT_EQUAL(parsed.timeout_ms, 50);
+  CU_ASSERT_FALSE(parse_decode_limit("ms", 2, &parsed));
+  CU_ASSERT_FALSE(parse_decode_limit("ms5x", 4, &parsed));
+  CU_ASSERT_FALSE(parse_decode_limit("kb4", 3, &parsed));
+  CU_ASSERT_FALSE(parse_decode_limit("mpx1234567890", 13, &parsed));
+}
+
+
+void test_image_corrupt(void) {
+  const struct mfile file = map_file("suite/basn3p04.png");
+  uint8_t *copy = malloc(file.size);
+  memcpy(copy, file.data, file.size);
+  struct mfile broken = {"broken", copy, file.size, 0};
+  const struct decode_limits limits = {0, 1 << 20, 0, NULL}; // a flipped width is not allocated
+  struct image img;
+
+  // cut anywhere: at least the IEND chunk is missing
+  for (size_t size = 0; size < file.size; size++) {
+    broken.size = size;
+    CU_ASSERT_EQUAL(get_image_checked(&broken, 0, &limits, &img), DECODE_CORRUPT);
+  }
+  // any byte flipped: decoded (CRC only warned about), or a status
+  broken.size = file.size;
+  for (size_t k = 0; k < file.size; k++) {
+    copy[k] ^= 0xFF;
+    const enum decode_status status = get_image_checked(&broken, 0, &limits, &img);
+    CU_ASSERT(status <= DECODE_OVER_BUDGET);
+    if (status == DECODE_OK) {
+      free_image(&img);
+    }
+    copy[k] ^= 0xFF;
+  }
+  CU_ASSERT_EQUAL(get_image_checked(&broken, 0, &limits, &img), DECODE_OK);
+  free_image(&img);
+  free(copy);
+  unmap_file(&file);
+}
+
+
+void test_image_bad_chunks(void) {
+  // gAMA, sRGB and cHRM one byte short or long: skipped
+  const uint8_t zero[32] = {0};
+  uint8_t chunks[3 * 12 + 3 + 2 + 31];
+  uint32_t size = chunk_bytes(chunks, "gAMA", zero, 3);
+  size += chunk_bytes(chunks + size, "sRGB", zero, 2);
+  size += chunk_bytes(chunks + size, "cHRM", zero, 31);
+  check_skipped("suite/basn2c08.png", chunks, size);
+  check_skipped("suite/basn3p04.png", chunks, size);
+
+  // bKGD of the length of another color type: gray, RGB, palette
+  const char *files[3] = {"suite/basn0g08.png", "suite/basn2c08.png", "suite/basn3p04.png"};
+  const uint8_t lengths[3][2] = {{1, 6}, {2, 1}, {2, 6}};
+  for (uint8_t f = 0; f < 3; f++) {
+    for (uint8_t k = 0; k < 2; k++) {
+      size = chunk_bytes(chunks, "bKGD", zero, lengths[f][k]);
+      check_skipped(files[f], chunks, size);
+    }
+  }
+}
@@ -25,5 +25,27 @@ void test_image_basn4a08(void);
 
 void test_image_pp0n6a08(void);
 
+/* Crop against the full image */
+
+void test_image_crop(void);
+
+/* Downscale against the full image */
+
+void test_image_scaled(void);
+
+/* Bands against the full image */
+
+void test_image_stream(void);
+
+/* Decode with a budget, without ending the process */
+
+void test_image_checked(void);
+
+void test_image_limits(void);
+
+void test_image_corrupt(void);
+
+void test_image_bad_chunks(void);
+
 
 #endif // __TEST_IMAGE_H__
@@ -0,0 +1,96 @@
+/**
+ * @file test-index.c
+ * @brief Test IDAT checkpoints and crop from them
+ * @details
+ */
+
+#include <string.h>
+
+#include "test-index.h"
+
+#include "image.h"
+#include "index.h"
+
+
+/** @brief Sidecar file written by the tests */
+#define SIDECAR "suite/index.tmp"
+
+
+int init_test_index(void) {
+  return 0;
+}
+
+int clean_test_index(void) {
+  remove(SIDECAR);
+  return 0;
+}
+
+
+/**
+ * @brief Compare every band of lines decoded from the index to the full image
+ */
+static void check_index_rows(const struct mfile *file, const struct idat_index *index) {
+
+  const struct image full = get_image(file);
+  const uint32_t lsize = line_size(&full);
+
+  for (uint32_t y = 0; y < full.height; y += 3) {
+    uint32_t height = (y + 5 <= full.height) ? 5 : full.height - y;
+    const struct image band = get_image_crop_indexed(file, index, 0, y, full.width, height);
+
+    CU_ASSERT_EQUAL(memcmp(band.data, ((uint8_t *) full.data) + y * lsize, height * lsize), 0);
+    free_image(&band);
+  }
+  free_image(&full);
+}
+
+
+void test_index_crop(void) {
+  const char *files[] = {"suite/basn0g01.png", "suite/basn2c16.png", "suite/basn3p04.png", "suite/f04n0g08.png"};
+
+  for (int f = 0; f < 4; f++) {
+    const struct mfile file = map_file(files[f]);
+    struct idat_index index;
+    build_index(&file, 1, &index);
+
+    CU_ASSERT_EQUAL(index.span, 1);
+    CU_ASSERT_EQUAL(index.header.height, 32);
+    for (uint32_t p = 1; p < index.nb_point; p++) {
+      CU_ASSERT_TRUE(index.point[p].row > index.point[p - 1].row);
+    }
+    check_index_rows(&file, &index);
+
+    free_index(&index);
+    unmap_file(&file);
+  }
+}
+
+
+void test_index_sidecar(void) {
+  const struct mfile file = map_file("suite/basn6a16.png");
+
+  struct idat_index index;
+  build_index(&file, 2, &index);
+  save_index(&index, SIDECAR);
+
+  struct idat_index loaded;
+  load_index(SIDECAR, &loaded);
+
+  CU_ASSERT_EQUAL(loaded.span, index.span);
+  CU_ASSERT_EQUAL(loaded.lsize, index.lsize);
+  CU_ASSERT_EQUAL(loaded.nb_point, index.nb_point);
+  for (uint32_t p = 0; p < index.nb_point; p++) {
+    const struct index_point *a = index.point + p;
+    const struct index_point *b = loaded.point + p;
+    CU_ASSERT_EQUAL(a->row, b->row);
+    CU_ASSERT_EQUAL(a->chunk, b->chunk);
+    CU_ASSERT_EQUAL(a->in, b->in);
+    CU_ASSERT_EQUAL(a->bits, b->bits);
+    CU_ASSERT_EQUAL(memcmp(a->window, b->window, a->wsize + index.lsize + a->offset), 0);
+  }
+  check_index_rows(&file, &loaded);
+
+  free_index(&loaded);
+  free_index(&index);
+  unmap_file(&file);
+}
@@ -0,0 +1,25 @@
+/**
+ * @file test-index.h
+ * @brief Test IDAT checkpoints and crop from them
+ * @details
+ */
+
+#ifndef __TEST_INDEX_H__
+#define __TEST_INDEX_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_index(void);
+
+int clean_test_index(void);
+
+
+void test_index_crop(void);
+
+void test_index_sidecar(void);
+
+
+
+#endif // __TEST_INDEX_H__
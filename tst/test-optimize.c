@@ -0,0 +1,282 @@
+/**
+ * @file test-optimize.c
+ * @brief Test the lossless optimizer
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-optimize.h"
+#include "png-fixture.h"
+
+#include "convert.h"
+#include "icc.h"
+#include "image.h"
+#include "mfile.h"
+#include "optimize.h"
+
+
+#define OPTIMIZE_FILE "suite/optimize-tmp.png"
+#define OPTIMIZE_OTHER "suite/optimize-tmp2.png"
+
+
+/**
+ * @brief Check two images have the same pixels and metadata
+ */
+static void same_image(const struct image *a, const struct image *b) {
+  CU_ASSERT_EQUAL(a->width, b->width);
+  CU_ASSERT_EQUAL(a->height, b->height);
+  if ((a->width != b->width) || (a->height != b->height)) {
+    return;
+  }
+  CU_ASSERT_EQUAL(a->gamma, b->gamma);
+  CU_ASSERT_EQUAL(a->has_background, b->has_background);
+  if (a->has_background && b->has_background) {
+    CU_ASSERT_EQUAL(memcmp(a->background, b->background, sizeof(a->background)), 0);
+  }
+
+  uint16_t *ra = malloc((size_t) a->width * 8);
+  uint16_t *rb = malloc((size_t) a->width * 8);
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < a->height; i++) {
+    convert_rows(a, i, 1, FORMAT_RGBA16, ra, (size_t) a->width * 8);
+    convert_rows(b, i, 1, FORMAT_RGBA16, rb, (size_t) a->width * 8);
+    wrong += (memcmp(ra, rb, (size_t) a->width * 8) != 0);
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  free(ra);
+  free(rb);
+}
+
+/**
+ * @brief RGBA16 image in the native byte order, every sample from a function of the pixel
+ */
+static struct image rgba16(uint32_t width, uint32_t height, void (*pixel)(uint32_t i, uint32_t j, uint16_t px[4])) {
+  uint16_t *data = malloc((size_t) width * height * 8);
+  for (uint32_t i = 0; i < height; i++) {
+    for (uint32_t j = 0; j < width; j++) {
+      pixel(i, j, data + ((size_t) i * width + j) * 4);
+    }
+  }
+  const struct image r = {.width = width, .height = height, .depth = 16, .sample = 4, .native = 1, .data = data};
+  return r;
+}
+
+/** @brief Opaque gray on 4 bits */
+static void gray4(uint32_t i, uint32_t j, uint16_t px[4]) {
+  px[0] = px[1] = px[2] = ((i + j / 3) % 16) * 4369;
+  px[3] = 65535;
+}
+
+/** @brief Three opaque colors on 8 bits */
+static void three(uint32_t i, uint32_t j, uint16_t px[4]) {
+  static const uint16_t colors[3][3] = {{255, 0, 0}, {10, 20, 30}, {0, 0, 255}};
+  for (uint8_t k = 0; k < 3; k++) {
+    px[k] = colors[(i / 4 + j / 5) % 3][k] * 257;
+  }
+  px[3] = 65535;
+}
+
+/** @brief Color with alpha on 8 bits */
+static void alpha8(uint32_t i, uint32_t j, uint16_t px[4]) {
+  px[0] = (i * 3) % 256 * 257;
+  px[1] = (j * 5) % 256 * 257;
+  px[2] = ((i + j) % 256) * 257;
+  px[3] = ((i * j) % 256) * 257;
+}
+
+/** @brief Gray with alpha, gray on 16 bits */
+static void gray16(uint32_t i, uint32_t j, uint16_t px[4]) {
+  px[0] = px[1] = px[2] = i * 1000 + j;
+  px[3] = 65535 - i;
+}
+
+
+
+int init_test_optimize(void) {
+  return 0;
+}
+
+int clean_test_optimize(void) {
+  remove(OPTIMIZE_FILE);
+  remove(OPTIMIZE_OTHER);
+  return 0;
+}
+
+
+
+void test_optimize_reduce(void) {
+  struct {
+    void (*pixel)(uint32_t, uint32_t, uint16_t[4]);
+    uint8_t sample, depth, palette_depth;
+  } cases[] = {
+    {gray4, 1, 4, 4},
+    {three, 3, 8, 2},
+    {alpha8, 4, 8, 0},
+    {gray16, 2, 16, 0},
+  };
+
+  for (uint8_t c = 0; c < 4; c++) {
+    struct image img = rgba16(37, 21, cases[c].pixel);
+    img.gamma = 45455;
+    const struct image r = reduce_image(&img, 0);
+    CU_ASSERT_EQUAL(r.sample, cases[c].sample);
+    CU_ASSERT_EQUAL(r.depth, cases[c].depth);
+    CU_ASSERT_PTR_NULL(r.palette);
+    same_image(&img, &r);
+    free_image(&r);
+
+    const struct image p = reduce_image(&img, 1);
+    CU_ASSERT_EQUAL(p.data == NULL, cases[c].palette_depth == 0);
+    if (p.data != NULL) {
+      CU_ASSERT_PTR_NOT_NULL(p.palette);
+      CU_ASSERT_EQUAL(p.depth, cases[c].palette_depth);
+      same_image(&img, &p);
+      free_image(&p);
+    }
+    free(img.data);
+  }
+
+  // a background which is not gray keeps the colors
+  struct image img = rgba16(8, 8, gray4);
+  img.has_background = 1;
+  img.background[0] = 65535;
+  const struct image r = reduce_image(&img, 0);
+  CU_ASSERT_EQUAL(r.sample, 3);
+  same_image(&img, &r);
+  free_image(&r);
+
+  // so does an ICC profile of the colors
+  struct icc_transform *profile = calloc(1, sizeof(struct icc_transform));
+  profile->refs = 1;
+  img.has_background = 0;
+  img.profile = profile;
+  const struct image c = reduce_image(&img, 0);
+  CU_ASSERT_EQUAL(c.sample, 3);
+  CU_ASSERT_PTR_EQUAL(c.profile, profile);
+  free_image(&c);
+  CU_ASSERT_EQUAL(profile->refs, 1);
+  free(profile);
+  free(img.data);
+}
+
+
+void test_optimize_suite(void) {
+  const char *files[] = {"suite/basn0g01.png", "suite/basn0g16.png", "suite/basn2c16.png", "suite/basn3p02.png",
+                         "suite/basn4a08.png", "suite/basn6a16.png", "suite/bgwn6a08.png", "suite/tbbn3p08.png"};
+
+  for (int f = 0; f < 8; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image(&file);
+    struct optimize_report report;
+    const uint64_t size = optimize_png(&img, &file, OPTIMIZE_FILE, 0, &report);
+    CU_ASSERT(size <= file.size);
+    unmap_file(&file);
+
+    const struct mfile out = map_file(OPTIMIZE_FILE);
+    CU_ASSERT_EQUAL(out.size, size);
+    const struct image res = get_image(&out);
+    unmap_file(&out);
+    same_image(&img, &res);
+
+    // the smallest one is written (or the source), the stopped ones were larger
+    CU_ASSERT(report.copied || (report.trial[report.best].size == size));
+    for (uint32_t t = 0; t < report.nb_trial; t++) {
+      CU_ASSERT((report.trial[t].size == 0) || (report.trial[t].size >= size));
+    }
+    free_image(&res);
+    free_optimize_report(&report);
+    free_image(&img);
+  }
+}
+
+
+void test_optimize_trials(void) {
+  const struct image img = rgba16(211, 97, alpha8);
+
+  // the same file on any number of threads
+  struct optimize_report report;
+  const uint64_t size = optimize_png(&img, NULL, OPTIMIZE_FILE, 1, &report);
+  const uint32_t best = report.best;
+  CU_ASSERT_EQUAL(report.nb_image, 1);
+  free_optimize_report(&report);
+
+  CU_ASSERT_EQUAL(optimize_png(&img, NULL, OPTIMIZE_OTHER, 4, &report), size);
+  CU_ASSERT_EQUAL(report.best, best);
+  free_optimize_report(&report);
+
+  const struct mfile f1 = map_file(OPTIMIZE_FILE);
+  const struct mfile f2 = map_file(OPTIMIZE_OTHER);
+  CU_ASSERT_EQUAL(f1.size, size);
+  CU_ASSERT_EQUAL(f2.size, size);
+  CU_ASSERT_EQUAL(memcmp(f1.data, f2.data, size), 0);
+  unmap_file(&f1);
+  unmap_file(&f2);
+
+  // no larger than the default encoder
+  CU_ASSERT(size <= png_size(&img, NULL));
+  free(img.data);
+}
+
+
+void test_optimize_chunks(void) {
+  uint8_t chunks[128];
+  const uint8_t srgb[1] = {0};
+  const uint8_t chrm[32] = {0, 0, 0x7a, 0x26, 0, 0, 0x80, 0x84, 0, 0, 0xfa, 0, 0, 0, 0x80, 0xe8,
+                            0, 0, 0x75, 0x30, 0, 0, 0xea, 0x60, 0, 0, 0x3a, 0x98, 0, 0, 0x17, 0x6f};
+  uint32_t length = chunk_bytes(chunks, "sRGB", srgb, 1);
+  length += chunk_bytes(chunks + length, "cHRM", chrm, 32);
+
+  // sRGB and cHRM copied into the palette image, no larger than the source
+  struct image img = rgba16(40, 30, three);
+  struct png_options options = png_default_options();
+  options.level  = 0;
+  options.chunks = chunks;
+  options.chunks_size = length;
+  write_png(&img, OPTIMIZE_OTHER, &options);
+  free(img.data);
+
+  struct mfile source = map_file(OPTIMIZE_OTHER);
+  struct image src = get_image(&source);
+  struct optimize_report report;
+  uint64_t size = optimize_png(&src, &source, OPTIMIZE_FILE, 0, &report);
+  CU_ASSERT(!report.copied);
+  CU_ASSERT(size < source.size);
+  free_optimize_report(&report);
+  unmap_file(&source);
+
+  char types[4 * 64 + 1];
+  chunk_types(OPTIMIZE_FILE, types, NULL);
+  CU_ASSERT_EQUAL(strncmp(types, "IHDRsRGBcHRMPLTE", 16), 0);
+  struct mfile out = map_file(OPTIMIZE_FILE);
+  CU_ASSERT_EQUAL(out.size, size);
+  const struct image res = get_image(&out);
+  unmap_file(&out);
+  same_image(&src, &res);
+  free_image(&res);
+  free_image(&src);
+
+  // tRNS: the source as it is
+  img = rgba16(40, 30, gray4);
+  const struct image gray = reduce_image(&img, 0);
+  const uint8_t trns[2] = {0, 5};
+  options.chunks_size = chunk_bytes(chunks, "tRNS", trns, 2);
+  write_png(&gray, OPTIMIZE_OTHER, &options);
+  free_image(&gray);
+  free(img.data);
+
+  source = map_file(OPTIMIZE_OTHER);
+  src = get_image(&source);
+  size = optimize_png(&src, &source, OPTIMIZE_FILE, 0, &report);
+  CU_ASSERT(report.copied);
+  CU_ASSERT_EQUAL(report.nb_trial, 0);
+  out = map_file(OPTIMIZE_FILE);
+  CU_ASSERT_EQUAL(out.size, source.size);
+  CU_ASSERT_EQUAL(size, source.size);
+  CU_ASSERT((out.size == source.size) && (memcmp(out.data, source.data, out.size) == 0));
+  unmap_file(&out);
+  free_optimize_report(&report);
+  free_image(&src);
+  unmap_file(&source);
+}
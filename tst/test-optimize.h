@@ -0,0 +1,29 @@
+/**
+ * @file test-optimize.h
+ * @brief Test the lossless optimizer
+ * @details
+ */
+
+#ifndef __TEST_OPTIMIZE_H__
+#define __TEST_OPTIMIZE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_optimize(void);
+
+int clean_test_optimize(void);
+
+
+void test_optimize_reduce(void);
+
+void test_optimize_suite(void);
+
+void test_optimize_trials(void);
+
+void test_optimize_chunks(void);
+
+
+
+#endif // __TEST_OPTIMIZE_H__
@@ -0,0 +1,368 @@
+/**
+ * @file test-png.c
+ * @brief Test the PNG writer
+ * @details
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "test-png.h"
+#include "png-fixture.h"
+
+#include "chunk.h"
+#include "filter.h"
+#include "image.h"
+#include "mfile.h"
+#include "png.h"
+
+
+#define PNG_FILE "suite/png-tmp.png"
+#define PNG_OTHER "suite/png-tmp2.png"
+
+/** @brief Synthetic image, several threads and strips */
+#define SYN_WIDTH (777U)
+#define SYN_HEIGHT (900U)
+#define SYN_STRIP (37U)
+
+
+/**
+ * @brief Decode a file written from an image and compare
+ */
+static void check_png(const char *filename, const struct image *img) {
+  // every chunk with its CRC, up to IEND
+  char types[4 * 64 + 1];
+  chunk_types(filename, types, NULL);
+
+  const struct mfile file = map_file(filename);
+  const struct image res = get_image_native(&file);
+  unmap_file(&file);
+
+  CU_ASSERT_EQUAL(res.width, img->width);
+  CU_ASSERT_EQUAL(res.height, img->height);
+  CU_ASSERT_EQUAL(res.depth, img->depth);
+  CU_ASSERT_EQUAL(res.sample, img->sample);
+  CU_ASSERT_EQUAL(res.gamma, img->gamma);
+  CU_ASSERT_EQUAL(res.has_background, img->has_background);
+  CU_ASSERT_EQUAL(memcmp(res.background, img->background, sizeof(res.background)), 0);
+  CU_ASSERT_EQUAL(memcmp(res.data, img->data, (size_t) line_size(img) * img->height), 0);
+
+  CU_ASSERT_EQUAL(res.palette == NULL, img->palette == NULL);
+  if ((res.palette != NULL) && (img->palette != NULL)) {
+    // colors up to the last one used
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < img->height; i++) {
+      for (uint32_t j = 0; j < img->width; j++) {
+        const uint8_t *row = ((const uint8_t *) img->data) + (size_t) i * line_size(img);
+        const uint32_t bit = j * img->depth;
+        const uint32_t index = (row[bit / 8] >> (8 - img->depth - bit % 8)) & ((1U << img->depth) - 1);
+        used = (index >= used) ? index + 1 : used;
+      }
+    }
+    CU_ASSERT_EQUAL(memcmp(res.palette, img->palette, used * 3), 0);
+  }
+  free_image(&res);
+}
+
+/**
+ * @brief Copy a file with an sRGB chunk after its IHDR and a tRNS chunk before its first IDAT
+ */
+static void add_transparency(const char *source, const char *filename, const uint8_t *trns, uint32_t length) {
+  const struct mfile file = map_file(source);
+  const uint8_t *data = file.data;
+  size_t idat = 8;
+  while (memcmp(data + idat + 4, "IDAT", 4) != 0) {
+    idat += 12 + get32(data + idat);
+  }
+  const uint8_t intent = 0;
+  FILE *f = fopen(filename, "wb");
+  fwrite(data, 1, 33, f); // signature and IHDR
+  put_chunk(f, "sRGB", &intent, 1);
+  fwrite(data + 33, 1, idat - 33, f);
+  put_chunk(f, "tRNS", trns, length);
+  fwrite(data + idat, 1, file.size - idat, f);
+  fclose(f);
+  unmap_file(&file);
+}
+
+/**
+ * @brief Data of the first chunk of a type
+ * @return The data, NULL if there is no such chunk
+ */
+static const uint8_t *find_chunk(const struct mfile *file, const char *type, uint32_t *length) {
+  const uint8_t *data = file->data;
+  for (size_t offset = 8; offset + 12 <= file->size; offset += 12 + get32(data + offset)) {
+    if (memcmp(data + offset + 4, type, 4) == 0) {
+      *length = get32(data + offset);
+      return data + offset + 8;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief RGB16 gradient with noise, native byte order
+ */
+static struct image synthetic_image(void) {
+  uint16_t *data = malloc(SYN_WIDTH * SYN_HEIGHT * 3 * 2);
+  for (uint32_t i = 0; i < SYN_HEIGHT; i++) {
+    for (uint32_t j = 0; j < SYN_WIDTH; j++) {
+      uint16_t *px = data + (i * SYN_WIDTH + j) * 3;
+      px[0] = j * 80;
+      px[1] = i * 70 + ((i * j * 2654435761U) >> 28);
+      px[2] = (i + j) * 37;
+    }
+  }
+  const struct image img = {.width = SYN_WIDTH, .height = SYN_HEIGHT, .depth = 16, .sample = 3,
+                            .native = 1, .gamma = 45455, .data = data};
+  return img;
+}
+
+
+
+int init_test_png(void) {
+  return 0;
+}
+
+int clean_test_png(void) {
+  remove(PNG_FILE);
+  remove(PNG_OTHER);
+  return 0;
+}
+
+
+
+void test_png_suite(void) {
+  // every color type and depth, palettes, gAMA and bKGD
+  const char *files[] = {"suite/basn0g01.png", "suite/basn0g02.png", "suite/basn0g04.png", "suite/basn0g08.png",
+                         "suite/basn0g16.png", "suite/basn2c08.png", "suite/basn2c16.png", "suite/basn3p01.png",
+                         "suite/basn3p02.png", "suite/basn3p04.png", "suite/basn3p08.png", "suite/basn4a08.png",
+                         "suite/basn4a16.png", "suite/basn6a08.png", "suite/basn6a16.png", "suite/bgan6a16.png",
+                         "suite/bgbn4a08.png", "suite/bgwn6a08.png", "suite/bgyn6a16.png", "suite/g03n2c08.png",
+                         "suite/s01n2c08.png", "suite/s39n2c08.png", "suite/tbbn3p08.png"};
+
+  for (int f = 0; f < 23; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image_native(&file);
+    unmap_file(&file);
+
+    // one strip, then a strip per row
+    struct png_options options = png_default_options();
+    write_png(&img, PNG_FILE, &options);
+    check_png(PNG_FILE, &img);
+    options.strip_rows = 1;
+    write_png(&img, PNG_FILE, &options);
+    check_png(PNG_FILE, &img);
+    free_image(&img);
+  }
+}
+
+
+void test_png_threads(void) {
+  const struct image img = synthetic_image();
+
+  // the same file on any number of threads, with or without dictionary
+  for (uint8_t dictionary = 0; dictionary < 2; dictionary++) {
+    struct png_options options = png_default_options();
+    options.strip_rows = SYN_STRIP;
+    options.dictionary = dictionary;
+    options.threads = 1;
+    const uint64_t size = write_png(&img, PNG_FILE, &options);
+    options.threads = 4;
+    CU_ASSERT_EQUAL(write_png(&img, PNG_OTHER, &options), size);
+
+    const struct mfile f1 = map_file(PNG_FILE);
+    const struct mfile f2 = map_file(PNG_OTHER);
+    CU_ASSERT_EQUAL(f1.size, size);
+    CU_ASSERT_EQUAL(f2.size, size);
+    CU_ASSERT_EQUAL(memcmp(f1.data, f2.data, size), 0);
+    unmap_file(&f1);
+    unmap_file(&f2);
+    check_png(PNG_OTHER, &img);
+  }
+
+  // every level
+  for (int level = 0; level <= 9; level += 3) {
+    struct png_options options = png_default_options();
+    options.level = level;
+    write_png(&img, PNG_FILE, &options);
+    check_png(PNG_FILE, &img);
+  }
+  free(img.data);
+}
+
+
+void test_png_strips(void) {
+  const struct image img = synthetic_image();
+  struct png_options options = png_default_options();
+  options.strip_rows = SYN_STRIP;
+  write_png(&img, PNG_FILE, &options);
+
+  // the image in the byte order of the file
+  const struct mfile file = map_file(PNG_FILE);
+  const struct image ref = get_image(&file);
+  const uint32_t lsize = line_size(&ref);
+
+  // stRP right before the first IDAT
+  const uint8_t *ptr = ((const uint8_t *) file.data) + 8;
+  while (memcmp(ptr + 4, PNG_STRIP_CHUNK, 4) != 0) {
+    CU_ASSERT_NOT_EQUAL(memcmp(ptr + 4, "IDAT", 4), 0);
+    ptr += 12 + get32(ptr);
+  }
+  const uint32_t nb_strip = (SYN_HEIGHT + SYN_STRIP - 1) / SYN_STRIP;
+  CU_ASSERT_EQUAL(get32(ptr), 4 + 4 * nb_strip);
+  CU_ASSERT_EQUAL(get32(ptr + 8), SYN_STRIP);
+  CU_ASSERT_EQUAL(memcmp(ptr + 12 + get32(ptr) + 4, "IDAT", 4), 0);
+
+  // each strip alone, last one first
+  uint8_t *rows = malloc((size_t) SYN_STRIP * (lsize + 1));
+  uint32_t wrong = 0;
+  for (uint32_t s = nb_strip; s-- > 0;) {
+    const uint8_t *idat = ptr + get32(ptr + 12 + 4 * s);
+    CU_ASSERT_EQUAL(memcmp(idat + 4, "IDAT", 4), 0);
+    const uint32_t row0  = s * SYN_STRIP;
+    const uint32_t nrows = (SYN_HEIGHT - row0 < SYN_STRIP) ? SYN_HEIGHT - row0 : SYN_STRIP;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    CU_ASSERT_EQUAL(inflateInit2(&z, -MAX_WBITS), Z_OK);
+    z.next_in   = (uint8_t *) idat + 8 + ((s == 0) ? 2 : 0);
+    z.avail_in  = get32(idat) - ((s == 0) ? 2 : 0);
+    z.next_out  = rows;
+    z.avail_out = nrows * (lsize + 1);
+    const int ret = inflate(&z, Z_SYNC_FLUSH);
+    CU_ASSERT((ret == Z_OK) || (ret == Z_STREAM_END));
+    CU_ASSERT_EQUAL(z.avail_out, 0);
+    inflateEnd(&z);
+
+    uint8_t *prior = NULL;
+    for (uint32_t i = 0; i < nrows; i++) {
+      uint8_t *raw = rows + i * (lsize + 1);
+      if (i == 0) {
+        CU_ASSERT(raw[0] <= 1); // None or Sub
+      }
+      unfilter_line(raw[0], raw + 1, prior, lsize, 6);
+      wrong += (memcmp(raw + 1, ((const uint8_t *) ref.data) + (size_t) (row0 + i) * lsize, lsize) != 0);
+      prior = raw + 1;
+    }
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  free(rows);
+  free_image(&ref);
+  unmap_file(&file);
+
+  // no stRP when strips need the one before
+  options.dictionary = 1;
+  write_png(&img, PNG_FILE, &options);
+  const struct mfile dict = map_file(PNG_FILE);
+  ptr = ((const uint8_t *) dict.data) + 8;
+  uint32_t nb_idat = 0;
+  while (memcmp(ptr + 4, "IEND", 4) != 0) {
+    CU_ASSERT_NOT_EQUAL(memcmp(ptr + 4, PNG_STRIP_CHUNK, 4), 0);
+    nb_idat += (memcmp(ptr + 4, "IDAT", 4) == 0);
+    ptr += 12 + get32(ptr);
+  }
+  CU_ASSERT_EQUAL(nb_idat, nb_strip);
+  unmap_file(&dict);
+  free(img.data);
+}
+
+
+void test_png_filters(void) {
+  const struct image img = synthetic_image();
+  const struct mfile file = map_file("suite/basn3p04.png");
+  const struct image pal  = get_image_native(&file);
+  unmap_file(&file);
+
+  for (uint8_t dictionary = 0; dictionary < 2; dictionary++) {
+    struct png_options options = png_default_options();
+    options.strip_rows = SYN_STRIP;
+    options.dictionary = dictionary;
+
+    // every fixed type, the brute force (whose filters depend on the rows before)
+    options.filter = FILTER_FIXED;
+    for (uint8_t type = 0; type < NB_FILTER; type++) {
+      options.filter_type = type;
+      write_png(&img, PNG_FILE, &options);
+      check_png(PNG_FILE, &img);
+    }
+    options.filter = FILTER_BRUTE;
+    options.threads = 1;
+    const uint64_t size = write_png(&img, PNG_FILE, &options);
+    check_png(PNG_FILE, &img);
+    options.threads = 4;
+    CU_ASSERT_EQUAL(write_png(&img, PNG_OTHER, &options), size);
+    check_png(PNG_OTHER, &img);
+
+    // palettes are filtered too except by the heuristic
+    options.strip_rows = 5;
+    write_png(&pal, PNG_FILE, &options);
+    check_png(PNG_FILE, &pal);
+  }
+  free_image(&pal);
+  free(img.data);
+}
+
+
+void test_png_errors(void) {
+  const struct mfile file = map_file("suite/basn2c08.png");
+  const struct image img = get_image_native(&file);
+  unmap_file(&file);
+
+  // a file that can't be created, a descriptor that can't be written
+  CU_ASSERT_EQUAL(write_png(&img, "suite", NULL), 0);
+  const int fd = open("suite/basn2c08.png", O_RDONLY);
+  CU_ASSERT_EQUAL(write_png_chunk(fd, "suite/basn2c08.png", "IEND", NULL, 0, NULL), 0);
+  close(fd);
+  CU_ASSERT_EQUAL(write_png_chunk(-1, NULL, "IEND", NULL, 0, NULL), 12);
+#ifdef __linux__
+  CU_ASSERT_EQUAL(write_png(&img, "/dev/full", NULL), 0);
+#endif
+  free_image(&img);
+}
+
+
+void test_png_transparency(void) {
+  // a palette with more alpha than colors written, a gray key
+  uint8_t alpha[256];
+  for (uint32_t k = 0; k < 256; k++) {
+    alpha[k] = k * 17;
+  }
+  const uint8_t key[2] = {0, 0x40};
+  const char *files[2] = {"suite/basn3p04.png", "suite/basn0g08.png"};
+  const uint8_t *trns[2] = {alpha, key};
+  const uint32_t length[2] = {256, 2};
+
+  for (uint8_t f = 0; f < 2; f++) {
+    add_transparency(files[f], PNG_OTHER, trns[f], length[f]);
+    const struct mfile source = map_file(PNG_OTHER);
+    const struct image img = get_image_native(&source);
+    struct png_options options = png_default_options();
+    uint8_t *chunks = png_source_chunks(&source, &options, NULL);
+    CU_ASSERT_EQUAL(options.transparency_length, length[f]);
+    CU_ASSERT_EQUAL(options.chunks_size, 13);
+    CU_ASSERT(write_png(&img, PNG_FILE, &options) > 0);
+    free(chunks);
+    unmap_file(&source);
+    check_png(PNG_FILE, &img);
+
+    // sRGB before PLTE, tRNS after it, as much alpha as colors
+    char types[4 * 64 + 1];
+    chunk_types(PNG_FILE, types, NULL);
+    const char *plte = strstr(types, "PLTE");
+    const char *srgb = strstr(types, "sRGB"), *alpha_chunk = strstr(types, "tRNS"), *idat = strstr(types, "IDAT");
+    CU_ASSERT((srgb != NULL) && (alpha_chunk != NULL) && (alpha_chunk < idat));
+    CU_ASSERT((plte == NULL) || ((srgb < plte) && (plte < alpha_chunk)));
+    const struct mfile file = map_file(PNG_FILE);
+    uint32_t plte_length = 0, trns_length = 0;
+    find_chunk(&file, "PLTE", &plte_length);
+    const uint8_t *written = find_chunk(&file, "tRNS", &trns_length);
+    CU_ASSERT_EQUAL(trns_length, (img.palette != NULL) ? plte_length / 3 : length[f]);
+    CU_ASSERT((written != NULL) && (memcmp(written, trns[f], trns_length) == 0));
+    unmap_file(&file);
+    free_image(&img);
+  }
+}
@@ -0,0 +1,33 @@
+/**
+ * @file test-png.h
+ * @brief Test the PNG writer
+ * @details
+ */
+
+#ifndef __TEST_PNG_H__
+#define __TEST_PNG_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_png(void);
+
+int clean_test_png(void);
+
+
+void test_png_suite(void);
+
+void test_png_threads(void);
+
+void test_png_strips(void);
+
+void test_png_filters(void);
+
+void test_png_errors(void);
+
+void test_png_transparency(void);
+
+
+
+#endif // __TEST_PNG_H__
@@ -0,0 +1,301 @@
+/**
+ * @file test-pnm.c
+ * @brief Test the PPM, PAM and raw writers
+ * @details
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "test-pnm.h"
+#include "png-fixture.h"
+
+#include "image.h"
+#include "mfile.h"
+#include "pnm.h"
+#include "render.h"
+
+
+#define PNM_FILE "suite/pnm.tmp"
+#define PNM_PNG "suite/pnm-tmp.png"
+
+/** @brief Size of the synthetic image (a few bands of PNM_BATCH_SIZE) */
+#define SYN_WIDTH (512U)
+#define SYN_HEIGHT (1300U)
+
+
+
+/**
+ * @brief Expected header of a file
+ */
+static int expected_header(char *header, enum pnm_format format, uint32_t width, uint32_t height, uint8_t depth) {
+  const uint32_t maxval = (1U << depth) - 1;
+  switch (format) {
+  case PNM_PPM:
+    return sprintf(header, "P6\n%u %u\n%u\n", width, height, maxval);
+  case PNM_PAM:
+    return sprintf(header, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL %u\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+                   width, height, maxval);
+  default:
+    header[0] = '\0';
+    return 0;
+  }
+}
+
+/**
+ * @brief Write a file with save_file_as_pnm and check it against render_rows on the whole image
+ */
+static void check_pnm(const char *filename, enum pnm_format format, uint8_t depth) {
+  const struct mfile file = map_file(filename);
+  const struct image img  = get_image_native(&file);
+  const uint8_t bytes = (depth == 0) ? ((img.depth == 16) ? 2 : 1) : depth / 8;
+  CU_ASSERT(save_file_as_pnm(&file, PNM_FILE, format, depth, NULL));
+
+  const struct mfile out = map_file(PNM_FILE);
+  char header[128];
+  const int length = expected_header(header, format, img.width, img.height, 8 * bytes);
+  const uint8_t sample = (format == PNM_PPM) ? 3 : 4;
+  const size_t pitch = (size_t) img.width * sample * bytes;
+  CU_ASSERT_EQUAL(out.size, length + img.height * pitch);
+  CU_ASSERT_EQUAL(memcmp(out.data, header, length), 0);
+
+  // every sample against render_rows
+  const size_t stride = (size_t) img.width * 4 * bytes;
+  uint8_t *rgba = malloc(stride * img.height);
+  render_rows(&img, 0, img.height, (bytes == 2) ? FORMAT_RGBA16 : FORMAT_RGBA8,
+              (format == PNM_PPM) ? ALPHA_BACKGROUND : ALPHA_STRAIGHT, rgba, stride);
+  const uint8_t *pixels = ((const uint8_t *) out.data) + length;
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < img.height; i++) {
+    for (uint32_t j = 0; j < img.width; j++) {
+      for (uint8_t c = 0; c < sample; c++) {
+        const size_t k = (size_t) i * img.width * 4 + j * 4 + c;
+        const size_t n = (size_t) i * img.width * sample + j * sample + c;
+        if (bytes == 1) {
+          wrong += (pixels[n] != rgba[k]);
+        }
+        else {
+          const uint16_t expected = ((const uint16_t *) rgba)[k];
+          const uint16_t v = (format == PNM_RAW) ? ((const uint16_t *) pixels)[n]
+                                                 : (uint16_t) ((pixels[2 * n] << 8) | pixels[2 * n + 1]);
+          wrong += (v != expected);
+        }
+      }
+    }
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+
+  free(rgba);
+  unmap_file(&out);
+  free_image(&img);
+  unmap_file(&file);
+}
+
+
+/**
+ * @brief Write a RGBA8 PNG without gAMA (sRGB samples) and give its pixels
+ * @return The pixels, SYN_WIDTH x SYN_HEIGHT RGBA8 (to free)
+ */
+static uint8_t *synthetic_png(void) {
+  const size_t lsize = SYN_WIDTH * 4;
+  uint8_t *pixels = malloc(lsize * SYN_HEIGHT);
+  uint8_t *raw = malloc((lsize + 1) * SYN_HEIGHT);
+  for (uint32_t i = 0; i < SYN_HEIGHT; i++) {
+    raw[i * (lsize + 1)] = 0; // filter none
+    for (uint32_t k = 0; k < lsize; k++) {
+      pixels[i * lsize + k] = (i * 7 + k * 13 + ((i * k) >> 5)) & 0xff;
+    }
+    memcpy(raw + i * (lsize + 1) + 1, pixels + i * lsize, lsize);
+  }
+  uLongf size = compressBound((lsize + 1) * SYN_HEIGHT);
+  uint8_t *z = malloc(size);
+  compress2(z, &size, raw, (lsize + 1) * SYN_HEIGHT, 1);
+
+  FILE *f = fopen(PNM_PNG, "wb");
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  const uint8_t ihdr[13] = {0, 0, SYN_WIDTH >> 8, SYN_WIDTH & 0xff, 0, 0, SYN_HEIGHT >> 8, SYN_HEIGHT & 0xff, 8, 6, 0, 0, 0};
+  fwrite(signature, 1, 8, f);
+  put_chunk(f, "IHDR", ihdr, 13);
+  put_chunk(f, "IDAT", z, size);
+  put_chunk(f, "IEND", NULL, 0);
+  fclose(f);
+
+  free(z);
+  free(raw);
+  return pixels;
+}
+
+
+/**
+ * @brief Read a pipe until its end
+ */
+struct pipe_reader {
+  int fd;
+  uint8_t *data;
+  size_t size;
+};
+
+static void *read_pipe(void *arg) {
+  struct pipe_reader *reader = arg;
+  size_t allocated = 1 << 16;
+  reader->data = malloc(allocated);
+  reader->size = 0;
+  ssize_t n;
+  while ((n = read(reader->fd, reader->data + reader->size, allocated - reader->size)) > 0) {
+    reader->size += n;
+    if (reader->size == allocated) {
+      allocated *= 2;
+      reader->data = realloc(reader->data, allocated);
+    }
+  }
+  return NULL;
+}
+
+
+
+int init_test_pnm(void) {
+  return 0;
+}
+
+int clean_test_pnm(void) {
+  remove(PNM_FILE);
+  remove(PNM_PNG);
+  return 0;
+}
+
+
+
+void test_pnm_8(void) {
+  const char *files[] = {"suite/basn0g04.png", "suite/basn2c08.png", "suite/basn3p04.png", "suite/basn4a08.png",
+                         "suite/basn6a08.png", "suite/bgwn6a08.png", "suite/s03n2c08.png", "suite/f04n0g08.png"};
+
+  for (uint8_t f = 0; f < 8; f++) {
+    check_pnm(files[f], PNM_PPM, 0);
+    check_pnm(files[f], PNM_PAM, 0);
+    check_pnm(files[f], PNM_RAW, 8);
+  }
+}
+
+void test_pnm_16(void) {
+  const char *files[] = {"suite/basn0g16.png", "suite/basn2c16.png", "suite/basn4a16.png", "suite/basn6a16.png",
+                         "suite/bgan6a16.png", "suite/basn2c08.png"};
+
+  for (uint8_t f = 0; f < 6; f++) {
+    check_pnm(files[f], PNM_PPM, 16);
+    check_pnm(files[f], PNM_PAM, 16);
+    check_pnm(files[f], PNM_RAW, 16);
+  }
+  // depth of the file
+  check_pnm("suite/basn6a16.png", PNM_PAM, 0);
+  check_pnm("suite/basn2c16.png", PNM_PPM, 0);
+}
+
+void test_pnm_passthrough(void) {
+  uint8_t data[4 * 4] = {0};
+  struct image img = {.width = 2, .height = 2, .depth = 8, .sample = 4, .data = data};
+
+  CU_ASSERT(pnm_passthrough(&img, PNM_PAM, 8));
+  CU_ASSERT(pnm_passthrough(&img, PNM_RAW, 8));
+  CU_ASSERT(!pnm_passthrough(&img, PNM_PPM, 8));  // alpha to composite
+  CU_ASSERT(!pnm_passthrough(&img, PNM_RAW, 16));
+  img.gamma = 45455;
+  CU_ASSERT(!pnm_passthrough(&img, PNM_RAW, 8));  // gamma to correct
+  img.gamma = 0;
+  img.sample = 3;
+  CU_ASSERT(pnm_passthrough(&img, PNM_PPM, 8));
+  img.depth = 16;
+  CU_ASSERT(pnm_passthrough(&img, PNM_PPM, 16));  // big endian as in the file
+  img.native = 1;
+  CU_ASSERT(!pnm_passthrough(&img, PNM_PPM, 16));
+  img.sample = 4;
+  CU_ASSERT(pnm_passthrough(&img, PNM_RAW, 16));  // native byte order
+  CU_ASSERT(!pnm_passthrough(&img, PNM_PAM, 16));
+}
+
+void test_pnm_pipe(void) {
+  uint8_t *pixels = synthetic_png();
+  const size_t size = (size_t) SYN_WIDTH * SYN_HEIGHT * 4;
+  const struct mfile file = map_file(PNM_PNG);
+
+  // to a file: same bytes, nothing spliced
+  uint64_t spliced = 1;
+  CU_ASSERT(save_file_as_pnm(&file, PNM_FILE, PNM_RAW, 8, &spliced));
+  CU_ASSERT_EQUAL(spliced, 0);
+  const struct mfile out = map_file(PNM_FILE);
+  CU_ASSERT_EQUAL(out.size, size);
+  CU_ASSERT_EQUAL(memcmp(out.data, pixels, size), 0);
+  unmap_file(&out);
+
+  // to a pipe: the decoded rows go as they are
+  int fd[2];
+  CU_ASSERT_EQUAL(pipe(fd), 0);
+  struct pipe_reader reader = {.fd = fd[0]};
+  pthread_t thread;
+  pthread_create(&thread, NULL, read_pipe, &reader);
+
+  char path[64];
+  sprintf(path, "/dev/fd/%d", fd[1]);
+  CU_ASSERT(save_file_as_pnm(&file, path, PNM_RAW, 8, &spliced));
+  close(fd[1]);
+  pthread_join(thread, NULL);
+  close(fd[0]);
+
+#ifdef __linux__
+  CU_ASSERT_EQUAL(spliced, size);
+#else
+  (void) spliced;
+#endif
+  CU_ASSERT_EQUAL(reader.size, size);
+  CU_ASSERT_EQUAL(memcmp(reader.data, pixels, size), 0);
+
+  // rendered rows are written
+  free(reader.data);
+  CU_ASSERT_EQUAL(pipe(fd), 0);
+  reader.fd = fd[0];
+  pthread_create(&thread, NULL, read_pipe, &reader);
+  sprintf(path, "/dev/fd/%d", fd[1]);
+  CU_ASSERT(save_file_as_pnm(&file, path, PNM_PPM, 8, &spliced));
+  CU_ASSERT_EQUAL(spliced, 0);
+  close(fd[1]);
+  pthread_join(thread, NULL);
+  close(fd[0]);
+  CU_ASSERT_EQUAL(reader.size, strlen("P6\n512 1300\n255\n") + size / 4 * 3);
+
+  free(reader.data);
+  unmap_file(&file);
+  free(pixels);
+}
+
+void test_pnm_errors(void) {
+  free(synthetic_png());
+  const struct mfile file = map_file(PNM_PNG);
+
+  // a file that can't be created, then one that can't be written
+  CU_ASSERT_FALSE(save_file_as_pnm(&file, "suite", PNM_PAM, 8, NULL));
+  CU_ASSERT_FALSE(save_file_as_pnm(&file, "suite/missing/pnm.tmp", PNM_PPM, 8, NULL));
+#ifdef __linux__
+  CU_ASSERT_FALSE(save_file_as_pnm(&file, "/dev/full", PNM_RAW, 16, NULL));
+#endif
+
+  // a pipe nobody reads: rows spliced, then rows rendered
+  void (*previous)(int) = signal(SIGPIPE, SIG_IGN);
+  const enum pnm_format formats[2] = {PNM_RAW, PNM_PAM};
+  for (uint8_t k = 0; k < 2; k++) {
+    int fd[2];
+    CU_ASSERT_EQUAL(pipe(fd), 0);
+    close(fd[0]);
+    char path[64];
+    sprintf(path, "/dev/fd/%d", fd[1]);
+    uint64_t spliced = 1;
+    CU_ASSERT_FALSE(save_file_as_pnm(&file, path, formats[k], 8, &spliced));
+    CU_ASSERT_EQUAL(spliced, 0);
+    close(fd[1]);
+  }
+  signal(SIGPIPE, previous);
+  unmap_file(&file);
+}
@@ -0,0 +1,31 @@
+/**
+ * @file test-pnm.h
+ * @brief Test the PPM, PAM and raw writers
+ * @details
+ */
+
+#ifndef __TEST_PNM_H__
+#define __TEST_PNM_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_pnm(void);
+
+int clean_test_pnm(void);
+
+
+void test_pnm_8(void);
+
+void test_pnm_16(void);
+
+void test_pnm_passthrough(void);
+
+void test_pnm_pipe(void);
+
+void test_pnm_errors(void);
+
+
+
+#endif // __TEST_PNM_H__
@@ -0,0 +1,140 @@
+/**
+ * @file test-prefetch.c
+ * @brief Test the read ahead of files
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-prefetch.h"
+
+#include "mfile.h"
+#include "prefetch.h"
+
+
+#define NB_FILE (6U)
+
+
+/** @brief Files read ahead (a file not PNG is read the same) */
+static char *files[NB_FILE] = {"suite/basn0g01.png", "suite/basn2c16.png", "suite/PngSuite.README",
+                               "suite/basn3p02.png", "suite/basn6a08.png", "suite/s01n2c08.png"};
+/** @brief Modes tested */
+static const enum prefetch_mode modes[3] = {PREFETCH_OFF, PREFETCH_URING, PREFETCH_ADVISE};
+
+
+/**
+ * @brief Check a file against the same file mapped
+ */
+static void check_file(const struct mfile *file, const char *name) {
+  const struct mfile expected = map_file(name);
+  CU_ASSERT_EQUAL(strcmp(file->pathname, name), 0);
+  CU_ASSERT_EQUAL(file->size, expected.size);
+  CU_ASSERT_EQUAL(file->allocated_size, expected.allocated_size);
+  CU_ASSERT((file->size == expected.size) && (memcmp(file->data, expected.data, file->size) == 0));
+  unmap_file(&expected);
+}
+
+
+
+int init_test_prefetch(void) {
+  return 0;
+}
+
+int clean_test_prefetch(void) {
+  return 0;
+}
+
+
+
+void test_prefetch_files(void) {
+  for (uint8_t m = 0; m < 3; m++) {
+    for (uint32_t depth = 1; depth <= NB_FILE; depth += 5) {
+      struct prefetch prefetch;
+      prefetch_open(&prefetch, files, NULL, NB_FILE, depth, modes[m]);
+      for (uint32_t r = 0; r < NB_FILE; r++) {
+        struct mfile file;
+        CU_ASSERT(prefetch_get(&prefetch, r, &file));
+        check_file(&file, files[r]);
+        unmap_file(&file);
+      }
+      const struct prefetch_stats stats = prefetch_close(&prefetch);
+
+      // io_uring may be missing, then the fallback is used
+      if (modes[m] == PREFETCH_OFF) {
+        CU_ASSERT_EQUAL(stats.mode, PREFETCH_OFF);
+        CU_ASSERT_EQUAL(stats.nb_file, 0);
+        continue;
+      }
+      CU_ASSERT((stats.mode == modes[m]) || (stats.mode == PREFETCH_ADVISE));
+      CU_ASSERT_EQUAL(stats.nb_file, NB_FILE);
+      CU_ASSERT(stats.io >= 0);
+      CU_ASSERT(stats.wait >= 0);
+      uint64_t bytes = 0;
+      for (uint32_t k = 0; k < NB_FILE; k++) {
+        const struct mfile file = map_file(files[k]);
+        bytes += file.size;
+        unmap_file(&file);
+      }
+      CU_ASSERT_EQUAL(stats.bytes, bytes);
+    }
+  }
+}
+
+
+void test_prefetch_order(void) {
+  // ranks in the reverse order of the names
+  uint32_t order[NB_FILE];
+  for (uint32_t r = 0; r < NB_FILE; r++) {
+    order[r] = NB_FILE - 1 - r;
+  }
+  for (uint8_t m = 0; m < 3; m++) {
+    struct prefetch prefetch;
+    prefetch_open(&prefetch, files, order, NB_FILE, 2, modes[m]);
+    for (uint32_t r = 0; r < NB_FILE; r++) {
+      struct mfile file;
+      CU_ASSERT(prefetch_get(&prefetch, r, &file));
+      check_file(&file, files[order[r]]);
+      unmap_file(&file);
+    }
+    prefetch_close(&prefetch);
+  }
+}
+
+
+void test_prefetch_close(void) {
+  // files read and not taken, files not read, no file
+  for (uint8_t m = 1; m < 3; m++) {
+    struct prefetch prefetch;
+    prefetch_open(&prefetch, files, NULL, NB_FILE, 3, modes[m]);
+    struct mfile file;
+    CU_ASSERT(prefetch_get(&prefetch, 1, &file));
+    check_file(&file, files[1]);
+    unmap_file(&file);
+    const struct prefetch_stats stats = prefetch_close(&prefetch);
+    CU_ASSERT(stats.nb_file <= NB_FILE);
+
+    prefetch_open(&prefetch, files, NULL, 0, 3, modes[m]);
+    CU_ASSERT_EQUAL(prefetch_close(&prefetch).nb_file, 0);
+  }
+}
+
+
+void test_prefetch_missing(void) {
+  // a file gone is told, the files around it are still read
+  char *names[3] = {files[0], "suite/missing.png", files[1]};
+  for (uint8_t m = 0; m < 3; m++) {
+    struct prefetch prefetch;
+    prefetch_open(&prefetch, names, NULL, 3, 3, modes[m]);
+    for (uint32_t r = 0; r < 3; r++) {
+      struct mfile file;
+      const uint8_t mapped = prefetch_get(&prefetch, r, &file);
+      CU_ASSERT_EQUAL(mapped, r != 1);
+      if (mapped) {
+        check_file(&file, names[r]);
+        unmap_file(&file);
+      }
+    }
+    prefetch_close(&prefetch);
+  }
+}
@@ -0,0 +1,29 @@
+/**
+ * @file test-prefetch.h
+ * @brief Test the read ahead of files
+ * @details
+ */
+
+#ifndef __TEST_PREFETCH_H__
+#define __TEST_PREFETCH_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_prefetch(void);
+
+int clean_test_prefetch(void);
+
+
+void test_prefetch_files(void);
+
+void test_prefetch_order(void);
+
+void test_prefetch_close(void);
+
+void test_prefetch_missing(void);
+
+
+
+#endif // __TEST_PREFETCH_H__
@@ -0,0 +1,214 @@
+/**
+ * @file test-pyramid.c
+ * @brief Test the mip pyramid and the view over it
+ * @details
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-pyramid.h"
+
+#include "image.h"
+#include "mfile.h"
+#include "pyramid.h"
+#include "render.h"
+
+
+
+/**
+ * @brief RGB8 image of noise
+ */
+static struct image noise_image(uint32_t width, uint32_t height) {
+  uint8_t *data = malloc((size_t) width * height * 3);
+  uint32_t x = 12345;
+  for (size_t k = 0; k < (size_t) width * height * 3; k++) {
+    x = x * 1103515245 + 12345;
+    data[k] = x >> 24;
+  }
+  const struct image img = {.width = width, .height = height, .depth = 8, .sample = 3, .data = data};
+  return img;
+}
+
+/**
+ * @brief Build a pyramid by bands and check every level
+ */
+static void check_pyramid(const struct image *img, uint32_t band, uint8_t nb_level) {
+  struct pyramid pyramid;
+  pyramid_init(&pyramid, img);
+  CU_ASSERT_EQUAL(pyramid.nb_level, nb_level);
+  CU_ASSERT_EQUAL(pyramid.level[0].width, img->width);
+  CU_ASSERT_EQUAL(pyramid.level[0].height, img->height);
+
+  uint32_t calls = 0;
+  while (!pyramid_build(&pyramid, band)) {
+    calls++;
+    // a row of a level is built once its two rows below are
+    CU_ASSERT_EQUAL(pyramid.level[0].rows, calls * band);
+    for (uint8_t l = 1; l < pyramid.nb_level; l++) {
+      CU_ASSERT_EQUAL(pyramid.level[l].rows, pyramid.level[l - 1].rows / 2);
+    }
+  }
+  CU_ASSERT_EQUAL(calls, (img->height + band - 1) / band - 1);
+  CU_ASSERT(pyramid_done(&pyramid));
+
+  // level 0 is render_rows
+  const size_t pitch = (size_t) img->width * 4;
+  uint8_t *bgra = malloc(pitch * img->height);
+  render_rows(img, 0, img->height, FORMAT_BGRA8, ALPHA_BACKGROUND, bgra, pitch);
+  CU_ASSERT_EQUAL(memcmp(bgra, pyramid.level[0].pixels, pitch * img->height), 0);
+  free(bgra);
+
+  // each level is the one below averaged by 2 x 2
+  uint32_t wrong = 0;
+  for (uint8_t l = 1; l < pyramid.nb_level; l++) {
+    const struct pyramid_level *below = pyramid.level + l - 1;
+    const struct pyramid_level *level = pyramid.level + l;
+    CU_ASSERT_EQUAL(level->width, (below->width + 1) / 2);
+    CU_ASSERT_EQUAL(level->height, (below->height + 1) / 2);
+    CU_ASSERT_EQUAL(level->rows, level->height);
+
+    for (uint32_t i = 0; i < level->height; i++) {
+      for (uint32_t j = 0; j < level->width; j++) {
+        const uint32_t x1 = (2 * j + 1 < below->width) ? 2 * j + 1 : 2 * j;
+        const uint32_t y1 = (2 * i + 1 < below->height) ? 2 * i + 1 : 2 * i;
+        for (uint8_t c = 0; c < 4; c++) {
+          const uint32_t sum = below->pixels[((size_t) 2 * i * below->width + 2 * j) * 4 + c]
+            + below->pixels[((size_t) 2 * i * below->width + x1) * 4 + c]
+            + below->pixels[((size_t) y1 * below->width + 2 * j) * 4 + c]
+            + below->pixels[((size_t) y1 * below->width + x1) * 4 + c];
+          wrong += (level->pixels[((size_t) i * level->width + j) * 4 + c] != (sum + 2) / 4);
+        }
+      }
+    }
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+
+  // the last level fits in a tile
+  CU_ASSERT(pyramid.level[nb_level - 1].width <= PYRAMID_TILE);
+  CU_ASSERT(pyramid.level[nb_level - 1].height <= PYRAMID_TILE);
+  pyramid_free(&pyramid);
+}
+
+
+
+int init_test_pyramid(void) {
+  return 0;
+}
+
+int clean_test_pyramid(void) {
+  return 0;
+}
+
+
+
+void test_pyramid_levels(void) {
+  const struct mfile file = map_file("suite/bgan6a16.png");
+  const struct image png  = get_image_native(&file);
+  unmap_file(&file);
+  check_pyramid(&png, 5, 1);
+  free_image(&png);
+
+  // odd sizes at each level
+  const struct image img = noise_image(2501, 1027);
+  check_pyramid(&img, 100, 4);
+  check_pyramid(&img, 1027, 4);
+  free(img.data);
+
+  const struct image tall = noise_image(3, 1500);
+  check_pyramid(&tall, 7, 3);
+  free(tall.data);
+}
+
+void test_view_zoom(void) {
+  struct view view;
+  view_init(&view, 2000, 1000, 500, 500);
+
+  // whole image, centered
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, 0.25, 1e-12);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 0, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, -500, 1e-9);
+  CU_ASSERT_EQUAL(view_level(&view, 8), 2);
+
+  // the point under the center stays there
+  view_zoom(&view, 1.0, 250, 250);
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, 1.0, 1e-12);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 750, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 250, 1e-9);
+  CU_ASSERT_EQUAL(view_level(&view, 8), 0);
+
+  // a point off center
+  view_zoom(&view, 2.0, 100, 400);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 750 + 100 - 50, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 250 + 400 - 200, 1e-9);
+
+  // pan, the image always covers the window
+  view_pan(&view, 100, -20);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 800 - 50, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 450 + 10, 1e-9);
+  view_pan(&view, 1e6, 1e6);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 0, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 0, 1e-9);
+  view_pan(&view, -1e6, -1e6);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 2000 - 250, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 1000 - 250, 1e-9);
+
+  // clamped zoom
+  view_zoom(&view, 1000, 0, 0);
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, VIEW_MAX_ZOOM, 1e-12);
+  view_zoom(&view, 0.001, 0, 0);
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, 0.25, 1e-12);
+
+  // levels: shown at 1:1 or downscaled by less than 2
+  const double zooms[] = {4, 1, 0.99, 0.51, 0.5, 0.3, 0.25, 0.126, 0.125, 0.001};
+  const uint8_t levels[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 5};
+  for (uint8_t k = 0; k < 10; k++) {
+    view.zoom = zooms[k];
+    CU_ASSERT_EQUAL(view_level(&view, 6), levels[k]);
+  }
+
+  // resize: same center, the zoom follows the fit
+  view_init(&view, 2000, 1000, 500, 500);
+  view_zoom(&view, 1.0, 250, 250);
+  view_resize(&view, 300, 100);
+  CU_ASSERT_DOUBLE_EQUAL(view.x, 1000 - 150, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(view.y, 500 - 50, 1e-9);
+  view_fit(&view);
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, 0.1, 1e-12);
+  view_resize(&view, 600, 600);
+  CU_ASSERT_DOUBLE_EQUAL(view.zoom, 0.3, 1e-12); // at least the fitting zoom
+}
+
+void test_view_tiles(void) {
+  struct view view;
+  int64_t tile[4];
+
+  view_init(&view, 2000, 1000, 500, 500);
+  view_tiles(&view, view_level(&view, 3), tile);
+  CU_ASSERT_EQUAL(tile[0], 0);
+  CU_ASSERT_EQUAL(tile[1], 0);
+  CU_ASSERT_EQUAL(tile[2], 0);
+  CU_ASSERT_EQUAL(tile[3], 0);
+
+  view_zoom(&view, 1.0, 250, 250); // x 750 to 1250, y 250 to 750
+  view_tiles(&view, 0, tile);
+  CU_ASSERT_EQUAL(tile[0], 750 / PYRAMID_TILE);
+  CU_ASSERT_EQUAL(tile[1], 1249 / PYRAMID_TILE);
+  CU_ASSERT_EQUAL(tile[2], 250 / PYRAMID_TILE);
+  CU_ASSERT_EQUAL(tile[3], 749 / PYRAMID_TILE);
+
+  // never out of the level
+  view_pan(&view, -1e6, -1e6);
+  view_tiles(&view, 0, tile);
+  CU_ASSERT_EQUAL(tile[1], (2000 + PYRAMID_TILE - 1) / PYRAMID_TILE - 1);
+  CU_ASSERT_EQUAL(tile[3], (1000 + PYRAMID_TILE - 1) / PYRAMID_TILE - 1);
+
+  // small image in a large window
+  view_init(&view, 10, 10, 500, 500);
+  view_tiles(&view, 0, tile);
+  CU_ASSERT_EQUAL(tile[0], 0);
+  CU_ASSERT_EQUAL(tile[1], 0);
+  CU_ASSERT_EQUAL(tile[2], 0);
+  CU_ASSERT_EQUAL(tile[3], 0);
+}
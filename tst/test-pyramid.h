@@ -0,0 +1,27 @@
+/**
+ * @file test-pyramid.h
+ * @brief Test the mip pyramid and the view over it
+ * @details
+ */
+
+#ifndef __TEST_PYRAMID_H__
+#define __TEST_PYRAMID_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_pyramid(void);
+
+int clean_test_pyramid(void);
+
+
+void test_pyramid_levels(void);
+
+void test_view_zoom(void);
+
+void test_view_tiles(void);
+
+
+
+#endif // __TEST_PYRAMID_H__
@@ -0,0 +1,163 @@
+/**
+ * @file test-quantize.c
+ * @brief Test the palette quantizer
+ * @details
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-quantize.h"
+
+#include "convert.h"
+#include "image.h"
+#include "mfile.h"
+#include "quantize.h"
+
+
+/**
+ * @brief Mean squared error per sample between two RGB8 images
+ */
+static double rgb_error(const struct image *a, const struct image *b) {
+  const size_t size = (size_t) a->width * a->height * 3;
+  uint8_t *ra = malloc(size);
+  uint8_t *rb = malloc(size);
+  convert_rows(a, 0, a->height, FORMAT_RGB8, ra, a->width * 3);
+  convert_rows(b, 0, b->height, FORMAT_RGB8, rb, b->width * 3);
+
+  double sum = 0;
+  for (size_t k = 0; k < size; k++) {
+    sum += (ra[k] - rb[k]) * (ra[k] - rb[k]);
+  }
+  free(ra);
+  free(rb);
+  return sum / size;
+}
+
+/**
+ * @brief Check every index is in the palette
+ */
+static void check_index(const struct image *q, uint16_t nb_color) {
+  const uint8_t *index = q->data;
+  uint32_t wrong = 0;
+  for (size_t k = 0; k < (size_t) q->width * q->height; k++) {
+    wrong += (index[k] >= nb_color);
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+}
+
+/**
+ * @brief Smooth RGB gradient of width x height (free data)
+ */
+static struct image gradient(uint32_t width, uint32_t height) {
+  uint8_t *data = malloc((size_t) width * height * 3);
+  for (uint32_t i = 0; i < height; i++) {
+    for (uint32_t j = 0; j < width; j++) {
+      uint8_t *p = data + 3 * ((size_t) i * width + j);
+      p[0] = (j * 255) / (width - 1);
+      p[1] = (i * 255) / (height - 1);
+      p[2] = ((i + j) * 255) / (width + height - 2);
+    }
+  }
+  struct image r = {
+    .width  = width,
+    .height = height,
+    .depth  = 8,
+    .sample = 3,
+    .data   = data,
+  };
+  return r;
+}
+
+
+
+int init_test_quantize(void) {
+  return 0;
+}
+
+int clean_test_quantize(void) {
+  return 0;
+}
+
+
+
+void test_quantize_exact(void) {
+  // a palette image and a gray image have few enough colors: nothing lost
+  const char *files[] = {"suite/basn3p08.png", "suite/basn0g08.png", "suite/basn3p02.png"};
+
+  for (int f = 0; f < 3; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image(&file);
+    unmap_file(&file);
+
+    for (int dither = DITHER_NONE; dither <= DITHER_FLOYD_STEINBERG; dither++) {
+      uint16_t nb_color;
+      const struct image q = quantize_image(&img, 256, dither, &nb_color);
+      CU_ASSERT(nb_color <= 256);
+      CU_ASSERT_EQUAL(q.depth, 8);
+      CU_ASSERT_EQUAL(q.sample, 1);
+      CU_ASSERT_PTR_NOT_EQUAL(q.palette, NULL);
+      check_index(&q, nb_color);
+      CU_ASSERT_DOUBLE_EQUAL(rgb_error(&img, &q), 0.0, 1e-9);
+      free_image(&q);
+    }
+    free_image(&img);
+  }
+}
+
+void test_quantize_error(void) {
+  const struct image img = gradient(96, 64);
+
+  // more colors, less error
+  double previous = 1e9;
+  for (uint16_t max = 4; max <= 256; max *= 4) {
+    uint16_t nb_color;
+    const struct image q = quantize_image(&img, max, DITHER_NONE, &nb_color);
+    CU_ASSERT_EQUAL(nb_color, max);
+    check_index(&q, nb_color);
+    const double error = rgb_error(&img, &q);
+    CU_ASSERT(error < previous);
+    previous = error;
+    free_image(&q);
+  }
+  CU_ASSERT(previous < 25.0); // about 5 levels, the gradient has 6144 colors
+  free(img.data);
+}
+
+void test_quantize_dither(void) {
+  // large enough for several threads
+  const struct image img = gradient(1024, 512);
+  const size_t size = (size_t) img.width * img.height * 3;
+  uint8_t *rgb = malloc(size);
+  double banding[3];
+
+  for (int dither = DITHER_NONE; dither <= DITHER_FLOYD_STEINBERG; dither++) {
+    uint16_t nb_color;
+    const struct image q = quantize_image(&img, 16, dither, &nb_color);
+    CU_ASSERT_EQUAL(nb_color, 16);
+    check_index(&q, nb_color);
+
+    // dithering keeps the mean color of areas: blocks of 16x16 pixels
+    convert_rows(&q, 0, q.height, FORMAT_RGB8, rgb, q.width * 3);
+    banding[dither] = 0;
+    for (uint32_t i = 0; i < img.height; i += 16) {
+      for (uint32_t j = 0; j < img.width; j += 16) {
+        for (uint8_t c = 0; c < 3; c++) {
+          double sum = 0;
+          for (uint32_t k = 0; k < 256; k++) {
+            const size_t p = 3 * ((size_t) (i + k / 16) * img.width + j + k % 16) + c;
+            sum += rgb[p] - ((uint8_t *) img.data)[p];
+          }
+          banding[dither] += fabs(sum / 256);
+        }
+      }
+    }
+    free_image(&q);
+  }
+  // colors out of the palette hull are clipped anyway
+  CU_ASSERT(banding[DITHER_ORDERED] < banding[DITHER_NONE] * 0.75);
+  CU_ASSERT(banding[DITHER_FLOYD_STEINBERG] < banding[DITHER_NONE] * 0.5);
+  free(rgb);
+  free(img.data);
+}
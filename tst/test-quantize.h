@@ -0,0 +1,27 @@
+/**
+ * @file test-quantize.h
+ * @brief Test the palette quantizer
+ * @details
+ */
+
+#ifndef __TEST_QUANTIZE_H__
+#define __TEST_QUANTIZE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_quantize(void);
+
+int clean_test_quantize(void);
+
+
+void test_quantize_exact(void);
+
+void test_quantize_error(void);
+
+void test_quantize_dither(void);
+
+
+
+#endif // __TEST_QUANTIZE_H__
@@ -0,0 +1,191 @@
+/**
+ * @file test-rewrite.c
+ * @brief Test the chunk rewriter
+ * @details
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-rewrite.h"
+#include "png-fixture.h"
+
+#include "image.h"
+#include "mfile.h"
+#include "png.h"
+#include "rewrite.h"
+
+
+/** @brief Many IDAT, stRP, text before and text and time after the image data */
+#define REWRITE_SOURCE "suite/rewrite-src.png"
+#define REWRITE_FILE "suite/rewrite-tmp.png"
+
+#define SRC_WIDTH (53U)
+#define SRC_HEIGHT (41U)
+
+
+/**
+ * @brief Check a file has the same image as the source
+ */
+static void same_image(const char *filename) {
+  const struct mfile f1 = map_file(REWRITE_SOURCE);
+  const struct mfile f2 = map_file(filename);
+  const struct image i1 = get_image(&f1);
+  const struct image i2 = get_image(&f2);
+  CU_ASSERT_EQUAL(i1.width, i2.width);
+  CU_ASSERT_EQUAL(i1.height, i2.height);
+  CU_ASSERT_EQUAL(i1.gamma, i2.gamma);
+  CU_ASSERT_EQUAL(memcmp(i1.data, i2.data, (size_t) line_size(&i1) * i1.height), 0);
+  free_image(&i1);
+  free_image(&i2);
+  unmap_file(&f1);
+  unmap_file(&f2);
+}
+
+/**
+ * @brief Check the offsets of stRP point to IDAT chunks
+ * @return Number of strips
+ */
+static uint32_t check_strips(const char *filename) {
+  const struct mfile file = map_file(filename);
+  const uint8_t *ptr = ((const uint8_t *) file.data) + 8;
+  while (memcmp(ptr + 4, PNG_STRIP_CHUNK, 4) != 0) {
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      unmap_file(&file);
+      return 0;
+    }
+    ptr += 12 + get32(ptr);
+  }
+  const uint32_t nb_strip = (get32(ptr) - 4) / 4;
+  for (uint32_t s = 0; s < nb_strip; s++) {
+    CU_ASSERT_EQUAL(memcmp(ptr + get32(ptr + 12 + 4 * s) + 4, "IDAT", 4), 0);
+  }
+  unmap_file(&file);
+  return nb_strip;
+}
+
+
+
+int init_test_rewrite(void) {
+  // a strip per row: one IDAT per row and stRP
+  uint8_t *data = malloc(SRC_WIDTH * SRC_HEIGHT * 3);
+  for (uint32_t p = 0; p < SRC_WIDTH * SRC_HEIGHT * 3; p++) {
+    data[p] = (p * 7) ^ (p >> 5);
+  }
+  const struct image img = {.width = SRC_WIDTH, .height = SRC_HEIGHT, .depth = 8, .sample = 3,
+                            .gamma = 45455, .data = data};
+  struct png_options options = png_default_options();
+  options.strip_rows = 1;
+  write_png(&img, REWRITE_FILE, &options);
+  free(data);
+
+  // tEXt and a private chunk before the image data, zTXt and tIME after
+  const struct mfile file = map_file(REWRITE_FILE);
+  const uint8_t *ptr = file.data;
+  FILE *f = fopen(REWRITE_SOURCE, "wb");
+  fwrite(ptr, 1, 8, f);
+  ptr += 8;
+  for (;;) {
+    const uint32_t length = get32(ptr);
+    if (memcmp(ptr + 4, PNG_STRIP_CHUNK, 4) == 0) {
+      put_chunk(f, "tEXt", "Title\0Rewrite", 13);
+      put_chunk(f, "prVt", "private", 7);
+    }
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      put_chunk(f, "zTXt", "Comment\0\0x", 10);
+      put_chunk(f, "tIME", "\x07\xea\x0a\x12\x0c\x00\x00", 7);
+    }
+    fwrite(ptr, 1, 12 + length, f);
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      break;
+    }
+    ptr += 12 + length;
+  }
+  fclose(f);
+  unmap_file(&file);
+  return 0;
+}
+
+int clean_test_rewrite(void) {
+  remove(REWRITE_SOURCE);
+  remove(REWRITE_FILE);
+  return 0;
+}
+
+
+
+void test_rewrite_copy(void) {
+  // nothing to do: the same bytes, copied by the kernel
+  const struct mfile src = map_file(REWRITE_SOURCE);
+  const struct rewrite_stats stats = rewrite_png(&src, REWRITE_FILE, 0);
+  CU_ASSERT_EQUAL(stats.size, src.size);
+  CU_ASSERT_EQUAL(stats.dropped, 0);
+  CU_ASSERT_EQUAL(stats.idat_in, SRC_HEIGHT);
+  CU_ASSERT_EQUAL(stats.idat_out, SRC_HEIGHT);
+#ifdef __linux__
+  CU_ASSERT_EQUAL(stats.copied, src.size - 8);
+#endif
+
+  const struct mfile dst = map_file(REWRITE_FILE);
+  CU_ASSERT_EQUAL(dst.size, src.size);
+  CU_ASSERT_EQUAL(memcmp(dst.data, src.data, src.size), 0);
+  unmap_file(&dst);
+  unmap_file(&src);
+}
+
+
+void test_rewrite_clean(void) {
+  const struct mfile src = map_file(REWRITE_SOURCE);
+  const struct rewrite_stats stats = rewrite_png(&src, REWRITE_FILE, REWRITE_CLEAN);
+  unmap_file(&src);
+  CU_ASSERT_EQUAL(stats.dropped, 5); // tEXt, prVt, stRP, zTXt, tIME
+  CU_ASSERT_EQUAL(stats.idat_out, 1);
+
+  char types[4 * 64 + 1];
+  CU_ASSERT_EQUAL(chunk_types(REWRITE_FILE, types, NULL), 4);
+  CU_ASSERT_EQUAL(strcmp(types, "IHDRgAMAIDATIEND"), 0);
+  same_image(REWRITE_FILE);
+
+  // tIME of the suite
+  const struct mfile time = map_file("suite/cm0n0g04.png");
+  rewrite_png(&time, REWRITE_FILE, REWRITE_CLEAN);
+  unmap_file(&time);
+  chunk_types(REWRITE_FILE, types, NULL);
+  CU_ASSERT_PTR_NULL(strstr(types, "tIME"));
+}
+
+
+void test_rewrite_metadata_first(void) {
+  const struct mfile src = map_file(REWRITE_SOURCE);
+  const struct rewrite_stats stats = rewrite_png(&src, REWRITE_FILE, REWRITE_METADATA_FIRST);
+  CU_ASSERT_EQUAL(stats.size, src.size);
+  CU_ASSERT_EQUAL(stats.moved, 2);
+  unmap_file(&src);
+
+  // before stRP, which still points to the IDAT
+  char types[4 * 64 + 1];
+  chunk_types(REWRITE_FILE, types, NULL);
+  CU_ASSERT_EQUAL(strncmp(types, "IHDRgAMAtEXtprVtzTXttIMEstRPIDAT", 32), 0);
+  CU_ASSERT_EQUAL(check_strips(REWRITE_FILE), SRC_HEIGHT);
+  same_image(REWRITE_FILE);
+}
+
+
+void test_rewrite_index(void) {
+  char types[4 * 64 + 1];
+
+  // text dropped far from the image data: the index stays
+  const struct mfile src = map_file(REWRITE_SOURCE);
+  rewrite_png(&src, REWRITE_FILE, REWRITE_TEXT | REWRITE_TIME);
+  CU_ASSERT_EQUAL(chunk_types(REWRITE_FILE, types, NULL), 5 + SRC_HEIGHT);
+  CU_ASSERT_EQUAL(check_strips(REWRITE_FILE), SRC_HEIGHT);
+
+  // IDAT merged: no index anymore, even if other chunks are kept
+  const struct rewrite_stats stats = rewrite_png(&src, REWRITE_FILE, REWRITE_MERGE_IDAT);
+  unmap_file(&src);
+  CU_ASSERT_EQUAL(stats.dropped, 1);
+  CU_ASSERT_EQUAL(chunk_types(REWRITE_FILE, types, NULL), 8);
+  CU_ASSERT_EQUAL(strcmp(types, "IHDRgAMAtEXtprVtIDATzTXttIMEIEND"), 0);
+  same_image(REWRITE_FILE);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file test-rewrite.h
+ * @brief Test the chunk rewriter
+ * @details
+ */
+
+#ifndef __TEST_REWRITE_H__
+#define __TEST_REWRITE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_rewrite(void);
+
+int clean_test_rewrite(void);
+
+
+void test_rewrite_copy(void);
+
+void test_rewrite_clean(void);
+
+void test_rewrite_metadata_first(void);
+
+void test_rewrite_index(void);
+
+
+
+#endif // __TEST_REWRITE_H__
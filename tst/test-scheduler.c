@@ -0,0 +1,186 @@
+/**
+ * @file test-scheduler.c
+ * @brief Test the work-stealing scheduler
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-scheduler.h"
+
+#include "scheduler.h"
+
+
+/** @brief Number of indexes of the outer tasks */
+#define NB_OUTER (12U)
+/** @brief Number of indexes of each inner task */
+#define NB_INNER (40U)
+
+
+/**
+ * @brief Counters of the indexes run
+ */
+struct counters {
+  /** @brief Scheduler expected from the tasks */
+  struct sched *sched;
+  /** @brief Number of runs of each index */
+  uint32_t run[NB_OUTER * NB_INNER];
+  /** @brief Number of tasks that saw another scheduler */
+  uint32_t wrong;
+  /** @brief Lock of wrong */
+  pthread_mutex_t lock;
+};
+
+/**
+ * @brief Inner task of an outer index
+ */
+struct inner {
+  /** @brief The counters */
+  struct counters *counters;
+  /** @brief The outer index */
+  uint32_t outer;
+};
+
+
+/**
+ * @brief Count an index, with a little work to let the others steal
+ */
+static void count(void *arg, uint32_t index) {
+  struct counters *counters = arg;
+  volatile uint32_t spin = 0;
+  for (uint32_t k = 0; k < 20000; k++) {
+    spin += k;
+  }
+  counters->run[index]++;
+  if (sched_current() != counters->sched) {
+    pthread_mutex_lock(&(counters->lock));
+    counters->wrong++;
+    pthread_mutex_unlock(&(counters->lock));
+  }
+}
+
+static void run_inner(void *arg, uint32_t index) {
+  const struct inner *inner = arg;
+  count(inner->counters, inner->outer * NB_INNER + index);
+}
+
+/**
+ * @brief Outer index: an inner task on the scheduler of the worker
+ */
+static void run_outer(void *arg, uint32_t index) {
+  struct inner inner = {
+    .counters = arg,
+    .outer    = index,
+  };
+  sched_run(NULL, NB_INNER, run_inner, &inner);
+}
+
+/**
+ * @brief Number of pieces allowed in a task (limited to 3)
+ */
+static void limited(void *arg, uint32_t index) {
+  uint32_t *pieces = arg;
+  const uint32_t previous = sched_limit_pieces(3);
+  pieces[index] = sched_pieces(1000, 1, 1000);
+  sched_limit_pieces(previous);
+}
+
+
+
+int init_test_sched(void) {
+  return 0;
+}
+
+int clean_test_sched(void) {
+  return 0;
+}
+
+
+
+void test_sched_run(void) {
+  struct counters *counters = calloc(1, sizeof(struct counters));
+  pthread_mutex_init(&(counters->lock), NULL);
+  struct sched sched;
+  sched_open(&sched, 4);
+  CU_ASSERT_EQUAL(sched.nb_worker, 4);
+  counters->sched = &sched;
+
+  for (uint8_t pass = 1; pass <= 3; pass++) {
+    sched_run(&sched, NB_OUTER * NB_INNER, count, counters);
+    for (uint32_t k = 0; k < NB_OUTER * NB_INNER; k++) {
+      CU_ASSERT_EQUAL(counters->run[k], pass);
+    }
+  }
+  CU_ASSERT_EQUAL(counters->wrong, 0);
+  // no index
+  sched_run(&sched, 0, count, counters);
+  CU_ASSERT_EQUAL(counters->run[0], 3);
+
+  sched_close(&sched);
+  pthread_mutex_destroy(&(counters->lock));
+  free(counters);
+}
+
+
+void test_sched_nested(void) {
+  struct counters *counters = calloc(1, sizeof(struct counters));
+  pthread_mutex_init(&(counters->lock), NULL);
+  struct sched sched;
+  sched_open(&sched, 3);
+  counters->sched = &sched;
+
+  // the inner tasks are pushed on the deques of the workers running the outer ones
+  sched_run(&sched, NB_OUTER, run_outer, counters);
+  for (uint32_t k = 0; k < NB_OUTER * NB_INNER; k++) {
+    CU_ASSERT_EQUAL(counters->run[k], 1);
+  }
+  CU_ASSERT_EQUAL(counters->wrong, 0);
+  CU_ASSERT(sched.stolen > 0);
+  // back outside: the default scheduler
+  CU_ASSERT_PTR_NOT_NULL(sched_current());
+  CU_ASSERT(sched_current() != &sched);
+
+  sched_close(&sched);
+  pthread_mutex_destroy(&(counters->lock));
+  free(counters);
+}
+
+
+void test_sched_single(void) {
+  struct counters *counters = calloc(1, sizeof(struct counters));
+  struct sched sched;
+  sched_open(&sched, 1);
+  CU_ASSERT_EQUAL(sched.nb_worker, 1);
+  counters->sched = &sched;
+
+  // everything in the calling thread
+  sched_run(&sched, NB_OUTER, run_outer, counters);
+  for (uint32_t k = 0; k < NB_OUTER * NB_INNER; k++) {
+    CU_ASSERT_EQUAL(counters->run[k], 1);
+  }
+  CU_ASSERT_EQUAL(counters->wrong, 0);
+  CU_ASSERT_EQUAL(sched.stolen, 0);
+
+  sched_close(&sched);
+  free(counters);
+}
+
+
+void test_sched_pieces(void) {
+  // outside any task: nothing to limit
+  CU_ASSERT_EQUAL(sched_limit_pieces(3), 0);
+  const uint32_t workers = sched_current()->nb_worker;
+  CU_ASSERT_EQUAL(sched_pieces(0, 100, 64), 1);
+  CU_ASSERT_EQUAL(sched_pieces(250, 100, 64), 2);
+  CU_ASSERT_EQUAL(sched_pieces(1000000, 1, 2), 2);
+  CU_ASSERT_EQUAL(sched_pieces(1000000, 1, 1000), SCHED_PIECES * workers);
+
+  struct sched sched;
+  sched_open(&sched, 2);
+  uint32_t pieces[2] = {0, 0};
+  sched_run(&sched, 2, limited, pieces);
+  CU_ASSERT_EQUAL(pieces[0], 3);
+  CU_ASSERT_EQUAL(pieces[1], 3);
+  sched_close(&sched);
+}
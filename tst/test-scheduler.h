@@ -0,0 +1,29 @@
+/**
+ * @file test-scheduler.h
+ * @brief Test the work-stealing scheduler
+ * @details
+ */
+
+#ifndef __TEST_SCHEDULER_H__
+#define __TEST_SCHEDULER_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_sched(void);
+
+int clean_test_sched(void);
+
+
+void test_sched_run(void);
+
+void test_sched_nested(void);
+
+void test_sched_single(void);
+
+void test_sched_pieces(void);
+
+
+
+#endif // __TEST_SCHEDULER_H__
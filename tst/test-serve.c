@@ -0,0 +1,405 @@
+/**
+ * @file test-serve.c
+ * @brief Test the decode daemon
+ * @details
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "test-serve.h"
+
+#include "convert.h"
+#include "image.h"
+#include "mfile.h"
+#include "serve.h"
+
+
+#define NB_FILE (4U)
+
+
+/** @brief Images requested: gray 1-bit, RGB 16-bit, palette, RGBA 8-bit */
+static const char *files[NB_FILE] = {"suite/basn0g01.png", "suite/basn2c16.png", "suite/basn3p02.png",
+                                     "suite/basn6a08.png"};
+/** @brief Path of the socket */
+static char socket_path[64];
+/** @brief The daemon */
+static struct serve server;
+
+
+/**
+ * @brief Map a memfd received
+ * @param[in] fd
+ * @param[out] size
+ * @return The mapping, NULL if fd is not a memfd sealed against writes (opened read-only outside Linux)
+ */
+static uint8_t *map_memfd(int fd, size_t *size) {
+  struct stat st;
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    return NULL;
+  }
+#ifdef __linux__
+  if ((fcntl(fd, F_GET_SEALS) & F_SEAL_WRITE) == 0) {
+    return NULL;
+  }
+#else
+  if ((fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDONLY) {
+    return NULL;
+  }
+#endif
+  *size = st.st_size;
+  void *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+  return (data != MAP_FAILED) ? data : NULL;
+}
+
+/**
+ * @brief Check an answer of decode against get_image_native
+ */
+static void check_decode(const char *file_name, const char *line, int fd) {
+  const struct mfile file = map_file(file_name);
+  const struct image image = get_image_native(&file);
+  const size_t stride = line_size(&image);
+  const uint8_t palette = image.palette != NULL;
+  const size_t bytes = stride * image.height + (palette ? PALETTE_SIZE : 0);
+
+  char expected[128];
+  snprintf(expected, sizeof(expected), "ok %u %u %u %u %zu %zu %u", image.width, image.height, image.depth,
+           image.sample, stride, bytes, palette);
+  CU_ASSERT_EQUAL(strcmp(line, expected), 0);
+  size_t size = 0;
+  uint8_t *data = map_memfd(fd, &size);
+  CU_ASSERT_PTR_NOT_NULL(data);
+  CU_ASSERT_EQUAL(size, bytes);
+  if ((data != NULL) && (size == bytes)) {
+    CU_ASSERT_EQUAL(memcmp(data, image.data, stride * image.height), 0);
+    CU_ASSERT(!palette || (memcmp(data + stride * image.height, image.palette, PALETTE_SIZE) == 0));
+  }
+  if (data != NULL) {
+    munmap(data, size);
+  }
+  free_image(&image);
+  unmap_file(&file);
+}
+
+/**
+ * @brief Check an answer of convert against convert_rows
+ */
+static void check_convert(const char *file_name, enum pixel_format format, const char *name, const char *line,
+                          int fd) {
+  const struct mfile file = map_file(file_name);
+  const struct image image = get_image_native(&file);
+  const size_t stride = (size_t) image.width * format_size(format);
+  uint8_t *rows = malloc(stride * image.height);
+  convert_rows(&image, 0, image.height, format, rows, stride);
+
+  char expected[128];
+  snprintf(expected, sizeof(expected), "ok %u %u %s %zu %zu", image.width, image.height, name, stride,
+           stride * image.height);
+  CU_ASSERT_EQUAL(strcmp(line, expected), 0);
+  size_t size = 0;
+  uint8_t *data = map_memfd(fd, &size);
+  CU_ASSERT(data != NULL && (size == stride * image.height) && (memcmp(data, rows, size) == 0));
+  if (data != NULL) {
+    munmap(data, size);
+  }
+  free(rows);
+  free_image(&image);
+  unmap_file(&file);
+}
+
+
+
+int init_test_serve(void) {
+  snprintf(socket_path, sizeof(socket_path), "/tmp/png-plte-test-%d.sock", (int) getpid());
+  return 0;
+}
+
+int clean_test_serve(void) {
+  return 0;
+}
+
+
+
+void test_serve_requests(void) {
+  struct serve_options options = serve_default_options();
+  options.threads = 2;
+  CU_ASSERT(serve_open(&server, socket_path, &options));
+  struct stat st;
+  CU_ASSERT_EQUAL(stat(socket_path, &st), 0);
+  CU_ASSERT_EQUAL(st.st_mode & 0777, 0600);
+
+  // two clients at once, each with its requests in order
+  const int client[2] = {serve_connect(socket_path), serve_connect(socket_path)};
+  CU_ASSERT(client[0] >= 0);
+  CU_ASSERT(client[1] >= 0);
+  char request[128], line[128];
+  int fd;
+  for (uint32_t k = 0; k < NB_FILE; k++) {
+    snprintf(request, sizeof(request), "probe %s", files[k]);
+    CU_ASSERT(serve_request(client[k % 2], request, line, sizeof(line), &fd));
+    CU_ASSERT_EQUAL(fd, -1);
+    const struct mfile file = map_file(files[k]);
+    const struct image image = get_image(&file);
+    char expected[32];
+    snprintf(expected, sizeof(expected), "ok %u %u ", image.width, image.height);
+    CU_ASSERT_EQUAL(strncmp(line, expected, strlen(expected)), 0);
+    free_image(&image);
+    unmap_file(&file);
+
+    snprintf(request, sizeof(request), "decode %s", files[k]);
+    CU_ASSERT(serve_request(client[k % 2], request, line, sizeof(line), &fd));
+    check_decode(files[k], line, fd);
+    close(fd);
+
+    snprintf(request, sizeof(request), "convert rgba8 %s", files[k]);
+    CU_ASSERT(serve_request(client[(k + 1) % 2], request, line, sizeof(line), &fd));
+    check_convert(files[k], FORMAT_RGBA8, "rgba8", line, fd);
+    close(fd);
+    snprintf(request, sizeof(request), "convert gray8 %s", files[k]);
+    CU_ASSERT(serve_request(client[(k + 1) % 2], request, line, sizeof(line), &fd));
+    check_convert(files[k], FORMAT_GRAY8, "gray8", line, fd);
+    close(fd);
+  }
+  close(client[0]);
+  close(client[1]);
+
+  // a client still connected does not hold the daemon
+  const int idle = serve_connect(socket_path);
+  const struct serve_stats stats = serve_close(&server);
+  close(idle);
+  CU_ASSERT_EQUAL(stats.requests, 4 * NB_FILE);
+  CU_ASSERT_EQUAL(stats.errors, 0);
+  CU_ASSERT(stats.connections >= 2);
+  CU_ASSERT_EQUAL(access(socket_path, F_OK), -1);
+  CU_ASSERT_EQUAL(serve_connect(socket_path), -1);
+}
+
+
+void test_serve_errors(void) {
+  CU_ASSERT(serve_open(&server, socket_path, NULL));
+  const int client = serve_connect(socket_path);
+  char line[128];
+  int fd;
+
+  static const char *requests[] = {"decode suite/missing.png", "decode suite", "probe suite/PngSuite.README",
+                                   "convert rgba8 suite/basi0g08.png", "convert rgb16 suite/basn0g01.png",
+                                   "resize suite/basn0g01.png", "decode"};
+  static const enum serve_status status[] = {SERVE_NOT_FOUND, SERVE_NOT_FOUND, SERVE_NOT_PNG, SERVE_INTERLACED,
+                                             SERVE_BAD_REQUEST, SERVE_BAD_REQUEST, SERVE_BAD_REQUEST};
+  for (uint8_t r = 0; r < 7; r++) {
+    CU_ASSERT_FALSE(serve_request(client, requests[r], line, sizeof(line), &fd));
+    CU_ASSERT_EQUAL(fd, -1);
+    char expected[16];
+    snprintf(expected, sizeof(expected), "error %d ", status[r]);
+    CU_ASSERT_EQUAL(strncmp(line, expected, strlen(expected)), 0);
+  }
+  // the interlaced image is probed all the same, and the connection still works
+  CU_ASSERT(serve_request(client, "probe suite/basi0g08.png", line, sizeof(line), &fd));
+  CU_ASSERT_EQUAL(strcmp(line, "ok 32 32 8 0 1"), 0);
+
+  // a line too long ends the connection after its error
+  char *longer = malloc(2 * SERVE_LINE_SIZE);
+  memset(longer, 'a', 2 * SERVE_LINE_SIZE - 1);
+  longer[2 * SERVE_LINE_SIZE - 1] = '\0';
+  CU_ASSERT_FALSE(serve_request(client, longer, line, sizeof(line), &fd));
+  CU_ASSERT_EQUAL(strncmp(line, "error 1 ", 8), 0);
+  CU_ASSERT_FALSE(serve_request(client, "probe suite/basn0g01.png", line, sizeof(line), &fd));
+  free(longer);
+  close(client);
+
+  const struct serve_stats stats = serve_close(&server);
+  CU_ASSERT_EQUAL(stats.errors, 8);
+}
+
+
+void test_serve_cache(void) {
+  for (uint8_t cache = 0; cache < 2; cache++) {
+    struct serve_options options = serve_default_options();
+    options.cache_mb = cache;
+    CU_ASSERT(serve_open(&server, socket_path, &options));
+    const int client = serve_connect(socket_path);
+    char request[128], line[128];
+    int fd;
+    // each answer twice: the same memfd from the cache
+    for (uint8_t round = 0; round < 2; round++) {
+      for (uint32_t k = 0; k < NB_FILE; k++) {
+        snprintf(request, sizeof(request), "decode %s", files[k]);
+        CU_ASSERT(serve_request(client, request, line, sizeof(line), &fd));
+        check_decode(files[k], line, fd);
+        close(fd);
+        snprintf(request, sizeof(request), "convert rgba16 %s", files[k]);
+        CU_ASSERT(serve_request(client, request, line, sizeof(line), &fd));
+        check_convert(files[k], FORMAT_RGBA16, "rgba16", line, fd);
+        close(fd);
+      }
+    }
+    close(client);
+    const struct serve_stats stats = serve_close(&server);
+    CU_ASSERT_EQUAL(stats.requests, 4 * NB_FILE);
+    CU_ASSERT_EQUAL(stats.hits, cache ? 2 * NB_FILE : 0);
+  }
+
+  // the socket file left by a daemon gone is taken over
+  const int old = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  strcpy(address.sun_path, socket_path);
+  CU_ASSERT_EQUAL(bind(old, (const struct sockaddr *) &address, sizeof(address)), 0);
+  close(old);
+  CU_ASSERT_EQUAL(access(socket_path, F_OK), 0);
+  CU_ASSERT(serve_open(&server, socket_path, NULL));
+  const int other = serve_connect(socket_path);
+  CU_ASSERT(other >= 0);
+  close(other);
+  serve_close(&server);
+}
+
+
+void test_serve_parse(void) {
+  struct serve_options options;
+
+  CU_ASSERT(parse_serve("4", &options));
+  CU_ASSERT_EQUAL(options.threads, 4);
+  CU_ASSERT_EQUAL(options.cache_mb, 64);
+  CU_ASSERT_EQUAL(options.idle_s, 30);
+
+  CU_ASSERT(parse_serve("idle0,2", &options));
+  CU_ASSERT_EQUAL(options.threads, 2);
+  CU_ASSERT_EQUAL(options.idle_s, 0);
+  CU_ASSERT(parse_serve("idle600", &options));
+  CU_ASSERT_EQUAL(options.idle_s, 600);
+  CU_ASSERT_EQUAL(options.mode, 0600);
+  CU_ASSERT(parse_serve("mode660,4", &options));
+  CU_ASSERT_EQUAL(options.mode, 0660);
+  CU_ASSERT(parse_serve("mode0", &options));
+  CU_ASSERT_EQUAL(options.mode, 0);
+
+  CU_ASSERT(parse_serve("cache0,16", &options));
+  CU_ASSERT_EQUAL(options.threads, 16);
+  CU_ASSERT_EQUAL(options.cache_mb, 0);
+
+  CU_ASSERT(parse_serve("cache1024", &options));
+  CU_ASSERT_EQUAL(options.threads, 0);
+  CU_ASSERT_EQUAL(options.cache_mb, 1024);
+
+  CU_ASSERT(parse_serve("8,mb256,ms50", &options));
+  CU_ASSERT_EQUAL(options.threads, 8);
+  CU_ASSERT_EQUAL(options.limits.max_memory, 256ULL << 20);
+  CU_ASSERT_EQUAL(options.limits.timeout_ms, 50);
+
+  const char *wrong[] = {"0",      "65",  "cache", "cachex", "cache12345678", "4,,cache8",
+                         "decode", "mpx", "ms-1",  "idle",   "idle1x",        "idle123456",
+                         "mode",   "mode8", "mode1000", "mode66a"};
+  for (uint8_t w = 0; w < 16; w++) {
+    CU_ASSERT_FALSE(parse_serve(wrong[w], &options));
+  }
+}
+
+
+void test_serve_limits(void) {
+  // a copy of a 1x1 image without the end of its IEND chunk
+  char corrupt[64];
+  snprintf(corrupt, sizeof(corrupt), "/tmp/png-plte-test-%d.png", (int) getpid());
+  const struct mfile file = map_file("suite/s01n2c08.png");
+  FILE *out = fopen(corrupt, "wb");
+  CU_ASSERT_PTR_NOT_NULL(out);
+  if (out != NULL) {
+    fwrite(file.data, 1, file.size - 6, out);
+    fclose(out);
+  }
+  unmap_file(&file);
+
+  struct serve_options options = serve_default_options();
+  options.limits.max_pixels = 1023;
+  CU_ASSERT(serve_open(&server, socket_path, &options));
+  const int client = serve_connect(socket_path);
+  char request[128], line[128];
+  int fd;
+
+  // 32x32 refused, still probed; 1x1 decoded
+  CU_ASSERT_FALSE(serve_request(client, "decode suite/basn2c16.png", line, sizeof(line), &fd));
+  CU_ASSERT_EQUAL(strcmp(line, "error 7 over the limits"), 0);
+  CU_ASSERT(serve_request(client, "probe suite/basn2c16.png", line, sizeof(line), &fd));
+  CU_ASSERT(serve_request(client, "decode suite/s01n2c08.png", line, sizeof(line), &fd));
+  CU_ASSERT(fd >= 0);
+  close(fd);
+
+  // a corrupt file is an error answer, the daemon goes on
+  snprintf(request, sizeof(request), "convert rgba8 %s", corrupt);
+  CU_ASSERT_FALSE(serve_request(client, request, line, sizeof(line), &fd));
+  CU_ASSERT_EQUAL(strcmp(line, "error 6 corrupt file"), 0);
+  CU_ASSERT(serve_request(client, "decode suite/s01n2c08.png", line, sizeof(line), &fd));
+  close(fd);
+  close(client);
+
+  const struct serve_stats stats = serve_close(&server);
+  CU_ASSERT_EQUAL(stats.errors, 2);
+  unlink(corrupt);
+}
+
+
+void test_serve_idle(void) {
+  struct serve_options options = serve_default_options();
+  options.threads = 1;
+  options.idle_s  = 1;
+  options.mode    = 0660;
+  CU_ASSERT(serve_open(&server, socket_path, &options));
+  struct stat st;
+  CU_ASSERT_EQUAL(stat(socket_path, &st), 0);
+  CU_ASSERT_EQUAL(st.st_mode & 0777, 0660);
+
+  // the only thread is held by a silent client until it times out
+  const int silent = serve_connect(socket_path);
+  const int client = serve_connect(socket_path);
+  char line[128];
+  int fd;
+  CU_ASSERT(serve_request(client, "probe suite/basn2c16.png", line, sizeof(line), &fd));
+  char byte;
+  CU_ASSERT_EQUAL(recv(silent, &byte, 1, 0), 0);
+  close(silent);
+  close(client);
+
+  const struct serve_stats stats = serve_close(&server);
+  CU_ASSERT_EQUAL(stats.connections, 2);
+  CU_ASSERT_EQUAL(stats.idle, 1);
+  CU_ASSERT_EQUAL(stats.requests, 1);
+}
+
+
+void test_serve_taken(void) {
+  // a file that is not a socket is left alone
+  FILE *f = fopen(socket_path, "w");
+  fclose(f);
+  struct serve *other = malloc(sizeof(struct serve));
+  CU_ASSERT_FALSE(serve_open(other, socket_path, NULL));
+  struct stat st;
+  CU_ASSERT_EQUAL(stat(socket_path, &st), 0);
+  CU_ASSERT(S_ISREG(st.st_mode));
+  unlink(socket_path);
+
+  // a socket another daemon listens to is kept
+  CU_ASSERT(serve_open(&server, socket_path, NULL));
+  CU_ASSERT_FALSE(serve_open(other, socket_path, NULL));
+  const int client = serve_connect(socket_path);
+  char line[128];
+  int fd;
+  CU_ASSERT(serve_request(client, "probe suite/basn2c16.png", line, sizeof(line), &fd));
+  close(client);
+  serve_close(&server);
+
+  // a path too long for a socket
+  char path[256];
+  memset(path, 'a', sizeof(path) - 1);
+  path[sizeof(path) - 1] = '\0';
+  CU_ASSERT_FALSE(serve_open(other, path, NULL));
+  CU_ASSERT(serve_connect(path) < 0);
+  free(other);
+}
@@ -0,0 +1,35 @@
+/**
+ * @file test-serve.h
+ * @brief Test the decode daemon
+ * @details
+ */
+
+#ifndef __TEST_SERVE_H__
+#define __TEST_SERVE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_serve(void);
+
+int clean_test_serve(void);
+
+
+void test_serve_requests(void);
+
+void test_serve_errors(void);
+
+void test_serve_cache(void);
+
+void test_serve_parse(void);
+
+void test_serve_limits(void);
+
+void test_serve_idle(void);
+
+void test_serve_taken(void);
+
+
+
+#endif // __TEST_SERVE_H__
@@ -0,0 +1,148 @@
+/**
+ * @file test-stats.c
+ * @brief Test the color statistics
+ * @details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-stats.h"
+
+#include "image.h"
+#include "mfile.h"
+#include "stats.h"
+
+
+/**
+ * @brief Transparent RGBA8 image of width x height (free data)
+ */
+static struct image transparent(uint32_t width, uint32_t height) {
+  void *data = calloc((size_t) width * height, 4);
+  struct image r = {
+    .width  = width,
+    .height = height,
+    .depth  = 8,
+    .sample = 4,
+    .data   = data,
+  };
+  return r;
+}
+
+/**
+ * @brief Check every histogram counts every pixel
+ */
+static void check_histogram(const struct color_stats *stats, uint64_t nb_pixel) {
+  for (int c = 0; c < 4; c++) {
+    uint64_t sum = 0;
+    for (int v = 0; v < 256; v++) {
+      sum += stats->histogram[c][v];
+    }
+    CU_ASSERT_EQUAL(sum, nb_pixel);
+  }
+}
+
+
+
+int init_test_stats(void) {
+  return 0;
+}
+
+int clean_test_stats(void) {
+  return 0;
+}
+
+
+
+void test_stats_file(void) {
+  const char *files[] = {"suite/basn0g08.png", "suite/basn2c08.png", "suite/basn4a08.png", "suite/basn6a08.png",
+                         "suite/basn0g16.png", "suite/basn2c16.png", "suite/basn3p02.png", "suite/basn0g01.png"};
+  const uint8_t gray[]   = {1, 0, 1, 0, 1, 0, 0, 1};
+  const uint8_t opaque[] = {1, 1, 0, 0, 1, 1, 1, 1};
+
+  for (int f = 0; f < 8; f++) {
+    const struct mfile file = map_file(files[f]);
+    const struct image img  = get_image(&file);
+    const struct image native = get_image_native(&file);
+    unmap_file(&file);
+
+    const struct color_stats stats = get_color_stats(&img);
+    CU_ASSERT_EQUAL(stats.gray, gray[f]);
+    CU_ASSERT_EQUAL(stats.opaque, opaque[f]);
+    check_histogram(&stats, img.width * img.height);
+    if (opaque[f]) {
+      CU_ASSERT_EQUAL(stats.histogram[3][255], img.width * img.height);
+      CU_ASSERT_EQUAL(stats.alpha_box.width, img.width);
+      CU_ASSERT_EQUAL(stats.alpha_box.height, img.height);
+    }
+    if (f == 6) {
+      CU_ASSERT(stats.nb_color <= 4);
+    }
+    if (f == 7) {
+      CU_ASSERT_EQUAL(stats.nb_color, 2);
+    }
+
+    // same result from native samples
+    const struct color_stats same = get_color_stats(&native);
+    CU_ASSERT_EQUAL(memcmp(&stats, &same, sizeof(stats)), 0);
+    free_image(&img);
+    free_image(&native);
+  }
+}
+
+void test_stats_colors(void) {
+  // large enough for several threads, colors spread over the bands
+  struct image img = transparent(1024, 512);
+  uint8_t *px = img.data;
+  for (uint32_t k = 0; k < img.width * img.height; k++) {
+    px[4 * k]     = (k * 7) % 200;
+    px[4 * k + 1] = 10;
+    px[4 * k + 2] = 20;
+    px[4 * k + 3] = 255;
+  }
+  struct color_stats stats = get_color_stats(&img);
+  CU_ASSERT_EQUAL(stats.nb_color, 200);
+  CU_ASSERT_EQUAL(stats.opaque, 1);
+  CU_ASSERT_EQUAL(stats.gray, 0);
+  CU_ASSERT_EQUAL(stats.histogram[1][10], img.width * img.height);
+  check_histogram(&stats, img.width * img.height);
+
+  // 256 colors: still counted, one more in the last row: more than 256
+  for (uint32_t k = 0; k < img.width * img.height; k++) {
+    px[4 * k] = k % 256;
+    px[4 * k + 1] = px[4 * k];
+    px[4 * k + 2] = px[4 * k];
+  }
+  stats = get_color_stats(&img);
+  CU_ASSERT_EQUAL(stats.nb_color, 256);
+  CU_ASSERT_EQUAL(stats.gray, 1);
+
+  px[4 * (img.width * img.height - 1) + 3] = 254;
+  stats = get_color_stats(&img);
+  CU_ASSERT_EQUAL(stats.nb_color, STATS_MAX_COLOR + 1);
+  CU_ASSERT_EQUAL(stats.opaque, 0);
+  CU_ASSERT_EQUAL(stats.histogram[3][254], 1);
+  free(img.data);
+}
+
+void test_stats_alpha_box(void) {
+  struct image img = transparent(700, 300);
+  struct color_stats stats = get_color_stats(&img);
+  CU_ASSERT_EQUAL(stats.alpha_box.width, 0);
+  CU_ASSERT_EQUAL(stats.alpha_box.height, 0);
+  CU_ASSERT_EQUAL(stats.nb_color, 1);
+  CU_ASSERT_EQUAL(stats.gray, 1);
+  CU_ASSERT_EQUAL(stats.opaque, 0);
+
+  // two barely visible pixels
+  uint8_t *px = img.data;
+  px[4 * (17 * 700 + 650) + 3] = 1;
+  px[4 * (250 * 700 + 3) + 3]  = 1;
+  stats = get_color_stats(&img);
+  CU_ASSERT_EQUAL(stats.alpha_box.x, 3);
+  CU_ASSERT_EQUAL(stats.alpha_box.y, 17);
+  CU_ASSERT_EQUAL(stats.alpha_box.width, 648);
+  CU_ASSERT_EQUAL(stats.alpha_box.height, 234);
+  CU_ASSERT_EQUAL(stats.nb_color, 2);
+  free(img.data);
+}
@@ -0,0 +1,27 @@
+/**
+ * @file test-stats.h
+ * @brief Test the color statistics
+ * @details
+ */
+
+#ifndef __TEST_STATS_H__
+#define __TEST_STATS_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_stats(void);
+
+int clean_test_stats(void);
+
+
+void test_stats_file(void);
+
+void test_stats_colors(void);
+
+void test_stats_alpha_box(void);
+
+
+
+#endif // __TEST_STATS_H__
@@ -0,0 +1,433 @@
+/**
+ * @file test-transcode.c
+ * @brief Test the streaming transcoder
+ * @details
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-transcode.h"
+#include "png-fixture.h"
+
+#include "convert.h"
+#include "image.h"
+#include "mfile.h"
+#include "png.h"
+#include "transcode.h"
+
+
+/** @brief Background, text and private chunks, sBIT and stRP before the image data, text and time after */
+#define TRANSCODE_SOURCE "suite/transcode-src.png"
+/** @brief Large noise: many IDAT written */
+#define TRANSCODE_LARGE "suite/transcode-large.png"
+#define TRANSCODE_FILE "suite/transcode-tmp.png"
+/** @brief A file of the suite with a tRNS chunk */
+#define TRANSCODE_TRNS "suite/transcode-trns.png"
+
+#define SRC_WIDTH (37U)
+#define SRC_HEIGHT (29U)
+#define LARGE_WIDTH (300U)
+#define LARGE_HEIGHT (200U)
+
+
+/**
+ * @brief Copy a file with one more chunk before the image data
+ * @param[in] source
+ * @param[in] filename Name of the copy
+ * @param[in] type Type of the chunk added
+ * @param[in] data
+ * @param[in] length
+ */
+static void add_chunk(const char *source, const char *filename, const char *type, const void *data,
+                      uint32_t length) {
+  const struct mfile file = map_file(source);
+  const uint8_t *ptr = ((const uint8_t *) file.data) + 8;
+  FILE *f = fopen(filename, "wb");
+  fwrite(file.data, 1, 8, f);
+  while (memcmp(ptr + 4, "IDAT", 4) != 0) {
+    fwrite(ptr, 1, 12 + get32(ptr), f);
+    ptr += 12 + get32(ptr);
+  }
+  put_chunk(f, type, data, length);
+  fwrite(ptr, 1, ((const uint8_t *) file.data) + file.size - ptr, f);
+  fclose(f);
+  unmap_file(&file);
+}
+
+/**
+ * @brief Data of the first chunk of a type in a file
+ * @param[in] filename
+ * @param[in] type
+ * @param[out] data At least 6 bytes
+ * @return Length of the chunk (what does not fit in data is not copied), 0 if none
+ */
+static uint32_t chunk_data(const char *filename, const char *type, uint8_t data[6]) {
+  const struct mfile file = map_file(filename);
+  const uint8_t *ptr = ((const uint8_t *) file.data) + 8;
+  uint32_t length = 0;
+  for (; memcmp(ptr + 4, "IEND", 4) != 0; ptr += 12 + get32(ptr)) {
+    if (memcmp(ptr + 4, type, 4) == 0) {
+      length = get32(ptr);
+      memcpy(data, ptr + 8, (length < 6) ? length : 6);
+      break;
+    }
+  }
+  unmap_file(&file);
+  return length;
+}
+
+/**
+ * @brief The whole image of a file in RGBA16
+ * @param[in] filename
+ * @param[out] image The image (to free)
+ * @return The pixels (to free)
+ */
+static uint16_t *read_rgba16(const char *filename, struct image *image) {
+  const struct mfile file = map_file(filename);
+  *image = get_image(&file);
+  unmap_file(&file);
+  uint16_t *rgba = malloc((size_t) image->width * image->height * 8);
+  convert_rows(image, 0, image->height, FORMAT_RGBA16, rgba, (size_t) image->width * 8);
+  return rgba;
+}
+
+/**
+ * @brief Transcode a file
+ */
+static uint64_t transcode(const char *source, const struct transcode_options *options) {
+  const struct mfile file = map_file(source);
+  const uint64_t size = transcode_png(&file, TRANSCODE_FILE, options);
+  unmap_file(&file);
+  return size;
+}
+
+/**
+ * @brief Check the transcoded file has a region of the source, with the expected color type and depth
+ * @param[in] source
+ * @param[in] options Target (sample and depth set)
+ * @return Number of wrong samples
+ */
+static uint32_t check_region(const char *source, const struct transcode_options *options) {
+  struct image si, di;
+  uint16_t *src = read_rgba16(source, &si);
+  uint16_t *dst = read_rgba16(TRANSCODE_FILE, &di);
+  const uint32_t x = options->x, y = options->y;
+  const uint32_t width = (options->width > 0) ? options->width : si.width;
+  const uint32_t height = (options->width > 0) ? options->height : si.height;
+  CU_ASSERT_EQUAL(di.width, width);
+  CU_ASSERT_EQUAL(di.height, height);
+  CU_ASSERT_EQUAL(di.sample, options->sample);
+  CU_ASSERT_EQUAL(di.depth, options->depth);
+
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; (di.width == width) && (di.height == height) && (i < height); i++) {
+    for (uint32_t j = 0; j < width; j++) {
+      const uint16_t *s = src + (((size_t) (y + i) * si.width) + x + j) * 4;
+      const uint16_t *d = dst + ((size_t) i * width + j) * 4;
+      uint16_t expected[4] = {s[0], s[1], s[2], (options->sample & 1) ? 65535 : s[3]};
+      if (options->sample <= 2) {
+        const uint16_t gray = (19595U * s[0] + 38470U * s[1] + 7471U * s[2] + 32768) >> 16;
+        expected[0] = expected[1] = expected[2] = gray;
+      }
+      for (uint8_t k = 0; k < 4; k++) {
+        const uint16_t v = (options->depth == 8) ? ((expected[k] + 128) / 257) * 257 : expected[k];
+        wrong += (d[k] != v);
+      }
+    }
+  }
+  free(src);
+  free(dst);
+  free_image(&si);
+  free_image(&di);
+  return wrong;
+}
+
+
+
+int init_test_transcode(void) {
+  // noise with a background, a strip per 8 rows (stRP)
+  uint8_t *data = malloc(LARGE_WIDTH * LARGE_HEIGHT * 6);
+  for (uint32_t p = 0; p < LARGE_WIDTH * LARGE_HEIGHT * 6; p++) {
+    data[p] = (p * 2654435761U) >> 24;
+  }
+  struct image img = {.width = SRC_WIDTH, .height = SRC_HEIGHT, .depth = 8, .sample = 4, .gamma = 45455,
+                      .has_background = 1, .background = {0xffff, 0x8080, 0x0000}, .data = data};
+  struct png_options options = png_default_options();
+  options.strip_rows = 8;
+  write_png(&img, TRANSCODE_FILE, &options);
+
+  // no compression: more than one IDAT once transcoded at level 0
+  const struct image large = {.width = LARGE_WIDTH, .height = LARGE_HEIGHT, .depth = 16, .sample = 3,
+                              .data = data};
+  options.level = 0;
+  write_png(&large, TRANSCODE_LARGE, &options);
+  free(data);
+
+  // text, a private chunk safe to copy and sBIT before the image data, text and time after
+  const struct mfile file = map_file(TRANSCODE_FILE);
+  const uint8_t *ptr = file.data;
+  FILE *f = fopen(TRANSCODE_SOURCE, "wb");
+  fwrite(ptr, 1, 8, f);
+  ptr += 8;
+  for (;;) {
+    const uint32_t length = get32(ptr);
+    if (memcmp(ptr + 4, PNG_STRIP_CHUNK, 4) == 0) {
+      put_chunk(f, "tEXt", "Title\0Transcode", 15);
+      put_chunk(f, "prVt", "private", 7);
+      put_chunk(f, "sBIT", "\x08\x08\x08\x08", 4);
+    }
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      put_chunk(f, "zTXt", "Comment\0\0x", 10);
+      put_chunk(f, "tIME", "\x07\xea\x0a\x12\x0c\x00\x00", 7);
+    }
+    fwrite(ptr, 1, 12 + length, f);
+    if (memcmp(ptr + 4, "IEND", 4) == 0) {
+      break;
+    }
+    ptr += 12 + length;
+  }
+  fclose(f);
+  unmap_file(&file);
+  return 0;
+}
+
+int clean_test_transcode(void) {
+  remove(TRANSCODE_SOURCE);
+  remove(TRANSCODE_LARGE);
+  remove(TRANSCODE_FILE);
+  remove(TRANSCODE_TRNS);
+  return 0;
+}
+
+
+
+void test_transcode_same(void) {
+  // same color type (palette to RGB, less than 8 bits to 8): same pixels
+  const char *files[] = {"suite/basn0g02.png", "suite/basn0g16.png", "suite/basn2c08.png", "suite/basn3p04.png",
+                         "suite/basn4a08.png", "suite/basn6a16.png", TRANSCODE_SOURCE};
+  const uint8_t sample[] = {1, 1, 3, 3, 2, 4, 4};
+  const uint8_t depth[] = {8, 16, 8, 8, 8, 16, 8};
+  for (uint8_t f = 0; f < sizeof(sample); f++) {
+    struct transcode_options options = transcode_default_options();
+    transcode(files[f], &options);
+    options.sample = sample[f];
+    options.depth  = depth[f];
+    CU_ASSERT_EQUAL(check_region(files[f], &options), 0);
+  }
+}
+
+
+void test_transcode_convert(void) {
+  const uint8_t sample[] = {1, 2, 3, 4};
+  const char *files[] = {"suite/basn6a16.png", "suite/basn2c16.png", TRANSCODE_SOURCE};
+  for (uint8_t f = 0; f < 3; f++) {
+    for (uint8_t s = 0; s < 4; s++) {
+      for (uint8_t depth = 8; depth <= 16; depth += 8) {
+        struct transcode_options options = transcode_default_options();
+        options.sample = sample[s];
+        options.depth  = depth;
+        transcode(files[f], &options);
+        CU_ASSERT_EQUAL(check_region(files[f], &options), 0);
+      }
+    }
+  }
+}
+
+
+void test_transcode_crop(void) {
+  struct transcode_options options = transcode_default_options();
+  options.sample = 3;
+  options.depth  = 16;
+  options.x = 5;
+  options.y = 3;
+  options.width  = 17;
+  options.height = 11;
+  transcode("suite/basn2c16.png", &options);
+  CU_ASSERT_EQUAL(check_region("suite/basn2c16.png", &options), 0);
+
+  // a corner pixel, the last row: the whole file decoded
+  options.x = 31;
+  options.y = 31;
+  options.width  = 1;
+  options.height = 1;
+  transcode("suite/basn2c16.png", &options);
+  CU_ASSERT_EQUAL(check_region("suite/basn2c16.png", &options), 0);
+
+  // the whole width, not compressed: many IDAT of TRANSCODE_IDAT_SIZE bytes
+  options.png.level = 0;
+  options.x = 0;
+  options.y = 10;
+  options.width  = LARGE_WIDTH;
+  options.height = LARGE_HEIGHT - 20;
+  const uint64_t size = transcode(TRANSCODE_LARGE, &options);
+  CU_ASSERT_EQUAL(check_region(TRANSCODE_LARGE, &options), 0);
+  char types[4 * 64 + 1];
+  uint32_t nb_idat;
+  chunk_types(TRANSCODE_FILE, types, &nb_idat);
+  CU_ASSERT(nb_idat > 1);
+  CU_ASSERT(nb_idat <= size / TRANSCODE_IDAT_SIZE + 1);
+  CU_ASSERT_EQUAL(strcmp(types, "IHDRIDATIEND"), 0);
+}
+
+
+void test_transcode_chunks(void) {
+  char types[4 * 64 + 1];
+  struct transcode_options options = transcode_default_options();
+
+  // text and private chunks copied where they are, sBIT and stRP dropped, bKGD written again
+  transcode(TRANSCODE_SOURCE, &options);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_EQUAL(strcmp(types, "IHDRgAMAtEXtprVtbKGDIDATzTXttIMEIEND"), 0);
+
+  // the background in gray
+  options.sample = 1;
+  options.depth  = 16;
+  transcode(TRANSCODE_SOURCE, &options);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_EQUAL(strcmp(types, "IHDRgAMAtEXtprVtbKGDIDATzTXttIMEIEND"), 0);
+  const struct mfile file = map_file(TRANSCODE_FILE);
+  const struct image image = get_image(&file);
+  unmap_file(&file);
+  CU_ASSERT_EQUAL(image.gamma, 45455);
+  CU_ASSERT(image.has_background);
+  const uint16_t gray = (19595U * 0xffff + 38470U * 0x8080 + 32768) >> 16;
+  CU_ASSERT_EQUAL(image.background[0], gray);
+  CU_ASSERT_EQUAL(image.background[2], gray);
+  free_image(&image);
+
+  // tIME of the suite, palette and sub-byte sources
+  transcode("suite/cm0n0g04.png", NULL);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_PTR_NOT_NULL(strstr(types, "tIME"));
+  transcode("suite/basn3p01.png", NULL);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_PTR_NULL(strstr(types, "PLTE"));
+}
+
+
+void test_transcode_trns(void) {
+  char types[4 * 64 + 1];
+  uint8_t data[6];
+  struct image si, di;
+
+  // palette: the alpha of each index (RGBA by default)
+  const uint8_t alpha[3] = {0, 128, 255};
+  add_chunk("suite/basn3p04.png", TRANSCODE_TRNS, "tRNS", alpha, 3);
+  transcode(TRANSCODE_TRNS, NULL);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_PTR_NULL(strstr(types, "tRNS"));
+  uint16_t *src = read_rgba16(TRANSCODE_TRNS, &si);
+  uint16_t *dst = read_rgba16(TRANSCODE_FILE, &di);
+  CU_ASSERT_EQUAL(di.sample, 4);
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < si.height; i++) {
+    const uint8_t *row = ((const uint8_t *) si.data) + (size_t) i * line_size(&si);
+    for (uint32_t j = 0; j < si.width; j++) {
+      const uint8_t index = (row[j / 2] >> ((j % 2) ? 0 : 4)) & 15;
+      const uint16_t *d = dst + ((size_t) i * si.width + j) * 4;
+      const uint16_t *s = src + ((size_t) i * si.width + j) * 4;
+      wrong += (d[0] != s[0]) || (d[3] != ((index < 3) ? alpha[index] : 255) * 257);
+    }
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  free(src);
+  free(dst);
+  free_image(&si);
+  free_image(&di);
+
+  // without alpha in the target: dropped
+  struct transcode_options options = transcode_default_options();
+  options.sample = 3;
+  transcode(TRANSCODE_TRNS, &options);
+  chunk_types(TRANSCODE_FILE, types, NULL);
+  CU_ASSERT_PTR_NULL(strstr(types, "tRNS"));
+
+  // gray: the key at the new depth, or alpha
+  src = read_rgba16("suite/basn0g16.png", &si);
+  const uint16_t key16 = src[4 * (3 * si.width + 5)];
+  free(src);
+  free_image(&si);
+  const uint8_t key[2] = {key16 >> 8, key16};
+  add_chunk("suite/basn0g16.png", TRANSCODE_TRNS, "tRNS", key, 2);
+
+  transcode(TRANSCODE_TRNS, NULL);
+  CU_ASSERT_EQUAL(chunk_data(TRANSCODE_FILE, "tRNS", data), 2);
+  CU_ASSERT_EQUAL(memcmp(data, key, 2), 0);
+
+  options.sample = 3;
+  options.depth  = 8;
+  transcode(TRANSCODE_TRNS, &options);
+  CU_ASSERT_EQUAL(chunk_data(TRANSCODE_FILE, "tRNS", data), 6);
+  CU_ASSERT_EQUAL(data[1], (key16 + 128) / 257);
+  CU_ASSERT_EQUAL(data[5], (key16 + 128) / 257);
+
+  options.sample = 2;
+  options.depth  = 16;
+  transcode(TRANSCODE_TRNS, &options);
+  CU_ASSERT_EQUAL(chunk_data(TRANSCODE_FILE, "tRNS", data), 0);
+  src = read_rgba16(TRANSCODE_TRNS, &si);
+  dst = read_rgba16(TRANSCODE_FILE, &di);
+  uint32_t transparent = 0;
+  wrong = 0;
+  for (size_t p = 0; p < (size_t) si.width * si.height; p++) {
+    wrong += (dst[4 * p + 3] != ((src[4 * p] == key16) ? 0 : 65535));
+    transparent += (dst[4 * p + 3] == 0);
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  CU_ASSERT(transparent > 0);
+  free(src);
+  free(dst);
+  free_image(&si);
+  free_image(&di);
+
+  // RGB to gray: the key does not hold
+  const uint8_t rgb[6] = {0, 255, 0, 0, 0, 0};
+  add_chunk("suite/basn2c08.png", TRANSCODE_TRNS, "tRNS", rgb, 6);
+  options.sample = 1;
+  options.depth  = 8;
+  transcode(TRANSCODE_TRNS, &options);
+  CU_ASSERT_EQUAL(chunk_data(TRANSCODE_FILE, "tRNS", data), 0);
+  transcode(TRANSCODE_TRNS, NULL);
+  CU_ASSERT_EQUAL(chunk_data(TRANSCODE_FILE, "tRNS", data), 6);
+  CU_ASSERT_EQUAL(memcmp(data, rgb, 6), 0);
+}
+
+
+void test_transcode_parse(void) {
+  struct transcode_options options;
+
+  CU_ASSERT_EQUAL(strcmp(parse_transcode("out.png", &options), "out.png"), 0);
+  CU_ASSERT_EQUAL(options.sample, 0);
+  CU_ASSERT_EQUAL(options.width, 0);
+
+  CU_ASSERT_EQUAL(strcmp(parse_transcode("rgb8:out.png", &options), "out.png"), 0);
+  CU_ASSERT_EQUAL(options.sample, 3);
+  CU_ASSERT_EQUAL(options.depth, 8);
+
+  CU_ASSERT_EQUAL(strcmp(parse_transcode("graya16@64x32+10+20:-", &options), "-"), 0);
+  CU_ASSERT_EQUAL(options.sample, 2);
+  CU_ASSERT_EQUAL(options.depth, 16);
+  CU_ASSERT_EQUAL(options.width, 64);
+  CU_ASSERT_EQUAL(options.height, 32);
+  CU_ASSERT_EQUAL(options.x, 10);
+  CU_ASSERT_EQUAL(options.y, 20);
+
+  CU_ASSERT_EQUAL(strcmp(parse_transcode("rgba@1x1+0+0:a:b.png", &options), "a:b.png"), 0);
+  CU_ASSERT_EQUAL(options.sample, 4);
+  CU_ASSERT_EQUAL(options.depth, 0);
+
+  CU_ASSERT_EQUAL(strcmp(parse_transcode("@8x8+0+0:out.png", &options), "out.png"), 0);
+  CU_ASSERT_EQUAL(options.sample, 0);
+  CU_ASSERT_EQUAL(options.width, 8);
+
+  // not a target: the whole argument is the file name
+  const char *names[] = {"c:out.png", "rgb12:out.png", "rgb8@0x8+0+0:out.png", "gray@8x8:out.png", ":out.png",
+                         "rgb8:"};
+  for (uint8_t n = 0; n < 6; n++) {
+    CU_ASSERT_EQUAL(strcmp(parse_transcode(names[n], &options), names[n]), 0);
+    CU_ASSERT_EQUAL(options.sample, 0);
+    CU_ASSERT_EQUAL(options.width, 0);
+  }
+}
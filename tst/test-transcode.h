@@ -0,0 +1,33 @@
+/**
+ * @file test-transcode.h
+ * @brief Test the streaming transcoder
+ * @details
+ */
+
+#ifndef __TEST_TRANSCODE_H__
+#define __TEST_TRANSCODE_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_transcode(void);
+
+int clean_test_transcode(void);
+
+
+void test_transcode_same(void);
+
+void test_transcode_convert(void);
+
+void test_transcode_crop(void);
+
+void test_transcode_chunks(void);
+
+void test_transcode_trns(void);
+
+void test_transcode_parse(void);
+
+
+
+#endif // __TEST_TRANSCODE_H__
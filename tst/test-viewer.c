@@ -0,0 +1,194 @@
+/**
+ * @file test-viewer.c
+ * @brief Test the viewer with the SDL dummy video driver (no display needed)
+ * @details
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-viewer.h"
+
+#include "image.h"
+#include "mfile.h"
+#include "render.h"
+#include "viewer.h"
+
+
+
+/**
+ * @brief Read the window back and compare it to BGRA8 pixels
+ * @param[in] viewer
+ * @param[in] bgra Expected pixels
+ * @param[in] x Column of bgra at the top left corner of the window
+ * @param[in] y Row of bgra at the top left corner of the window
+ * @param[in] stride Number of pixels of a row of bgra
+ * @return Number of pixels not as expected
+ */
+static uint32_t compare_window(struct viewer *viewer, const uint8_t *bgra, uint32_t x, uint32_t y, uint32_t stride) {
+  const uint32_t w = viewer->view.width;
+  const uint32_t h = viewer->view.height;
+  uint32_t *window = malloc((size_t) w * h * 4);
+  CU_ASSERT_EQUAL(sdl.RenderReadPixels(viewer->renderer, NULL, SDL_PIXELFORMAT_ARGB8888, window, w * 4), 0);
+
+  uint32_t wrong = 0;
+  for (uint32_t i = 0; i < h; i++) {
+    for (uint32_t j = 0; j < w; j++) {
+      const uint8_t *px = bgra + ((size_t) (y + i) * stride + x + j) * 4;
+      const uint32_t expected = (px[2] << 16) | (px[1] << 8) | px[0];
+      wrong += ((window[(size_t) i * w + j] & 0xffffff) != expected);
+    }
+  }
+  free(window);
+  return wrong;
+}
+
+/**
+ * @brief RGB8 gradient with some noise
+ */
+static struct image test_image(uint32_t width, uint32_t height) {
+  uint8_t *data = malloc((size_t) width * height * 3);
+  for (uint32_t i = 0; i < height; i++) {
+    for (uint32_t j = 0; j < width; j++) {
+      uint8_t *px = data + ((size_t) i * width + j) * 3;
+      px[0] = j;
+      px[1] = i;
+      px[2] = (i * 31 + j * 17) >> 2;
+    }
+  }
+  const struct image img = {.width = width, .height = height, .depth = 8, .sample = 3, .data = data};
+  return img;
+}
+
+
+
+int init_test_viewer(void) {
+  if (!sdl_load()) {
+    return 1;
+  }
+  return setenv("SDL_VIDEODRIVER", "dummy", 1);
+}
+
+int clean_test_viewer(void) {
+  return 0;
+}
+
+
+
+void test_viewer_draw(void) {
+  const struct mfile file = map_file("suite/basn6a08.png");
+  const struct image img  = get_image_native(&file);
+  unmap_file(&file);
+
+  struct viewer viewer;
+  viewer_open(&viewer, &img, 0, 0); // the size of the image
+  CU_ASSERT_EQUAL(viewer.view.width, img.width);
+  CU_ASSERT_EQUAL(viewer.view.height, img.height);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.zoom, 1.0, 1e-12);
+  CU_ASSERT_EQUAL(viewer.pyramid.nb_level, 1);
+
+  while (!pyramid_build(&(viewer.pyramid), 10)) {
+    viewer_draw(&viewer); // rows show up while they are built
+  }
+  viewer_draw(&viewer);
+
+  uint8_t *bgra = malloc((size_t) img.width * img.height * 4);
+  render_rows(&img, 0, img.height, FORMAT_BGRA8, ALPHA_BACKGROUND, bgra, img.width * 4);
+  CU_ASSERT_EQUAL(compare_window(&viewer, bgra, 0, 0, img.width), 0);
+  CU_ASSERT_EQUAL(viewer.tile[0].rows, img.height);
+  CU_ASSERT_EQUAL(viewer.tile[1].texture, NULL); // a single tile
+
+  free(bgra);
+  viewer_close(&viewer);
+  free_image(&img);
+}
+
+void test_viewer_zoom(void) {
+  const struct image img = test_image(1500, 900);
+  struct viewer viewer;
+  viewer_open(&viewer, &img, 300, 200);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.zoom, 0.2, 1e-12);
+
+  // a part of the pyramid, then the rest
+  pyramid_build(&(viewer.pyramid), 100);
+  viewer_draw(&viewer);
+  while (!pyramid_build(&(viewer.pyramid), 100));
+  viewer_draw(&viewer);
+
+  // fit: level 2 shown at 0.8
+  CU_ASSERT_EQUAL(view_level(&(viewer.view), viewer.pyramid.nb_level), 2);
+  CU_ASSERT_EQUAL(viewer.tile[0].level, 2);
+  CU_ASSERT_EQUAL(viewer.tile[0].rows, viewer.pyramid.level[2].height);
+
+  // actual size around the center: level 0, window at (600, 350)
+  SDL_Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = SDL_KEYDOWN;
+  event.key.keysym.sym = SDLK_1;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 1);
+  CU_ASSERT(viewer.dirty);
+  viewer_draw(&viewer);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.x, 600, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.y, 350, 1e-9);
+  CU_ASSERT_EQUAL(compare_window(&viewer, viewer.pyramid.level[0].pixels, 600, 350, img.width), 0);
+
+  // zoom out by 2: level 1 at 1:1
+  event.key.keysym.sym = SDLK_MINUS;
+  viewer_event(&viewer, &event);
+  viewer_draw(&viewer);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.zoom, 0.5, 1e-12);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.x, 450, 1e-9);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.y, 250, 1e-9);
+  CU_ASSERT_EQUAL(compare_window(&viewer, viewer.pyramid.level[1].pixels, 225, 125, viewer.pyramid.level[1].width), 0);
+
+  // arrows
+  event.key.keysym.sym = SDLK_RIGHT;
+  viewer_event(&viewer, &event);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.x, 450 + 300.0 / 8 / 0.5, 1e-9);
+  viewer_draw(&viewer);
+
+  viewer_close(&viewer);
+  free(img.data);
+}
+
+void test_viewer_events(void) {
+  const struct image img = test_image(64, 48);
+  struct viewer viewer;
+  viewer_open(&viewer, &img, 0, 0);
+  while (!pyramid_build(&(viewer.pyramid), 16));
+
+  SDL_Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = SDL_WINDOWEVENT;
+  event.window.event = SDL_WINDOWEVENT_EXPOSED;
+  viewer.dirty = 0;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 1);
+  CU_ASSERT(viewer.dirty);
+  viewer_draw(&viewer);
+  CU_ASSERT(!viewer.dirty);
+
+  // unknown keys change nothing
+  event.type = SDL_KEYDOWN;
+  event.key.keysym.sym = 'z';
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 1);
+  CU_ASSERT(!viewer.dirty);
+
+  event.key.keysym.sym = SDLK_PLUS;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 1);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.zoom, 2.0, 1e-12);
+  event.key.keysym.sym = SDLK_0;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 1);
+  CU_ASSERT_DOUBLE_EQUAL(viewer.view.zoom, 1.0, 1e-12);
+
+  event.key.keysym.sym = SDLK_ESCAPE;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 0);
+  event.key.keysym.sym = SDLK_q;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 0);
+  event.type = SDL_QUIT;
+  CU_ASSERT_EQUAL(viewer_event(&viewer, &event), 0);
+
+  viewer_close(&viewer);
+  free(img.data);
+}
@@ -0,0 +1,27 @@
+/**
+ * @file test-viewer.h
+ * @brief Test the viewer with the SDL dummy video driver (no display needed)
+ * @details
+ */
+
+#ifndef __TEST_VIEWER_H__
+#define __TEST_VIEWER_H__
+
+#include <CUnit/Basic.h>
+
+
+
+int init_test_viewer(void);
+
+int clean_test_viewer(void);
+
+
+void test_viewer_draw(void);
+
+void test_viewer_zoom(void);
+
+void test_viewer_events(void);
+
+
+
+#endif // __TEST_VIEWER_H__